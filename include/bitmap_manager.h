@@ -2,9 +2,15 @@
 #define BITMAP_MANAGER_H
 
 #include "file_system_config.h"
+#include <atomic>
+#include <deque>
 #include <vector>
 #include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
 
+#include "metadata_cache.h"
 #include "volume_manager.h"
 
 class BitmapManager {
@@ -12,33 +18,140 @@ public:
     explicit BitmapManager(VolumeManager& volume_manager);
     // инициализация битовой карты при форматировании
     bool initialize_and_flush(const FileSystem::Header& header);
-    // загрузка битовой карты с диска в память
+    // подключение битовой карты тома; страницы читаются с диска по требованию
     bool load(const FileSystem::Header& header);
     // находит свободный кластер и помечает его как занятый
     std::optional<uint32_t> find_and_allocate_free_cluster();
+    // находит count подряд идущих свободных кластеров и помечает их как занятые
+    std::optional<uint32_t> find_and_allocate_free_run(uint32_t count);
+
+    // --- Группы размещения --- //
+    // область данных делится на группы со своей подсказкой поиска и счётчиком свободных кластеров;
+    // кластеры одного файла берутся из его группы, поэтому одновременно растущие файлы не перемешиваются.
+    // У каждой группы свой замок: allocate_in_group, allocate_near и reserve_near можно вызывать из разных потоков,
+    // потоки, размещающие кластеры в разных группах, друг друга не ждут.
+    // false - одна группа на всю область данных; действует со следующего подключения
+    void set_allocation_groups(bool enabled) { groups_enabled_ = enabled; }
+    [[nodiscard]] uint32_t group_count() const { return static_cast<uint32_t>(groups_.size()); }
+    // группа для ключа (хеша имени файла)
+    [[nodiscard]] uint32_t group_for_key(uint32_t key) const;
+    // свободный кластер из группы group, если она заполнена - из следующих групп по кругу
+    std::optional<uint32_t> allocate_in_group(uint32_t group);
+    // ближайший свободный кластер начиная с goal в группе goal; если там места нет или goal не кластер
+    // данных - allocate_in_group(group)
+    std::optional<uint32_t> allocate_near(uint32_t goal, uint32_t group);
+    // группа кластера данных (0 для служебных областей)
+    [[nodiscard]] uint32_t group_index(uint32_t cluster_idx) const;
+    // группа с наибольшим количеством свободных кластеров
+    std::optional<uint32_t> most_free_group();
+    // количество свободных кластеров в группе; считается по битовой карте при первом обращении
+    std::optional<uint32_t> group_free_count(uint32_t group);
+
+    // --- Запас кластеров дескриптора --- //
+    // помечает занятыми до count свободных кластеров подряд, начиная с того, что выдал бы allocate_near(goal, group);
+    // возвращает их по возрастанию, пусто - места нет
+    std::vector<uint32_t> reserve_near(uint32_t goal, uint32_t group, uint32_t count);
+    // возвращает неиспользованный запас; дыры под ним не пробиваются - данные туда не писались
+    bool release_reserved(const std::vector<uint32_t> &clusters);
+    // вызывает fn(cluster) для каждого занятого кластера области данных; обход прекращается, если fn вернула false
+    bool for_each_used_cluster(const std::function<bool(uint32_t)> &fn) const;
     // помечает кластер как свободный
     bool free_cluster(uint32_t cluster_idx);
+    // помечает набор кластеров как свободные
+    bool free_clusters(const std::vector<uint32_t> &clusters);
     // проверят свободен ли кластер
     [[nodiscard]] bool is_cluster_free(uint32_t cluster_idx) const;
+
+    // записывает на диск изменённые страницы битовой карты
+    bool flush();
+    // строит битовую карту заново: служебные кластеры заняты, кластер данных занят, если in_use(cluster)
+    // вернула true (nullopt - ошибка чтения); счётчики пересчитываются, страницы записываются на диск
+    bool rebuild(const std::function<std::optional<bool>(uint32_t)> &in_use);
+
+    // освобождать место в файле-образе под освобождаемыми кластерами
+    void set_discard_freed(bool discard_freed) { discard_freed_ = discard_freed; }
+    [[nodiscard]] bool discard_freed() const { return discard_freed_; }
+    // вызывает fn(first_cluster, count) для каждого непрерывного участка свободных кластеров данных;
+    // обход прекращается, если fn вернула false
+    bool for_each_free_run(const std::function<bool(uint32_t, uint32_t)> &fn) const;
+
+    // --- Счётчики свободного места --- //
+    // количество свободных кластеров данных; при недостоверных счётчиках они перестраиваются по битовой карте
+    std::optional<uint64_t> free_cluster_count();
+    // количество свободных кластеров в регионе (CLUSTERS_PER_REGION кластеров)
+    std::optional<uint32_t> region_free_count(uint32_t region_idx);
+    [[nodiscard]] uint32_t region_count() const { return region_count_; }
+    [[nodiscard]] bool counters_valid() const { return counters_valid_; }
+    // записывает таблицу регионов на диск и free_clusters в заголовок; false, если счётчики недостоверны
+    bool store_free_counters(FileSystem::Header& header) const;
+
+    // лимит страниц битовой карты в памяти
+    void set_max_resident_pages(size_t max_resident_pages);
+    [[nodiscard]] MetadataCache::Stats cache_stats() const;
 private:
+    static constexpr uint32_t BITS_PER_PAGE = FileSystem::CLUSTER_SIZE_BYTES * 8;
+
     VolumeManager& volume_mgr_; // ссылка на менеджер тома
-    std::vector<uint32_t> bitmap_data_; // копия битовой карты в памяти
+    std::unique_ptr<MetadataCache> bitmap_cache_; // страницы битовой карты (бит i байта k -> кластер 8 * k + i)
+    size_t max_resident_pages_; // лимит страниц, применяемый при подключении
+    std::atomic<uint32_t> first_free_hint_; // все кластеры данных до этого номера заняты
+
+    struct AllocationGroup {
+        AllocationGroup(const uint32_t first_cluster, const uint32_t end_cluster)
+            : first(first_cluster), end(end_cluster), hint(first_cluster) {
+        }
+
+        uint32_t first; // первый кластер группы
+        uint32_t end; // кластер за последним
+        uint32_t hint; // все кластеры группы до этого номера заняты
+        int64_t free = -1; // свободные кластеры группы, -1 - ещё не посчитаны
+        std::mutex mutex; // поиск и выделение в группе, hint и free
+    };
+    std::deque<AllocationGroup> groups_; // группы с замками не перемещаются в памяти
+    uint32_t group_clusters_ = 0; // размер группы, последняя может быть короче
+    bool groups_enabled_ = true;
+
+    std::unique_ptr<std::atomic<uint32_t>[]> region_free_; // свободные кластеры данных в каждом регионе
+    uint32_t region_count_ = 0;
+    std::atomic<uint64_t> free_clusters_; // свободные кластеры данных на томе
+    std::atomic<bool> counters_valid_; // счётчики соответствуют битовой карте
+    bool discard_freed_ = false; // пробивать дыры в образе под освобождёнными кластерами
 
     uint32_t total_clusters_managed_; // количество кластеров фс == FileSystem::Header->total_clusters
     uint32_t bitmap_disk_start_cluster_; // начальный кластер битовой карты
     uint32_t bitmap_disk_cluster_count_; // количество кластеров, занимаемых битовой картой
+    uint32_t data_start_cluster_; // первый кластер области данных
+    uint32_t free_counts_start_cluster_; // первый кластер таблицы регионов
+    uint32_t free_counts_cluster_count_; // размер таблицы регионов в кластерах
+
+    // создаёт кэш страниц для области битовой карты из заголовка
+    bool attach(const FileSystem::Header& header);
 
-    // установить бит
-    void set_bit(uint32_t cluster_idx);
-    // снять бит
-    void clear_bit(uint32_t cluster_idx);
+    // установить бит; кластер данных - под замком его группы
+    bool set_bit(uint32_t cluster_idx);
+    // снять бит; замок группы берётся внутри
+    bool clear_bit(uint32_t cluster_idx);
     // получить бит
     [[nodiscard]] std::optional<bool> get_bit(uint32_t cluster_idx) const;
 
-    // чтение битовой карты с диска
-    bool read_bitmap_from_disk();
-    // записать битовую карту на диск
-    [[nodiscard]] bool write_bitmap_to_disk() const;
+    // пробивает дыры в образе под освобождёнными кластерами, объединяя соседние в участки
+    void discard_clusters(std::vector<uint32_t> clusters);
+    // снимает биты набора кластеров данных
+    bool clear_clusters(const std::vector<uint32_t> &clusters);
+    // загружает таблицу регионов после корректного размонтирования
+    bool load_free_counters(const FileSystem::Header& header);
+    // пересчитывает счётчики по битовой карте
+    bool rebuild_free_counters();
+    // первый свободный кластер в диапазоне [from, to) по страницам, без выделения
+    [[nodiscard]] std::optional<uint32_t> find_free_from(uint32_t from, uint32_t to) const;
+    // group_free_count под уже взятым замком группы
+    std::optional<uint32_t> count_group_free(AllocationGroup &group);
+    // сдвигает first_free_hint_ за cluster, если подсказка указывала на него
+    void advance_first_free_hint(uint32_t cluster, uint32_t next);
+    // делит область данных на группы размещения
+    void build_groups();
+    // группа кластера области данных
+    [[nodiscard]] AllocationGroup &group_of(uint32_t cluster_idx);
 };
 
 #endif //BITMAP_MANAGER_H
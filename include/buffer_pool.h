@@ -0,0 +1,87 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Пул выровненных буферов одного размера.
+// Буферы выделяются блоками по buffers_per_chunk и возвращаются в пул при освобождении;
+// память блоков отдаётся системе только вместе с пулом. Буферы можно брать и возвращать из разных потоков.
+class BufferPool {
+public:
+    // буфер, арендованный у пула: возвращается в пул при разрушении
+    class Lease {
+    public:
+        Lease() = default;
+        Lease(BufferPool *pool, char *buffer) : pool_(pool), buffer_(buffer) {
+        }
+        Lease(Lease &&other) noexcept : pool_(other.pool_), buffer_(other.buffer_) {
+            other.pool_ = nullptr;
+            other.buffer_ = nullptr;
+        }
+        Lease &operator=(Lease &&other) noexcept {
+            if (this != &other) {
+                reset();
+                pool_ = other.pool_;
+                buffer_ = other.buffer_;
+                other.pool_ = nullptr;
+                other.buffer_ = nullptr;
+            }
+            return *this;
+        }
+        Lease(const Lease &) = delete;
+        Lease &operator=(const Lease &) = delete;
+        ~Lease() { reset(); }
+
+        [[nodiscard]] char *get() const { return buffer_; }
+        explicit operator bool() const { return buffer_ != nullptr; }
+        // досрочно возвращает буфер в пул
+        void reset() {
+            if (pool_) pool_->release(buffer_);
+            pool_ = nullptr;
+            buffer_ = nullptr;
+        }
+
+    private:
+        BufferPool *pool_ = nullptr;
+        char *buffer_ = nullptr;
+    };
+
+    struct Stats {
+        size_t buffers = 0; // всего буферов в выделенных блоках
+        size_t in_use = 0; // выданные буферы
+        size_t chunks = 0; // выделенные блоки
+    };
+
+    // alignment - степень двойки, buffer_size должен быть ей кратен
+    BufferPool(size_t buffer_size, size_t alignment, size_t buffers_per_chunk);
+
+    // свободный буфер (содержимое не определено); nullptr, если память не выделилась
+    char *acquire();
+    // возвращает буфер, полученный acquire(); nullptr игнорируется
+    void release(char *buffer);
+    // acquire() с автоматическим возвратом; пустая аренда, если память не выделилась
+    Lease lease() { return {this, acquire()}; }
+
+    [[nodiscard]] size_t buffer_size() const { return buffer_size_; }
+    [[nodiscard]] Stats stats() const;
+
+private:
+    struct ChunkDeleter {
+        size_t alignment;
+        void operator()(char *chunk) const;
+    };
+
+    size_t buffer_size_; // размер одного буфера
+    size_t alignment_; // выравнивание начала каждого буфера
+    size_t buffers_per_chunk_; // буферов в одном блоке
+
+    std::vector<std::unique_ptr<char, ChunkDeleter>> chunks_; // выделенные блоки
+    std::vector<char *> free_; // свободные буферы, последний освобождённый выдаётся первым
+    size_t in_use_ = 0;
+    mutable std::mutex mutex_; // блоки, список свободных и счётчик
+};
+
+#endif //BUFFER_POOL_H
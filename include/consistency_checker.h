@@ -0,0 +1,162 @@
+#ifndef CONSISTENCY_CHECKER_H
+#define CONSISTENCY_CHECKER_H
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "file_system_config.h"
+#include "volume_manager.h"
+
+// Офлайн проверка согласованности тома (fsck).
+// Метаданные (битовая карта и FAT) читаются с диска один раз, каталоги обходятся параллельно,
+// цепочки FAT сверяются с битовой картой и размерами файлов; занятые кластеры сверяются с контрольными суммами.
+class ConsistencyChecker {
+public:
+    struct Options {
+        bool repair = false; // исправлять найденные ошибки
+        unsigned threads = 0; // количество рабочих потоков, 0 - по числу ядер
+    };
+
+    struct Report {
+        uint64_t directories_checked = 0;
+        uint64_t files_checked = 0;
+        uint64_t inline_files = 0; // файлы, данные которых хранятся в записи каталога
+
+        uint64_t leaked_clusters = 0; // заняты в битовой карте, но не принадлежат ни одной цепочке
+        uint64_t orphaned_clusters = 0; // заняты в FAT, но недостижимы ни из одной записи каталога
+        uint64_t cross_linked_clusters = 0; // принадлежат нескольким цепочкам
+        uint64_t unmarked_clusters = 0; // принадлежат цепочке, но свободны в битовой карте
+        uint64_t broken_chains = 0; // циклы, ссылки за пределы тома или на свободные записи FAT и дыры
+        uint64_t size_mismatches = 0; // длина цепочки не соответствует file_size_bytes
+        uint64_t orphaned_holes = 0; // занятые записи таблицы дыр, не принадлежащие ни одной цепочке
+        uint64_t refcount_mismatches = 0; // счётчики ссылок расходятся с количеством ссылок на кластер
+        uint64_t counter_mismatches = 0; // счётчики свободного места расходятся с битовой картой
+        uint64_t checksum_errors = 0; // кластеры метаданных и данных, не совпадающие с контрольной суммой
+        bool checksums_verified = false; // том ведёт контрольные суммы и они были сверены
+        bool unclean_shutdown = false; // том не был корректно размонтирован, счётчики не проверялись
+
+        uint64_t repaired_entries = 0; // исправленные записи каталогов
+        bool repaired = false; // были ли записаны исправления на диск
+
+        std::vector<std::string> problems; // описание найденных ошибок (не более MAX_REPORTED_PROBLEMS)
+
+        [[nodiscard]] bool is_clean() const;
+    };
+
+    static constexpr size_t MAX_REPORTED_PROBLEMS = 1000;
+
+    explicit ConsistencyChecker(VolumeManager &vol_manager);
+
+    // запускает проверку примонтированного VolumeManager тома
+    std::optional<Report> run(const Options &options);
+
+private:
+    // файл или каталог, владеющий цепочкой кластеров
+    struct Object {
+        std::string path; // путь для отчёта
+        uint32_t dir_cluster = FileSystem::MARKER_FAT_ENTRY_FREE; // кластер каталога, содержащий запись
+        uint32_t slot = 0; // номер записи в кластере каталога
+        FileSystem::DirectoryEntry entry; // копия записи каталога
+        bool is_root = false; // корневой каталог не имеет записи
+        bool detached = false; // каталог снимков: ссылка на него хранится в заголовке, а не в записи каталога
+
+        uint32_t chain_length = 0; // количество кластеров, принадлежащих объекту
+        uint64_t logical_length = 0; // длина цепочки в логических кластерах с учётом дыр
+        uint32_t cut_after = FileSystem::MARKER_FAT_ENTRY_FREE; // кластер, после которого цепочку нужно обрезать
+        bool needs_cut = false; // цепочка повреждена и должна быть обрезана
+        bool needs_removal = false; // запись каталога не может быть восстановлена
+
+        [[nodiscard]] bool is_directory() const {
+            return is_root || entry.type == FileSystem::EntityType::DIRECTORY;
+        }
+    };
+
+    VolumeManager &vol_manager_; // ссылка на менеджер тома
+    FileSystem::Header header_{};
+
+    std::vector<uint64_t> disk_bitmap_; // битовая карта, прочитанная с диска
+    std::vector<uint32_t> fat_table_; // FAT, прочитанная с диска
+    std::vector<FileSystem::HoleRecord> hole_table_; // таблица дыр (и ссылок на общие кластеры), прочитанная с диска
+    std::vector<uint32_t> refcounts_; // таблица счётчиков ссылок, пустая - том её не ведёт
+    std::unique_ptr<std::atomic<uint32_t>[]> hole_owners_; // владелец каждой записи таблицы дыр
+    std::unique_ptr<std::atomic<uint32_t>[]> owners_; // владелец каждого кластера (индекс объекта + 1)
+    // наименьший ранг цепочки, дошедшей до кластера (записи таблицы дыр); NO_RANK - ни одной
+    std::unique_ptr<std::atomic<uint64_t>[]> ranks_;
+    std::unique_ptr<std::atomic<uint64_t>[]> hole_ranks_;
+    std::unique_ptr<std::atomic<uint32_t>[]> shared_refs_; // количество ссылок на общий кластер из цепочек
+
+    std::vector<uint32_t> bad_checksums_; // кластеры с несовпавшей контрольной суммой
+    std::deque<Object> objects_; // все найденные объекты, objects_[0] - корневой каталог, затем каталог снимков
+    std::mutex io_mutex_; // VolumeManager не допускает параллельных операций ввода-вывода
+    std::mutex report_mutex_;
+
+    Report report_;
+    unsigned threads_ = 1;
+
+    bool load_metadata();
+    bool read_directory_cluster(uint32_t cluster_idx, std::vector<FileSystem::DirectoryEntry> &entries);
+
+    // параллельный обход дерева каталогов
+    void walk_directories();
+    // параллельный проход по цепочкам всех файлов
+    void walk_file_chains();
+    // Пересечения цепочек разрешаются одинаково при любом числе потоков: кластер достаётся претенденту
+    // с наименьшим рангом - каталоги раньше файлов, среди них меньший номер объекта (порядок обхода).
+    // Первый проход (ranking) помечает узлы цепочек рангами, второй захватывает их
+    enum class Claim { CLAIMED, LOOP, CROSS_LINKED };
+    static constexpr uint64_t NO_RANK = ~uint64_t{0};
+    static uint64_t claim_rank(uint32_t object_id, const Object &object);
+    static Claim claim_node(std::atomic<uint64_t> &node_rank, std::atomic<uint32_t> &owner, uint32_t object_id,
+                            uint64_t rank, bool ranking);
+    // проходит цепочку объекта; во втором проходе захватывает её кластеры и записывает ошибки
+    void claim_chain(uint32_t object_id, Object &object, bool ranking);
+    // сверяет длины цепочек с размерами файлов
+    void check_sizes();
+    // сверяет битовую карту и FAT с найденными владельцами кластеров
+    void compare_allocation();
+    // сверяет счётчики свободного места (заголовок и таблица регионов) с битовой картой
+    void check_free_counters();
+    // свободные кластеры данных по регионам согласно disk_bitmap_
+    [[nodiscard]] std::vector<uint32_t> count_region_free() const;
+    // записывает счётчики, посчитанные по disk_bitmap_, и помечает том корректно размонтированным
+    bool store_free_counters();
+
+    // количество занятых записей таблицы дыр без владельца
+    void count_orphaned_holes();
+    // сверяет счётчики ссылок с найденными ссылками на кластеры
+    void check_refcounts();
+    // счётчик ссылок кластера по найденным владельцам и ссылкам
+    [[nodiscard]] uint32_t expected_refcount(uint32_t cluster_idx) const;
+    // сверяет с контрольными суммами области метаданных и кластеры, принадлежащие цепочкам
+    void verify_checksums();
+    // записывает суммы для текущего содержимого кластеров из bad_checksums_
+    bool reseal_checksums();
+    // обрезает цепочку файла до needed логических кластеров
+    void trim_chain(const Object &object, uint64_t needed);
+    // индекс записи для ссылки на дыру или общий кластер; nullopt для ссылок за пределы таблицы
+    [[nodiscard]] std::optional<uint32_t> hole_index(uint32_t hole_ref) const;
+    // следующий узел после кластера или ссылки на общий кластер
+    [[nodiscard]] uint32_t next_node(uint32_t node) const;
+    // делает узел (кластер или ссылку на общий кластер) последним в цепочке
+    void end_chain_at(uint32_t node);
+
+    bool repair();
+    void reset_owners() const;
+
+    [[nodiscard]] bool is_chain_cluster(uint32_t cluster_idx) const;
+    // кластер принадлежит цепочке сам или через ссылки на общий кластер
+    [[nodiscard]] bool is_in_use(uint32_t cluster_idx) const;
+    [[nodiscard]] std::vector<uint64_t> build_expected_bitmap() const;
+    void add_problem(uint64_t &counter, const std::string &problem);
+
+    template<typename Fn>
+    void parallel_for(size_t count, Fn &&fn) const;
+};
+
+#endif //CONSISTENCY_CHECKER_H
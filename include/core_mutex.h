@@ -0,0 +1,29 @@
+#ifndef CORE_MUTEX_H
+#define CORE_MUTEX_H
+
+#include <atomic>
+#include <shared_mutex>
+#include <thread>
+
+// Замок ядра файловой системы. Исключительный захват рекурсивный, как у std::recursive_mutex: публичные операции
+// вызывают друг друга под уже взятым замком. Разделяемый захват берут потоки, дописывающие свои файлы одновременно;
+// если поток уже держит замок исключительно, lock_shared() продолжает исключительный захват.
+// Пока исключительный захват ждёт, новые разделяемые владельцы не пропускаются вперёд.
+class CoreMutex {
+public:
+    void lock();
+    void unlock();
+    void lock_shared();
+    void unlock_shared();
+
+    // замок исключительно у вызывающего потока
+    [[nodiscard]] bool held_exclusively() const { return owner_.load() == std::this_thread::get_id(); }
+
+private:
+    std::shared_mutex mutex_;
+    std::atomic<std::thread::id> owner_{}; // поток с исключительным захватом
+    unsigned depth_ = 0; // глубина рекурсии исключительного захвата
+    std::atomic<unsigned> exclusive_waiting_{0}; // потоки, ждущие исключительного захвата
+};
+
+#endif //CORE_MUTEX_H
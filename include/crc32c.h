@@ -0,0 +1,21 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <cstddef>
+#include <cstdint>
+
+// CRC32C (полином Кастаньоли) для контрольных сумм кластеров.
+// Реализация выбирается при первом вызове по возможностям процессора: свёртка AVX-512 VPCLMULQDQ,
+// инструкции crc32 SSE4.2 (x86-64) или ARMv8 CRC, иначе табличный алгоритм (slicing-by-8).
+namespace crc32c {
+    // CRC32C от size байт data; crc - результат для предыдущей части данных (0 для начала)
+    uint32_t compute(const void *data, size_t size, uint32_t crc = 0);
+
+    // табличная реализация независимо от процессора (для сравнения и проверки)
+    uint32_t compute_portable(const void *data, size_t size, uint32_t crc = 0);
+
+    // название выбранной реализации: "avx512-vpclmulqdq", "sse4.2", "armv8" или "table"
+    const char *implementation();
+}
+
+#endif //CRC32C_H
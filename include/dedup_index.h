@@ -0,0 +1,45 @@
+#ifndef DEDUP_INDEX_H
+#define DEDUP_INDEX_H
+
+#include <memory>
+#include <optional>
+#include <vector>
+
+#include "metadata_cache.h"
+#include "volume_manager.h"
+
+// Индекс дедупликации на томе: CRC32C содержимого кластера -> кластеры, записанные с таким содержимым.
+// Индекс с потерями: корзина из DEDUP_BUCKET_SLOTS ячеек выбирается по сумме, при переполнении ячейка вытесняется.
+// Ячейки не удаляются при освобождении и изменении кластеров, поэтому кандидат всегда сверяется с содержимым.
+class DedupIndex {
+public:
+    explicit DedupIndex(VolumeManager &vol_manager);
+
+    // подключает индекс тома; false - том не содержит индекса
+    bool load(const FileSystem::Header &header);
+
+    // кластеры, записанные под суммой checksum (возможно, уже с другим содержимым)
+    [[nodiscard]] std::optional<std::vector<uint32_t>> lookup(uint32_t checksum) const;
+    // запоминает кластер под суммой checksum
+    bool insert(uint32_t checksum, uint32_t cluster_idx);
+
+    // записывает изменённые страницы индекса на диск
+    bool flush() const;
+    // лимит страниц индекса в памяти
+    void set_max_resident_pages(size_t max_resident_pages);
+    [[nodiscard]] MetadataCache::Stats cache_stats() const;
+
+private:
+    static constexpr uint32_t SLOTS_PER_PAGE = FileSystem::CLUSTER_SIZE_BYTES / sizeof(uint32_t);
+    static_assert(SLOTS_PER_PAGE % FileSystem::DEDUP_BUCKET_SLOTS == 0, "Bucket must not cross a page");
+
+    VolumeManager &vol_manager_; // ссылка на менеджер тома
+    std::unique_ptr<MetadataCache> cache_; // страницы индекса, nullptr - индекса нет
+    size_t max_resident_pages_; // лимит страниц, применяемый при подключении
+    uint32_t bucket_count_ = 0; // количество корзин
+
+    // первая ячейка корзины для суммы
+    [[nodiscard]] uint32_t bucket_start(uint32_t checksum) const;
+};
+
+#endif //DEDUP_INDEX_H
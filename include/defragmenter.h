@@ -0,0 +1,47 @@
+#ifndef DEFRAGMENTER_H
+#define DEFRAGMENTER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "fs_core.h"
+
+// Фоновый дефрагментатор: переносит фрагментированные файлы в непрерывные участки
+// с ограничением скорости, не мешая работе с открытыми файлами.
+class Defragmenter {
+public:
+    struct Status {
+        bool running = false; // выполняется ли проход
+        uint64_t files_defragmented = 0; // перенесённые файлы за последний запуск
+        uint64_t files_skipped = 0; // файлы, для которых не нашлось места или которые сейчас изменяются
+        uint64_t clusters_moved = 0; // перенесённые кластеры за последний запуск
+        std::string current_file; // файл, обрабатываемый в данный момент
+    };
+
+    explicit Defragmenter(FileSystemCore &fs_core);
+    ~Defragmenter();
+
+    // запускает один фоновый проход по тому; clusters_per_second == 0 - без ограничения скорости
+    bool start(uint32_t clusters_per_second);
+    // останавливает проход и дожидается завершения потока
+    void stop();
+
+    [[nodiscard]] Status status() const;
+
+private:
+    FileSystemCore &fs_core_; // ссылка на ядро файловой системы
+    std::thread worker_;
+    std::atomic<bool> stop_requested_{false};
+
+    mutable std::mutex status_mutex_;
+    std::condition_variable stop_cv_; // прерывает паузу ограничения скорости при остановке
+    Status status_;
+
+    void run(uint32_t clusters_per_second);
+};
+
+#endif //DEFRAGMENTER_H
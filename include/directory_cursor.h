@@ -0,0 +1,76 @@
+#ifndef DIRECTORY_CURSOR_H
+#define DIRECTORY_CURSOR_H
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "buffer_pool.h"
+#include "file_system_config.h"
+
+class FATManager;
+class VolumeManager;
+
+// Курсор каталога в стиле opendir/readdir.
+// Записи читаются по одному кластеру цепочки в буфер из пула тома и выдаются без копирования,
+// следующий кластер цепочки заранее запрашивается у тома, пока обходится текущий.
+// Каталог-дерево обходится по цепочке листьев, то есть в порядке имён.
+class DirectoryCursor {
+public:
+    // позиция для продолжения обхода; 0 - начало каталога. Обычный каталог: номер кластера в цепочке
+    // (старшие 32 бита) и слот в нём; дерево: TREE_POSITION, кластер листа (биты 16-47) и слот в листе
+    using Position = uint64_t;
+    static constexpr Position TREE_POSITION = 1ull << 63;
+
+    // запись каталога в буфере курсора; действительна до следующего вызова next() или seek()
+    struct EntryView {
+        std::string_view name;
+        FileSystem::EntityType type;
+        uint32_t first_cluster;
+        uint32_t file_size_bytes;
+        const char *record; // запись на диске целиком, sizeof(DirectoryEntry) байт
+
+        [[nodiscard]] bool is_compressed() const;
+        [[nodiscard]] bool is_inline() const;
+        // полная копия записи, включая встроенные данные
+        [[nodiscard]] FileSystem::DirectoryEntry copy() const;
+    };
+
+    DirectoryCursor(const VolumeManager &vol_manager, const FATManager &fat_manager, uint32_t dir_start_cluster);
+
+    // переходит к позиции, возвращённой tell(); false - позиция за концом каталога или ошибка чтения FAT
+    bool seek(Position position);
+    // выдавать только имена, начинающиеся с prefix; задаётся до первого next(). В дереве обход начинается
+    // с листа, где лежит prefix, и заканчивается на первом имени без него
+    void set_prefix(std::string prefix) { prefix_ = std::move(prefix); }
+    // следующая занятая запись; nullopt - конец каталога или ошибка (см. failed())
+    std::optional<EntryView> next();
+    [[nodiscard]] Position tell() const;
+    [[nodiscard]] bool failed() const { return failed_; }
+    [[nodiscard]] uint32_t dir_start_cluster() const { return dir_start_cluster_; }
+
+private:
+    const VolumeManager &vol_manager_; // ссылка на менеджер тома
+    const FATManager &fat_manager_; // ссылка на менеджер FAT
+    uint32_t dir_start_cluster_; // первый кластер каталога
+    uint32_t cluster_idx_; // текущий кластер; MARKER_FAT_ENTRY_EOF - каталог пройден
+    uint32_t next_cluster_ = FileSystem::MARKER_FAT_ENTRY_EOF; // следующий кластер цепочки, известен после загрузки
+    uint32_t chain_ordinal_ = 0; // номер текущего кластера в цепочке
+    uint32_t slot_ = 0; // следующий непросмотренный слот текущего кластера
+    uint32_t slot_count_ = 0; // слотов в загруженном кластере
+    size_t records_offset_ = 0; // смещение первого слота в загруженном кластере
+    bool tree_ = false; // каталог - дерево, cluster_idx_ - лист
+    bool loaded_ = false; // буфер содержит cluster_idx_
+    bool failed_ = false;
+    std::string prefix_; // фильтр имён
+    BufferPool::Lease buffer_; // текущий кластер каталога
+
+    // кластер принадлежит области тома и может быть звеном цепочки каталога
+    [[nodiscard]] bool is_chain_cluster(uint32_t cluster_idx) const;
+    // читает текущий кластер и запрашивает упреждающее чтение следующего
+    // для дерева при первом чтении спускается от корня к листу, с которого начинается обход
+    bool load_current();
+};
+
+#endif //DIRECTORY_CURSOR_H
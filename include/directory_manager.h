@@ -1,6 +1,8 @@
 #ifndef DIRECTORY_MANAGER_H
 #define DIRECTORY_MANAGER_H
 #include "bitmap_manager.h"
+#include "directory_cursor.h"
+#include "directory_tree.h"
 #include "fat_manager.h"
 #include "volume_manager.h"
 #include "output.h"
@@ -17,13 +19,24 @@ public:
     // выводит список всех записей в каталоге
     [[nodiscard]] std::vector<FileSystem::DirectoryEntry> get_directories_list(uint32_t directory_start_cluster) const;
 
+    // курсор по записям каталога без загрузки всего списка; position - значение DirectoryCursor::tell()
+    // для продолжения обхода, prefix - фильтр имён; nullopt - позиция за концом каталога
+    [[nodiscard]] std::optional<DirectoryCursor> open_cursor(uint32_t directory_start_cluster,
+                                                             DirectoryCursor::Position position = 0,
+                                                             const std::string &prefix = {}) const;
+
+    // длина цепочки, после которой заполненный обычный каталог перестраивается в B+-дерево; 0 - никогда
+    void set_btree_threshold(const uint32_t clusters) { btree_threshold_clusters_ = clusters; }
+    // каталог хранится деревом
+    [[nodiscard]] bool is_tree(uint32_t dir_start_cluster) const;
+
     // находит и возвращает запись в каталоге
     std::optional<FileSystem::DirectoryEntry> find_entry(uint32_t dir_start_cluster, const std::string &name);
 
     // структура местоположения и информации о записи в каталоге
     struct EntryLocation {
-        uint32_t dir_cluster_idx{}; // индекс кластера
-        uint32_t entry_offset{}; // смещение
+        uint32_t dir_cluster_idx{}; // индекс кластера (в дереве - листа)
+        uint32_t entry_offset{}; // смещение (номер слота)
         FileSystem::DirectoryEntry entry_data; // данные о записи
     };
     // находит запись в каталоге
@@ -45,10 +58,15 @@ private:
     VolumeManager &vol_manager_; // ссылка на менеджер тома
     FATManager& fat_manager_; // ссылка на менеджер FAT
     BitmapManager& bitmap_manager_; // ссылка на менеджер битовой карты
+    DirectoryTree tree_; // операции над каталогами-деревьями
+    uint32_t btree_threshold_clusters_ = FileSystem::DIR_BTREE_THRESHOLD_CLUSTERS;
 
     // чтение всех записей каталога из его цепочки кластеров
     [[nodiscard]] std::vector<FileSystem::DirectoryEntry> read_all_entries(uint32_t dir_start_cluster) const;
 
+    // перестраивает заполненный обычный каталог в дерево; кластеры цепочки после первого освобождаются
+    [[nodiscard]] bool convert_to_tree(uint32_t dir_start_cluster, const std::list<uint32_t> &cluster_chain) const;
+
     // функция для расширения каталога на один кластер
     [[nodiscard]] std::optional<uint32_t> extend_directory(uint32_t dir_last_cluster_idx) const;
 };
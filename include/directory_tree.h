@@ -0,0 +1,73 @@
+#ifndef DIRECTORY_TREE_H
+#define DIRECTORY_TREE_H
+
+#include <cstdint>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+#include "file_system_config.h"
+
+class BitmapManager;
+class FATManager;
+class VolumeManager;
+
+// Каталог в виде B+-дерева, упорядоченного по имени (формат узлов - в file_system_config.h).
+// Корень всегда лежит в первом кластере каталога, новые узлы дописываются в конец его цепочки в FAT,
+// поэтому освобождение, клонирование и снимки обходят дерево как обычную цепочку.
+// При удалении листья не сливаются: опустевший лист остаётся в цепочке до удаления каталога.
+class DirectoryTree {
+public:
+    // запись в листе: кластер листа, слот и копия записи
+    struct Location {
+        uint32_t leaf_cluster;
+        uint32_t slot;
+        FileSystem::DirectoryEntry entry;
+    };
+
+    DirectoryTree(VolumeManager &vol_manager, FATManager &fat_manager, BitmapManager &bitmap_manager);
+
+    // записывает в root_cluster пустой корень-лист; цепочка каталога должна состоять из одного root_cluster
+    [[nodiscard]] bool create(uint32_t root_cluster) const;
+    [[nodiscard]] std::optional<Location> find(uint32_t root_cluster, std::string_view name) const;
+    // добавляет запись с новым именем, при переполнении делит узлы вплоть до корня
+    [[nodiscard]] bool insert(uint32_t root_cluster, const FileSystem::DirectoryEntry &entry) const;
+    [[nodiscard]] bool remove(uint32_t root_cluster, std::string_view name) const;
+    // перезаписывает запись на месте; имя записи не меняется
+    [[nodiscard]] bool replace(const Location &location, const FileSystem::DirectoryEntry &entry) const;
+
+    // спускается от корня к листу, в диапазон которого попадает name (пустое имя - самый левый лист);
+    // содержимое листа остаётся в buffer, path получает пройденные внутренние узлы от корня;
+    // nullopt - ошибка чтения или повреждённый узел
+    static std::optional<uint32_t> descend(const VolumeManager &vol_manager, uint32_t root_cluster,
+                                           std::string_view name, char *buffer,
+                                           std::vector<uint32_t> *path = nullptr);
+    static FileSystem::DirectoryNodeHeader read_header(const char *node);
+    // имя записи каталога без завершающих нулей
+    static std::string_view entry_name(const char *record);
+
+private:
+    VolumeManager &vol_manager_; // ссылка на менеджер тома
+    FATManager &fat_manager_; // ссылка на менеджер FAT
+    BitmapManager &bitmap_manager_; // ссылка на менеджер битовой карты
+
+    // занятые записи листа по порядку имён
+    [[nodiscard]] static std::vector<FileSystem::DirectoryEntry> leaf_entries(const char *leaf);
+    [[nodiscard]] static std::vector<FileSystem::DirectoryIndexKey> index_keys(const char *node);
+
+    [[nodiscard]] bool write_leaf(uint32_t cluster, const FileSystem::DirectoryNodeHeader &header,
+                                  const FileSystem::DirectoryEntry *entries, size_t count) const;
+    [[nodiscard]] bool write_index(uint32_t cluster, const FileSystem::DirectoryNodeHeader &header,
+                                   uint32_t first_child, const FileSystem::DirectoryIndexKey *keys,
+                                   size_t count) const;
+    // выделяет кластер под узел и дописывает его в цепочку каталога; tail - известный конец цепочки
+    // или EOF (тогда он берётся из заголовка корня)
+    [[nodiscard]] std::optional<uint32_t> allocate_node(uint32_t root_cluster, uint32_t &tail) const;
+    // поднимает ключ separator -> right от разделённого узла к корню по path
+    [[nodiscard]] bool insert_separator(uint32_t root_cluster, std::vector<uint32_t> &path,
+                                        FileSystem::DirectoryIndexKey separator, bool append, uint32_t &tail) const;
+    // записывает в заголовок корня новый конец цепочки
+    [[nodiscard]] bool store_chain_tail(uint32_t root_cluster, uint32_t tail) const;
+};
+
+#endif //DIRECTORY_TREE_H
@@ -3,7 +3,9 @@
 
 #include <list>
 #include <cstring>
+#include <memory>
 
+#include "metadata_cache.h"
 #include "volume_manager.h"
 
 
@@ -13,34 +15,110 @@ public:
     // инициализирует FAT
     bool initialize_and_flush(const FileSystem::Header& header);
 
-    // загружает FAT с диска
+    // подключает FAT тома; страницы читаются с диска по требованию
     bool load(const FileSystem::Header& header);
 
     // получение значения записи FAT
     [[nodiscard]] std::optional<uint32_t> get_entry(uint32_t cluster_idx) const;
 
-    // устанавливает значение записи FAT и записывает на диск
+    // устанавливает значение записи FAT; страница попадает на диск при вытеснении или flush().
+    // get_entry и set_entry для записей кластеров можно вызывать из разных потоков: страница берётся под замком кэша
     bool set_entry(uint32_t cluster_idx, uint32_t value);
 
-    // для указанного кластера возвращает всю цепочку кластеров
+    // для указанного кластера возвращает всю цепочку кластеров с данными (дыры пропускаются, вместо ссылки
+    // на общий кластер - сам общий кластер)
     [[nodiscard]] std::list<uint32_t> get_cluster_chain(uint32_t start_cluster) const;
 
-    // освобождает цепочку кластеров начиная со start_cluster
-    bool free_chain(uint32_t start_cluster);
+    // узлы цепочки по порядку: кластеры, ссылки на дыры и на общие кластеры
+    [[nodiscard]] std::vector<uint32_t> get_chain_nodes(uint32_t start_node) const;
+
+    // следующий узел цепочки после кластера, дыры или ссылки на общий кластер
+    [[nodiscard]] std::optional<uint32_t> get_next_node(uint32_t node) const;
+
+    // записывает следующий узел: для кластера - в FAT, для дыры и ссылки на общий кластер - в их запись
+    bool set_next_node(uint32_t node, uint32_t next);
+
+    // освобождает цепочку начиная со start_node вместе с записями её дыр и ссылок;
+    // возвращает кластеры, на которые не осталось ссылок, - их нужно освободить в битовой карте
+    std::optional<std::vector<uint32_t>> free_chain(uint32_t start_node);
+
+    // снимает одну ссылку на кластер (direct - кластер стоит в цепочке сам, а не через запись таблицы дыр);
+    // true - ссылок не осталось и запись FAT освобождена, false - кластер остаётся у других ссылок
+    std::optional<bool> release_cluster(uint32_t cluster_idx, bool direct);
+
+    // помечает записи FAT указанных кластеров свободными, не проходя по цепочке
+    bool clear_entries(const std::vector<uint32_t> &clusters);
 
     // добавляет кластер в цепочку кластеров
     bool append_to_chain(uint32_t last_cluster_in_chain, uint32_t new_cluster_idx);
+
+    // связывает узлы (кластеры, дыры и ссылки) в цепочку в указанном порядке, последний помечается EOF
+    bool link_chain(const std::vector<uint32_t> &nodes);
+
+    // --- Таблица дыр разреженных файлов --- //
+    // том содержит таблицу дыр
+    [[nodiscard]] bool sparse_supported() const { return hole_cache_ != nullptr; }
+    // запись дыры по ссылке из FAT
+    [[nodiscard]] std::optional<FileSystem::HoleRecord> get_hole(uint32_t hole_ref) const;
+    // создаёт дыру длиной length_clusters перед узлом next; возвращает ссылку для FAT
+    std::optional<uint32_t> create_hole(uint32_t length_clusters, uint32_t next);
+    bool set_hole(uint32_t hole_ref, const FileSystem::HoleRecord &record);
+    bool free_hole(uint32_t hole_ref);
+
+    // --- Общие кластеры --- //
+    // том ведёт счётчики ссылок: кластер может входить в несколько цепочек через ссылки на общий кластер
+    [[nodiscard]] bool sharing_supported() const { return refcount_cache_ != nullptr; }
+    // количество ссылок на кластер; 0 - счётчик не ведётся (на кластер ссылается не больше одного узла)
+    [[nodiscard]] std::optional<uint32_t> get_refcount(uint32_t cluster_idx) const;
+    bool set_refcount(uint32_t cluster_idx, uint32_t refcount);
+    // запись ссылки на общий кластер
+    [[nodiscard]] std::optional<FileSystem::SharedRecord> get_shared(uint32_t shared_ref) const;
+    // создаёт ссылку на кластер cluster_idx перед узлом next; счётчик ссылок не меняется
+    std::optional<uint32_t> create_shared(uint32_t cluster_idx, uint32_t next);
+    bool set_shared(uint32_t shared_ref, const FileSystem::SharedRecord &record);
+    bool free_shared(uint32_t shared_ref);
+
+    // записывает на диск изменённые страницы FAT, таблицы дыр и счётчиков ссылок
+    bool flush();
+
+    // лимит страниц FAT в памяти (таблица дыр и счётчики ссылок получают долю пропорционально своему размеру)
+    void set_max_resident_pages(size_t max_resident_pages);
+    [[nodiscard]] MetadataCache::Stats cache_stats() const;
 private:
+    static constexpr uint32_t ENTRIES_PER_PAGE = FileSystem::CLUSTER_SIZE_BYTES / sizeof(uint32_t);
+    static constexpr uint32_t HOLES_PER_PAGE = FileSystem::CLUSTER_SIZE_BYTES / sizeof(FileSystem::HoleRecord);
+
     VolumeManager& vol_manager_; // ссылка на менеджер томов
-    std::vector<uint32_t> fat_table_; // копия fat в памяти
+    std::unique_ptr<MetadataCache> fat_cache_; // страницы fat в памяти
+    size_t max_resident_pages_; // лимит страниц, применяемый при подключении
     uint32_t total_clusters_managed_; // общее количество управляемых кластеров
     uint32_t fat_disk_start_cluster_; // начальный кластер fat на диске
     uint32_t fat_dist_clusters_count_; // количество кластеров отведённых под fat
 
-    // чтение fat с диска
-    bool read_fat_from_disk();
-    // запись fat на диск
-    [[nodiscard]] bool write_fat_to_disk() const;
+    std::unique_ptr<MetadataCache> hole_cache_; // страницы таблицы дыр, nullptr - таблицы нет
+    uint32_t hole_records_count_ = 0; // количество записей в таблице дыр
+    uint32_t hole_search_hint_ = 0; // с этой записи начинается поиск свободной
+
+    std::unique_ptr<MetadataCache> refcount_cache_; // страницы таблицы счётчиков ссылок, nullptr - таблицы нет
+
+    // создаёт кэш страниц для области fat из заголовка
+    bool attach(const FileSystem::Header& header);
+    // чтение записи без проверок границ
+    [[nodiscard]] std::optional<uint32_t> read_raw(uint32_t cluster_idx) const;
+    // запись значения без проверок границ
+    bool write_raw(uint32_t cluster_idx, uint32_t value);
+    // ссылка на запись таблицы дыр: дыра или общий кластер
+    static bool is_record_ref(uint32_t value) {
+        return FileSystem::is_hole_ref(value) || FileSystem::is_shared_ref(value);
+    }
+    // индекс записи по ссылке; nullopt для чужих значений и ссылок за пределы таблицы
+    [[nodiscard]] std::optional<uint32_t> record_index(uint32_t record_ref) const;
+    [[nodiscard]] std::optional<FileSystem::HoleRecord> read_record(uint32_t record_ref) const;
+    bool write_record(uint32_t record_ref, const FileSystem::HoleRecord &record);
+    // занимает свободную запись; flags - FAT_HOLE_FLAG или FAT_HOLE_FLAG | FAT_SHARED_FLAG
+    std::optional<uint32_t> allocate_record(const FileSystem::HoleRecord &record, uint32_t flags);
+    // делит лимит страниц между FAT, таблицей дыр и таблицей счётчиков
+    void apply_page_limits() const;
 };
 
 
@@ -1,7 +1,9 @@
 #ifndef FILE_SYSTEM_DEFS_H
 #define FILE_SYSTEM_DEFS_H
 
+#include <cstring>
 #include <string>
+#include <string_view>
 #include <vector>
 
 #pragma once
@@ -9,14 +11,57 @@ namespace FileSystem {
     constexpr uint32_t CLUSTER_SIZE_BYTES = 4096; // размер одного кластера 4096 байт -> 4 Кб
     constexpr uint8_t MAX_FILE_NAME = 255; // максимальная длинна имени файла
     constexpr uint16_t ROOT_DIRECTORY_CLUSTER_COUNT = 1; // изначальный размер корневого каталога
+    constexpr uint32_t CLUSTERS_PER_REGION = CLUSTER_SIZE_BYTES * 8; // кластеров в регионе == битов в кластере битовой карты
+    constexpr uint64_t DEFAULT_METADATA_CACHE_BYTES = 64ull * 1024 * 1024; // лимит памяти под страницы FAT и битовой карты
+    constexpr uint32_t HANDLE_BUFFERS_PER_CHUNK = 64; // кластерные буферы дескрипторов выделяются блоками по 256 Кб
+    constexpr uint32_t IO_BUFFERS_PER_CHUNK = 64; // кластерные буферы тома (метаданные, каталоги) - тоже по 256 Кб
+    constexpr uint32_t DIRECT_IO_BOUNCE_CLUSTERS = 64; // O_DIRECT с невыровненным буфером идёт частями по 256 Кб
+    constexpr uint32_t VECTOR_IO_MAX_RUN_CLUSTERS = 64; // позиционный ввод-вывод объединяет до 256 Кб за операцию
+    constexpr uint32_t COPY_BATCH_CLUSTERS = 1024; // копирование файла внутри тома переносит до 4 Мб за операцию
+    constexpr uint32_t MAX_VOLUME_IMAGES = 8; // том можно разложить или отразить не более чем на 8 файлов-образов
+    constexpr uint32_t DEFAULT_STRIPE_WIDTH_CLUSTERS = 16; // по умолчанию в участник подряд пишется 64 Кб
+    constexpr uint32_t DEFAULT_DIRTY_REGION_CLUSTERS = 256; // журнал зеркала отмечает изменённые участки по 1 Мб
+    constexpr uint32_t MIRROR_SPLIT_MIN_CLUSTERS = 32; // чтение от 128 Кб делится между копиями зеркала
+    constexpr uint32_t MIRROR_PROBE_INTERVAL = 64; // каждое 64-е чтение идёт в давно не читавшуюся копию
+    constexpr uint32_t MAX_ALLOCATION_GROUPS = 64; // область данных делится не более чем на 64 группы размещения
+    constexpr uint32_t MIN_ALLOCATION_GROUP_CLUSTERS = 1024; // группа размещения не меньше 4 Мб
+    constexpr uint32_t CLUSTER_MAGAZINE_MAX_CLUSTERS = 64; // запас кластеров дескриптора - не больше 256 Кб
 
     constexpr char ENTRY_NEVER_USED = 0x00; // значение имени, при условии, что имя не заполнено
     constexpr char ENTRY_DELETED = static_cast<char>(0xE5); // значение имени, при условии, что имя было очищено
+    constexpr uint8_t ENTRY_ATTR_INLINE = 0x01; // reserved[0]: данные файла хранятся в самой записи каталога
+    constexpr uint8_t ENTRY_ATTR_COMPRESSED = 0x02; // reserved[0]: данные файла хранятся сжатыми группами кластеров
+
+    // группа сжатия: логические кластеры [16 * g, 16 * g + 16) файла сжимаются вместе
+    constexpr uint32_t COMPRESSION_GROUP_CLUSTERS = 16;
+    constexpr uint32_t COMPRESSION_GROUP_BYTES = COMPRESSION_GROUP_CLUSTERS * CLUSTER_SIZE_BYTES; // 64 Кб
 
     // системные маркеры для FAT
     constexpr uint32_t MARKER_FAT_ENTRY_FREE = 0x00000000; // кластер свободен
     constexpr uint32_t MARKER_FAT_ENTRY_EOF = 0xFFFFFFFF; // маркер конца файла
-    // любое другое значение - указатель на следующий кластер
+    // значение с FAT_HOLE_FLAG (кроме EOF) - ссылка на запись таблицы дыр, остальные - указатель на следующий кластер;
+    // если вместе с ним установлен FAT_SHARED_FLAG, запись таблицы описывает ссылку на общий кластер
+    constexpr uint32_t FAT_HOLE_FLAG = 0x80000000; // признак ссылки на дыру разреженного файла
+    constexpr uint32_t FAT_SHARED_FLAG = 0x40000000; // признак ссылки на общий кластер (вместе с FAT_HOLE_FLAG)
+    constexpr uint32_t FAT_RECORD_INDEX_MASK = ~(FAT_HOLE_FLAG | FAT_SHARED_FLAG); // номер записи таблицы в ссылке
+
+    // ссылка на запись таблицы дыр (участок файла без выделенных кластеров)
+    constexpr bool is_hole_ref(const uint32_t value) {
+        return value != MARKER_FAT_ENTRY_EOF && (value & (FAT_HOLE_FLAG | FAT_SHARED_FLAG)) == FAT_HOLE_FLAG;
+    }
+
+    // ссылка на общий кластер: кластер с тем же содержимым уже принадлежит другому месту цепочки или другому файлу
+    constexpr bool is_shared_ref(const uint32_t value) {
+        return value != MARKER_FAT_ENTRY_EOF &&
+               (value & (FAT_HOLE_FLAG | FAT_SHARED_FLAG)) == (FAT_HOLE_FLAG | FAT_SHARED_FLAG);
+    }
+
+    // значение в таблице контрольных сумм: сумма кластера ещё не записана (кластер не проверяется)
+    constexpr uint32_t CHECKSUM_NONE = 0;
+
+    // состояние тома в заголовке; 0 - том создан до появления счётчиков свободного места
+    constexpr uint32_t VOLUME_STATE_CLEAN = 1; // том корректно размонтирован, счётчики свободного места достоверны
+    constexpr uint32_t VOLUME_STATE_DIRTY = 2; // том смонтирован или не был корректно размонтирован
 
     struct Header {
         char signature[16]; // идентификатор для заголовка
@@ -36,10 +81,83 @@ namespace FileSystem {
         uint32_t root_dir_size_clusters; // размер корневого каталога
 
         uint32_t data_start_cluster; // номер первого доступного для записи кластера
+
+        uint32_t free_counts_start_cluster; // первый кластер таблицы свободных кластеров по регионам
+        uint32_t free_counts_size_clusters; // количество кластеров таблицы (0 - таблицы нет)
+        uint32_t free_clusters; // свободные кластеры данных на момент размонтирования
+        uint32_t volume_state; // VOLUME_STATE_*
+
+        uint32_t hole_table_start_cluster; // первый кластер таблицы дыр разреженных файлов
+        uint32_t hole_table_size_clusters; // количество кластеров таблицы (0 - разреженные файлы не поддерживаются)
+
+        uint32_t checksum_table_start_cluster; // первый кластер таблицы контрольных сумм (CRC32C на каждый кластер)
+        uint32_t checksum_table_size_clusters; // количество кластеров таблицы (0 - контрольные суммы не ведутся)
+        uint32_t header_checksum; // CRC32C заголовка, посчитанная при нулевом значении этого поля
+
+        // поля ниже добавлены после header_checksum; у старых томов они нулевые
+        uint32_t refcount_table_start_cluster; // первый кластер таблицы счётчиков ссылок (uint32_t на каждый кластер)
+        uint32_t refcount_table_size_clusters; // количество кластеров таблицы (0 - общих кластеров нет)
+        uint32_t dedup_index_start_cluster; // первый кластер индекса дедупликации "CRC32C -> кластер"
+        uint32_t dedup_index_size_clusters; // количество кластеров индекса (0 - дедупликация не поддерживается)
+        uint32_t snapshot_dir_cluster; // первый кластер каталога снимков тома (0 - снимков нет)
+        uint32_t stripe_member_count; // количество файлов-образов тома (0 - том из одного образа)
+        uint32_t stripe_width_clusters; // кластеров подряд в одном образе, дальше - следующий образ
+        uint32_t stripe_member_clusters; // размер каждого образа в кластерах
+        uint32_t image_table_checksum; // CRC32C таблицы образов в кластере заголовка
+        uint32_t mirror_count; // количество копий зеркального тома (0 - зеркала нет)
+        uint32_t dirty_region_clusters; // кластеров в участке журнала изменённых участков зеркала
+    };
+
+    // таблица образов чередующегося или зеркального тома лежит в кластере заголовка после Header: абсолютные пути
+    // образов, следующих за основным (основной - файл с заголовком, он открывается по пути, переданному
+    // при монтировании). Кластер чередующегося тома c попадает в образ (c / ширина) % образов, полосы одного образа
+    // лежат в нём подряд; каждая копия зеркала - полный образ тома
+    struct ImageRecord {
+        char path[256]; // путь к образу, дополненный нулями
+    };
+    constexpr size_t IMAGE_TABLE_OFFSET = 1024; // смещение таблицы в кластере заголовка
+
+    // журнал изменённых участков зеркала - битовая карта в конце кластера заголовка: бит ставится (и заголовок
+    // записывается во все копии) до первой записи в участок и снимается при корректном закрытии тома.
+    // Отмеченные участки после аварийного завершения копируются из основного образа в остальные
+    constexpr size_t DIRTY_LOG_OFFSET = 3072;
+    constexpr size_t DIRTY_LOG_BYTES = CLUSTER_SIZE_BYTES - DIRTY_LOG_OFFSET; // до 8192 участков
+
+    // запись таблицы дыр: length_clusters логических кластеров без данных, за которыми следует узел next
+    struct HoleRecord {
+        uint32_t length_clusters; // длина дыры в кластерах, 0 - запись свободна
+        uint32_t next; // следующий узел цепочки (кластер, другая дыра или EOF)
+    };
+
+    // запись таблицы дыр по ссылке с FAT_SHARED_FLAG: один логический кластер, данные которого лежат в cluster
+    struct SharedRecord {
+        uint32_t cluster; // общий кластер с данными (не 0, поэтому запись не считается свободной)
+        uint32_t next; // следующий узел цепочки
+    };
+
+    static_assert(sizeof(SharedRecord) == sizeof(HoleRecord), "Shared records live in the hole table");
+
+    // индекс дедупликации: ячейки сгруппированы в корзины, корзина выбирается по CRC32C содержимого кластера
+    constexpr uint32_t DEDUP_BUCKET_SLOTS = 8;
+
+    // начало первого кластера сжатой группы; группа, не сэкономившая ни одного кластера, хранится без сжатия и без заголовка
+    struct CompressedGroupHeader {
+        uint32_t compressed_bytes; // размер сжатых данных после заголовка
+        uint32_t raw_bytes; // размер данных группы после распаковки
+    };
+
+    // положение группы сжатия в цепочке файла: кластеры с данными, за ними дыра до конца группы
+    struct CompressedGroup {
+        uint32_t first_cluster; // первый кластер группы
+        uint32_t data_clusters; // кластеров с данными; дыра после них означает, что группа сжата
+        uint32_t hole_ref; // дыра до конца группы, MARKER_FAT_ENTRY_FREE - дыры нет
     };
 
     // проверка возможности поместить заголовок в один кластер
     static_assert(sizeof(Header) <= CLUSTER_SIZE_BYTES, "Header is too large for one cluster");
+    static_assert(sizeof(Header) <= IMAGE_TABLE_OFFSET &&
+                  IMAGE_TABLE_OFFSET + (MAX_VOLUME_IMAGES - 1) * sizeof(ImageRecord) <= DIRTY_LOG_OFFSET,
+                  "Image table must fit into the header cluster between the header and the dirty region log");
 
     enum EntityType: uint8_t {
         // тип сущности файл/директория
@@ -65,20 +183,79 @@ namespace FileSystem {
             for (unsigned char &i: reserved)
                 i = val_;
         }
+
+        // встроенные данные маленького файла лежат в name сразу после завершающего нуля имени
+        [[nodiscard]] bool is_inline() const { return (reserved[0] & ENTRY_ATTR_INLINE) != 0; }
+
+        // данные файла сжимаются группами по COMPRESSION_GROUP_CLUSTERS кластеров
+        [[nodiscard]] bool is_compressed() const { return (reserved[0] & ENTRY_ATTR_COMPRESSED) != 0; }
+
+        void set_compressed(const bool compressed) {
+            if (compressed) {
+                reserved[0] |= ENTRY_ATTR_COMPRESSED;
+            } else {
+                reserved[0] &= static_cast<uint8_t>(~ENTRY_ATTR_COMPRESSED);
+            }
+        }
+
+        // сколько байт данных помещается в запись при текущем имени
+        [[nodiscard]] uint32_t inline_capacity() const {
+            const size_t name_length = strnlen(name.data(), MAX_FILE_NAME);
+            return name_length + 1 < MAX_FILE_NAME ? static_cast<uint32_t>(MAX_FILE_NAME - name_length - 1) : 0;
+        }
+
+        char *inline_data() { return name.data() + strnlen(name.data(), MAX_FILE_NAME) + 1; }
+        [[nodiscard]] const char *inline_data() const { return name.data() + strnlen(name.data(), MAX_FILE_NAME) + 1; }
+
+        // помечает запись встроенной (или снимает пометку, обнуляя область данных)
+        void set_inline(const bool inline_) {
+            if (inline_) {
+                reserved[0] |= ENTRY_ATTR_INLINE;
+                return;
+            }
+            reserved[0] &= static_cast<uint8_t>(~ENTRY_ATTR_INLINE);
+            std::memset(inline_data(), 0, inline_capacity());
+        }
+
+        // меняет имя, сохраняя встроенные данные; false - имя вместе с данными не помещается в запись
+        bool set_name(const std::string &new_name) {
+            if (new_name.empty() || new_name.length() >= MAX_FILE_NAME) return false;
+            std::string data;
+            if (is_inline()) {
+                data.assign(inline_data(), file_size_bytes);
+                if (new_name.length() + 1 + data.size() > MAX_FILE_NAME) return false;
+            }
+            name.fill(ENTRY_NEVER_USED);
+            std::memcpy(name.data(), new_name.data(), new_name.length());
+            std::memcpy(inline_data(), data.data(), data.size());
+            return true;
+        }
     };
 
     struct FileHandle {
         // файловый дескриптор
-        uint32_t handle_id; // ID для файлового дескриптора
-        std::string path; // полный путь к файлу
+        uint32_t handle_id; // ID для файлового дескриптора (слот и поколение в таблице открытых файлов)
+        uint32_t dir_cluster = MARKER_FAT_ENTRY_FREE; // каталог с записью файла; имя файла - в копии записи
         DirectoryEntry dir_entry; // копия записи каталога
         uint64_t current_pos_bytes; // текущая позиция в файле
 
-        std::vector<char> buffer; // буфер размером в один кластер
+        char *buffer = nullptr; // буфер размером в один кластер из пула ядра, подключается при первом вводе-выводе
         uint32_t buffered_cluster_idx; // индекс кластера, который сейчас в буфере
         bool buffer_dirty; // флаг "грязного" буфера
         uint32_t current_cluster_in_chain; // текущий кластер в цепочке FAT
         uint32_t offset_in_buffered_cluster; // смещение внутри буферизированного кластера
+        uint32_t hole_offset_clusters; // номер логического кластера внутри дыры, если текущий узел - дыра
+        uint32_t previous_node_in_chain; // узел цепочки перед текущим (FREE - текущий узел первый)
+        uint32_t allocation_group = 0; // группа размещения, из которой берутся новые кластеры файла
+        uint32_t placement_goal = MARKER_FAT_ENTRY_FREE; // за этим кластером ставится первый кластер файла
+        // запас кластеров: заняты в битовой карте, но ещё не связаны в FAT; берутся с конца, по возрастанию номеров
+        std::vector<uint32_t> reserved_clusters;
+
+        // сжатый файл читается и пишется группами целиком; кластерный буфер и позиция в цепочке не используются
+        std::vector<CompressedGroup> groups; // индекс групп: положение каждой группы в цепочке
+        std::vector<char> group_buffer; // распакованная группа размером COMPRESSION_GROUP_BYTES
+        uint32_t buffered_group = MARKER_FAT_ENTRY_EOF; // номер группы в group_buffer
+        bool group_dirty = false; // группа изменена и ещё не сжата на диск
 
         bool is_open_to_write; // открыт ли файл для записи
         bool modified{}; // изменён ли файл
@@ -86,13 +263,64 @@ namespace FileSystem {
         FileHandle(): handle_id(0), current_pos_bytes(0),
                       buffered_cluster_idx(MARKER_FAT_ENTRY_EOF), buffer_dirty(false),
                       current_cluster_in_chain(MARKER_FAT_ENTRY_FREE), offset_in_buffered_cluster(0),
+                      hole_offset_clusters(0), previous_node_in_chain(MARKER_FAT_ENTRY_FREE),
                       is_open_to_write(false) {
-            buffer.resize(CLUSTER_SIZE_BYTES);
+        }
+
+        [[nodiscard]] std::string_view name() const {
+            return {dir_entry.name.data(), strnlen(dir_entry.name.data(), MAX_FILE_NAME)};
+        }
+        // дескриптор открыт на запись file_name каталога dir
+        [[nodiscard]] bool refers_to(const uint32_t dir, const std::string_view file_name) const {
+            return dir_cluster == dir && name() == file_name;
         }
     };
 
     constexpr uint32_t DIR_ENTRIES_PER_CLUSTER = CLUSTER_SIZE_BYTES / sizeof(DirectoryEntry);
 
+    // --- Каталоги в виде B+-дерева --- //
+    // Большой каталог хранится деревом, упорядоченным по имени; все узлы по-прежнему связаны в цепочку каталога
+    // в FAT, первый кластер каталога всегда корень. Узел начинается с заголовка, первый байт magic совпадает
+    // с ENTRY_DELETED, а за ним идут ненулевые байты - в обычном каталоге такой записи не бывает.
+    constexpr uint32_t DIR_NODE_MAGIC = 0x4E4454E5; // байты E5 'T' 'D' 'N'
+    constexpr uint32_t DIR_BTREE_THRESHOLD_CLUSTERS = 8; // обычный каталог длиннее переводится в дерево
+    constexpr uint32_t DIR_BTREE_MAX_DEPTH = 16; // защита от циклов в повреждённом дереве
+
+    struct DirectoryNodeHeader {
+        uint32_t magic; // DIR_NODE_MAGIC
+        uint16_t level; // 0 - лист с записями каталога, иначе внутренний узел
+        uint16_t count; // записей в листе / ключей во внутреннем узле
+        uint32_t next_leaf; // лист: следующий лист по порядку имён, MARKER_FAT_ENTRY_EOF - последний
+        uint32_t chain_tail; // корень: последний кластер цепочки каталога в FAT
+    };
+
+    // ключ внутреннего узла: в поддереве child имена не меньше name
+    struct DirectoryIndexKey {
+        std::array<char, MAX_FILE_NAME> name{};
+        uint8_t reserved{};
+        uint32_t child{};
+    };
+
+    // лист: заголовок и отсортированные записи; внутренний узел: заголовок, первый потомок (имена меньше
+    // первого ключа) и отсортированные ключи
+    constexpr uint32_t DIR_LEAF_CAPACITY = (CLUSTER_SIZE_BYTES - sizeof(DirectoryNodeHeader)) / sizeof(DirectoryEntry);
+    constexpr uint32_t DIR_INDEX_CAPACITY = (CLUSTER_SIZE_BYTES - sizeof(DirectoryNodeHeader) - sizeof(uint32_t)) /
+                                            sizeof(DirectoryIndexKey);
+    constexpr size_t DIR_NODE_FIRST_CHILD_OFFSET = sizeof(DirectoryNodeHeader);
+    constexpr size_t DIR_NODE_KEYS_OFFSET = sizeof(DirectoryNodeHeader) + sizeof(uint32_t);
+
+    // кластер каталога - узел дерева
+    inline bool is_directory_node(const char *cluster) {
+        uint32_t magic;
+        std::memcpy(&magic, cluster, sizeof(magic));
+        return magic == DIR_NODE_MAGIC;
+    }
+
+    // смещение записи slot в кластере каталога любого вида
+    inline size_t directory_slot_offset(const char *cluster, const uint32_t slot) {
+        return (is_directory_node(cluster) ? sizeof(DirectoryNodeHeader) : 0) + slot * sizeof(DirectoryEntry);
+    }
+
     inline std::optional<std::streamoff> try_to_streamoff(const uint64_t value) {
         if (value > static_cast<uint64_t>(std::numeric_limits<std::streamoff>::max())) {
             return std::nullopt;
@@ -0,0 +1,114 @@
+#ifndef FS_CLIENT_H
+#define FS_CLIENT_H
+
+#include <cstdint>
+#include <deque>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "file_system_config.h"
+#include "fs_protocol.h"
+
+// Клиент сервера файловой системы (FsServer).
+// Запросы не отправляются по одному: они копятся в буфере и уходят одной записью, когда буфер заполнен
+// или вызывающий ждёт результат. Данные больше INLINE_PAYLOAD_MAX идут через общую память,
+// крупные передачи делятся на части, которые сервер обрабатывает конвейером.
+// Объект не потокобезопасен: каждый поток или процесс открывает своё соединение.
+class FsClient {
+public:
+    // номер отправленной операции для wait(); 0 - операция не отправлена
+    using Ticket = uint32_t;
+
+    struct Entry {
+        std::string name;
+        FileSystem::EntityType type;
+        uint32_t size_bytes;
+    };
+
+    FsClient() = default;
+    ~FsClient();
+    FsClient(const FsClient &) = delete;
+    FsClient &operator=(const FsClient &) = delete;
+
+    bool connect(const std::string &socket_path);
+    void disconnect();
+    [[nodiscard]] bool connected() const { return fd_ >= 0; }
+    // сервер выдал общую память; без неё все данные идут через сокет
+    [[nodiscard]] bool shared_memory() const { return shared_ != nullptr; }
+
+    // --- Синхронные вызовы (как у FileSystemCore) --- //
+    std::optional<uint32_t> open(const std::string &path, const std::string &mode);
+    bool close(uint32_t handle);
+    int64_t read(uint32_t handle, char *buffer, uint64_t bytes);
+    int64_t write(uint32_t handle, const char *buffer, uint64_t bytes);
+    int64_t pread(uint32_t handle, char *buffer, uint64_t bytes, uint64_t offset);
+    int64_t pwrite(uint32_t handle, const char *buffer, uint64_t bytes, uint64_t offset);
+    // whence - FS_SEEK_*; возвращает новую позицию
+    std::optional<uint64_t> seek(uint32_t handle, uint64_t offset, int whence);
+    std::optional<std::vector<Entry>> list(const std::string &path = "/");
+    bool remove(const std::string &path);
+
+    // --- Конвейер --- //
+    // ставят операцию в очередь и сразу возвращаются; buffer должен жить до wait().
+    // Данные pwrite копируются при вызове, данные pread попадают в buffer во время wait()
+    Ticket submit_pread(uint32_t handle, char *buffer, uint64_t bytes, uint64_t offset);
+    Ticket submit_pwrite(uint32_t handle, const char *buffer, uint64_t bytes, uint64_t offset);
+    // дожидается операции: количество переданных байт, -1 при ошибке
+    int64_t wait(Ticket ticket);
+    // отправляет накопленные запросы, не дожидаясь ответов
+    bool flush();
+
+private:
+    // итог операции, возможно разбитой на несколько запросов
+    struct Operation {
+        uint32_t outstanding = 0; // запросы без ответа
+        bool failed = false;
+        int64_t result = 0; // сумма для чтения и записи, иначе результат последнего ответа
+        uint8_t flags = 0;
+        std::vector<char> payload; // данные ответа LIST
+    };
+
+    // отправленный запрос в порядке ответов
+    struct InFlight {
+        uint32_t request_id;
+        Ticket ticket;
+        FsProtocol::Opcode opcode;
+        char *target; // куда положить прочитанное
+        uint64_t length;
+        bool shared;
+        uint32_t shared_offset;
+    };
+
+    int fd_ = -1;
+    char *shared_ = nullptr;
+    uint64_t shared_bytes_ = 0;
+    uint64_t shared_used_ = 0; // занятая запросами в полёте часть общей памяти
+    uint32_t next_request_id_ = 1;
+    Ticket next_ticket_ = 1;
+    std::vector<char> send_buffer_; // запросы, ещё не отправленные
+    std::vector<char> receive_buffer_; // принятые, ещё не разобранные ответы
+    std::vector<char> receive_chunk_; // буфер одного чтения из сокета
+    std::deque<InFlight> in_flight_;
+    std::unordered_map<Ticket, Operation> operations_;
+
+    Ticket new_operation();
+    // ставит в очередь запрос с данными: для чтения target - куда их положить, для записи - откуда взять.
+    // крупная передача делится на части, каждая получает свой запрос
+    bool submit_transfer(Ticket ticket, FsProtocol::Opcode opcode, uint32_t handle, char *target,
+                         const char *source, uint64_t bytes, uint64_t offset);
+    // ставит в очередь запрос без данных
+    Ticket submit_simple(FsProtocol::Request request, const std::string &name);
+    void enqueue(const FsProtocol::Request &request, const std::string &name, const char *payload);
+    // участок общей памяти под bytes байт; при нехватке дожидается всех запросов в полёте
+    std::optional<uint32_t> reserve_shared(uint64_t bytes);
+    // читает из сокета, сколько есть (block - ждать хотя бы одного ответа), и разбирает пришедшие ответы
+    bool receive(bool block);
+    bool handle_reply(const FsProtocol::Reply &reply, const char *payload);
+    // итог операции после всех её ответов
+    std::optional<Operation> complete(Ticket ticket);
+    bool fail(const std::string &message);
+};
+
+#endif //FS_CLIENT_H
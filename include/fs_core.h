@@ -1,20 +1,85 @@
 #ifndef FS_CORE_H
 #define FS_CORE_H
+#include <array>
 #include <cstdint>
 #include <map>
+#include <unordered_map>
+#include <mutex>
 #include <string>
 #include <vector>
 #include <optional>
 
 #include "bitmap_manager.h"
+#include "buffer_pool.h"
+#include "core_mutex.h"
+#include "dedup_index.h"
 #include "directory_manager.h"
 #include "fat_manager.h"
 #include "file_system_config.h"
+#include "fs_trace.h"
+#include "handle_table.h"
 #include "volume_manager.h"
 
 #define FS_SEEK_SET 0
 #define FS_SEEK_CUR 1
 #define FS_SEEK_END 2
+#define FS_SEEK_DATA 3 // ближайшие данные начиная с offset (как SEEK_DATA в lseek)
+#define FS_SEEK_HOLE 4 // ближайшая дыра начиная с offset; конец файла считается дырой
+
+// сегмент буфера для векторного ввода-вывода (как struct iovec)
+struct FsIoVec {
+    void *base;
+    uint64_t length;
+};
+
+// фрагментация одного файла
+struct FileFragmentation {
+    std::string path; // путь к файлу
+    uint32_t clusters = 0; // количество кластеров в цепочке
+    uint32_t extents = 0; // количество непрерывных участков цепочки
+};
+
+// отчёт о фрагментации тома
+struct FragmentationReport {
+    uint64_t files = 0; // количество непустых файлов
+    uint64_t fragmented_files = 0; // файлы, состоящие из нескольких участков
+    uint64_t clusters = 0; // суммарное количество кластеров в файлах
+    uint64_t extents = 0; // суммарное количество участков
+    std::vector<FileFragmentation> per_file; // статистика по каждому файлу
+
+    // средняя длина непрерывного участка в кластерах
+    [[nodiscard]] double average_run_length() const {
+        return extents == 0 ? 0.0 : static_cast<double>(clusters) / static_cast<double>(extents);
+    }
+};
+
+// занятость тома (df)
+struct SpaceInfo {
+    uint32_t cluster_size = 0; // размер кластера в байтах
+    uint64_t total_clusters = 0; // все кластеры тома, включая метаданные
+    uint64_t data_clusters = 0; // кластеры области данных
+    uint64_t free_clusters = 0; // свободные кластеры области данных
+    uint32_t regions = 0; // количество регионов по CLUSTERS_PER_REGION кластеров
+    uint32_t allocation_groups = 0; // количество групп размещения
+
+    [[nodiscard]] uint64_t used_clusters() const { return data_clusters - free_clusters; }
+};
+
+// отчёт о дедупликации тома
+struct DedupReport {
+    uint64_t files = 0; // просмотренные файлы с кластерами
+    uint64_t clusters = 0; // проверенные кластеры, ещё не общие
+    uint64_t deduplicated_clusters = 0; // кластеры, заменённые ссылками на такие же
+    uint64_t skipped_files = 0; // сжатые и открытые файлы
+};
+
+// использование памяти страницами FAT, битовой карты, таблицы контрольных сумм и индекса дедупликации
+struct MetadataCacheUsage {
+    MetadataCache::Stats fat;
+    MetadataCache::Stats bitmap;
+    MetadataCache::Stats checksums;
+    MetadataCache::Stats dedup;
+};
 
 class FileSystemCore {
 public:
@@ -23,9 +88,13 @@ public:
     ~FileSystemCore();
 
     bool mount(const std::string &volume_path); // монтирование существующего тома
-    bool format(const std::string &volume_path, uint64_t volume_size_mb); // форматирование тома
+    // монтирование снимка тома только для чтения
+    bool mount_snapshot(const std::string &volume_path, const std::string &snapshot_name);
+    // форматирование тома; preallocate - выделить место под весь образ сразу
+    bool format(const std::string &volume_path, uint64_t volume_size_mb, bool preallocate = false);
     void unmount(); // размонтирование тома
     bool isMounted() const;
+    bool isReadOnly() const; // смонтирован снимок
 
     // --- Операции с файлами --- //
     std::optional<uint32_t> open_file(const std::string &path, const std::string &mode);
@@ -33,41 +102,321 @@ public:
     int64_t read_file(uint32_t handle_id, char *buffer, uint64_t bytes_to_read);
     int64_t write_file(uint32_t handle_id, const char *buffer, uint64_t bytes_to_write);
     bool seek(uint32_t handle_id, uint64_t offset, int whence);
+    std::optional<uint64_t> tell(uint32_t handle_id) const; // текущая позиция, в том числе после FS_SEEK_DATA/HOLE
+
+    // --- Позиционный и векторный ввод-вывод --- //
+    // чтение и запись с offset без сдвига позиции дескриптора (как pread/pwrite): кластеры диапазона находятся
+    // за один проход по цепочке, подряд идущие на томе читаются и пишутся одной операцией
+    int64_t pread_file(uint32_t handle_id, char *buffer, uint64_t bytes_to_read, uint64_t offset);
+    int64_t pwrite_file(uint32_t handle_id, const char *buffer, uint64_t bytes_to_write, uint64_t offset);
+    // то же для массива сегментов (как preadv/pwritev)
+    int64_t preadv_file(uint32_t handle_id, const FsIoVec *iov, size_t iov_count, uint64_t offset);
+    int64_t pwritev_file(uint32_t handle_id, const FsIoVec *iov, size_t iov_count, uint64_t offset);
+    // с текущей позиции дескриптора, которая сдвигается на обработанные байты (как readv/writev)
+    int64_t readv_file(uint32_t handle_id, const FsIoVec *iov, size_t iov_count);
+    int64_t writev_file(uint32_t handle_id, const FsIoVec *iov, size_t iov_count);
     bool remove_file(const std::string &path) const;
     bool rename_file(const std::string &old_path, const std::string &new_path);
 
     // --- Операции с каталогами --- //
     bool create_directory(const std::string &path) const;
-    bool remove_directory(const std::string &path) const;
+    bool remove_directory(const std::string &path);
     std::vector<FileSystem::DirectoryEntry> list_directory(const std::string &path) const;
 
+    // --- Обход каталогов --- //
+    // курсор каталога (как opendir): записи читаются по кластеру, список целиком в памяти не собирается;
+    // position - значение tell_directory() для продолжения прерванного обхода, prefix - фильтр имён
+    // (в каталоге-дереве обходятся только листья с подходящими именами)
+    std::optional<uint32_t> open_directory(const std::string &path, DirectoryCursor::Position position = 0,
+                                           const std::string &prefix = {});
+    // следующая запись (как readdir); представление действительно до следующего вызова для этого курсора,
+    // nullopt - конец каталога или ошибка
+    std::optional<DirectoryCursor::EntryView> read_directory(uint32_t dir_id);
+    std::optional<DirectoryCursor::Position> tell_directory(uint32_t dir_id) const;
+    // кластер с данными узла цепочки (first_cluster записи каталога): для ссылки на общий кластер - сам кластер;
+    // nullopt для дыры и пустой цепочки
+    std::optional<uint32_t> resolve_data_cluster(uint32_t node) const;
+    bool close_directory(uint32_t dir_id);
+    // длина цепочки, после которой заполненный каталог перестраивается в B+-дерево (0 - никогда);
+    // действует сразу и при следующих монтированиях
+    void set_directory_btree_threshold(uint32_t clusters);
+
+    // --- Фрагментация --- //
+    FragmentationReport analyze_fragmentation() const;
+    // переносит цепочку файла в непрерывный участок; возвращает количество перенесённых кластеров
+    std::optional<uint32_t> defragment_file(const std::string &path);
+
+    // --- Свободное место --- //
+    // сведения о свободном месте из счётчиков; после некорректного размонтирования счётчики перестраиваются здесь
+    std::optional<SpaceInfo> get_space_info() const;
+    // свободные кластеры в регионе
+    std::optional<uint32_t> get_region_free_clusters(uint32_t region_idx) const;
+    // свободные кластеры в группе размещения
+    std::optional<uint32_t> get_group_free_clusters(uint32_t group) const;
+    // делить область данных на группы размещения по файлам (включено по умолчанию); действует со следующего
+    // монтирования или форматирования
+    void set_allocation_groups(bool enabled);
+    // выделять кластеры дописываемым файлам из запаса дескриптора, пополняемого участками из группы файла
+    // (включено по умолчанию); действует сразу
+    void set_cluster_magazines(bool enabled);
+    // дописывать в конец файлов под разделяемым замком ядра: потоки, дописывающие разные файлы, берут кластеры
+    // из своих групп и пишут данные одновременно (включено по умолчанию); действует сразу
+    void set_parallel_appends(bool enabled);
+
+    // --- Разреженный образ --- //
+    // пробивать дыры в образе под освобождаемыми кластерами; действует сразу и при следующих монтированиях
+    void set_discard_freed(bool discard_freed);
+    // пробивает дыры под всеми свободными кластерами; возвращает количество освобождённых на хосте байт
+    std::optional<uint64_t> compact_volume();
+    // место, занимаемое образом на диске хоста
+    std::optional<uint64_t> get_allocated_bytes() const;
+
+    // --- Сжатие --- //
+    // включает или снимает сжатие файла; данные непустого файла перепаковываются через временный файл рядом с ним
+    bool set_compression(const std::string &path, bool enabled);
+
+    // --- Контрольные суммы --- //
+    // проверять CRC32C кластеров при чтении (включено по умолчанию); действует сразу и при следующих монтированиях
+    void set_checksum_verification(bool enabled);
+
+    // --- Прямой ввод-вывод --- //
+    // O_DIRECT в обход страничного кэша хоста; действует со следующего монтирования или форматирования
+    void set_direct_io(bool enabled);
+    bool isDirectIO() const; // том смонтирован с O_DIRECT
+
+    // --- Чередование и зеркалирование по образам --- //
+    // следующие форматируемые тома раскладываются по основному образу и member_paths полосами по width_clusters
+    // кластеров; пустой список - том из одного образа. false - слишком много образов или нулевая ширина
+    bool set_stripe_layout(const std::vector<std::string> &member_paths,
+                           uint32_t width_clusters = FileSystem::DEFAULT_STRIPE_WIDTH_CLUSTERS);
+    // следующие форматируемые тома хранятся в основном образе и в копиях mirror_paths; пустой список - без зеркала
+    bool set_mirror_layout(const std::vector<std::string> &mirror_paths);
+    // пути образов смонтированного тома, первым - основной; пусто, если том не смонтирован
+    std::vector<std::string> volume_image_paths() const;
+    // статистика чтений по образам смонтированного тома в том же порядке
+    std::vector<VolumeManager::ImageStats> volume_image_stats() const;
+    bool isMirrorResyncing() const; // копии зеркала синхронизируются после аварийного завершения
+    bool isMirrorDegraded() const; // часть копий зеркала недоступна
+
+    // --- Дедупликация --- //
+    // записываемые кластеры с содержимым, уже имеющимся на томе, заменяются ссылками на него;
+    // действует сразу и при следующих монтированиях
+    void set_dedup(bool enabled);
+    // заменяет ссылками одинаковые кластеры уже записанных файлов
+    std::optional<DedupReport> deduplicate_volume();
+
+    // --- Клоны и снимки --- //
+    // создаёт dst с теми же кластерами, что у src; изменённые кластеры любой из копий копируются при записи
+    bool clone_file(const std::string &src_path, const std::string &dst_path);
+    // создаёт dst с собственной копией данных src: кластеры копируются внутри образа в заранее выделенный
+    // непрерывный участок, не проходя через буферы файловой системы; работает и без таблицы счётчиков ссылок
+    bool copy_file(const std::string &src_path, const std::string &dst_path);
+    // снимок тома: дерево каталогов копируется, файлы клонируются
+    bool create_snapshot(const std::string &name);
+    bool delete_snapshot(const std::string &name);
+    std::vector<std::string> list_snapshots() const;
+
+    // --- Трасса вызовов --- //
+    // записывает в файл хоста каждый вызов операций с файлами и каталогами (операция, путь, дескриптор, смещение,
+    // размер, результат, задержка) для fs_replay; вызовы, сделанные изнутри других, не записываются
+    bool start_trace(const std::string &trace_path);
+    // завершает запись; возвращает количество записанных вызовов, nullopt - трасса не велась или не дописана
+    std::optional<uint64_t> stop_trace();
+    bool isTracing() const;
+
+    // --- Кэш метаданных --- //
+    // лимит памяти под страницы FAT, битовой карты, таблицы сумм и индекса дедупликации; действует сразу и при следующих монтированиях
+    void set_metadata_cache_budget(uint64_t bytes);
+    MetadataCacheUsage get_metadata_cache_usage() const;
+
     static std::string get_filename_from_path(const std::string &path); // разбор пути
 
-    FileSystem::Header get_header() const { return header_; }
+    FileSystem::Header get_header() const {
+        std::lock_guard lock(fs_mutex_);
+        return header_;
+    }
 
 private:
     VolumeManager vol_manager_;
     std::unique_ptr<BitmapManager> bitmap_manager_;
     std::unique_ptr<FATManager> fat_manager_;
     std::unique_ptr<DirectoryManager> directory_manager_;
+    std::unique_ptr<DedupIndex> dedup_index_; // nullptr - том без индекса дедупликации
+
+    // все публичные операции сериализуются, чтобы фоновые задачи (дефрагментация) могли работать параллельно
+    // с клиентом; дописывание в конец файла идёт под разделяемым захватом (append_shared)
+    mutable CoreMutex fs_mutex_;
+    // дописывание через один дескриптор из разных потоков под разделяемым захватом; замок выбирается по слоту
+    std::array<std::mutex, 64> append_locks_;
 
     bool mounted_ = false;
+    bool read_only_ = false; // смонтирован снимок: метаданные не меняются и не записываются
     FileSystem::Header header_{};
+    uint64_t metadata_cache_bytes_ = FileSystem::DEFAULT_METADATA_CACHE_BYTES; // лимит памяти под страницы метаданных
+    bool discard_freed_ = false; // пробивать дыры под освобождаемыми кластерами
+    bool allocation_groups_ = true; // размещать данные файлов по группам
+    bool cluster_magazines_ = true; // выделять кластеры из запаса дескриптора
+    bool parallel_appends_ = true; // дописывать в конец файлов под разделяемым захватом
+    bool dedup_enabled_ = false; // дедуплицировать записываемые кластеры
+    uint32_t btree_threshold_clusters_ = FileSystem::DIR_BTREE_THRESHOLD_CLUSTERS; // порог перестройки каталога
+
+    HandleTable opened_files_table_; // таблица открытых файлов
+    std::unordered_map<uint32_t, DirectoryCursor> open_directories_; // открытые курсоры каталогов
+    uint32_t next_directory_id_ = 1;
+    mutable BufferPool handle_buffers_; // кластерные буферы дескрипторов
+    mutable std::vector<char> compression_scratch_; // сжатые данные группы при чтении и записи
+    mutable std::vector<char> dedup_scratch_; // кластер-кандидат при сравнении содержимого
+    mutable std::vector<char> vector_io_scratch_; // участок кластеров позиционного ввода-вывода, не попавший в один сегмент
+    mutable FsTrace::TraceWriter trace_writer_; // трасса вызовов, пока она ведётся
+
+    // выполняет публичную операцию и, если ведётся трасса, записывает её; call - тело операции
+    template<typename Call>
+    auto traced(FsTrace::Record record, const std::string &path, const std::string &second, Call &&call) const;
+    // тела записываемых в трассу операций
+    std::optional<uint32_t> open_file_untraced(const std::string &path, const std::string &mode);
+    bool close_file_untraced(uint32_t handle_id);
+    int64_t read_file_untraced(uint32_t handle_id, char *buffer, uint64_t bytes_to_read);
+    int64_t write_file_untraced(uint32_t handle_id, const char *user_buffer, uint64_t bytes_to_write);
+    bool seek_untraced(uint32_t handle_id, uint64_t offset, int whence);
+    int64_t preadv_file_untraced(uint32_t handle_id, const FsIoVec *iov, size_t iov_count, uint64_t offset);
+    int64_t pwritev_file_untraced(uint32_t handle_id, const FsIoVec *iov, size_t iov_count, uint64_t offset);
+    bool remove_file_untraced(const std::string &path) const;
+    bool rename_file_untraced(const std::string &old_path, const std::string &new_path);
+    bool create_directory_untraced(const std::string &path) const;
+    bool remove_directory_untraced(const std::string &path);
+    std::vector<FileSystem::DirectoryEntry> list_directory_untraced(const std::string &path) const;
+    std::optional<uint32_t> open_directory_untraced(const std::string &path, DirectoryCursor::Position position,
+                                                    const std::string &prefix);
+    bool clone_file_untraced(const std::string &src_path, const std::string &dst_path);
+    bool copy_file_untraced(const std::string &src_path, const std::string &dst_path);
 
-    std::map<uint32_t, FileSystem::FileHandle> opened_files_table_; // таблица открытых файлов
-    uint32_t next_handle_id = 1; // ID следующего дескриптора
+    // первый кластер каталога по пути; nullopt и сообщение об ошибке, если каталога нет
+    std::optional<uint32_t> find_directory_cluster(const std::string &path) const;
 
     // Вспомогательные методы для работы с файлами
+    // подключает к дескриптору кластерный буфер из пула
+    bool attach_buffer(FileSystem::FileHandle &handle) const;
+    // возвращает буфер дескриптора в пул и освобождает слот
+    void release_handle(uint32_t handle_id);
     bool load_cluster_info_buffer(FileSystem::FileHandle &handle, uint32_t cluster_to_load) const;
     bool flush_cluster(FileSystem::FileHandle &handle) const;
-    std::optional<uint32_t> allocate_and_link_cluster(FileSystem::FileHandle &handle) const;
+    // выделяет кластер за концом цепочки; промежуток до позиции записи становится дырой
+    std::optional<uint32_t> allocate_and_link_cluster(FileSystem::FileHandle &handle);
+    // кластер из запаса дескриптора; пустой запас пополняется участком сразу за последним кластером файла
+    // (первый кластер - за кластером каталога) или из группы файла, при нехватке места
+    // забираются запасы остальных дескрипторов
+    std::optional<uint32_t> take_reserved_cluster(FileSystem::FileHandle &handle);
+    // то же без обращения к запасам других дескрипторов; безопасно под разделяемым захватом
+    std::optional<uint32_t> pop_reserved_cluster(FileSystem::FileHandle &handle) const;
+    // дописывает начало записи в конец файла под разделяемым захватом; возвращает записанные байты.
+    // 0 - запись не подходит (сжатие, дедупликация, позиция не в конце, запись посередине цепочки и т.п.),
+    // остаток выполняет write_file под исключительным захватом
+    uint64_t append_shared(uint32_t handle_id, const char *user_buffer, uint64_t bytes_to_write);
+    // возвращает запас дескриптора в битовую карту
+    void return_reserved_clusters(FileSystem::FileHandle &handle) const;
+    // после некорректного размонтирования освобождает занятые в битовой карте кластеры без записи в FAT:
+    // это запасы дескрипторов и кластеры, выделение которых не завершилось
+    bool reclaim_reserved_clusters() const;
+    // том записан до побайтовой битовой карты: ни состояния тома, ни таблицы регионов
+    static bool is_legacy_bitmap(const FileSystem::Header &header);
+    // строит битовую карту такого тома заново по FAT до первого выделения кластера
+    bool rebuild_legacy_bitmap() const;
+    // выделяет кластер на месте текущего логического кластера дыры, разделяя её
+    std::optional<uint32_t> fill_hole_cluster(FileSystem::FileHandle &handle) const;
+    // запись во встроенные данные файла (запись каталога без кластеров)
+    int64_t write_inline(FileSystem::FileHandle &handle, const char *user_buffer, uint64_t bytes_to_write) const;
+    // переносит встроенные данные в выделенный кластер, запись становится обычной
+    bool spill_inline_data(FileSystem::DirectoryEntry &entry) const;
+    // подключает узел после previous_node_in_chain (или первым узлом файла)
+    bool link_after_previous(FileSystem::FileHandle &handle, uint32_t node) const;
+    // кластер с данными узла: сам кластер или кластер ссылки на общий; nullopt для дыр и концов цепочки
+    [[nodiscard]] std::optional<uint32_t> node_cluster(uint32_t node) const;
+    // переход к следующему логическому кластеру (внутри дыры или к следующему узлу)
+    bool advance_in_chain(FileSystem::FileHandle &handle) const;
+    // находит узел цепочки для current_pos_bytes
+    bool position_in_chain(FileSystem::FileHandle &handle) const;
+    // начало ближайших данных (find_data) или дыры не раньше offset
+    std::optional<uint64_t> find_data_or_hole(const FileSystem::FileHandle &handle, uint64_t offset,
+                                              bool find_data) const;
     bool update_directory_entry_for_file(const FileSystem::FileHandle &handle) const;
 
+    // --- Позиционный ввод-вывод --- //
+    // узлы логических кластеров [first, first + count) файла: кластер (свой или ссылка на общий) или FREE
+    // для дыры и места за концом цепочки; проход начинается с узла дескриптора, если он не дальше first
+    std::optional<std::vector<uint32_t>> resolve_nodes(const FileSystem::FileHandle &handle, uint64_t first,
+                                                       uint64_t count) const;
+    int64_t read_at(uint32_t handle_id, FileSystem::FileHandle &handle, const FsIoVec *iov, size_t iov_count,
+                    uint64_t offset);
+    // на месте перезаписываются только собственные кластеры внутри файла; остальное (выделение, дыры,
+    // общие кластеры, сжатые и встроенные файлы) идёт обычной записью через позицию дескриптора
+    int64_t write_at(uint32_t handle_id, FileSystem::FileHandle &handle, const FsIoVec *iov, size_t iov_count,
+                     uint64_t offset);
+    // read_file / write_file с offset; позиция дескриптора затем возвращается на место
+    int64_t transfer_with_cursor(uint32_t handle_id, const FsIoVec *iov, size_t iov_count, uint64_t offset,
+                                 bool write);
+
+    // --- Общие кластеры --- //
+    // перед изменением общего кластера в буфере подставляет на его место в цепочке собственную копию
+    bool unshare_buffered_cluster(FileSystem::FileHandle &handle) const;
+    // кластер из индекса с тем же содержимым, что data; exclude - кластер, который не рассматривается
+    [[nodiscard]] std::optional<uint32_t> find_duplicate(const char *data, uint32_t checksum, uint32_t exclude) const;
+    // записанный кластер становится кандидатом для дедупликации
+    bool track_cluster(uint32_t cluster_idx, uint32_t checksum) const;
+    // заменяет кластер node (следующий после previous) ссылкой на target; first_node - первый узел цепочки,
+    // меняется, если node был первым; возвращает ссылку
+    std::optional<uint32_t> share_node(uint32_t previous, uint32_t node, uint32_t target, uint32_t &first_node) const;
+
+    // --- Клоны и снимки --- //
+    // подключает том; read_only - не помечать том смонтированным и ничего не записывать
+    bool mount_volume(const std::string &volume_path, bool read_only);
+    // сообщает об ошибке, если смонтирован снимок
+    bool check_writable() const;
+    // переносит в цепочки и записи каталогов несохранённые данные открытых дескрипторов
+    bool sync_open_files();
+    // выделяет и очищает кластер нового каталога в группе group
+    std::optional<uint32_t> new_directory_cluster(uint32_t group) const;
+    // цепочка с теми же данными, что у файла: кластеры становятся общими, кластеры сжатых файлов копируются
+    std::optional<uint32_t> clone_chain(const FileSystem::DirectoryEntry &entry) const;
+    // цепочка с копией данных файла: дыры остаются дырами, кластеры (свои и общие) копируются
+    std::optional<uint32_t> copy_chain(const FileSystem::DirectoryEntry &entry) const;
+    // выделяет count кластеров как можно меньшим числом непрерывных участков
+    std::optional<std::vector<uint32_t>> allocate_extents(uint32_t count) const;
+    // клонирует содержимое каталога src в пустой каталог dst
+    bool clone_directory(uint32_t src_dir_cluster, uint32_t dst_dir_cluster) const;
+    // освобождает каталог вместе со всем содержимым
+    bool free_directory_tree(uint32_t dir_cluster) const;
+    // освобождает цепочку в FAT и кластеры без оставшихся ссылок в битовой карте
+    bool release_chain(uint32_t first_node) const;
+
+    // --- Сжатые файлы --- //
+    // строит индекс групп по цепочке файла
+    bool build_group_index(FileSystem::FileHandle &handle) const;
+    // кластеры с данными группы по порядку
+    std::optional<std::vector<uint32_t>> group_clusters(const FileSystem::CompressedGroup &group) const;
+    // загружает группу в group_buffer (сначала сохраняет изменённую); группа за концом цепочки читается нулями
+    bool load_group(FileSystem::FileHandle &handle, uint32_t group) const;
+    // сжимает изменённую группу из group_buffer и перестраивает её участок цепочки
+    bool store_group(FileSystem::FileHandle &handle) const;
+    // дополняет цепочку группами до group: последняя группа доводится до полной длины, промежуток - нулевыми группами
+    bool extend_groups(FileSystem::FileHandle &handle, uint32_t group) const;
+    int64_t read_compressed(FileSystem::FileHandle &handle, char *buffer, uint64_t bytes_to_read) const;
+    int64_t write_compressed(FileSystem::FileHandle &handle, const char *user_buffer, uint64_t bytes_to_write) const;
+
+    // распределяет metadata_cache_bytes_ между FAT, битовой картой, таблицей сумм и индексом дедупликации
+    void apply_metadata_cache_budget();
+    // записывает изменённые страницы FAT, битовой карты, индекса дедупликации и таблицы сумм на диск
+    bool flush_metadata() const;
+
     // Получить начальный кластер каталога (для плоской ФС всегда корневой)
     uint32_t get_containing_directory_cluster(const std::string &path_ignored_for_flat_fs) const;
 
+    // количество непрерывных участков в цепочке
+    static uint32_t count_extents(const std::list<uint32_t> &chain);
+
     // Валидация кластеров
     bool is_valid_cluster(uint32_t cluster_idx) const;
+    // у файла есть цепочка (первый узел - кластер или дыра)
+    static bool has_chain(uint32_t first_node);
 
     struct OpenMode {
         bool read = false;
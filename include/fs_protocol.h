@@ -0,0 +1,79 @@
+#ifndef FS_PROTOCOL_H
+#define FS_PROTOCOL_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Двоичный протокол сервера файловой системы (FsServer <-> FsClient) поверх потокового Unix-сокета.
+// Клиент шлёт запросы подряд, не дожидаясь ответов; сервер выполняет их по порядку и отвечает в том же порядке.
+// Запрос: Request, затем name_length байт имени (OPEN: "путь\0режим") и для WRITE/PWRITE без FLAG_SHARED -
+// length байт данных. Ответ: Reply и payload_length байт (данные READ/PREAD без FLAG_SHARED, записи LIST).
+// Крупные данные передаются через общую память клиента (memfd, передаётся в ответе на HELLO):
+// запрос с FLAG_SHARED указывает участок [shared_offset, shared_offset + length).
+// Все поля - в порядке байтов хоста: клиент и сервер работают на одной машине.
+namespace FsProtocol {
+    constexpr uint32_t MAGIC = 0x50525346; // "FSRP"
+    constexpr uint32_t VERSION = 1;
+
+    constexpr uint64_t SHARED_BUFFER_BYTES = 8 * 1024 * 1024; // общая память одного клиента
+    constexpr uint64_t INLINE_PAYLOAD_MAX = 4096; // данные до 4 Кб идут в сокете вместе с запросом
+    constexpr uint64_t MAX_MESSAGE_PAYLOAD = 1024 * 1024; // предел данных в сокете на один запрос или ответ
+    constexpr uint32_t MAX_NAME_LENGTH = 1024; // предел имени в запросе
+    constexpr size_t BATCH_BYTES = 64 * 1024; // клиент копит мелкие запросы до стольких байт и шлёт одной записью
+    constexpr size_t LIST_PAGE_BYTES = 64 * 1024; // записей LIST в одном ответе - не больше стольких байт
+
+    enum class Opcode : uint8_t {
+        HELLO = 1, // offset = MAGIC, length = VERSION; result - размер общей памяти (0 - её нет), fd - в SCM_RIGHTS
+        OPEN, // имя "путь\0режим"; result - дескриптор
+        CLOSE,
+        READ, // length байт с текущей позиции; result - прочитано
+        WRITE,
+        PREAD, // length байт с offset
+        PWRITE,
+        SEEK, // offset, length = whence (FS_SEEK_*); result - новая позиция
+        LIST, // имя - путь каталога, offset - позиция курсора (0 - начало); result - позиция продолжения
+        REMOVE, // имя - путь файла
+    };
+
+    constexpr uint8_t FLAG_SHARED = 1; // данные лежат в общей памяти
+    constexpr uint8_t FLAG_MORE = 2; // ответ LIST: каталог прочитан не до конца
+
+    struct Request {
+        uint32_t id; // номер запроса, повторяется в ответе
+        Opcode opcode;
+        uint8_t flags;
+        uint16_t name_length;
+        uint32_t handle;
+        uint32_t shared_offset;
+        uint64_t offset;
+        uint64_t length;
+    };
+    static_assert(sizeof(Request) == 32, "Request layout is part of the protocol");
+
+    struct Reply {
+        uint32_t id;
+        int32_t status; // 0 - успех, -1 - ошибка
+        int64_t result;
+        uint32_t payload_length;
+        uint8_t flags;
+        uint8_t reserved[3];
+    };
+    static_assert(sizeof(Reply) == 24, "Reply layout is part of the protocol");
+
+    // запись каталога в ответе LIST, за ней name_length байт имени
+    struct ListEntry {
+        uint8_t type; // FileSystem::EntityType
+        uint8_t name_length;
+        uint16_t reserved;
+        uint32_t size_bytes;
+    };
+    static_assert(sizeof(ListEntry) == 8, "ListEntry layout is part of the protocol");
+
+    // данные запроса, идущие в сокете после имени
+    inline uint64_t inline_request_payload(const Request &request) {
+        const bool carries_data = request.opcode == Opcode::WRITE || request.opcode == Opcode::PWRITE;
+        return carries_data && !(request.flags & FLAG_SHARED) ? request.length : 0;
+    }
+}
+
+#endif //FS_PROTOCOL_H
@@ -0,0 +1,82 @@
+#ifndef FS_SERVER_H
+#define FS_SERVER_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "fs_core.h"
+#include "fs_protocol.h"
+
+// Сервер файловой системы: один смонтированный том (и его кэши) обслуживает несколько процессов-клиентов
+// через Unix-сокет по протоколу из fs_protocol.h.
+// Один поток опрашивает все соединения (poll): запросы, пришедшие одним чтением, выполняются подряд,
+// а ответы на них уходят одной записью. Дескрипторы файлов принадлежат соединению и закрываются при его разрыве.
+class FsServer {
+public:
+    struct Stats {
+        uint64_t clients_accepted = 0;
+        uint64_t requests = 0; // выполненные запросы
+        uint64_t batches = 0; // чтения из сокетов, принёсшие хотя бы один запрос
+        uint64_t inline_bytes = 0; // данные, переданные в сокете
+        uint64_t shared_bytes = 0; // данные, переданные через общую память
+    };
+
+    explicit FsServer(FileSystemCore &fs_core);
+    ~FsServer();
+
+    // создаёт сокет по socket_path; оставшийся от прошлого запуска сокет удаляется
+    bool listen(const std::string &socket_path);
+    // обслуживает клиентов, пока не вызван stop(); false - ошибка опроса сокетов
+    bool run();
+    // просит run() завершиться; можно вызывать из обработчика сигнала
+    void stop() { stop_requested_ = true; }
+
+    [[nodiscard]] Stats stats() const { return stats_; }
+
+private:
+    struct Client {
+        int fd = -1;
+        bool greeted = false; // получен HELLO
+        int shared_fd = -1; // memfd общей памяти
+        char *shared = nullptr;
+        uint64_t shared_bytes = 0;
+        std::vector<char> input; // принятые, ещё не выполненные запросы
+        std::vector<char> output; // ответы, ещё не отправленные
+        size_t output_sent = 0;
+        std::unordered_set<uint32_t> handles; // открытые этим клиентом файлы
+        bool closed = false;
+    };
+
+    FileSystemCore &fs_core_; // ссылка на ядро файловой системы
+    int listen_fd_ = -1;
+    std::string socket_path_;
+    std::vector<std::unique_ptr<Client>> clients_;
+    std::atomic<bool> stop_requested_{false};
+    Stats stats_;
+    std::vector<char> receive_chunk_; // буфер одного чтения из сокета, общий для всех клиентов
+
+    void accept_clients();
+    // читает порцию запросов и выполняет все пришедшие целиком; false - соединение закрыто
+    bool receive(Client &client);
+    // выполняет накопленные запросы, пока ответов не слишком много; false - нарушение протокола
+    bool process_requests(Client &client);
+    // отправляет сколько примет сокет; false - соединение разорвано
+    bool send_pending(Client &client);
+    void execute(Client &client, const FsProtocol::Request &request, const std::string &name, const char *payload);
+    // HELLO: создаёт общую память клиента и передаёт её дескриптор вместе с ответом
+    bool greet(Client &client, const FsProtocol::Request &request);
+    void list_directory(Client &client, const FsProtocol::Request &request, const std::string &path);
+    // участок общей памяти из запроса; nullptr - выходит за её пределы
+    [[nodiscard]] char *shared_range(const Client &client, const FsProtocol::Request &request) const;
+    // дописывает ответ; payload_length байт данных вызывающий дописывает сам
+    static void append_reply(Client &client, const FsProtocol::Request &request, int64_t result,
+                             uint8_t flags = 0, uint32_t payload_length = 0);
+    static void append_error(Client &client, const FsProtocol::Request &request);
+    void disconnect(Client &client);
+};
+
+#endif //FS_SERVER_H
@@ -0,0 +1,124 @@
+#ifndef FS_TRACE_H
+#define FS_TRACE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+// Двоичная трасса вызовов FileSystemCore: заголовок файла TraceHeader, затем записи Record,
+// за каждой - path_length байт пути и second_length байт второго аргумента (новый путь rename/clone/copy,
+// режим open, префикс opendir). Данные операций не записываются: трасса повторяет нагрузку, а не содержимое файлов.
+// Все поля - в порядке байтов хоста.
+namespace FsTrace {
+    constexpr uint64_t MAGIC = 0x3145434152545346; // "FSTRACE1"
+    constexpr uint32_t VERSION = 1;
+    constexpr size_t WRITE_BUFFER_BYTES = 1024 * 1024; // записи копятся в памяти и сбрасываются в файл порциями
+
+    enum class Op : uint8_t {
+        OPEN = 1, // result - дескриптор; size - размер файла после открытия
+        CLOSE,
+        READ, // offset - позиция дескриптора до вызова; result - прочитано
+        WRITE,
+        PREAD,
+        PWRITE,
+        PREADV, // size - сумма длин сегментов, segments - их количество
+        PWRITEV,
+        READV,
+        WRITEV,
+        SEEK, // whence - FS_SEEK_*; result - 1 (успех) или 0
+        REMOVE,
+        RENAME,
+        MKDIR,
+        RMDIR,
+        LIST, // result - количество записей, -1 - ошибка
+        CLONE,
+        COPY,
+        OPENDIR, // offset - начальная позиция курсора, второй аргумент - префикс имён; result - номер курсора
+        READDIR, // handle - номер курсора; result - 1 (запись прочитана) или 0
+        CLOSEDIR,
+    };
+    constexpr uint8_t OP_COUNT = static_cast<uint8_t>(Op::CLOSEDIR) + 1;
+
+    const char *op_name(Op op);
+
+    struct TraceHeader {
+        uint64_t magic;
+        uint32_t version;
+        uint32_t record_bytes; // sizeof(Record) записавшей программы
+    };
+    static_assert(sizeof(TraceHeader) == 16, "TraceHeader layout is part of the trace format");
+
+    struct Record {
+        Op op = Op::OPEN;
+        uint8_t whence = 0;
+        uint16_t path_length = 0;
+        uint16_t second_length = 0;
+        uint16_t reserved = 0;
+        uint32_t handle = 0;
+        uint32_t segments = 0;
+        uint64_t offset = 0;
+        uint64_t size = 0;
+        int64_t result = 0; // число байт, дескриптор или количество записей; для bool - 1 или 0; -1 - ошибка
+        uint64_t start_ns = 0; // от начала записи трассы
+        uint64_t latency_ns = 0;
+    };
+    static_assert(sizeof(Record) == 56, "Record layout is part of the trace format");
+
+    // запись трассы; вызовы из разных потоков сериализуются внутри
+    class TraceWriter {
+    public:
+        TraceWriter() = default;
+        ~TraceWriter() { close(); }
+        TraceWriter(const TraceWriter &) = delete;
+        TraceWriter &operator=(const TraceWriter &) = delete;
+
+        // создаёт файл трассы (существующий перезаписывается) и начинает отсчёт времени
+        bool open(const std::string &path);
+        // дописывает оставшиеся записи и закрывает файл; false - запись в файл не удалась
+        bool close();
+        [[nodiscard]] bool active() const { return active_.load(std::memory_order_relaxed); }
+        // наносекунды от open()
+        [[nodiscard]] uint64_t now_ns() const;
+
+        void record(Record record, const std::string &path, const std::string &second = {});
+        [[nodiscard]] uint64_t records() const;
+
+    private:
+        mutable std::mutex mutex_;
+        std::atomic<bool> active_{false};
+        std::ofstream file_;
+        std::vector<char> buffer_;
+        std::chrono::steady_clock::time_point started_;
+        uint64_t records_ = 0;
+        bool failed_ = false;
+
+        void flush_buffer();
+    };
+
+    struct Entry {
+        Record record;
+        std::string path;
+        std::string second;
+    };
+
+    // последовательное чтение трассы
+    class TraceReader {
+    public:
+        // проверяет заголовок; false - файла нет или это не трасса этой версии
+        bool open(const std::string &path);
+        // следующая запись; nullopt - конец трассы (или обрезанная запись, см. truncated())
+        std::optional<Entry> next();
+        [[nodiscard]] bool truncated() const { return truncated_; }
+
+    private:
+        std::ifstream file_;
+        bool truncated_ = false;
+    };
+}
+
+#endif //FS_TRACE_H
@@ -0,0 +1,89 @@
+#ifndef HANDLE_TABLE_H
+#define HANDLE_TABLE_H
+
+#include <cstdint>
+#include <cstddef>
+#include <deque>
+#include <iterator>
+#include <optional>
+
+#include "file_system_config.h"
+
+// Таблица открытых файлов: массив слотов с поколениями.
+// ID дескриптора - номер слота в младших SLOT_BITS битах и поколение слота в старших; поиск по ID - обращение
+// к слоту по индексу. При освобождении слота поколение увеличивается, поэтому ID закрытого дескриптора
+// не находит дескриптор, открытый позже в том же слоте. Освободившиеся слоты переиспользуются по очереди,
+// чтобы поколение одного слота не перебиралось быстро.
+class HandleTable {
+    struct Slot {
+        FileSystem::FileHandle handle;
+        uint32_t generation = 1; // поколение текущего или следующего дескриптора в слоте
+        bool in_use = false;
+    };
+
+public:
+    static constexpr uint32_t SLOT_BITS = 20;
+    static constexpr uint32_t MAX_HANDLES = 1u << SLOT_BITS; // одновременно открытых дескрипторов
+    static constexpr uint32_t GENERATION_MASK = (1u << (32 - SLOT_BITS)) - 1;
+
+    // обход занятых слотов
+    template<typename SlotIt, typename Handle>
+    class basic_iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = FileSystem::FileHandle;
+        using difference_type = std::ptrdiff_t;
+        using pointer = Handle *;
+        using reference = Handle &;
+
+        basic_iterator(SlotIt it, SlotIt end): it_(it), end_(end) { skip_free(); }
+        Handle &operator*() const { return it_->handle; }
+        Handle *operator->() const { return &it_->handle; }
+        basic_iterator &operator++() {
+            ++it_;
+            skip_free();
+            return *this;
+        }
+        bool operator==(const basic_iterator &other) const { return it_ == other.it_; }
+        bool operator!=(const basic_iterator &other) const { return it_ != other.it_; }
+
+    private:
+        void skip_free() {
+            while (it_ != end_ && !it_->in_use) ++it_;
+        }
+
+        SlotIt it_;
+        SlotIt end_;
+    };
+
+    using iterator = basic_iterator<std::deque<Slot>::iterator, FileSystem::FileHandle>;
+    using const_iterator = basic_iterator<std::deque<Slot>::const_iterator, const FileSystem::FileHandle>;
+
+    // занимает слот и присваивает дескриптору handle_id; nullopt - таблица заполнена
+    std::optional<uint32_t> insert(FileSystem::FileHandle &&handle);
+    // дескриптор по ID; nullptr - ID не выдавался или дескриптор уже закрыт
+    [[nodiscard]] FileSystem::FileHandle *find(uint32_t handle_id);
+    [[nodiscard]] const FileSystem::FileHandle *find(uint32_t handle_id) const;
+    // освобождает слот; буфер дескриптора должен быть уже возвращён владельцу
+    bool erase(uint32_t handle_id);
+    void clear();
+
+    [[nodiscard]] size_t size() const { return size_; }
+    [[nodiscard]] bool empty() const { return size_ == 0; }
+
+    iterator begin() { return {slots_.begin(), slots_.end()}; }
+    iterator end() { return {slots_.end(), slots_.end()}; }
+    [[nodiscard]] const_iterator begin() const { return {slots_.begin(), slots_.end()}; }
+    [[nodiscard]] const_iterator end() const { return {slots_.end(), slots_.end()}; }
+
+private:
+    std::deque<Slot> slots_; // deque: ссылки на дескрипторы остаются действительными при росте таблицы
+    std::deque<uint32_t> free_slots_; // освободившиеся слоты в порядке освобождения
+    size_t size_ = 0;
+
+    [[nodiscard]] static uint32_t make_id(const uint32_t slot, const uint32_t generation) {
+        return generation << SLOT_BITS | slot;
+    }
+};
+
+#endif //HANDLE_TABLE_H
@@ -0,0 +1,22 @@
+#ifndef LZ_CODEC_H
+#define LZ_CODEC_H
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+
+// Быстрый кодек семейства LZ77 для сжатых групп кластеров.
+// Формат блока совпадает с блочным форматом LZ4: последовательности "литералы + совпадение",
+// смещение совпадения до 65535 байт, последние 5 байт блока всегда литералы.
+namespace lz_codec {
+    // размер сжатых данных в худшем случае (несжимаемый вход)
+    constexpr size_t max_compressed_size(const size_t size) { return size + size / 255 + 16; }
+
+    // сжимает size байт src в dst; 0 - результат не помещается в dst_capacity
+    size_t compress(const void *src, size_t size, void *dst, size_t dst_capacity);
+
+    // распаковывает блок размером size; nullopt - блок повреждён или не помещается в dst_capacity
+    std::optional<size_t> decompress(const void *src, size_t size, void *dst, size_t dst_capacity);
+}
+
+#endif //LZ_CODEC_H
@@ -0,0 +1,90 @@
+#ifndef METADATA_CACHE_H
+#define METADATA_CACHE_H
+
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "buffer_pool.h"
+
+class VolumeManager;
+
+// Страничный кэш области метаданных (FAT, битовая карта, таблица контрольных сумм).
+// Страница - один кластер области; страницы загружаются с диска по требованию,
+// при превышении лимита вытесняется давно не использованная страница (грязная предварительно записывается на диск).
+// Таблица страниц защищена замком кэша; потоки, обращающиеся к кэшу одновременно, берут страницу через lock_page().
+class MetadataCache {
+public:
+    struct Stats {
+        size_t resident_pages = 0; // страниц в памяти
+        size_t max_resident_pages = 0; // лимит страниц в памяти
+        uint32_t total_pages = 0; // страниц в области
+        uint64_t hits = 0; // обращения к загруженным страницам
+        uint64_t misses = 0; // загрузки страниц с диска
+        uint64_t writebacks = 0; // записи грязных страниц на диск
+    };
+
+    // страница под замком кэша: пока объект жив, другие потоки не обращаются к кэшу и страница не вытесняется
+    class LockedPage {
+    public:
+        [[nodiscard]] char *data() const { return data_; }
+        explicit operator bool() const { return data_ != nullptr; }
+
+    private:
+        friend class MetadataCache;
+        std::unique_lock<std::mutex> lock_;
+        char *data_ = nullptr;
+    };
+
+    MetadataCache(VolumeManager &vol_manager, uint32_t region_start_cluster, uint32_t region_cluster_count,
+                  size_t max_resident_pages);
+
+    // указатель на данные страницы только для чтения; nullptr при ошибке
+    // действителен до следующего обращения к кэшу из любого потока
+    const char *get_page(uint32_t page_idx);
+    // указатель на данные страницы для изменения, страница помечается грязной; nullptr при ошибке
+    char *get_page_for_write(uint32_t page_idx);
+    // страница под замком кэша (for_write - страница помечается грязной); пустой объект при ошибке.
+    // Пока объект жив, этот поток не должен обращаться к тому же кэшу
+    LockedPage lock_page(uint32_t page_idx, bool for_write);
+
+    // записывает на диск все грязные страницы
+    bool flush();
+    // сбрасывает все страницы без записи на диск
+    void drop();
+
+    void set_max_resident_pages(size_t max_resident_pages);
+    [[nodiscard]] uint32_t page_count() const { return region_cluster_count_; }
+    [[nodiscard]] uint32_t page_size() const { return page_size_; }
+    [[nodiscard]] Stats stats() const;
+
+private:
+    struct Page {
+        BufferPool::Lease data; // выровненный буфер из пула тома
+        bool dirty = false;
+        std::list<uint32_t>::iterator lru_position; // позиция в списке LRU
+    };
+
+    VolumeManager &vol_manager_; // ссылка на менеджер тома
+    uint32_t region_start_cluster_; // первый кластер области на диске
+    uint32_t region_cluster_count_; // количество кластеров области
+    uint32_t page_size_; // размер страницы == размер кластера
+    size_t max_resident_pages_; // лимит страниц в памяти (не меньше 1)
+
+    std::unordered_map<uint32_t, Page> pages_; // загруженные страницы
+    std::list<uint32_t> lru_; // порядок использования, в начале - самая свежая страница
+    Stats stats_;
+    // последняя выданная страница: повторные обращения к ней не ищутся в таблице и не двигают LRU
+    uint32_t last_page_idx_ = 0;
+    Page *last_page_ = nullptr;
+    mutable std::mutex mutex_; // таблица страниц, LRU и статистика
+
+    Page *load_page(uint32_t page_idx);
+    bool write_back(uint32_t page_idx, Page &page);
+    // вытесняет страницы, пока их количество превышает limit
+    bool evict_until(size_t limit);
+};
+
+#endif //METADATA_CACHE_H
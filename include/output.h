@@ -14,18 +14,28 @@ namespace output {
         constexpr auto FAT_MANAGER_ERROR = "FATManager Error: ";
         constexpr auto VOLUME_MANAGER_ERROR = "VolumeManager Error: ";
         constexpr auto FILE_SYSTEM_CORE_ERROR = "FileSystemCore Error: ";
+        constexpr auto CONSISTENCY_CHECKER_ERROR = "ConsistencyChecker Error: ";
+        constexpr auto DEFRAGMENTER_ERROR = "Defragmenter Error: ";
+        constexpr auto METADATA_CACHE_ERROR = "MetadataCache Error: ";
+        constexpr auto DEDUP_INDEX_ERROR = "DedupIndex Error: ";
+        constexpr auto FS_SERVER_ERROR = "FsServer Error: ";
+        constexpr auto FS_CLIENT_ERROR = "FsClient Error: ";
+        constexpr auto FS_TRACE_ERROR = "FsTrace Error: ";
 
         constexpr auto DIRECTORY_MANAGER = "DirectoryManager: ";
         constexpr auto BITMAP_MANAGER = "BitmapManager: ";
         constexpr auto FAT_MANAGER = "FATManager: ";
         constexpr auto VOLUME_MANAGER = "VolumeManager: ";
         constexpr auto FILE_SYSTEM_CORE = "FileSystemCore: ";
+        constexpr auto FS_SERVER = "FsServer: ";
 
         constexpr auto DIRECTORY_MANAGER_WARNING = "DirectoryManager Warning: ";
         constexpr auto BITMAP_MANAGER_WARNING = "BitmapManager Warning: ";
         constexpr auto FAT_MANAGER_WARNING = "FATManager Warning: ";
         constexpr auto VOLUME_MANAGER_WARNING = "VolumeManager Warning: ";
         constexpr auto FILE_SYSTEM_CORE_WARNING = "FileSystemCore Warning: ";
+        constexpr auto DEFRAGMENTER_WARNING = "Defragmenter Warning: ";
+        constexpr auto FS_SERVER_WARNING = "FsServer Warning: ";
     }
 
     namespace colors {
@@ -1,9 +1,17 @@
 #ifndef VOLUME_MANAGER_H
 #define VOLUME_MANAGER_H
 
+#include "buffer_pool.h"
 #include "file_system_config.h"
+#include "metadata_cache.h"
+#include <atomic>
 #include <fstream>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <string>
+#include <thread>
+#include <vector>
 
 class VolumeManager {
 public:
@@ -11,39 +19,210 @@ public:
     ~VolumeManager();
 
     // создание и форматирования нового тома
-    bool create_and_format(const std::string& volume_path, uint64_t volume_size_bytes, FileSystem::Header& out_header);
+    // preallocate - выделить место под весь образ сразу (иначе образ разреженный)
+    bool create_and_format(const std::string& volume_path, uint64_t volume_size_bytes, FileSystem::Header& out_header,
+                           bool preallocate = false);
 
-    // загрузка существующего тома
+    // загрузка существующего тома; образы чередующегося или зеркального тома открываются по путям из таблицы
+    // в заголовке. Без части копий зеркала том работает в деградированном режиме
     bool load_volume(const std::string& volume_path);
 
-    // читает кластер в указанный буфер
+    // --- Чередование и зеркалирование по нескольким образам --- //
+    // следующий форматируемый том раскладывается по основному образу и member_paths (всего не больше
+    // MAX_VOLUME_IMAGES) полосами по width_clusters кластеров; пустой список - том из одного образа.
+    // Крупные запросы чтения и записи выполняются во всех образах параллельно
+    bool set_stripe_layout(const std::vector<std::string>& member_paths, uint32_t width_clusters);
+    // следующий форматируемый том хранится в основном образе и в копиях mirror_paths: запись идёт во все копии,
+    // чтение - в копию с наименьшим временем ответа, крупное чтение делится между копиями
+    bool set_mirror_layout(const std::vector<std::string>& mirror_paths);
+    [[nodiscard]] uint32_t image_count() const { return 1 + static_cast<uint32_t>(members_.size()); }
+    [[nodiscard]] std::vector<std::string> image_paths() const; // пути всех образов, первым - основной
+
+    struct ImageStats {
+        bool online = true; // образ открыт (копия зеркала может отсутствовать)
+        uint64_t reads = 0; // выполненные участки чтения
+        uint64_t read_bytes = 0;
+        double service_us = 0; // скользящее среднее времени чтения одного кластера, мкс
+        uint64_t last_read = 0; // номер последнего чтения тома, обслуженного образом
+    };
+    [[nodiscard]] std::vector<ImageStats> image_stats() const { return image_stats_; }
+    // копии зеркала синхронизируются в фоне после аварийного завершения
+    [[nodiscard]] bool mirror_resync_active() const { return resync_active_; }
+    [[nodiscard]] bool mirror_degraded() const { return degraded_; } // часть копий зеркала недоступна
+
+    // читает кластер в указанный буфер; при несовпадении контрольной суммы возвращает false
     // размер buffer должен быть >= FileSystem::CLUSTER_SIZE_BYTES
     bool read_cluster(uint32_t cluster_idx, char* buffer) const;
 
-    // записывает данные из буфера в определённый кластер
+    // записывает данные из буфера в определённый кластер и обновляет его контрольную сумму
     // размер буфера == FileSystem::CLUSTER_SIZE_BYTES
     bool write_cluster(uint32_t cluster_idx, const char* buffer) const;
+    // write_cluster в разные кластеры можно вызывать из нескольких потоков одновременно; у зеркального тома
+    // нельзя - запись в копии выполняют их потоки по одному заданию
+    [[nodiscard]] bool parallel_writes_supported() const { return is_open() && !mirrored(); }
+
+    // читает cluster_count подряд идущих кластеров одной операцией
+    // размер buffer должен быть >= cluster_count * FileSystem::CLUSTER_SIZE_BYTES
+    bool read_clusters(uint32_t first_cluster_idx, uint32_t cluster_count, char* buffer) const;
+
+    // записывает cluster_count подряд идущих кластеров одной операцией
+    bool write_clusters(uint32_t first_cluster_idx, uint32_t cluster_count, const char* buffer) const;
+
+    // копирует cluster_count кластеров внутри образа вместе с их контрольными суммами; данные переносит ядро
+    // (copy_file_range), без него - чтение и запись частями через промежуточный буфер; диапазоны не пересекаются
+    bool copy_clusters(uint32_t src_first_cluster_idx, uint32_t dst_first_cluster_idx, uint32_t cluster_count) const;
+
+    // просит хост заранее прочитать кластеры в страничный кэш (posix_fadvise); с O_DIRECT кэш хоста не используется,
+    // и подсказка не даётся
+    void prefetch_clusters(uint32_t first_cluster_idx, uint32_t cluster_count) const;
+
+    // --- Контрольные суммы кластеров --- //
+    // том ведёт таблицу контрольных сумм
+    [[nodiscard]] bool checksums_supported() const { return checksum_cache_ != nullptr; }
+    // проверять суммы при чтении (включено по умолчанию)
+    void set_checksum_verification(bool enabled) { verify_checksums_ = enabled; }
+    // совпадает ли содержимое кластера с записанной суммой; true, если сумма не записана или не ведётся
+    [[nodiscard]] bool checksum_matches(uint32_t cluster_idx, const char* buffer) const;
+    // записывает сумму для указанного содержимого кластера
+    bool seal_checksum(uint32_t cluster_idx, const char* buffer) const;
+    // записывает изменённые страницы таблицы сумм на диск
+    bool flush_checksums() const;
+    // лимит страниц таблицы сумм в памяти
+    void set_checksum_cache_pages(size_t max_resident_pages);
+    [[nodiscard]] MetadataCache::Stats checksum_cache_stats() const;
+
+    // --- Прямой ввод-вывод --- //
+    // ввод-вывод с O_DIRECT в обход страничного кэша хоста; применяется при следующем открытии или форматировании тома,
+    // если файловая система хоста его не поддерживает, том работает через поток
+    void set_direct_io(bool enabled) { direct_io_requested_ = enabled; }
+    [[nodiscard]] bool direct_io() const { return direct_fd_ >= 0; }
+    // выровненный буфер размером в кластер; возвращается в пул тома при разрушении аренды
+    // буферы из пула передаются в O_DIRECT без промежуточного копирования
+    [[nodiscard]] BufferPool::Lease lease_cluster_buffer() const { return cluster_arena_.lease(); }
+    [[nodiscard]] BufferPool::Stats cluster_arena_stats() const { return cluster_arena_.stats(); }
+
+    // освобождает место под кластерами в файле-образе (дыра читается как нули); false, если не поддерживается
+    bool punch_holes(uint32_t first_cluster_idx, uint32_t cluster_count) const;
+    // фактически занятое образом место на диске хоста
+    std::optional<uint64_t> get_allocated_bytes() const;
 
     const FileSystem::Header& get_header() const; // получить суперблок; константный доступ
+    bool update_header(const FileSystem::Header& header); // записать изменённый суперблок на диск
 
     bool is_open() const; // проверка открыт ли том
 
     void close_volume(); // закрыть том
 
-    // получить смещение кластера
+    // получить смещение кластера в его образе
     std::optional<uint64_t> get_cluster_offset(uint32_t cluster_idx) const;
     uint32_t get_cluster_size() const;
 
 private:
+    struct ImageMember; // дополнительный образ (полосы или копия зеркала) со своим потоком ввода-вывода
+
+    // непрерывный участок запроса в одном образе
+    struct ImagePiece {
+        uint32_t member; // 0 - основной образ
+        std::streamoff offset; // смещение в образе
+        size_t buffer_offset; // смещение в буфере запроса
+        std::streamsize bytes;
+    };
 
     mutable std::fstream volume_stream_;
+    int volume_fd_ = -1; // дескриптор того же файла для fallocate/fstat и ввода-вывода без O_DIRECT
     FileSystem::Header header_cache_{}; // кэш заголовка
     std::string current_volume_path_; // текущий путь к файлу-тому
     bool is_volume_loaded_ = false; // загружен ли том
+    int direct_fd_ = -1; // дескриптор с O_DIRECT; -1 - ввод-вывод идёт через volume_fd_
+    bool direct_io_requested_ = false; // открывать direct_fd_ при подключении тома
+
+    // пулы объявлены до кэша таблицы сумм: его страницы возвращаются в cluster_arena_ при разрушении
+    mutable BufferPool cluster_arena_; // кластерные буферы для метаданных, каталогов и заголовка
+    mutable BufferPool bounce_arena_; // промежуточные буферы O_DIRECT для невыровненных буферов вызывающего
+
+    std::unique_ptr<MetadataCache> checksum_cache_; // страницы таблицы контрольных сумм, nullptr - таблицы нет
+    // лимит страниц таблицы сумм, применяемый при подключении
+    size_t checksum_cache_pages_ = FileSystem::DEFAULT_METADATA_CACHE_BYTES / FileSystem::CLUSTER_SIZE_BYTES;
+    bool verify_checksums_ = true; // проверять суммы при чтении
+
+    std::vector<std::unique_ptr<ImageMember>> members_; // образы после основного; пусто - один образ
+    mutable std::vector<ImageStats> image_stats_; // по образу, первым - основной
+    mutable uint64_t read_sequence_ = 0; // счётчик чтений для выбора копии зеркала
+    std::vector<std::string> requested_stripe_paths_; // образы для следующего форматирования
+    uint32_t requested_stripe_width_ = FileSystem::DEFAULT_STRIPE_WIDTH_CLUSTERS;
+    std::vector<std::string> requested_mirror_paths_; // копии зеркала для следующего форматирования
+
+    mutable std::vector<uint8_t> dirty_log_; // журнал изменённых участков зеркала, DIRTY_LOG_BYTES
+    bool degraded_ = false; // часть копий зеркала недоступна: журнал не очищается до полной синхронизации
+    std::atomic<bool> resync_active_{false}; // поток синхронизации копирует отмеченные участки
+    std::atomic<bool> resync_stop_{false};
+    // участок синхронизации и запросы к тому, пока она идёт; запросы вложены (страницы сумм читаются внутри чтения)
+    mutable std::recursive_mutex resync_mutex_;
+    std::thread resync_thread_;
+
+    // создаёт кэш страниц таблицы сумм из заголовка
+    void attach_checksums();
+    // ведётся ли сумма для кластера (заголовок и сама таблица не покрываются)
+    [[nodiscard]] bool is_checksummed(uint32_t cluster_idx) const;
+    [[nodiscard]] std::optional<uint32_t> stored_checksum(uint32_t cluster_idx) const;
+    bool store_checksum(uint32_t cluster_idx, uint32_t checksum) const;
+    // сверяет прочитанные кластеры с таблицей; false и сообщение об ошибке при несовпадении
+    bool verify_clusters(uint32_t first_cluster_idx, uint32_t cluster_count, const char* buffer) const;
+    // обновляет суммы записанных кластеров
+    bool store_checksums(uint32_t first_cluster_idx, uint32_t cluster_count, const char* buffer) const;
+    // CRC32C кластера; значение CHECKSUM_NONE заменяется, чтобы не совпасть с пометкой "сумма не записана"
+    static uint32_t cluster_checksum(const char* buffer, uint32_t cluster_size);
+    // CRC32C заголовка с обнулённым полем header_checksum
+    static uint32_t header_checksum(const FileSystem::Header& header);
 
+    bool open_native_handle(); // открыть volume_fd_ для current_volume_path_
+    void open_direct_handle(); // открыть direct_fd_, если запрошен прямой ввод-вывод
+    // открыть дополнительные образы и запустить их потоки; create - создать образы размером image_bytes,
+    // иначе размер существующих сверяется с image_bytes; без required недоступный образ остаётся закрытым
+    bool open_members(const std::vector<std::string>& paths, uint64_t image_bytes, bool create,
+                      bool required = true);
+    [[nodiscard]] bool mirrored() const { return header_cache_.mirror_count > 1; }
+    [[nodiscard]] bool member_online(uint32_t member) const;
+    // участки, повторённые для каждой доступной копии зеркала (запись, дыры); у других томов - сами pieces
+    [[nodiscard]] std::vector<ImagePiece> replicate(const std::vector<ImagePiece>& pieces) const;
+    // участки чтения зеркала: одна копия или доли крупного чтения по скорости копий
+    [[nodiscard]] std::vector<ImagePiece> mirror_read_pieces(uint32_t first_cluster_idx, uint32_t cluster_count) const;
+    [[nodiscard]] uint32_t choose_mirror() const; // копия с наименьшим временем ответа
+    // чтение из других копий после ошибки или несовпадения суммы; исправляет остальные копии
+    bool repair_read(uint32_t first_cluster_idx, uint32_t cluster_count, char* buffer) const;
+    // отмечает участки в журнале до записи в них; новые отметки записываются в заголовок всех копий
+    bool mark_dirty(uint32_t first_cluster_idx, uint32_t cluster_count) const;
+    [[nodiscard]] bool range_dirty(uint32_t first_cluster_idx, uint32_t cluster_count) const;
+    // блокировка на время запроса, пока идёт синхронизация копий; иначе пустая
+    [[nodiscard]] std::unique_lock<std::recursive_mutex> lock_resync() const;
+    void run_resync(); // поток синхронизации копий по журналу
+    // образ и смещение кластера
+    [[nodiscard]] std::optional<std::pair<uint32_t, std::streamoff>> locate_cluster(uint32_t cluster_idx) const;
+    // разбивает диапазон кластеров на участки по образам
+    [[nodiscard]] std::vector<ImagePiece> split_range(uint32_t first_cluster_idx, uint32_t cluster_count) const;
+    // выполняет участки чтения в read_buffer или записи из write_buffer (задан один из них):
+    // каждый дополнительный образ - в своём потоке, основной - в вызывающем
+    bool transfer_pieces(const std::vector<ImagePiece>& pieces, char* read_buffer, const char* write_buffer) const;
+    [[nodiscard]] int member_fd(uint32_t member) const; // дескриптор образа для fallocate/fadvise/copy_file_range
+    // чтение и запись по смещению в образе member; основной образ - через direct_fd_ или volume_stream_
+    // read_at возвращает количество прочитанных байт (меньше bytes у конца файла), -1 при ошибке
+    std::streamsize read_at(uint32_t member, std::streamoff offset, char* buffer, std::streamsize bytes) const;
+    bool write_at(uint32_t member, std::streamoff offset, const char* buffer, std::streamsize bytes) const;
+    // копирование байтов между образами (или внутри одного) через copy_file_range; возвращает скопированное
+    // (меньше bytes, если ядро или файловая система хоста так копировать не умеют), -1 при ошибке
+    std::streamsize copy_range(uint32_t src_member, std::streamoff src_offset, uint32_t dst_member,
+                               std::streamoff dst_offset, std::streamsize bytes) const;
+    static bool preallocate_image(int fd, uint64_t image_bytes); // выделить место под весь образ
+    // заполняет таблицу образов в кластере заголовка и возвращает её CRC32C
+    uint32_t fill_image_table(char* header_cluster) const;
+    // пути образов из таблицы прочитанного кластера заголовка; nullopt - таблица повреждена
+    static std::optional<std::vector<std::string>> parse_image_table(const FileSystem::Header& header,
+                                                                      const char* header_cluster);
     static bool initialize_header(uint64_t volume_size_bytes, FileSystem::Header& header_to_fill); // инициализация заголовка, необходима при форматировании
     bool write_header_to_disk(const FileSystem::Header& header_to_write) const; // записать заголовок на диск
-    bool read_header_from_disk(FileSystem::Header& header_to_fill) const; // прочитать заголовок с диска
+    // прочитать заголовок с диска; member_paths - пути дополнительных образов из таблицы, журнал зеркала
+    // загружается в dirty_log_
+    bool read_header_from_disk(FileSystem::Header& header_to_fill, std::vector<std::string>& member_paths);
 };
 
 #endif //VOLUME_MANAGER_H
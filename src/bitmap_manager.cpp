@@ -1,43 +1,215 @@
 #include "../include/bitmap_manager.h"
 
+#include <algorithm>
 #include <iostream>
 #include <cstring>
 
 #include "../include/output.h"
 
+namespace {
+    // количество установленных битов [from_bit, to_bit) в странице битовой карты
+    uint32_t count_set_bits(const char *page, uint32_t from_bit, const uint32_t to_bit) {
+        uint32_t count = 0;
+        for (; from_bit < to_bit && from_bit % 8 != 0; ++from_bit) count += (page[from_bit / 8] >> (from_bit % 8)) & 1;
+        for (; from_bit + 8 <= to_bit; from_bit += 8) count += __builtin_popcount(static_cast<uint8_t>(page[from_bit / 8]));
+        for (; from_bit < to_bit; ++from_bit) count += (page[from_bit / 8] >> (from_bit % 8)) & 1;
+        return count;
+    }
+}
+
 BitmapManager::BitmapManager(VolumeManager &volume_manager)
-    : volume_mgr_(volume_manager), total_clusters_managed_(0),
-      bitmap_disk_start_cluster_(0), bitmap_disk_cluster_count_(0) {
+    : volume_mgr_(volume_manager), max_resident_pages_(FileSystem::DEFAULT_METADATA_CACHE_BYTES /
+                                                       FileSystem::CLUSTER_SIZE_BYTES),
+      first_free_hint_(0), free_clusters_(0), counters_valid_(false), total_clusters_managed_(0),
+      bitmap_disk_start_cluster_(0), bitmap_disk_cluster_count_(0), data_start_cluster_(0),
+      free_counts_start_cluster_(0), free_counts_cluster_count_(0) {
 }
 
-bool BitmapManager::initialize_and_flush(const FileSystem::Header &header) {
+bool BitmapManager::attach(const FileSystem::Header &header) {
     total_clusters_managed_ = header.total_clusters;
     bitmap_disk_start_cluster_ = header.bitmap_start_cluster;
     bitmap_disk_cluster_count_ = header.bitmap_size_cluster;
+    data_start_cluster_ = header.data_start_cluster;
+    free_counts_start_cluster_ = header.free_counts_start_cluster;
+    free_counts_cluster_count_ = header.free_counts_size_clusters;
+    first_free_hint_ = header.data_start_cluster;
+
+    region_count_ = (total_clusters_managed_ + FileSystem::CLUSTERS_PER_REGION - 1) / FileSystem::CLUSTERS_PER_REGION;
+    region_free_ = std::make_unique<std::atomic<uint32_t>[]>(region_count_);
+    for (uint32_t region = 0; region < region_count_; ++region) region_free_[region] = 0;
+    free_clusters_ = 0;
+    counters_valid_ = false;
+    if (free_counts_cluster_count_ != 0 &&
+        static_cast<uint64_t>(free_counts_cluster_count_) * FileSystem::CLUSTER_SIZE_BYTES <
+        static_cast<uint64_t>(region_count_) * sizeof(uint32_t)) {
+        output::err(output::prefix::BITMAP_MANAGER_ERROR) << "Free counts region is too small for " <<
+                region_count_ << " regions" << std::endl;
+        return false;
+    }
+
+    if (static_cast<uint64_t>(bitmap_disk_cluster_count_) * BITS_PER_PAGE < total_clusters_managed_) {
+        output::err(output::prefix::BITMAP_MANAGER_ERROR) << "Bitmap region (" << bitmap_disk_cluster_count_ <<
+                " clusters) is too small for " << total_clusters_managed_ << " clusters" << std::endl;
+        return false;
+    }
+    bitmap_cache_ = std::make_unique<MetadataCache>(volume_mgr_, bitmap_disk_start_cluster_,
+                                                    bitmap_disk_cluster_count_, max_resident_pages_);
+    build_groups();
+    return true;
+}
+
+void BitmapManager::build_groups() {
+    groups_.clear();
+    const uint32_t data_clusters = total_clusters_managed_ > data_start_cluster_
+                                       ? total_clusters_managed_ - data_start_cluster_
+                                       : 0;
+    // групп столько, чтобы каждая была не меньше MIN_ALLOCATION_GROUP_CLUSTERS
+    const uint32_t groups = groups_enabled_
+                                ? std::clamp<uint32_t>(data_clusters / FileSystem::MIN_ALLOCATION_GROUP_CLUSTERS, 1,
+                                                       FileSystem::MAX_ALLOCATION_GROUPS)
+                                : 1;
+    group_clusters_ = std::max<uint32_t>(1, (data_clusters + groups - 1) / groups);
+    for (uint64_t first = data_start_cluster_; first < total_clusters_managed_; first += group_clusters_) {
+        const auto end = static_cast<uint32_t>(std::min<uint64_t>(first + group_clusters_, total_clusters_managed_));
+        groups_.emplace_back(static_cast<uint32_t>(first), end);
+    }
+}
 
-    const uint32_t bitmap_size_in_bytes = (total_clusters_managed_ + 7) / 8;
-    bitmap_data_.assign(bitmap_size_in_bytes, 0);
+BitmapManager::AllocationGroup &BitmapManager::group_of(const uint32_t cluster_idx) {
+    return groups_[(cluster_idx - data_start_cluster_) / group_clusters_];
+}
 
-    for (uint32_t i = 0; i < header.header_cluster_count; ++i) {
-        if (i < total_clusters_managed_) set_bit(i);
+uint32_t BitmapManager::group_for_key(const uint32_t key) const {
+    if (groups_.size() <= 1) return 0;
+    // ключи, отличающиеся в младших битах, расходятся по разным группам
+    return static_cast<uint32_t>((static_cast<uint64_t>(key) * 0x9E3779B1u >> 16) % groups_.size());
+}
+
+std::optional<uint32_t> BitmapManager::group_free_count(const uint32_t group) {
+    if (!bitmap_cache_ || group >= groups_.size()) return std::nullopt;
+    AllocationGroup &g = groups_[group];
+    std::lock_guard lock(g.mutex);
+    return count_group_free(g);
+}
+
+std::optional<uint32_t> BitmapManager::count_group_free(AllocationGroup &group) {
+    if (group.free >= 0) return static_cast<uint32_t>(group.free);
+    uint32_t used = 0;
+    for (uint32_t from = group.first; from < group.end;) {
+        const uint32_t page_idx = from / BITS_PER_PAGE;
+        const auto page_end = static_cast<uint32_t>(
+            std::min<uint64_t>(group.end, static_cast<uint64_t>(page_idx + 1) * BITS_PER_PAGE));
+        const MetadataCache::LockedPage page = bitmap_cache_->lock_page(page_idx, false);
+        if (!page) return std::nullopt;
+        used += count_set_bits(page.data(), from % BITS_PER_PAGE, page_end - page_idx * BITS_PER_PAGE);
+        from = page_end;
+    }
+    group.free = group.end - group.first - used;
+    return static_cast<uint32_t>(group.free);
+}
+
+void BitmapManager::advance_first_free_hint(const uint32_t cluster, const uint32_t next) {
+    uint32_t expected = cluster;
+    first_free_hint_.compare_exchange_strong(expected, next);
+}
+
+std::optional<uint32_t> BitmapManager::allocate_in_group(const uint32_t group) {
+    if (groups_.size() <= 1) {
+        // одна группа на всю область: поиск идёт от общей подсказки под замком этой группы
+        std::unique_lock<std::mutex> lock;
+        if (!groups_.empty()) lock = std::unique_lock(groups_.front().mutex);
+        return find_and_allocate_free_cluster();
+    }
+    if (!volume_mgr_.is_open() || !bitmap_cache_) {
+        output::err(output::prefix::BITMAP_MANAGER_ERROR) << "Volume not open" << std::endl;
+        return std::nullopt;
+    }
+    for (uint32_t step = 0; step < groups_.size(); ++step) {
+        const uint32_t current = (group + step) % static_cast<uint32_t>(groups_.size());
+        AllocationGroup &g = groups_[current];
+        std::lock_guard lock(g.mutex);
+        const std::optional<uint32_t> free = count_group_free(g);
+        if (!free) return std::nullopt;
+        if (*free == 0) continue;
+        const std::optional<uint32_t> cluster = find_free_from(std::max(g.hint, g.first), g.end);
+        if (!cluster) continue;
+        if (!set_bit(*cluster)) {
+            output::err(output::prefix::BITMAP_MANAGER_ERROR) << "Failed to allocate cluster " << *cluster <<
+                    std::endl;
+            return std::nullopt;
+        }
+        g.hint = *cluster + 1;
+        return cluster;
+    }
+    output::warn(output::prefix::BITMAP_MANAGER_WARNING) << "No free clusters found" << std::endl;
+    return std::nullopt;
+}
+
+std::optional<uint32_t> BitmapManager::allocate_near(const uint32_t goal, const uint32_t group) {
+    if (!volume_mgr_.is_open() || !bitmap_cache_) {
+        output::err(output::prefix::BITMAP_MANAGER_ERROR) << "Volume not open" << std::endl;
+        return std::nullopt;
+    }
+    if (goal < data_start_cluster_ || goal >= total_clusters_managed_ || groups_.empty()) {
+        return allocate_in_group(group);
+    }
+    {
+        // поиск идёт только вперёд: кластеры файла остаются в порядке цепочки
+        AllocationGroup &near = group_of(goal);
+        std::lock_guard lock(near.mutex);
+        if (const std::optional<uint32_t> cluster = find_free_from(goal, near.end)) {
+            if (!set_bit(*cluster)) {
+                output::err(output::prefix::BITMAP_MANAGER_ERROR) << "Failed to allocate cluster " << *cluster <<
+                        std::endl;
+                return std::nullopt;
+            }
+            if (near.hint == *cluster) near.hint = *cluster + 1;
+            advance_first_free_hint(*cluster, *cluster + 1);
+            return cluster;
+        }
     }
+    return allocate_in_group(group);
+}
+
+uint32_t BitmapManager::group_index(const uint32_t cluster_idx) const {
+    if (cluster_idx < data_start_cluster_ || cluster_idx >= total_clusters_managed_ || groups_.empty()) return 0;
+    return (cluster_idx - data_start_cluster_) / group_clusters_;
+}
 
-    for (uint32_t i = 0; i < header.bitmap_size_cluster; ++i) {
-        if (const uint32_t cluster_idx = header.bitmap_start_cluster + i; cluster_idx < total_clusters_managed_)
-            set_bit(cluster_idx);
+std::optional<uint32_t> BitmapManager::most_free_group() {
+    uint32_t best = 0;
+    uint32_t best_free = 0;
+    for (uint32_t group = 0; group < groups_.size(); ++group) {
+        const std::optional<uint32_t> free = group_free_count(group);
+        if (!free) return std::nullopt;
+        if (*free > best_free) {
+            best = group;
+            best_free = *free;
+        }
     }
+    return best;
+}
 
-    for (uint32_t i = 0; i < header.fat_size_clusters; ++i) {
-        if (const uint32_t cluster_idx = header.fat_start_cluster + i; cluster_idx < total_clusters_managed_)
-            set_bit(cluster_idx);
+bool BitmapManager::initialize_and_flush(const FileSystem::Header &header) {
+    if (!attach(header)) return false;
+
+    // том только что создан с обрезкой файла, поэтому область битовой карты уже заполнена нулями
+    for (uint32_t i = 0; i < header.data_start_cluster && i < total_clusters_managed_; ++i) {
+        if (!set_bit(i)) return false;
     }
 
-    for (uint32_t i = 0; i < header.root_dir_size_clusters; ++i) {
-        if (const uint32_t cluster_idx = header.root_dir_start_cluster + i; cluster_idx < total_clusters_managed_)
-            set_bit(cluster_idx);
+    // на пустом томе свободны все кластеры данных
+    for (uint32_t region = 0; region < region_count_; ++region) {
+        const uint64_t lo = std::max<uint64_t>(static_cast<uint64_t>(region) * FileSystem::CLUSTERS_PER_REGION,
+                                               data_start_cluster_);
+        const uint64_t hi = std::min<uint64_t>(static_cast<uint64_t>(region + 1) * FileSystem::CLUSTERS_PER_REGION,
+                                               total_clusters_managed_);
+        region_free_[region] = hi > lo ? static_cast<uint32_t>(hi - lo) : 0;
+        free_clusters_ += region_free_[region];
     }
+    counters_valid_ = true;
 
-    if (!write_bitmap_to_disk()) {
+    if (!flush()) {
         output::err(output::prefix::BITMAP_MANAGER) << "Failed to write initialized bitmap to disk" << std::endl;
         return false;
     }
@@ -47,53 +219,172 @@ bool BitmapManager::initialize_and_flush(const FileSystem::Header &header) {
 }
 
 bool BitmapManager::load(const FileSystem::Header &header) {
-    total_clusters_managed_ = header.total_clusters;
-    bitmap_disk_start_cluster_ = header.bitmap_start_cluster;
-    bitmap_disk_cluster_count_ = header.bitmap_size_cluster;
-
-    const uint32_t bitmap_size_in_bytes = (total_clusters_managed_ + 7) / 8;
-    bitmap_data_.resize(bitmap_size_in_bytes);
-
-    if (!read_bitmap_from_disk()) {
-        output::err(output::prefix::BITMAP_MANAGER_ERROR) << "Failed to load bitmap from disk" << std::endl;
+    if (!attach(header)) {
+        output::err(output::prefix::BITMAP_MANAGER_ERROR) << "Failed to load bitmap" << std::endl;
         return false;
     }
+    if (!load_free_counters(header)) {
+        output::warn(output::prefix::BITMAP_MANAGER_WARNING) <<
+                "Volume was not cleanly unmounted, free space counters will be rebuilt on first use" << std::endl;
+    }
     output::succ(output::prefix::BITMAP_MANAGER) << "Loaded successfully" << std::endl;
     return true;
 }
 
+std::optional<uint32_t> BitmapManager::find_free_from(uint32_t from, const uint32_t to) const {
+    while (from < to) {
+        const uint32_t page_idx = from / BITS_PER_PAGE;
+        if (counters_valid_ && region_free_[page_idx] == 0) {
+            // регион полностью занят, страницу можно не читать
+            from = static_cast<uint32_t>(std::min<uint64_t>(to, static_cast<uint64_t>(page_idx + 1) * BITS_PER_PAGE));
+            continue;
+        }
+        const MetadataCache::LockedPage page = bitmap_cache_->lock_page(page_idx, false);
+        if (!page) return std::nullopt;
+        const uint32_t page_end = static_cast<uint32_t>(
+            std::min<uint64_t>(to, static_cast<uint64_t>(page_idx + 1) * BITS_PER_PAGE));
+        while (from < page_end) {
+            const uint32_t bit_in_page = from % BITS_PER_PAGE;
+            const auto byte = static_cast<uint8_t>(page.data()[bit_in_page / 8]);
+            if (byte == 0xFF) {
+                from = (from | 7) + 1; // байт полностью занят
+                continue;
+            }
+            if (!((byte >> (bit_in_page % 8)) & 1)) return from;
+            ++from;
+        }
+    }
+    return std::nullopt;
+}
+
 std::optional<uint32_t> BitmapManager::find_and_allocate_free_cluster() {
-    if (!volume_mgr_.is_open()) {
+    if (!volume_mgr_.is_open() || !bitmap_cache_) {
         output::err(output::prefix::BITMAP_MANAGER_ERROR) << "Volume not open" << std::endl;
         return std::nullopt;
     }
 
-    const auto &header = volume_mgr_.get_header();
+    const std::optional<uint32_t> free_cluster = find_free_from(first_free_hint_, total_clusters_managed_);
+    if (!free_cluster) {
+        output::warn(output::prefix::BITMAP_MANAGER_WARNING) << "No free clusters found" << std::endl;
+        return std::nullopt;
+    }
+    if (!set_bit(*free_cluster)) {
+        output::err(output::prefix::BITMAP_MANAGER_ERROR) << "Failed to allocate cluster " << *free_cluster <<
+                std::endl;
+        return std::nullopt;
+    }
+    first_free_hint_ = *free_cluster + 1;
+    return free_cluster;
+}
 
-    for (uint32_t i = header.data_start_cluster; i < total_clusters_managed_; ++i) {
-        const auto received_bit = get_bit(i);
-        if (!received_bit) {
-            output::err(output::prefix::BITMAP_MANAGER_ERROR) << "Cannot get bit " << i;
-            return std::nullopt;
+std::optional<uint32_t> BitmapManager::find_and_allocate_free_run(const uint32_t count) {
+    if (!volume_mgr_.is_open() || !bitmap_cache_) {
+        output::err(output::prefix::BITMAP_MANAGER_ERROR) << "Volume not open" << std::endl;
+        return std::nullopt;
+    }
+    if (count == 0) {
+        output::err(output::prefix::BITMAP_MANAGER_ERROR) << "Cannot allocate empty run" << std::endl;
+        return std::nullopt;
+    }
+
+    uint32_t run_start = first_free_hint_;
+    uint32_t run_length = 0;
+    uint32_t i = first_free_hint_;
+    while (i < total_clusters_managed_ && run_length < count) {
+        const uint32_t page_idx = i / BITS_PER_PAGE;
+        const uint32_t page_end = static_cast<uint32_t>(
+            std::min<uint64_t>(total_clusters_managed_, static_cast<uint64_t>(page_idx + 1) * BITS_PER_PAGE));
+        if (counters_valid_ && region_free_[page_idx] == 0) {
+            run_length = 0;
+            run_start = i = page_end;
+            continue;
         }
-        if (!*received_bit) {
-            set_bit(i);
-            if (!write_bitmap_to_disk()) {
-                clear_bit(i);
-                output::err(output::prefix::BITMAP_MANAGER_ERROR) <<
-                        "Failed to write bitmap to disk after allocating cluster " << i <<
-                        std::endl;
-                return std::nullopt;
+        const char *page = bitmap_cache_->get_page(page_idx);
+        if (!page) return std::nullopt;
+        for (; i < page_end && run_length < count; ++i) {
+            const uint32_t bit_in_page = i % BITS_PER_PAGE;
+            if ((static_cast<uint8_t>(page[bit_in_page / 8]) >> (bit_in_page % 8)) & 1) {
+                run_length = 0;
+                run_start = i + 1;
+            } else {
+                ++run_length;
             }
-            return i;
         }
     }
-    output::warn(output::prefix::BITMAP_MANAGER_WARNING) << "No free clusters found" << std::endl;
-    return std::nullopt;
+    if (run_length < count) return std::nullopt;
+
+    for (uint32_t j = run_start; j < run_start + count; ++j) {
+        if (!set_bit(j)) {
+            for (uint32_t k = run_start; k < j; ++k) clear_bit(k);
+            output::err(output::prefix::BITMAP_MANAGER_ERROR) << "Failed to allocate run at " << run_start <<
+                    std::endl;
+            return std::nullopt;
+        }
+    }
+    if (run_start == first_free_hint_) first_free_hint_ = run_start + count;
+    return run_start;
+}
+
+std::vector<uint32_t> BitmapManager::reserve_near(const uint32_t goal, const uint32_t group, const uint32_t count) {
+    std::vector<uint32_t> reserved;
+    if (count == 0) return reserved;
+    const std::optional<uint32_t> first = allocate_near(goal, group);
+    if (!first) return reserved;
+    reserved.reserve(count);
+    reserved.push_back(*first);
+
+    // запас продолжает участок за первым кластером, пока кластеры свободны и не выходят за его группу;
+    // между allocate_near и замком группы соседние кластеры мог занять другой поток - тогда запас короче
+    AllocationGroup &owner = group_of(*first);
+    std::lock_guard lock(owner.mutex);
+    for (uint32_t next = *first + 1; reserved.size() < count && next < owner.end; ++next) {
+        const std::optional<bool> used = get_bit(next);
+        if (!used || *used || !set_bit(next)) break;
+        reserved.push_back(next);
+    }
+    if (owner.hint == *first + 1) owner.hint = reserved.back() + 1;
+    advance_first_free_hint(*first + 1, reserved.back() + 1);
+    return reserved;
+}
+
+bool BitmapManager::release_reserved(const std::vector<uint32_t> &clusters) {
+    if (!volume_mgr_.is_open() || !bitmap_cache_) {
+        output::err(output::prefix::BITMAP_MANAGER_ERROR) << "Volume not open" << std::endl;
+        return false;
+    }
+    return clear_clusters(clusters);
+}
+
+bool BitmapManager::free_clusters(const std::vector<uint32_t> &clusters) {
+    if (!volume_mgr_.is_open() || !bitmap_cache_) {
+        output::err(output::prefix::BITMAP_MANAGER_ERROR) << "Volume not open" << std::endl;
+        return false;
+    }
+    if (!clear_clusters(clusters)) return false;
+    if (discard_freed_) discard_clusters(clusters);
+    return true;
+}
+
+bool BitmapManager::clear_clusters(const std::vector<uint32_t> &clusters) {
+    const auto &header = volume_mgr_.get_header();
+    for (const uint32_t cluster_idx: clusters) {
+        if (cluster_idx >= total_clusters_managed_ || cluster_idx < header.data_start_cluster) {
+            output::err(output::prefix::BITMAP_MANAGER_ERROR) << "Cannot free cluster " << cluster_idx << std::endl;
+            return false;
+        }
+    }
+    for (const uint32_t cluster_idx: clusters) {
+        if (!clear_bit(cluster_idx)) {
+            output::err(output::prefix::BITMAP_MANAGER_ERROR) << "Failed to free cluster " << cluster_idx <<
+                    std::endl;
+            return false;
+        }
+    }
+    return true;
 }
 
 bool BitmapManager::free_cluster(uint32_t cluster_idx) {
-    if (!volume_mgr_.is_open()) {
+    if (!volume_mgr_.is_open() || !bitmap_cache_) {
         output::err(output::prefix::BITMAP_MANAGER_ERROR) << "Volume not open" << std::endl;
         return false;
     }
@@ -118,18 +409,91 @@ bool BitmapManager::free_cluster(uint32_t cluster_idx) {
                 std::endl;
     }
 
-    clear_bit(cluster_idx);
-    if (!write_bitmap_to_disk()) {
-        output::err(output::prefix::BITMAP_MANAGER_ERROR) << "Failed to write bitmap to disk after freeing cluster " <<
-                cluster_idx <<
-                std::endl;
+    if (!clear_bit(cluster_idx)) {
+        output::err(output::prefix::BITMAP_MANAGER_ERROR) << "Failed to free cluster " << cluster_idx << std::endl;
         return false;
     }
+    if (discard_freed_) discard_clusters({cluster_idx});
+    return true;
+}
+
+void BitmapManager::discard_clusters(std::vector<uint32_t> clusters) {
+    std::sort(clusters.begin(), clusters.end());
+    for (size_t i = 0; i < clusters.size();) {
+        size_t j = i + 1;
+        while (j < clusters.size() && clusters[j] == clusters[j - 1] + 1) ++j;
+        if (!volume_mgr_.punch_holes(clusters[i], static_cast<uint32_t>(j - i))) {
+            // файловая система хоста не поддерживает дыры - больше не пытаемся
+            output::warn(output::prefix::BITMAP_MANAGER_WARNING) << "Discarding freed clusters disabled" << std::endl;
+            discard_freed_ = false;
+            return;
+        }
+        i = j;
+    }
+}
+
+bool BitmapManager::for_each_free_run(const std::function<bool(uint32_t, uint32_t)> &fn) const {
+    if (!bitmap_cache_) return false;
+    uint32_t run_start = 0;
+    uint32_t run_length = 0;
+    uint32_t i = data_start_cluster_;
+    while (i < total_clusters_managed_) {
+        const uint32_t page_idx = i / BITS_PER_PAGE;
+        const uint32_t page_end = static_cast<uint32_t>(
+            std::min<uint64_t>(total_clusters_managed_, static_cast<uint64_t>(page_idx + 1) * BITS_PER_PAGE));
+        const char *page = bitmap_cache_->get_page(page_idx);
+        if (!page) return false;
+        for (; i < page_end; ++i) {
+            const uint32_t bit_in_page = i % BITS_PER_PAGE;
+            if (!((static_cast<uint8_t>(page[bit_in_page / 8]) >> (bit_in_page % 8)) & 1)) {
+                if (run_length++ == 0) run_start = i;
+                continue;
+            }
+            if (run_length != 0) {
+                // fn может обращаться к кэшу, поэтому страница перечитывается
+                if (!fn(run_start, run_length)) return true;
+                run_length = 0;
+                page = bitmap_cache_->get_page(page_idx);
+                if (!page) return false;
+            }
+        }
+    }
+    if (run_length != 0) fn(run_start, run_length);
+    return true;
+}
+
+bool BitmapManager::for_each_used_cluster(const std::function<bool(uint32_t)> &fn) const {
+    if (!bitmap_cache_) return false;
+    std::vector<uint32_t> used;
+    uint32_t i = data_start_cluster_;
+    while (i < total_clusters_managed_) {
+        const uint32_t page_idx = i / BITS_PER_PAGE;
+        const uint32_t page_end = static_cast<uint32_t>(
+            std::min<uint64_t>(total_clusters_managed_, static_cast<uint64_t>(page_idx + 1) * BITS_PER_PAGE));
+        const char *page = bitmap_cache_->get_page(page_idx);
+        if (!page) return false;
+        // fn может обращаться к кэшу, поэтому занятые кластеры страницы сначала собираются
+        used.clear();
+        while (i < page_end) {
+            const uint32_t bit_in_page = i % BITS_PER_PAGE;
+            const auto byte = static_cast<uint8_t>(page[bit_in_page / 8]);
+            if (byte == 0 && bit_in_page % 8 == 0) {
+                i += 8; // байт полностью свободен
+                continue;
+            }
+            if ((byte >> (bit_in_page % 8)) & 1) used.push_back(i);
+            ++i;
+        }
+        for (const uint32_t cluster: used) {
+            if (!fn(cluster)) return true;
+        }
+        i = page_end;
+    }
     return true;
 }
 
 bool BitmapManager::is_cluster_free(uint32_t cluster_idx) const {
-    if (cluster_idx >= total_clusters_managed_) {
+    if (cluster_idx >= total_clusters_managed_ || !bitmap_cache_) {
         return false;
     }
     const auto received_bit = get_bit(cluster_idx);
@@ -140,87 +504,184 @@ bool BitmapManager::is_cluster_free(uint32_t cluster_idx) const {
     return !*received_bit;
 }
 
-void BitmapManager::set_bit(const uint32_t cluster_idx) {
-    if (cluster_idx >= total_clusters_managed_) return;
-    const uint32_t byte_idx = cluster_idx / 8;
-    const uint8_t bit_offset = cluster_idx % 8;
-    if (byte_idx < bitmap_data_.size()) {
-        bitmap_data_[byte_idx] |= 1 << bit_offset;
+bool BitmapManager::flush() {
+    if (!bitmap_cache_) return true;
+    if (!bitmap_cache_->flush()) {
+        output::err(output::prefix::BITMAP_MANAGER_ERROR) << "Failed to write bitmap pages to disk" << std::endl;
+        return false;
     }
+    return true;
 }
 
-void BitmapManager::clear_bit(uint32_t cluster_idx) {
-    if (cluster_idx >= total_clusters_managed_) return;
-    uint32_t byte_idx = cluster_idx / 8;
-    uint8_t bit_offset = cluster_idx % 8;
-    if (byte_idx < bitmap_data_.size()) {
-        bitmap_data_[byte_idx] &= ~(1 << bit_offset);
+bool BitmapManager::rebuild(const std::function<std::optional<bool>(uint32_t)> &in_use) {
+    if (!bitmap_cache_) return false;
+    for (uint32_t page_idx = 0; page_idx < bitmap_disk_cluster_count_; ++page_idx) {
+        char *page = bitmap_cache_->get_page_for_write(page_idx);
+        if (!page) return false;
+        std::memset(page, 0, FileSystem::CLUSTER_SIZE_BYTES);
+        const uint64_t first = static_cast<uint64_t>(page_idx) * BITS_PER_PAGE;
+        const uint64_t end = std::min<uint64_t>(first + BITS_PER_PAGE, total_clusters_managed_);
+        // in_use читает другие области метаданных, поэтому указатель на страницу остаётся действительным
+        for (uint64_t cluster = first; cluster < end; ++cluster) {
+            bool used = cluster < data_start_cluster_;
+            if (!used) {
+                const std::optional<bool> referenced = in_use(static_cast<uint32_t>(cluster));
+                if (!referenced) return false;
+                used = *referenced;
+            }
+            if (used) page[(cluster - first) / 8] |= static_cast<char>(1 << (cluster - first) % 8);
+        }
     }
+    first_free_hint_ = data_start_cluster_;
+    build_groups();
+    return rebuild_free_counters() && flush();
 }
 
-std::optional<bool> BitmapManager::get_bit(uint32_t cluster_idx) const {
-    if (cluster_idx >= total_clusters_managed_) return std::nullopt;
-    const uint32_t byte_idx = cluster_idx / 8;
-    const uint8_t bit_offset = cluster_idx % 8;
-    if (byte_idx < bitmap_data_.size()) {
-        return (bitmap_data_[byte_idx] >> bit_offset) & 1;
-    }
-    return std::nullopt;
+void BitmapManager::set_max_resident_pages(const size_t max_resident_pages) {
+    max_resident_pages_ = max_resident_pages;
+    if (bitmap_cache_) bitmap_cache_->set_max_resident_pages(max_resident_pages);
+}
+
+MetadataCache::Stats BitmapManager::cache_stats() const {
+    return bitmap_cache_ ? bitmap_cache_->stats() : MetadataCache::Stats{};
 }
 
-bool BitmapManager::read_bitmap_from_disk() {
-    if (bitmap_disk_cluster_count_ == 0) {
-        output::err(output::prefix::BITMAP_MANAGER_ERROR) << "total_clusters is 0, cannot read" << std::endl;
-        return bitmap_data_.empty();
+bool BitmapManager::load_free_counters(const FileSystem::Header &header) {
+    if (header.volume_state != FileSystem::VOLUME_STATE_CLEAN || free_counts_cluster_count_ == 0) return false;
+
+    std::vector<uint32_t> table(static_cast<size_t>(free_counts_cluster_count_) * FileSystem::CLUSTER_SIZE_BYTES /
+                                sizeof(uint32_t));
+    if (!volume_mgr_.read_clusters(free_counts_start_cluster_, free_counts_cluster_count_,
+                                   reinterpret_cast<char *>(table.data()))) {
+        output::err(output::prefix::BITMAP_MANAGER_ERROR) << "Failed to read free counts table" << std::endl;
+        return false;
+    }
+    uint64_t total = 0;
+    for (size_t region = 0; region < region_count_; ++region) {
+        if (table[region] > FileSystem::CLUSTERS_PER_REGION) return false;
+        region_free_[region] = table[region];
+        total += table[region];
     }
-    std::vector<char> raw_bitmap_buffer(bitmap_disk_cluster_count_ * volume_mgr_.get_cluster_size());
+    // сумма по регионам должна совпадать с итогом в заголовке, иначе таблица не доверяется
+    if (total != header.free_clusters) return false;
+    free_clusters_ = total;
+    counters_valid_ = true;
+    return true;
+}
 
-    for (uint32_t i = 0; i < bitmap_disk_cluster_count_; ++i) {
-        if (!volume_mgr_.read_cluster(bitmap_disk_start_cluster_ + i,
-                                      raw_bitmap_buffer.data() + i * volume_mgr_.get_cluster_size())) {
-            output::err(output::prefix::BITMAP_MANAGER_ERROR) << "Failed to read cluster " << (
-                        bitmap_disk_cluster_count_ + i)
-                    << " for bitmap" << std::endl;
+bool BitmapManager::rebuild_free_counters() {
+    uint64_t total = 0;
+    for (uint32_t region = 0; region < region_count_; ++region) {
+        const uint64_t region_first = static_cast<uint64_t>(region) * FileSystem::CLUSTERS_PER_REGION;
+        const uint64_t lo = std::max<uint64_t>(region_first, data_start_cluster_);
+        const uint64_t hi = std::min<uint64_t>(region_first + FileSystem::CLUSTERS_PER_REGION, total_clusters_managed_);
+        if (hi <= lo) {
+            region_free_[region] = 0;
+            continue;
+        }
+        const char *page = bitmap_cache_->get_page(region);
+        if (!page) {
+            output::err(output::prefix::BITMAP_MANAGER_ERROR) << "Failed to read bitmap page " << region <<
+                    " while rebuilding free counters" << std::endl;
             return false;
         }
+        const uint32_t used = count_set_bits(page, static_cast<uint32_t>(lo - region_first),
+                                             static_cast<uint32_t>(hi - region_first));
+        region_free_[region] = static_cast<uint32_t>(hi - lo) - used;
+        total += region_free_[region];
     }
-    if (bitmap_data_.size() > raw_bitmap_buffer.size()) {
-        output::err(output::prefix::BITMAP_MANAGER_ERROR) << "bitmap_data_ vector is larger than buffer read from disk"
-                << std::endl;
-        return false;
+    free_clusters_ = total;
+    counters_valid_ = true;
+    output::succ(output::prefix::BITMAP_MANAGER) << "Free space counters rebuilt: " << total << " free clusters" <<
+            std::endl;
+    return true;
+}
+
+std::optional<uint64_t> BitmapManager::free_cluster_count() {
+    if (!bitmap_cache_) return std::nullopt;
+    if (!counters_valid_ && !rebuild_free_counters()) return std::nullopt;
+    return free_clusters_;
+}
+
+std::optional<uint32_t> BitmapManager::region_free_count(const uint32_t region_idx) {
+    if (!bitmap_cache_ || region_idx >= region_count_) return std::nullopt;
+    if (!counters_valid_ && !rebuild_free_counters()) return std::nullopt;
+    return region_free_[region_idx];
+}
+
+bool BitmapManager::store_free_counters(FileSystem::Header &header) const {
+    if (!counters_valid_) return false;
+    if (free_counts_cluster_count_ != 0) {
+        std::vector<uint32_t> table(static_cast<size_t>(free_counts_cluster_count_) * FileSystem::CLUSTER_SIZE_BYTES /
+                                    sizeof(uint32_t), 0);
+        std::copy(region_free_.get(), region_free_.get() + region_count_, table.begin());
+        if (!volume_mgr_.write_clusters(free_counts_start_cluster_, free_counts_cluster_count_,
+                                        reinterpret_cast<const char *>(table.data()))) {
+            output::err(output::prefix::BITMAP_MANAGER_ERROR) << "Failed to write free counts table" << std::endl;
+            return false;
+        }
     }
-    std::memcpy(bitmap_data_.data(), raw_bitmap_buffer.data(), bitmap_data_.size());
+    header.free_clusters = static_cast<uint32_t>(free_clusters_);
     return true;
 }
 
-bool BitmapManager::write_bitmap_to_disk() const {
-    if (bitmap_disk_cluster_count_ == 0 && bitmap_data_.empty()) {
-        output::err(output::prefix::BITMAP_MANAGER_ERROR) << "No bitmap data to write" << std::endl;
-        return false;
+bool BitmapManager::set_bit(const uint32_t cluster_idx) {
+    if (cluster_idx >= total_clusters_managed_) return false;
+    {
+        // соседние биты байта могут принадлежать другой группе, поэтому байт меняется под замком страницы
+        const MetadataCache::LockedPage page = bitmap_cache_->lock_page(cluster_idx / BITS_PER_PAGE, true);
+        if (!page) return false;
+        const uint32_t bit_in_page = cluster_idx % BITS_PER_PAGE;
+        const auto byte = static_cast<uint8_t>(page.data()[bit_in_page / 8]);
+        const uint8_t mask = 1 << bit_in_page % 8;
+        if (byte & mask) return true;
+        page.data()[bit_in_page / 8] = static_cast<char>(byte | mask);
     }
-    if (bitmap_disk_cluster_count_ == 0 && !bitmap_data_.empty()) {
-        output::err(output::prefix::BITMAP_MANAGER_ERROR) << "total_clusters_ is 0, but bitmap_data_ is not empty" <<
-                std::endl;
-        return false;
+    if (cluster_idx >= data_start_cluster_ && !groups_.empty()) {
+        if (AllocationGroup &group = group_of(cluster_idx); group.free > 0) --group.free;
     }
-    std::vector<char> raw_bitmap_buffer(bitmap_disk_cluster_count_ * volume_mgr_.get_cluster_size(), 0);
-
-    if (bitmap_data_.size() > raw_bitmap_buffer.size()) {
-        output::err(output::prefix::BITMAP_MANAGER_ERROR) <<
-                "bitmap_data_ vector is larger then disk space allocated for bitmap" <<
-                std::endl;
+    if (counters_valid_ && cluster_idx >= data_start_cluster_) {
+        --region_free_[cluster_idx / FileSystem::CLUSTERS_PER_REGION];
+        --free_clusters_;
     }
-    std::memcpy(raw_bitmap_buffer.data(), bitmap_data_.data(),
-                std::min(bitmap_data_.size(), raw_bitmap_buffer.size()));
+    return true;
+}
 
-    for (uint32_t i = 0; i < bitmap_disk_cluster_count_; ++i) {
-        if (!volume_mgr_.write_cluster(bitmap_disk_start_cluster_ + i,
-                                       raw_bitmap_buffer.data() + i * volume_mgr_.get_cluster_size())) {
-            output::err(output::prefix::BITMAP_MANAGER_ERROR) << "Failed to write cluster " << (
-                        bitmap_disk_start_cluster_ + i) <<
-                    " for bitmap" << std::endl;
-            return false;
-        }
+bool BitmapManager::clear_bit(const uint32_t cluster_idx) {
+    if (cluster_idx >= total_clusters_managed_) return false;
+    std::unique_lock<std::mutex> group_lock;
+    AllocationGroup *group = nullptr;
+    if (cluster_idx >= data_start_cluster_ && !groups_.empty()) {
+        group = &group_of(cluster_idx);
+        group_lock = std::unique_lock(group->mutex);
+    }
+    {
+        const MetadataCache::LockedPage page = bitmap_cache_->lock_page(cluster_idx / BITS_PER_PAGE, true);
+        if (!page) return false;
+        const uint32_t bit_in_page = cluster_idx % BITS_PER_PAGE;
+        const auto byte = static_cast<uint8_t>(page.data()[bit_in_page / 8]);
+        const uint8_t mask = 1 << bit_in_page % 8;
+        if (!(byte & mask)) return true;
+        page.data()[bit_in_page / 8] = static_cast<char>(byte & ~mask);
+    }
+    if (group) {
+        if (group->free >= 0) ++group->free;
+        group->hint = std::min(group->hint, cluster_idx);
+    }
+    if (counters_valid_ && cluster_idx >= data_start_cluster_) {
+        ++region_free_[cluster_idx / FileSystem::CLUSTERS_PER_REGION];
+        ++free_clusters_;
+    }
+    uint32_t hint = first_free_hint_;
+    while (cluster_idx < hint && !first_free_hint_.compare_exchange_weak(hint, cluster_idx)) {
     }
     return true;
 }
+
+std::optional<bool> BitmapManager::get_bit(const uint32_t cluster_idx) const {
+    if (cluster_idx >= total_clusters_managed_) return std::nullopt;
+    const MetadataCache::LockedPage page = bitmap_cache_->lock_page(cluster_idx / BITS_PER_PAGE, false);
+    if (!page) return std::nullopt;
+    const uint32_t bit_in_page = cluster_idx % BITS_PER_PAGE;
+    return (static_cast<uint8_t>(page.data()[bit_in_page / 8]) >> (bit_in_page % 8)) & 1;
+}
@@ -0,0 +1,43 @@
+#include "../include/buffer_pool.h"
+
+#include <new>
+
+BufferPool::BufferPool(const size_t buffer_size, const size_t alignment, const size_t buffers_per_chunk)
+    : buffer_size_(buffer_size), alignment_(alignment), buffers_per_chunk_(buffers_per_chunk == 0 ? 1 : buffers_per_chunk) {
+}
+
+void BufferPool::ChunkDeleter::operator()(char *chunk) const {
+    ::operator delete(chunk, std::align_val_t(alignment));
+}
+
+char *BufferPool::acquire() {
+    std::lock_guard lock(mutex_);
+    if (free_.empty()) {
+        char *chunk = static_cast<char *>(::operator new(buffer_size_ * buffers_per_chunk_, std::align_val_t(alignment_),
+                                                         std::nothrow));
+        if (!chunk) return nullptr;
+        chunks_.emplace_back(chunk, ChunkDeleter{alignment_});
+        // буферы выдаются от начала блока
+        for (size_t i = buffers_per_chunk_; i > 0; --i) free_.push_back(chunk + (i - 1) * buffer_size_);
+    }
+    char *buffer = free_.back();
+    free_.pop_back();
+    ++in_use_;
+    return buffer;
+}
+
+void BufferPool::release(char *buffer) {
+    if (!buffer) return;
+    std::lock_guard lock(mutex_);
+    free_.push_back(buffer);
+    --in_use_;
+}
+
+BufferPool::Stats BufferPool::stats() const {
+    std::lock_guard lock(mutex_);
+    Stats stats;
+    stats.buffers = chunks_.size() * buffers_per_chunk_;
+    stats.in_use = in_use_;
+    stats.chunks = chunks_.size();
+    return stats;
+}
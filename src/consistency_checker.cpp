@@ -0,0 +1,958 @@
+#include "../include/consistency_checker.h"
+
+#include <algorithm>
+#include <cstring>
+#include <thread>
+
+#include "../include/output.h"
+
+namespace {
+    constexpr uint32_t BITS_PER_WORD = 64;
+    // количество слов битовой карты, сравниваемых за одну итерацию (развёртка для векторизации)
+    constexpr size_t COMPARE_BLOCK_WORDS = 8;
+
+    bool is_end_marker(const uint32_t value) {
+        return value == FileSystem::MARKER_FAT_ENTRY_EOF || value == FileSystem::MARKER_FAT_ENTRY_FREE;
+    }
+
+    std::string entry_name(const FileSystem::DirectoryEntry &entry) {
+        return {entry.name.data(), strnlen(entry.name.data(), FileSystem::MAX_FILE_NAME)};
+    }
+}
+
+bool ConsistencyChecker::Report::is_clean() const {
+    return leaked_clusters == 0 && orphaned_clusters == 0 && cross_linked_clusters == 0 &&
+           unmarked_clusters == 0 && broken_chains == 0 && size_mismatches == 0 && counter_mismatches == 0 &&
+           orphaned_holes == 0 && checksum_errors == 0 && refcount_mismatches == 0;
+}
+
+ConsistencyChecker::ConsistencyChecker(VolumeManager &vol_manager) : vol_manager_(vol_manager) {
+}
+
+std::optional<ConsistencyChecker::Report> ConsistencyChecker::run(const Options &options) {
+    if (!vol_manager_.is_open()) {
+        output::err(output::prefix::CONSISTENCY_CHECKER_ERROR) << "Volume not open" << std::endl;
+        return std::nullopt;
+    }
+    header_ = vol_manager_.get_header();
+    report_ = Report{};
+    objects_.clear();
+    bad_checksums_.clear();
+    // суммы сверяются отдельным проходом: повреждённый кластер не должен прерывать разбор структуры
+    vol_manager_.set_checksum_verification(false);
+
+    threads_ = options.threads != 0 ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+
+    if (!load_metadata()) {
+        output::err(output::prefix::CONSISTENCY_CHECKER_ERROR) << "Failed to load metadata" << std::endl;
+        vol_manager_.set_checksum_verification(true);
+        return std::nullopt;
+    }
+
+    owners_ = std::make_unique<std::atomic<uint32_t>[]>(header_.total_clusters);
+    ranks_ = std::make_unique<std::atomic<uint64_t>[]>(header_.total_clusters);
+    hole_ranks_ = std::make_unique<std::atomic<uint64_t>[]>(hole_table_.size());
+    shared_refs_ = std::make_unique<std::atomic<uint32_t>[]>(header_.total_clusters);
+    hole_owners_ = std::make_unique<std::atomic<uint32_t>[]>(hole_table_.size());
+    reset_owners();
+
+    walk_directories();
+    walk_file_chains();
+    check_sizes();
+    compare_allocation();
+    count_orphaned_holes();
+    check_refcounts();
+    check_free_counters();
+    verify_checksums();
+    // потоки находят ошибки в произвольном порядке; отчёт выводится упорядоченным
+    std::sort(report_.problems.begin(), report_.problems.end());
+
+    // после некорректного размонтирования счётчики пересчитываются, даже если ошибок нет
+    if (options.repair && (!report_.is_clean() || report_.unclean_shutdown)) {
+        if (!repair()) {
+            output::err(output::prefix::CONSISTENCY_CHECKER_ERROR) << "Repair failed" << std::endl;
+            vol_manager_.set_checksum_verification(true);
+            return std::nullopt;
+        }
+        report_.repaired = true;
+    }
+    vol_manager_.set_checksum_verification(true);
+    return report_;
+}
+
+bool ConsistencyChecker::load_metadata() {
+    const uint32_t cluster_size = vol_manager_.get_cluster_size();
+    if (header_.total_clusters == 0 || header_.bitmap_size_cluster == 0 || header_.fat_size_clusters == 0) {
+        output::err(output::prefix::CONSISTENCY_CHECKER_ERROR) << "Header describes empty metadata regions" <<
+                std::endl;
+        return false;
+    }
+
+    const uint64_t bitmap_bytes = static_cast<uint64_t>(header_.bitmap_size_cluster) * cluster_size;
+    disk_bitmap_.assign(bitmap_bytes / sizeof(uint64_t), 0);
+    if (!vol_manager_.read_clusters(header_.bitmap_start_cluster, header_.bitmap_size_cluster,
+                                    reinterpret_cast<char *>(disk_bitmap_.data()))) {
+        output::err(output::prefix::CONSISTENCY_CHECKER_ERROR) << "Failed to read bitmap" << std::endl;
+        return false;
+    }
+
+    const uint64_t fat_bytes = static_cast<uint64_t>(header_.fat_size_clusters) * cluster_size;
+    if (fat_bytes < static_cast<uint64_t>(header_.total_clusters) * sizeof(uint32_t)) {
+        output::err(output::prefix::CONSISTENCY_CHECKER_ERROR) << "FAT region is smaller than total clusters" <<
+                std::endl;
+        return false;
+    }
+    fat_table_.assign(fat_bytes / sizeof(uint32_t), FileSystem::MARKER_FAT_ENTRY_FREE);
+    if (!vol_manager_.read_clusters(header_.fat_start_cluster, header_.fat_size_clusters,
+                                    reinterpret_cast<char *>(fat_table_.data()))) {
+        output::err(output::prefix::CONSISTENCY_CHECKER_ERROR) << "Failed to read FAT" << std::endl;
+        return false;
+    }
+
+    hole_table_.clear();
+    if (header_.hole_table_size_clusters != 0) {
+        const uint64_t hole_table_bytes = static_cast<uint64_t>(header_.hole_table_size_clusters) * cluster_size;
+        hole_table_.resize(std::min<uint64_t>(hole_table_bytes / sizeof(FileSystem::HoleRecord),
+                                              FileSystem::FAT_RECORD_INDEX_MASK));
+        std::vector<char> raw(hole_table_bytes);
+        if (!vol_manager_.read_clusters(header_.hole_table_start_cluster, header_.hole_table_size_clusters,
+                                        raw.data())) {
+            output::err(output::prefix::CONSISTENCY_CHECKER_ERROR) << "Failed to read hole table" << std::endl;
+            return false;
+        }
+        std::memcpy(hole_table_.data(), raw.data(), hole_table_.size() * sizeof(FileSystem::HoleRecord));
+    }
+
+    // таблица меньше тома не подключается и файловой системой (см. FATManager)
+    refcounts_.clear();
+    const uint64_t refcount_bytes = static_cast<uint64_t>(header_.refcount_table_size_clusters) * cluster_size;
+    if (!hole_table_.empty() && refcount_bytes >= static_cast<uint64_t>(header_.total_clusters) * sizeof(uint32_t)) {
+        refcounts_.resize(refcount_bytes / sizeof(uint32_t));
+        if (!vol_manager_.read_clusters(header_.refcount_table_start_cluster, header_.refcount_table_size_clusters,
+                                        reinterpret_cast<char *>(refcounts_.data()))) {
+            output::err(output::prefix::CONSISTENCY_CHECKER_ERROR) << "Failed to read refcount table" << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+std::optional<uint32_t> ConsistencyChecker::hole_index(const uint32_t hole_ref) const {
+    const uint32_t idx = hole_ref & FileSystem::FAT_RECORD_INDEX_MASK;
+    if (idx >= hole_table_.size()) return std::nullopt;
+    return idx;
+}
+
+uint32_t ConsistencyChecker::next_node(const uint32_t node) const {
+    return FileSystem::is_shared_ref(node) ? hole_table_[*hole_index(node)].next : fat_table_[node];
+}
+
+void ConsistencyChecker::end_chain_at(const uint32_t node) {
+    if (FileSystem::is_shared_ref(node)) {
+        hole_table_[*hole_index(node)].next = FileSystem::MARKER_FAT_ENTRY_EOF;
+    } else {
+        fat_table_[node] = FileSystem::MARKER_FAT_ENTRY_EOF;
+    }
+}
+
+bool ConsistencyChecker::read_directory_cluster(const uint32_t cluster_idx,
+                                                std::vector<FileSystem::DirectoryEntry> &entries) {
+    std::vector<char> buffer(vol_manager_.get_cluster_size());
+    {
+        std::lock_guard lock(io_mutex_);
+        if (!vol_manager_.read_cluster(cluster_idx, buffer.data())) {
+            return false;
+        }
+    }
+    if (!FileSystem::is_directory_node(buffer.data())) {
+        entries.resize(FileSystem::DIR_ENTRIES_PER_CLUSTER);
+        std::memcpy(entries.data(), buffer.data(),
+                    FileSystem::DIR_ENTRIES_PER_CLUSTER * sizeof(FileSystem::DirectoryEntry));
+        return true;
+    }
+
+    // узел дерева: записи есть только в листьях, внутренние узлы содержат лишь ключи
+    FileSystem::DirectoryNodeHeader header{};
+    std::memcpy(&header, buffer.data(), sizeof(header));
+    if (header.level != 0) {
+        entries.clear();
+        return header.count <= FileSystem::DIR_INDEX_CAPACITY;
+    }
+    if (header.count > FileSystem::DIR_LEAF_CAPACITY) return false;
+    entries.resize(header.count);
+    std::memcpy(entries.data(), buffer.data() + sizeof(header), header.count * sizeof(FileSystem::DirectoryEntry));
+    return true;
+}
+
+template<typename Fn>
+void ConsistencyChecker::parallel_for(const size_t count, Fn &&fn) const {
+    if (count == 0) return;
+    const size_t workers = std::min<size_t>(threads_, count);
+    if (workers <= 1) {
+        for (size_t i = 0; i < count; ++i) fn(i);
+        return;
+    }
+    std::atomic<size_t> next{0};
+    constexpr size_t chunk = 256;
+    std::vector<std::thread> pool;
+    pool.reserve(workers);
+    for (size_t t = 0; t < workers; ++t) {
+        pool.emplace_back([&] {
+            for (size_t begin = next.fetch_add(chunk); begin < count; begin = next.fetch_add(chunk)) {
+                const size_t end = std::min(count, begin + chunk);
+                for (size_t i = begin; i < end; ++i) fn(i);
+            }
+        });
+    }
+    for (auto &thread: pool) thread.join();
+}
+
+bool ConsistencyChecker::is_in_use(const uint32_t cluster_idx) const {
+    return owners_[cluster_idx].load(std::memory_order_relaxed) != 0 ||
+           shared_refs_[cluster_idx].load(std::memory_order_relaxed) != 0;
+}
+
+bool ConsistencyChecker::is_chain_cluster(const uint32_t cluster_idx) const {
+    if (cluster_idx >= header_.total_clusters) return false;
+    if (cluster_idx >= header_.data_start_cluster) return true;
+    return cluster_idx >= header_.root_dir_start_cluster &&
+           cluster_idx < header_.root_dir_start_cluster + header_.root_dir_size_clusters;
+}
+
+std::vector<uint32_t> ConsistencyChecker::count_region_free() const {
+    constexpr uint32_t words_per_region = FileSystem::CLUSTERS_PER_REGION / BITS_PER_WORD;
+    const uint32_t regions = (header_.total_clusters + FileSystem::CLUSTERS_PER_REGION - 1) /
+                             FileSystem::CLUSTERS_PER_REGION;
+    std::vector<uint32_t> region_free(regions, 0);
+    parallel_for(regions, [&](const size_t region) {
+        const uint64_t first = static_cast<uint64_t>(region) * FileSystem::CLUSTERS_PER_REGION;
+        const uint64_t lo = std::max<uint64_t>(first, header_.data_start_cluster);
+        const uint64_t hi = std::min<uint64_t>(first + FileSystem::CLUSTERS_PER_REGION, header_.total_clusters);
+        if (hi <= lo) return;
+        uint64_t used = 0;
+        for (size_t w = region * words_per_region; w < (region + 1) * words_per_region; ++w) {
+            const uint64_t word_first = static_cast<uint64_t>(w) * BITS_PER_WORD;
+            if (word_first >= hi || word_first + BITS_PER_WORD <= lo) continue;
+            uint64_t word = disk_bitmap_[w];
+            if (lo > word_first) word &= ~uint64_t{0} << (lo - word_first);
+            if (hi < word_first + BITS_PER_WORD) word &= (uint64_t{1} << (hi - word_first)) - 1;
+            used += __builtin_popcountll(word);
+        }
+        region_free[region] = static_cast<uint32_t>(hi - lo - used);
+    });
+    return region_free;
+}
+
+void ConsistencyChecker::check_free_counters() {
+    if (header_.volume_state != FileSystem::VOLUME_STATE_CLEAN) {
+        report_.unclean_shutdown = true;
+        return;
+    }
+    const std::vector<uint32_t> region_free = count_region_free();
+    uint64_t total_free = 0;
+    for (const uint32_t count: region_free) total_free += count;
+    if (total_free != header_.free_clusters) {
+        add_problem(report_.counter_mismatches, "header free cluster count " + std::to_string(header_.free_clusters) +
+                                                " != " + std::to_string(total_free) + " in bitmap");
+    }
+    if (header_.free_counts_size_clusters == 0) return;
+
+    std::vector<uint32_t> table(static_cast<size_t>(header_.free_counts_size_clusters) *
+                                vol_manager_.get_cluster_size() / sizeof(uint32_t));
+    if (table.size() < region_free.size() ||
+        !vol_manager_.read_clusters(header_.free_counts_start_cluster, header_.free_counts_size_clusters,
+                                    reinterpret_cast<char *>(table.data()))) {
+        add_problem(report_.counter_mismatches, "free counts table is unreadable");
+        return;
+    }
+    for (size_t region = 0; region < region_free.size(); ++region) {
+        if (table[region] != region_free[region]) {
+            add_problem(report_.counter_mismatches, "region " + std::to_string(region) + " free count " +
+                                                    std::to_string(table[region]) + " != " +
+                                                    std::to_string(region_free[region]) + " in bitmap");
+        }
+    }
+}
+
+bool ConsistencyChecker::store_free_counters() {
+    const std::vector<uint32_t> region_free = count_region_free();
+    uint64_t total_free = 0;
+    for (const uint32_t count: region_free) total_free += count;
+
+    if (header_.free_counts_size_clusters != 0) {
+        std::vector<uint32_t> table(static_cast<size_t>(header_.free_counts_size_clusters) *
+                                    vol_manager_.get_cluster_size() / sizeof(uint32_t), 0);
+        if (table.size() < region_free.size()) {
+            output::err(output::prefix::CONSISTENCY_CHECKER_ERROR) << "Free counts table is too small" << std::endl;
+            return false;
+        }
+        std::copy(region_free.begin(), region_free.end(), table.begin());
+        if (!vol_manager_.write_clusters(header_.free_counts_start_cluster, header_.free_counts_size_clusters,
+                                         reinterpret_cast<const char *>(table.data()))) {
+            output::err(output::prefix::CONSISTENCY_CHECKER_ERROR) << "Failed to write free counts table" <<
+                    std::endl;
+            return false;
+        }
+    }
+    header_.free_clusters = static_cast<uint32_t>(total_free);
+    header_.volume_state = FileSystem::VOLUME_STATE_CLEAN;
+    if (!vol_manager_.update_header(header_)) {
+        output::err(output::prefix::CONSISTENCY_CHECKER_ERROR) << "Failed to write header" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void ConsistencyChecker::verify_checksums() {
+    if (!vol_manager_.checksums_supported()) return;
+    report_.checksums_verified = true;
+
+    // метаданные до области данных (кроме самой таблицы сумм) и все кластеры, у которых нашёлся владелец
+    const auto needs_check = [this](const uint32_t cluster_idx) {
+        if (cluster_idx >= header_.checksum_table_start_cluster &&
+            cluster_idx - header_.checksum_table_start_cluster < header_.checksum_table_size_clusters) {
+            return false;
+        }
+        return cluster_idx < header_.data_start_cluster || is_in_use(cluster_idx);
+    };
+    const auto describe = [this](const uint32_t cluster_idx) -> std::string {
+        if (const uint32_t owner = owners_[cluster_idx].load(std::memory_order_relaxed); owner != 0) {
+            const Object &object = objects_[owner - 1];
+            return object.is_root ? "/" : object.path;
+        }
+        return cluster_idx < header_.data_start_cluster ? "metadata" : "shared data";
+    };
+
+    constexpr uint32_t max_batch = 256;
+    const uint32_t cluster_size = vol_manager_.get_cluster_size();
+    std::vector<char> buffer(static_cast<size_t>(max_batch) * cluster_size);
+    for (uint32_t c = header_.header_cluster_count; c < header_.total_clusters;) {
+        if (!needs_check(c)) {
+            ++c;
+            continue;
+        }
+        uint32_t batch = 1;
+        while (batch < max_batch && c + batch < header_.total_clusters && needs_check(c + batch)) ++batch;
+        if (!vol_manager_.read_clusters(c, batch, buffer.data())) {
+            add_problem(report_.checksum_errors, "clusters " + std::to_string(c) + "+" + std::to_string(batch) +
+                                                 " are unreadable");
+            c += batch;
+            continue;
+        }
+        for (uint32_t i = 0; i < batch; ++i) {
+            if (vol_manager_.checksum_matches(c + i, buffer.data() + static_cast<size_t>(i) * cluster_size)) continue;
+            bad_checksums_.push_back(c + i);
+            add_problem(report_.checksum_errors, "Checksum mismatch in cluster " + std::to_string(c + i) + " (" +
+                                                 describe(c + i) + ")");
+        }
+        c += batch;
+    }
+}
+
+bool ConsistencyChecker::reseal_checksums() {
+    // содержимое уже не восстановить; новые суммы делают кластеры снова читаемыми
+    std::vector<char> buffer(vol_manager_.get_cluster_size());
+    for (const uint32_t cluster_idx: bad_checksums_) {
+        if (!vol_manager_.read_cluster(cluster_idx, buffer.data()) ||
+            !vol_manager_.seal_checksum(cluster_idx, buffer.data())) {
+            output::err(output::prefix::CONSISTENCY_CHECKER_ERROR) << "Failed to reseal checksum of cluster " <<
+                    cluster_idx << std::endl;
+            return false;
+        }
+    }
+    return vol_manager_.flush_checksums();
+}
+
+void ConsistencyChecker::add_problem(uint64_t &counter, const std::string &problem) {
+    std::lock_guard lock(report_mutex_);
+    ++counter;
+    if (report_.problems.size() < MAX_REPORTED_PROBLEMS) {
+        report_.problems.push_back(problem);
+    }
+}
+
+void ConsistencyChecker::reset_owners() const {
+    parallel_for(header_.total_clusters, [this](const size_t i) {
+        owners_[i].store(0, std::memory_order_relaxed);
+        ranks_[i].store(NO_RANK, std::memory_order_relaxed);
+        shared_refs_[i].store(0, std::memory_order_relaxed);
+    });
+    parallel_for(hole_table_.size(), [this](const size_t i) {
+        hole_owners_[i].store(0, std::memory_order_relaxed);
+        hole_ranks_[i].store(NO_RANK, std::memory_order_relaxed);
+    });
+}
+
+uint64_t ConsistencyChecker::claim_rank(const uint32_t object_id, const Object &object) {
+    return (object.is_directory() ? 0 : uint64_t{1} << 32) | object_id;
+}
+
+ConsistencyChecker::Claim ConsistencyChecker::claim_node(std::atomic<uint64_t> &node_rank,
+                                                         std::atomic<uint32_t> &owner, const uint32_t object_id,
+                                                         const uint64_t rank, const bool ranking) {
+    uint64_t current = node_rank.load(std::memory_order_relaxed);
+    if (ranking) {
+        // первый проход: узел помечается наименьшим рангом среди всех цепочек, дошедших до него
+        while (current > rank) {
+            if (node_rank.compare_exchange_weak(current, rank, std::memory_order_relaxed)) return Claim::CLAIMED;
+        }
+        return current == rank ? Claim::LOOP : Claim::CROSS_LINKED;
+    }
+    // второй проход: узел достаётся только объекту, чей ранг остался на узле после первого
+    if (current != rank) return Claim::CROSS_LINKED;
+    uint32_t expected = 0;
+    return owner.compare_exchange_strong(expected, object_id, std::memory_order_relaxed) ? Claim::CLAIMED
+                                                                                         : Claim::LOOP;
+}
+
+void ConsistencyChecker::claim_chain(const uint32_t object_id, Object &object, const bool ranking) {
+    object.chain_length = 0;
+    object.logical_length = 0;
+    object.needs_cut = false;
+    object.cut_after = FileSystem::MARKER_FAT_ENTRY_FREE;
+    const uint64_t rank = claim_rank(object_id, object);
+    // при ранжировании цепочка проходится до тех же мест, но ошибки не записываются
+    const auto stop = [&](uint64_t &counter, const std::string &problem, const uint32_t cut_after) {
+        if (ranking) return;
+        add_problem(counter, problem);
+        object.needs_cut = true;
+        object.cut_after = cut_after;
+    };
+
+    uint32_t current = object.is_root ? header_.root_dir_start_cluster : object.entry.first_cluster;
+    if (is_end_marker(current)) {
+        if (object.is_directory() && !ranking) {
+            add_problem(report_.broken_chains, "Directory '" + object.path + "' has no clusters");
+            object.needs_removal = true;
+        }
+        return;
+    }
+
+    // cut_after - последний кластер с данными: повреждённая дыра отрезается вместе со всем, что за ней
+    uint32_t previous = FileSystem::MARKER_FAT_ENTRY_FREE;
+    bool previous_is_hole = false;
+    while (true) {
+        if (FileSystem::is_hole_ref(current)) {
+            const std::optional<uint32_t> idx = hole_index(current);
+            std::string problem;
+            if (object.is_directory()) {
+                problem = "Directory '" + object.path + "' references hole " + std::to_string(current);
+            } else if (!idx || hole_table_[*idx].length_clusters == 0) {
+                problem = "'" + object.path + "' references invalid hole " + std::to_string(current);
+            } else if (previous_is_hole) {
+                problem = "'" + object.path + "' has adjacent holes at " + std::to_string(current);
+            }
+            if (!problem.empty()) {
+                stop(report_.broken_chains, problem, previous);
+                return;
+            }
+
+            const Claim claim = claim_node(hole_ranks_[*idx], hole_owners_[*idx], object_id, rank, ranking);
+            if (claim != Claim::CLAIMED) {
+                stop(claim == Claim::LOOP ? report_.broken_chains : report_.cross_linked_clusters,
+                     "'" + object.path + (claim == Claim::LOOP ? "' has a loop at hole " : "' is cross-linked at hole ") +
+                     std::to_string(current), previous);
+                return;
+            }
+
+            const FileSystem::HoleRecord &hole = hole_table_[*idx];
+            if (hole.next == FileSystem::MARKER_FAT_ENTRY_FREE) {
+                stop(report_.broken_chains, "'" + object.path + "' ends with a free link at hole " +
+                                            std::to_string(current), previous);
+                return;
+            }
+            object.logical_length += hole.length_clusters;
+            if (hole.next == FileSystem::MARKER_FAT_ENTRY_EOF) return;
+            previous_is_hole = true;
+            current = hole.next;
+            continue;
+        }
+
+        if (FileSystem::is_shared_ref(current)) {
+            // ссылка на общий кластер: запись принадлежит цепочке, сам кластер делят несколько ссылок
+            const std::optional<uint32_t> idx = hole_index(current);
+            std::string problem;
+            if (object.is_directory()) {
+                problem = "Directory '" + object.path + "' references shared cluster " + std::to_string(current);
+            } else if (!idx || hole_table_[*idx].length_clusters < header_.data_start_cluster ||
+                       hole_table_[*idx].length_clusters >= header_.total_clusters) {
+                problem = "'" + object.path + "' references invalid shared cluster " + std::to_string(current);
+            }
+            if (!problem.empty()) {
+                stop(report_.broken_chains, problem, previous);
+                return;
+            }
+            const Claim claim = claim_node(hole_ranks_[*idx], hole_owners_[*idx], object_id, rank, ranking);
+            if (claim != Claim::CLAIMED) {
+                stop(claim == Claim::LOOP ? report_.broken_chains : report_.cross_linked_clusters,
+                     "'" + object.path + (claim == Claim::LOOP ? "' has a loop at shared cluster "
+                                                                : "' is cross-linked at shared cluster ") +
+                     std::to_string(current), previous);
+                return;
+            }
+
+            // у ссылки на общий кластер на месте длины дыры хранится номер кластера (SharedRecord)
+            const FileSystem::HoleRecord &shared = hole_table_[*idx];
+            if (!ranking) shared_refs_[shared.length_clusters].fetch_add(1, std::memory_order_relaxed);
+            ++object.logical_length;
+            if (shared.next == FileSystem::MARKER_FAT_ENTRY_EOF) return;
+            if (shared.next == FileSystem::MARKER_FAT_ENTRY_FREE) {
+                stop(report_.broken_chains, "'" + object.path + "' ends with a free link at shared cluster " +
+                                            std::to_string(current), current);
+                return;
+            }
+            previous = current;
+            previous_is_hole = false;
+            current = shared.next;
+            continue;
+        }
+
+        if (!is_chain_cluster(current)) {
+            stop(report_.broken_chains, "'" + object.path + "' references invalid cluster " + std::to_string(current),
+                 previous);
+            return;
+        }
+
+        const Claim claim = claim_node(ranks_[current], owners_[current], object_id, rank, ranking);
+        if (claim != Claim::CLAIMED) {
+            stop(claim == Claim::LOOP ? report_.broken_chains : report_.cross_linked_clusters,
+                 "'" + object.path + (claim == Claim::LOOP ? "' has a loop at cluster " : "' is cross-linked at cluster ") +
+                 std::to_string(current), previous);
+            return;
+        }
+        ++object.chain_length;
+        ++object.logical_length;
+
+        const uint32_t next = fat_table_[current];
+        if (next == FileSystem::MARKER_FAT_ENTRY_EOF) return;
+        if (next == FileSystem::MARKER_FAT_ENTRY_FREE) {
+            stop(report_.broken_chains, "'" + object.path + "' ends with a free FAT entry at cluster " +
+                                        std::to_string(current), current);
+            return;
+        }
+        previous = current;
+        previous_is_hole = false;
+        current = next;
+    }
+}
+
+void ConsistencyChecker::walk_directories() {
+    Object root;
+    root.path = "/";
+    root.is_root = true;
+    objects_.push_back(root);
+
+    // каталоги обходятся по уровням, а их записи добавляются в порядке каталогов и слотов: номера объектов,
+    // а с ними и исход пересечений цепочек, не зависят от числа потоков. Корень захватывает кластеры первым
+    std::vector<uint32_t> level{1};
+    if (header_.snapshot_dir_cluster != FileSystem::MARKER_FAT_ENTRY_FREE) {
+        Object snapshots;
+        snapshots.path = "<snapshots>";
+        snapshots.entry.type = FileSystem::EntityType::DIRECTORY;
+        snapshots.entry.first_cluster = header_.snapshot_dir_cluster;
+        snapshots.detached = true;
+        objects_.push_back(snapshots);
+        level.push_back(2);
+    }
+
+    while (!level.empty()) {
+        for (const bool ranking: {true, false}) {
+            parallel_for(level.size(), [&](const size_t i) {
+                claim_chain(level[i], objects_[level[i] - 1], ranking);
+            });
+        }
+
+        std::vector<std::vector<Object>> children(level.size());
+        parallel_for(level.size(), [&](const size_t i) {
+            const Object &directory = objects_[level[i] - 1];
+            std::vector<FileSystem::DirectoryEntry> entries;
+            uint32_t cluster = directory.is_root ? header_.root_dir_start_cluster : directory.entry.first_cluster;
+            for (uint32_t n = 0; n < directory.chain_length; ++n, cluster = fat_table_[cluster]) {
+                if (!read_directory_cluster(cluster, entries)) {
+                    add_problem(report_.broken_chains, "Cannot read cluster " + std::to_string(cluster) +
+                                                       " of directory '" + directory.path + "'");
+                    continue;
+                }
+                for (uint32_t slot = 0; slot < entries.size(); ++slot) {
+                    const auto &entry = entries[slot];
+                    if (entry.name[0] == FileSystem::ENTRY_NEVER_USED || entry.name[0] == FileSystem::ENTRY_DELETED) {
+                        continue;
+                    }
+                    Object child;
+                    child.path = (directory.is_root ? "/" : directory.path + "/") + entry_name(entry);
+                    child.dir_cluster = cluster;
+                    child.slot = slot;
+                    child.entry = entry;
+                    children[i].push_back(std::move(child));
+                }
+            }
+        });
+
+        std::vector<uint32_t> next_level;
+        for (auto &list: children) {
+            for (auto &child: list) {
+                const bool is_directory = child.is_directory();
+                objects_.push_back(std::move(child));
+                if (is_directory) next_level.push_back(static_cast<uint32_t>(objects_.size()));
+            }
+        }
+        level = std::move(next_level);
+    }
+}
+
+void ConsistencyChecker::walk_file_chains() {
+    for (const bool ranking: {true, false}) {
+        parallel_for(objects_.size(), [&](const size_t i) {
+            if (Object &object = objects_[i]; !object.is_directory()) {
+                claim_chain(static_cast<uint32_t>(i + 1), object, ranking);
+            }
+        });
+    }
+
+    for (const auto &object: objects_) {
+        if (object.is_directory()) ++report_.directories_checked;
+        else ++report_.files_checked;
+        if (!object.is_directory() && object.entry.is_inline()) ++report_.inline_files;
+    }
+}
+
+void ConsistencyChecker::check_sizes() {
+    const uint64_t cluster_size = vol_manager_.get_cluster_size();
+    for (const auto &object: objects_) {
+        if (object.is_directory() || object.needs_cut) continue;
+        if (object.entry.is_inline()) {
+            // у встроенного файла нет цепочки, а размер ограничен местом после имени
+            if (!is_end_marker(object.entry.first_cluster) ||
+                object.entry.file_size_bytes > object.entry.inline_capacity()) {
+                add_problem(report_.size_mismatches, "Inline file '" + object.path + "' has size " +
+                                                     std::to_string(object.entry.file_size_bytes) + " B and " +
+                                                     std::to_string(object.logical_length) + " clusters");
+            }
+            continue;
+        }
+        const uint64_t needed = (object.entry.file_size_bytes + cluster_size - 1) / cluster_size;
+        if (needed != object.logical_length) {
+            add_problem(report_.size_mismatches, "'" + object.path + "' has size " +
+                                                 std::to_string(object.entry.file_size_bytes) + " B but " +
+                                                 std::to_string(object.logical_length) + " clusters");
+        }
+    }
+}
+
+std::vector<uint64_t> ConsistencyChecker::build_expected_bitmap() const {
+    const size_t words = (header_.total_clusters + BITS_PER_WORD - 1) / BITS_PER_WORD;
+    std::vector<uint64_t> expected(disk_bitmap_.size(), 0);
+    parallel_for(words, [&](const size_t w) {
+        uint64_t word = 0;
+        const uint64_t first = static_cast<uint64_t>(w) * BITS_PER_WORD;
+        const uint64_t last = std::min<uint64_t>(first + BITS_PER_WORD, header_.total_clusters);
+        for (uint64_t c = first; c < last; ++c) {
+            if (c < header_.data_start_cluster || is_in_use(static_cast<uint32_t>(c))) {
+                word |= uint64_t{1} << (c - first);
+            }
+        }
+        expected[w] = word;
+    });
+    return expected;
+}
+
+void ConsistencyChecker::compare_allocation() {
+    const std::vector<uint64_t> expected = build_expected_bitmap();
+    const size_t words = (header_.total_clusters + BITS_PER_WORD - 1) / BITS_PER_WORD;
+    const uint32_t tail_bits = header_.total_clusters % BITS_PER_WORD;
+    const uint64_t tail_mask = tail_bits == 0 ? ~uint64_t{0} : (uint64_t{1} << tail_bits) - 1;
+
+    // Сравнение блоками: большая часть тома совпадает, поэтому сначала считается OR от XOR по блоку
+    // (цикл без ветвлений векторизуется компилятором), и только отличающиеся блоки разбираются по битам.
+    std::atomic<uint64_t> leaked{0};
+    std::atomic<uint64_t> unmarked{0};
+    const size_t blocks = (words + COMPARE_BLOCK_WORDS - 1) / COMPARE_BLOCK_WORDS;
+    parallel_for(blocks, [&](const size_t block) {
+        const size_t begin = block * COMPARE_BLOCK_WORDS;
+        const size_t end = std::min(words, begin + COMPARE_BLOCK_WORDS);
+        uint64_t any_diff = 0;
+        for (size_t w = begin; w < end; ++w) {
+            any_diff |= disk_bitmap_[w] ^ expected[w];
+        }
+        if (any_diff == 0) return;
+
+        uint64_t local_leaked = 0;
+        uint64_t local_unmarked = 0;
+        for (size_t w = begin; w < end; ++w) {
+            const uint64_t mask = w + 1 == words ? tail_mask : ~uint64_t{0};
+            uint64_t extra = disk_bitmap_[w] & ~expected[w] & mask;
+            local_unmarked += __builtin_popcountll(expected[w] & ~disk_bitmap_[w] & mask);
+            while (extra != 0) {
+                const uint32_t bit = __builtin_ctzll(extra);
+                extra &= extra - 1;
+                // занятый в FAT, но ничей кластер считается потерянным (orphaned), а не утёкшим
+                if (fat_table_[w * BITS_PER_WORD + bit] == FileSystem::MARKER_FAT_ENTRY_FREE) ++local_leaked;
+            }
+        }
+        leaked += local_leaked;
+        unmarked += local_unmarked;
+    });
+
+    std::atomic<uint64_t> orphaned{0};
+    const uint32_t data_clusters = header_.total_clusters - header_.data_start_cluster;
+    parallel_for((data_clusters + BITS_PER_WORD - 1) / BITS_PER_WORD, [&](const size_t chunk) {
+        const uint64_t first = header_.data_start_cluster + chunk * BITS_PER_WORD;
+        const uint64_t last = std::min<uint64_t>(first + BITS_PER_WORD, header_.total_clusters);
+        uint64_t local = 0;
+        for (uint64_t c = first; c < last; ++c) {
+            if (fat_table_[c] != FileSystem::MARKER_FAT_ENTRY_FREE && !is_in_use(static_cast<uint32_t>(c))) {
+                ++local;
+            }
+        }
+        orphaned += local;
+    });
+
+    report_.leaked_clusters = leaked;
+    report_.unmarked_clusters = unmarked;
+    report_.orphaned_clusters = orphaned;
+    if (leaked != 0) {
+        report_.problems.push_back(std::to_string(leaked.load()) + " cluster(s) marked used in bitmap but not referenced");
+    }
+    if (unmarked != 0) {
+        report_.problems.push_back(std::to_string(unmarked.load()) + " referenced cluster(s) marked free in bitmap");
+    }
+    if (orphaned != 0) {
+        report_.problems.push_back(std::to_string(orphaned.load()) + " orphaned cluster(s) allocated in FAT");
+    }
+}
+
+void ConsistencyChecker::count_orphaned_holes() {
+    std::atomic<uint64_t> orphaned{0};
+    parallel_for(hole_table_.size(), [&](const size_t i) {
+        if (hole_table_[i].length_clusters != 0 && hole_owners_[i].load(std::memory_order_relaxed) == 0) ++orphaned;
+    });
+    report_.orphaned_holes = orphaned;
+    if (orphaned != 0) {
+        report_.problems.push_back(std::to_string(orphaned.load()) + " orphaned hole record(s) in hole table");
+    }
+}
+
+uint32_t ConsistencyChecker::expected_refcount(const uint32_t cluster_idx) const {
+    return (owners_[cluster_idx].load(std::memory_order_relaxed) != 0 ? 1 : 0) +
+           shared_refs_[cluster_idx].load(std::memory_order_relaxed);
+}
+
+void ConsistencyChecker::check_refcounts() {
+    if (refcounts_.empty()) return;
+    // 0 - счётчик не ведётся и ссылка не больше одной; иначе счётчик точный и кластер не принадлежит каталогу
+    for (uint32_t c = 0; c < header_.total_clusters; ++c) {
+        const uint32_t refs = expected_refcount(c);
+        const uint32_t stored = refcounts_[c];
+        const uint32_t owner = owners_[c].load(std::memory_order_relaxed);
+        const bool directory = owner != 0 && objects_[owner - 1].is_directory();
+        if (stored == 0 ? refs <= 1 : refs == stored && !directory) continue;
+        add_problem(report_.refcount_mismatches, "Cluster " + std::to_string(c) + " has refcount " +
+                                                 std::to_string(stored) + " but " + std::to_string(refs) +
+                                                 " reference(s)");
+    }
+}
+
+void ConsistencyChecker::trim_chain(const Object &object, const uint64_t needed) {
+    uint32_t node = object.entry.first_cluster;
+    uint64_t logical = 0;
+    while (!is_end_marker(node)) {
+        if (FileSystem::is_hole_ref(node)) {
+            FileSystem::HoleRecord &hole = hole_table_[*hole_index(node)];
+            if (logical + hole.length_clusters >= needed) {
+                hole.length_clusters = static_cast<uint32_t>(needed - logical);
+                hole.next = FileSystem::MARKER_FAT_ENTRY_EOF;
+                return;
+            }
+            logical += hole.length_clusters;
+            node = hole.next;
+        } else {
+            if (++logical == needed) {
+                end_chain_at(node);
+                return;
+            }
+            node = next_node(node);
+        }
+    }
+}
+
+bool ConsistencyChecker::repair() {
+    const uint32_t cluster_size = vol_manager_.get_cluster_size();
+    std::vector<const Object *> changed_entries;
+
+    // 1. обрезаем повреждённые цепочки и приводим длину цепочек к размерам файлов
+    for (auto &object: objects_) {
+        bool entry_changed = false;
+        if (object.needs_removal) {
+            object.entry.name.fill(FileSystem::ENTRY_NEVER_USED);
+            object.entry.name[0] = FileSystem::ENTRY_DELETED;
+            entry_changed = true;
+        } else if (object.needs_cut) {
+            if (object.cut_after == FileSystem::MARKER_FAT_ENTRY_FREE) {
+                if (object.is_directory()) {
+                    // первый кластер каталога чужой или невалиден - восстановить записи невозможно
+                    object.entry.name.fill(FileSystem::ENTRY_NEVER_USED);
+                    object.entry.name[0] = FileSystem::ENTRY_DELETED;
+                    object.needs_removal = true;
+                } else {
+                    object.entry.first_cluster = FileSystem::MARKER_FAT_ENTRY_FREE;
+                    object.entry.file_size_bytes = 0;
+                }
+                entry_changed = !object.is_root;
+            } else {
+                end_chain_at(object.cut_after);
+                if (!object.is_directory()) {
+                    // логическая длина до cut_after: дыры за ним отрезаны вместе с кластером
+                    uint64_t kept = 0;
+                    for (uint32_t node = object.entry.first_cluster;; ) {
+                        if (FileSystem::is_hole_ref(node)) {
+                            kept += hole_table_[*hole_index(node)].length_clusters;
+                            node = hole_table_[*hole_index(node)].next;
+                            continue;
+                        }
+                        ++kept;
+                        if (node == object.cut_after) break;
+                        node = next_node(node);
+                    }
+                    const uint64_t capacity = kept * cluster_size;
+                    if (object.entry.file_size_bytes > capacity) {
+                        object.entry.file_size_bytes = static_cast<uint32_t>(capacity);
+                        entry_changed = true;
+                    }
+                }
+            }
+        } else if (!object.is_directory() && object.entry.is_inline() && is_end_marker(object.entry.first_cluster)) {
+            if (object.entry.file_size_bytes > object.entry.inline_capacity()) {
+                object.entry.file_size_bytes = object.entry.inline_capacity();
+                entry_changed = true;
+            }
+        } else if (!object.is_directory()) {
+            // пометка встроенного файла при наличии цепочки недостоверна - данные берутся из цепочки
+            if (object.entry.is_inline()) {
+                object.entry.reserved[0] &= static_cast<uint8_t>(~FileSystem::ENTRY_ATTR_INLINE);
+                entry_changed = true;
+            }
+            const uint64_t needed = (object.entry.file_size_bytes + cluster_size - 1) / cluster_size;
+            if (needed > object.logical_length) {
+                object.entry.file_size_bytes = static_cast<uint32_t>(object.logical_length * cluster_size);
+                entry_changed = true;
+            } else if (needed < object.logical_length) {
+                if (needed == 0) {
+                    object.entry.first_cluster = FileSystem::MARKER_FAT_ENTRY_FREE;
+                    entry_changed = true;
+                } else {
+                    trim_chain(object, needed);
+                }
+            }
+        }
+        if (object.detached) {
+            // каталог снимков восстановить нельзя - том остаётся без снимков, их кластеры освободятся как потерянные
+            if (object.needs_removal) header_.snapshot_dir_cluster = FileSystem::MARKER_FAT_ENTRY_FREE;
+        } else if (entry_changed) {
+            changed_entries.push_back(&object);
+        }
+    }
+
+    // 2. заново определяем владельцев кластеров по исправленным цепочкам
+    reset_owners();
+    parallel_for(objects_.size(), [this](const size_t i) {
+        Object &object = objects_[i];
+        if (object.needs_removal) return;
+        const uint32_t object_id = static_cast<uint32_t>(i + 1);
+        uint32_t current = object.is_root ? header_.root_dir_start_cluster : object.entry.first_cluster;
+        while (!is_end_marker(current)) {
+            uint32_t expected = 0;
+            if (FileSystem::is_hole_ref(current) || FileSystem::is_shared_ref(current)) {
+                const std::optional<uint32_t> idx = hole_index(current);
+                if (!idx || !hole_owners_[*idx].compare_exchange_strong(expected, object_id,
+                                                                       std::memory_order_relaxed)) break;
+                if (FileSystem::is_shared_ref(current) && hole_table_[*idx].length_clusters < header_.total_clusters) {
+                    shared_refs_[hole_table_[*idx].length_clusters].fetch_add(1, std::memory_order_relaxed);
+                }
+                current = hole_table_[*idx].next;
+                continue;
+            }
+            if (!is_chain_cluster(current) ||
+                !owners_[current].compare_exchange_strong(expected, object_id, std::memory_order_relaxed)) break;
+            current = fat_table_[current];
+        }
+    });
+
+    // 3. освобождаем потерянные записи FAT и таблицы дыр, перестраиваем битовую карту и счётчики ссылок
+    for (uint32_t c = header_.data_start_cluster; c < header_.total_clusters; ++c) {
+        if (fat_table_[c] != FileSystem::MARKER_FAT_ENTRY_FREE && !is_in_use(c)) {
+            fat_table_[c] = FileSystem::MARKER_FAT_ENTRY_FREE;
+        } else if (owners_[c].load(std::memory_order_relaxed) == 0 && is_in_use(c)) {
+            // кластер остался только у ссылок: ни одна цепочка не проходит через него сама
+            fat_table_[c] = FileSystem::MARKER_FAT_ENTRY_EOF;
+        }
+    }
+    if (!refcounts_.empty()) {
+        for (uint32_t c = 0; c < header_.total_clusters; ++c) {
+            const uint32_t refs = expected_refcount(c);
+            const uint32_t owner = owners_[c].load(std::memory_order_relaxed);
+            const bool directory = owner != 0 && objects_[owner - 1].is_directory();
+            // единственная ссылка сохраняет счётчик, если он вёлся: кластер остаётся кандидатом дедупликации
+            refcounts_[c] = refs >= 2 || (refs == 1 && refcounts_[c] != 0 && !directory) ? refs : 0;
+        }
+    }
+    for (size_t i = 0; i < hole_table_.size(); ++i) {
+        if (hole_table_[i].length_clusters != 0 && hole_owners_[i].load(std::memory_order_relaxed) == 0) {
+            hole_table_[i] = FileSystem::HoleRecord{0, FileSystem::MARKER_FAT_ENTRY_FREE};
+        }
+    }
+    disk_bitmap_ = build_expected_bitmap();
+
+    // 4. записываем метаданные на диск
+    if (!vol_manager_.write_clusters(header_.fat_start_cluster, header_.fat_size_clusters,
+                                     reinterpret_cast<const char *>(fat_table_.data()))) {
+        output::err(output::prefix::CONSISTENCY_CHECKER_ERROR) << "Failed to write repaired FAT" << std::endl;
+        return false;
+    }
+    if (!vol_manager_.write_clusters(header_.bitmap_start_cluster, header_.bitmap_size_cluster,
+                                     reinterpret_cast<const char *>(disk_bitmap_.data()))) {
+        output::err(output::prefix::CONSISTENCY_CHECKER_ERROR) << "Failed to write repaired bitmap" << std::endl;
+        return false;
+    }
+    if (!hole_table_.empty()) {
+        std::vector<char> raw(static_cast<size_t>(header_.hole_table_size_clusters) * cluster_size, 0);
+        std::memcpy(raw.data(), hole_table_.data(), hole_table_.size() * sizeof(FileSystem::HoleRecord));
+        if (!vol_manager_.write_clusters(header_.hole_table_start_cluster, header_.hole_table_size_clusters,
+                                         raw.data())) {
+            output::err(output::prefix::CONSISTENCY_CHECKER_ERROR) << "Failed to write repaired hole table" <<
+                    std::endl;
+            return false;
+        }
+    }
+
+    if (!refcounts_.empty() &&
+        !vol_manager_.write_clusters(header_.refcount_table_start_cluster, header_.refcount_table_size_clusters,
+                                     reinterpret_cast<const char *>(refcounts_.data()))) {
+        output::err(output::prefix::CONSISTENCY_CHECKER_ERROR) << "Failed to write repaired refcount table" <<
+                std::endl;
+        return false;
+    }
+
+    std::vector<char> buffer(cluster_size);
+    for (const Object *object: changed_entries) {
+        // запись правится на месте в исходном кластере, будь то обычный каталог или лист дерева
+        if (!vol_manager_.read_cluster(object->dir_cluster, buffer.data())) {
+            output::err(output::prefix::CONSISTENCY_CHECKER_ERROR) << "Failed to re-read directory cluster " <<
+                    object->dir_cluster << std::endl;
+            return false;
+        }
+        std::memcpy(buffer.data() + FileSystem::directory_slot_offset(buffer.data(), object->slot), &object->entry,
+                    sizeof(FileSystem::DirectoryEntry));
+        if (!vol_manager_.write_cluster(object->dir_cluster, buffer.data())) {
+            output::err(output::prefix::CONSISTENCY_CHECKER_ERROR) << "Failed to write directory cluster " <<
+                    object->dir_cluster << std::endl;
+            return false;
+        }
+        ++report_.repaired_entries;
+    }
+
+    // 5. счётчики свободного места по исправленной битовой карте
+    if (!store_free_counters()) return false;
+
+    // 6. суммы оставшихся повреждённых кластеров (переписанные выше метаданные уже получили новые)
+    return reseal_checksums();
+}
@@ -0,0 +1,37 @@
+#include "../include/core_mutex.h"
+
+void CoreMutex::lock() {
+    if (held_exclusively()) {
+        ++depth_;
+        return;
+    }
+    ++exclusive_waiting_;
+    mutex_.lock();
+    --exclusive_waiting_;
+    owner_.store(std::this_thread::get_id());
+    depth_ = 1;
+}
+
+void CoreMutex::unlock() {
+    if (--depth_ > 0) return;
+    owner_.store(std::thread::id());
+    mutex_.unlock();
+}
+
+void CoreMutex::lock_shared() {
+    if (held_exclusively()) {
+        ++depth_;
+        return;
+    }
+    // дописывающие потоки не должны бесконечно откладывать открытие, закрытие и остальные операции
+    while (exclusive_waiting_.load() != 0) std::this_thread::yield();
+    mutex_.lock_shared();
+}
+
+void CoreMutex::unlock_shared() {
+    if (held_exclusively()) {
+        unlock();
+        return;
+    }
+    mutex_.unlock_shared();
+}
@@ -0,0 +1,341 @@
+#include "../include/crc32c.h"
+
+#include <array>
+#include <cstring>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define CRC32C_HAVE_SSE42 1
+#define CRC32C_AVX512_TARGET __attribute__((target("avx512f,vpclmulqdq,pclmul,sse4.2")))
+#endif
+
+#if defined(__aarch64__) && defined(__linux__) && (defined(__GNUC__) || defined(__clang__))
+#include <arm_acle.h>
+#include <asm/hwcap.h>
+#include <sys/auxv.h>
+#define CRC32C_HAVE_ARMV8 1
+#if defined(__clang__)
+#define CRC32C_ARMV8_TARGET __attribute__((target("crc")))
+#else
+#define CRC32C_ARMV8_TARGET __attribute__((target("+crc")))
+#endif
+#endif
+
+namespace {
+    constexpr uint32_t POLY = 0x82F63B78; // отражённый полином Кастаньоли
+
+    // --- Табличная реализация --- //
+    using Tables = std::array<std::array<uint32_t, 256>, 8>;
+
+    const Tables &slicing_tables() {
+        static const Tables tables = [] {
+            Tables t{};
+            for (uint32_t n = 0; n < 256; ++n) {
+                uint32_t crc = n;
+                for (int k = 0; k < 8; ++k) crc = crc & 1 ? (crc >> 1) ^ POLY : crc >> 1;
+                t[0][n] = crc;
+            }
+            for (uint32_t n = 0; n < 256; ++n) {
+                for (size_t k = 1; k < 8; ++k) t[k][n] = (t[k - 1][n] >> 8) ^ t[0][t[k - 1][n] & 0xFF];
+            }
+            return t;
+        }();
+        return tables;
+    }
+
+    uint32_t compute_table(const unsigned char *next, size_t size, uint32_t crc) {
+        const Tables &t = slicing_tables();
+        crc = ~crc;
+        while (size >= 8) {
+            uint64_t word;
+            std::memcpy(&word, next, sizeof(word));
+            // порядок байт little-endian: младший байт слова - первый байт данных
+            word ^= crc;
+            crc = t[7][word & 0xFF] ^ t[6][(word >> 8) & 0xFF] ^ t[5][(word >> 16) & 0xFF] ^
+                  t[4][(word >> 24) & 0xFF] ^ t[3][(word >> 32) & 0xFF] ^ t[2][(word >> 40) & 0xFF] ^
+                  t[1][(word >> 48) & 0xFF] ^ t[0][word >> 56];
+            next += 8;
+            size -= 8;
+        }
+        while (size--) crc = (crc >> 8) ^ t[0][(crc ^ *next++) & 0xFF];
+        return ~crc;
+    }
+
+#if defined(CRC32C_HAVE_SSE42) || defined(CRC32C_HAVE_ARMV8)
+    // --- Аппаратные реализации --- //
+    // данные делятся на три потока, которые считаются одновременно (задержка инструкции crc32 - 3 такта),
+    // затем результаты объединяются сдвигом CRC на длину потока нулевых байт
+    constexpr size_t LONG_BLOCK = 1360; // длина потока в длинном проходе: три потока покрывают 4080 байт кластера
+    constexpr size_t SHORT_BLOCK = 256; // длина потока в коротком проходе
+
+    using ShiftTable = std::array<std::array<uint32_t, 256>, 4>;
+    using Matrix = std::array<uint32_t, 32>; // оператор над GF(2): столбец n - образ бита n
+
+    // умножение матрицы над GF(2) на вектор
+    uint32_t gf2_matrix_times(const Matrix &mat, uint32_t vec) {
+        uint32_t sum = 0;
+        for (size_t n = 0; vec != 0; vec >>= 1, ++n) {
+            if (vec & 1) sum ^= mat[n];
+        }
+        return sum;
+    }
+
+    // композиция операторов: сначала b, затем a
+    Matrix gf2_matrix_multiply(const Matrix &a, const Matrix &b) {
+        Matrix result{};
+        for (size_t n = 0; n < 32; ++n) result[n] = gf2_matrix_times(a, b[n]);
+        return result;
+    }
+
+    // таблица оператора "дописать length нулевых байт"
+    ShiftTable make_shift_table(size_t length) {
+        Matrix power{}; // оператор для одного нулевого бита
+        power[0] = POLY;
+        for (size_t n = 1; n < 32; ++n) power[n] = 1u << (n - 1);
+        for (int bit = 0; bit < 3; ++bit) power = gf2_matrix_multiply(power, power); // один байт
+
+        Matrix op{}; // тождественный оператор
+        for (size_t n = 0; n < 32; ++n) op[n] = 1u << n;
+        for (; length != 0; length >>= 1) {
+            if (length & 1) op = gf2_matrix_multiply(power, op);
+            power = gf2_matrix_multiply(power, power);
+        }
+
+        ShiftTable table{};
+        for (uint32_t n = 0; n < 256; ++n) {
+            table[0][n] = gf2_matrix_times(op, n);
+            table[1][n] = gf2_matrix_times(op, n << 8);
+            table[2][n] = gf2_matrix_times(op, n << 16);
+            table[3][n] = gf2_matrix_times(op, n << 24);
+        }
+        return table;
+    }
+
+    uint32_t shift(const ShiftTable &table, const uint32_t crc) {
+        return table[0][crc & 0xFF] ^ table[1][(crc >> 8) & 0xFF] ^ table[2][(crc >> 16) & 0xFF] ^
+               table[3][crc >> 24];
+    }
+
+    const ShiftTable &long_shift() {
+        static const ShiftTable table = make_shift_table(LONG_BLOCK);
+        return table;
+    }
+
+    const ShiftTable &short_shift() {
+        static const ShiftTable table = make_shift_table(SHORT_BLOCK);
+        return table;
+    }
+
+    uint64_t load64(const unsigned char *p) {
+        uint64_t word;
+        std::memcpy(&word, p, sizeof(word));
+        return word;
+    }
+#endif
+
+#ifdef CRC32C_HAVE_SSE42
+    __attribute__((target("sse4.2")))
+    uint64_t stream3_sse42(const unsigned char *&next, const size_t block, uint64_t crc0,
+                           const ShiftTable &table) {
+        uint64_t crc1 = 0, crc2 = 0;
+        const unsigned char *end = next + block;
+        do {
+            crc0 = _mm_crc32_u64(crc0, load64(next));
+            crc1 = _mm_crc32_u64(crc1, load64(next + block));
+            crc2 = _mm_crc32_u64(crc2, load64(next + 2 * block));
+            next += 8;
+        } while (next < end);
+        crc0 = shift(table, static_cast<uint32_t>(crc0)) ^ crc1;
+        crc0 = shift(table, static_cast<uint32_t>(crc0)) ^ crc2;
+        next += 2 * block;
+        return crc0;
+    }
+
+    __attribute__((target("sse4.2")))
+    uint32_t compute_sse42(const unsigned char *next, size_t size, const uint32_t crc) {
+        uint64_t crc0 = ~crc;
+        while (size != 0 && (reinterpret_cast<uintptr_t>(next) & 7) != 0) {
+            crc0 = _mm_crc32_u8(static_cast<uint32_t>(crc0), *next++);
+            --size;
+        }
+        for (; size >= 3 * LONG_BLOCK; size -= 3 * LONG_BLOCK) {
+            crc0 = stream3_sse42(next, LONG_BLOCK, crc0, long_shift());
+        }
+        for (; size >= 3 * SHORT_BLOCK; size -= 3 * SHORT_BLOCK) {
+            crc0 = stream3_sse42(next, SHORT_BLOCK, crc0, short_shift());
+        }
+        for (; size >= 8; size -= 8, next += 8) crc0 = _mm_crc32_u64(crc0, load64(next));
+        while (size--) crc0 = _mm_crc32_u8(static_cast<uint32_t>(crc0), *next++);
+        return ~static_cast<uint32_t>(crc0);
+    }
+
+    // --- Свёртка умножением без переноса (AVX-512 VPCLMULQDQ) --- //
+    // блок в 128 бит сдвигается вперёд на D бит умножением половин на x^(64+D) mod P и x^D mod P;
+    // произведения не длиннее 96 бит и ложатся на блок, отстоящий на D бит. Четыре регистра по 512 бит
+    // обрабатывают 256 байт за проход, остаток (последний блок и хвост) досчитывается инструкцией crc32
+
+    // x^n mod P в отражённом представлении (бит j - коэффициент при x^(31-j))
+    uint32_t xpow_mod(size_t n) {
+        uint32_t value = 0x80000000;
+        while (n--) value = value & 1 ? (value >> 1) ^ POLY : value >> 1;
+        return value;
+    }
+
+    // множители свёртки на distance_bits для младшей (старшие степени) и старшей половин блока;
+    // показатель уменьшен на 1, так как произведение отражённых 64-битных чисел сдвинуто на бит
+    struct FoldConstant {
+        int64_t low_half;
+        int64_t high_half;
+    };
+
+    FoldConstant fold_constant(const size_t distance_bits) {
+        return {static_cast<int64_t>(static_cast<uint64_t>(xpow_mod(64 + distance_bits - 1)) << 32),
+                static_cast<int64_t>(static_cast<uint64_t>(xpow_mod(distance_bits - 1)) << 32)};
+    }
+
+    struct FoldConstants {
+        FoldConstant by16; // сдвиг на 16 байт
+        FoldConstant by64; // сдвиг на 64 байта
+        FoldConstant by256; // сдвиг на 256 байт
+    };
+
+    const FoldConstants &fold_constants() {
+        static const FoldConstants constants{fold_constant(128), fold_constant(512), fold_constant(2048)};
+        return constants;
+    }
+
+    CRC32C_AVX512_TARGET
+    __m512i broadcast(const FoldConstant &k) {
+        return _mm512_set_epi64(k.high_half, k.low_half, k.high_half, k.low_half, k.high_half, k.low_half,
+                                k.high_half, k.low_half);
+    }
+
+    CRC32C_AVX512_TARGET
+    __m512i fold512(const __m512i x, const __m512i k, const __m512i next) {
+        return _mm512_ternarylogic_epi64(_mm512_clmulepi64_epi128(x, k, 0x00), _mm512_clmulepi64_epi128(x, k, 0x11),
+                                         next, 0x96);
+    }
+
+    CRC32C_AVX512_TARGET
+    __m128i fold128(const __m128i x, const __m128i k, const __m128i next) {
+        return _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x, k, 0x00), _mm_clmulepi64_si128(x, k, 0x11)), next);
+    }
+
+    CRC32C_AVX512_TARGET
+    uint32_t compute_avx512(const unsigned char *next, size_t size, const uint32_t crc) {
+        if (size < 256) return compute_sse42(next, size, crc);
+        const FoldConstants &k = fold_constants();
+
+        // начальное значение CRC складывается с первыми четырьмя байтами данных
+        __m512i x0 = _mm512_xor_si512(_mm512_loadu_si512(next), _mm512_maskz_set1_epi32(1, static_cast<int>(~crc)));
+        __m512i x1 = _mm512_loadu_si512(next + 64);
+        __m512i x2 = _mm512_loadu_si512(next + 128);
+        __m512i x3 = _mm512_loadu_si512(next + 192);
+        next += 256;
+        size -= 256;
+
+        const __m512i by256 = broadcast(k.by256);
+        for (; size >= 256; next += 256, size -= 256) {
+            x0 = fold512(x0, by256, _mm512_loadu_si512(next));
+            x1 = fold512(x1, by256, _mm512_loadu_si512(next + 64));
+            x2 = fold512(x2, by256, _mm512_loadu_si512(next + 128));
+            x3 = fold512(x3, by256, _mm512_loadu_si512(next + 192));
+        }
+
+        const __m512i by64 = broadcast(k.by64);
+        __m512i x = fold512(fold512(fold512(x0, by64, x1), by64, x2), by64, x3);
+        for (; size >= 64; next += 64, size -= 64) x = fold512(x, by64, _mm512_loadu_si512(next));
+
+        alignas(64) __m128i lanes[4];
+        _mm512_store_si512(lanes, x);
+        const __m128i by16 = _mm_set_epi64x(k.by16.high_half, k.by16.low_half);
+        __m128i a = fold128(fold128(fold128(lanes[0], by16, lanes[1]), by16, lanes[2]), by16, lanes[3]);
+        for (; size >= 16; next += 16, size -= 16) {
+            a = fold128(a, by16, _mm_loadu_si128(reinterpret_cast<const __m128i *>(next)));
+        }
+
+        // последний блок - сообщение с тем же остатком, что и обработанные данные
+        uint64_t crc0 = _mm_crc32_u64(0, static_cast<uint64_t>(_mm_cvtsi128_si64(a)));
+        crc0 = _mm_crc32_u64(crc0, static_cast<uint64_t>(_mm_extract_epi64(a, 1)));
+        for (; size >= 8; size -= 8, next += 8) crc0 = _mm_crc32_u64(crc0, load64(next));
+        while (size--) crc0 = _mm_crc32_u8(static_cast<uint32_t>(crc0), *next++);
+        return ~static_cast<uint32_t>(crc0);
+    }
+#endif
+
+#ifdef CRC32C_HAVE_ARMV8
+    CRC32C_ARMV8_TARGET
+    uint32_t stream3_armv8(const unsigned char *&next, const size_t block, uint32_t crc0, const ShiftTable &table) {
+        uint32_t crc1 = 0, crc2 = 0;
+        const unsigned char *end = next + block;
+        do {
+            crc0 = __crc32cd(crc0, load64(next));
+            crc1 = __crc32cd(crc1, load64(next + block));
+            crc2 = __crc32cd(crc2, load64(next + 2 * block));
+            next += 8;
+        } while (next < end);
+        crc0 = shift(table, crc0) ^ crc1;
+        crc0 = shift(table, crc0) ^ crc2;
+        next += 2 * block;
+        return crc0;
+    }
+
+    CRC32C_ARMV8_TARGET
+    uint32_t compute_armv8(const unsigned char *next, size_t size, const uint32_t crc) {
+        uint32_t crc0 = ~crc;
+        while (size != 0 && (reinterpret_cast<uintptr_t>(next) & 7) != 0) {
+            crc0 = __crc32cb(crc0, *next++);
+            --size;
+        }
+        for (; size >= 3 * LONG_BLOCK; size -= 3 * LONG_BLOCK) {
+            crc0 = stream3_armv8(next, LONG_BLOCK, crc0, long_shift());
+        }
+        for (; size >= 3 * SHORT_BLOCK; size -= 3 * SHORT_BLOCK) {
+            crc0 = stream3_armv8(next, SHORT_BLOCK, crc0, short_shift());
+        }
+        for (; size >= 8; size -= 8, next += 8) crc0 = __crc32cd(crc0, load64(next));
+        while (size--) crc0 = __crc32cb(crc0, *next++);
+        return ~crc0;
+    }
+#endif
+
+    using ComputeFn = uint32_t (*)(const unsigned char *, size_t, uint32_t);
+
+    struct Implementation {
+        ComputeFn compute;
+        const char *name;
+    };
+
+    Implementation select_implementation() {
+#ifdef CRC32C_HAVE_SSE42
+        if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("vpclmulqdq") &&
+            __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.2")) {
+            return {compute_avx512, "avx512-vpclmulqdq"};
+        }
+        if (__builtin_cpu_supports("sse4.2")) return {compute_sse42, "sse4.2"};
+#endif
+#ifdef CRC32C_HAVE_ARMV8
+        if (getauxval(AT_HWCAP) & HWCAP_CRC32) return {compute_armv8, "armv8"};
+#endif
+        return {compute_table, "table"};
+    }
+
+    const Implementation &active() {
+        static const Implementation implementation = select_implementation();
+        return implementation;
+    }
+}
+
+namespace crc32c {
+    uint32_t compute(const void *data, const size_t size, const uint32_t crc) {
+        return active().compute(static_cast<const unsigned char *>(data), size, crc);
+    }
+
+    uint32_t compute_portable(const void *data, const size_t size, const uint32_t crc) {
+        return compute_table(static_cast<const unsigned char *>(data), size, crc);
+    }
+
+    const char *implementation() {
+        return active().name;
+    }
+}
@@ -0,0 +1,76 @@
+#include "../include/dedup_index.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "../include/output.h"
+
+DedupIndex::DedupIndex(VolumeManager &vol_manager)
+    : vol_manager_(vol_manager), max_resident_pages_(1) {
+}
+
+bool DedupIndex::load(const FileSystem::Header &header) {
+    cache_.reset();
+    bucket_count_ = 0;
+    if (header.dedup_index_size_clusters == 0) return false;
+    cache_ = std::make_unique<MetadataCache>(vol_manager_, header.dedup_index_start_cluster,
+                                             header.dedup_index_size_clusters, max_resident_pages_);
+    bucket_count_ = header.dedup_index_size_clusters * (SLOTS_PER_PAGE / FileSystem::DEDUP_BUCKET_SLOTS);
+    return true;
+}
+
+uint32_t DedupIndex::bucket_start(const uint32_t checksum) const {
+    // старшие биты суммы выбирают корзину без деления
+    const auto bucket = static_cast<uint32_t>((static_cast<uint64_t>(checksum) * bucket_count_) >> 32);
+    return bucket * FileSystem::DEDUP_BUCKET_SLOTS;
+}
+
+std::optional<std::vector<uint32_t>> DedupIndex::lookup(const uint32_t checksum) const {
+    if (!cache_) return std::nullopt;
+    const uint32_t first = bucket_start(checksum);
+    const char *page = cache_->get_page(first / SLOTS_PER_PAGE);
+    if (!page) return std::nullopt;
+
+    uint32_t slots[FileSystem::DEDUP_BUCKET_SLOTS];
+    std::memcpy(slots, page + (first % SLOTS_PER_PAGE) * sizeof(uint32_t), sizeof(slots));
+    std::vector<uint32_t> clusters;
+    for (const uint32_t cluster_idx: slots) {
+        if (cluster_idx != FileSystem::MARKER_FAT_ENTRY_FREE) clusters.push_back(cluster_idx);
+    }
+    return clusters;
+}
+
+bool DedupIndex::insert(const uint32_t checksum, const uint32_t cluster_idx) {
+    if (!cache_) return false;
+    const uint32_t first = bucket_start(checksum);
+    char *page = cache_->get_page_for_write(first / SLOTS_PER_PAGE);
+    if (!page) {
+        output::err(output::prefix::DEDUP_INDEX_ERROR) << "Failed to update bucket of checksum " << std::hex <<
+                checksum << std::dec << std::endl;
+        return false;
+    }
+
+    auto *bucket = reinterpret_cast<uint32_t *>(page + (first % SLOTS_PER_PAGE) * sizeof(uint32_t));
+    uint32_t slots[FileSystem::DEDUP_BUCKET_SLOTS];
+    std::memcpy(slots, bucket, sizeof(slots));
+    if (std::find(std::begin(slots), std::end(slots), cluster_idx) != std::end(slots)) return true;
+    // пустая ячейка, иначе вытесняется ячейка, выбранная младшими битами суммы
+    const auto empty = std::find(std::begin(slots), std::end(slots), FileSystem::MARKER_FAT_ENTRY_FREE);
+    const size_t slot = empty != std::end(slots) ? static_cast<size_t>(empty - std::begin(slots))
+                                                 : checksum % FileSystem::DEDUP_BUCKET_SLOTS;
+    std::memcpy(bucket + slot, &cluster_idx, sizeof(cluster_idx));
+    return true;
+}
+
+bool DedupIndex::flush() const {
+    return !cache_ || cache_->flush();
+}
+
+void DedupIndex::set_max_resident_pages(const size_t max_resident_pages) {
+    max_resident_pages_ = max_resident_pages;
+    if (cache_) cache_->set_max_resident_pages(max_resident_pages);
+}
+
+MetadataCache::Stats DedupIndex::cache_stats() const {
+    return cache_ ? cache_->stats() : MetadataCache::Stats{};
+}
@@ -0,0 +1,87 @@
+#include "../include/defragmenter.h"
+
+#include <algorithm>
+#include <chrono>
+
+#include "../include/output.h"
+
+Defragmenter::Defragmenter(FileSystemCore &fs_core) : fs_core_(fs_core) {
+}
+
+Defragmenter::~Defragmenter() {
+    stop();
+}
+
+bool Defragmenter::start(const uint32_t clusters_per_second) {
+    if (status().running) {
+        output::warn(output::prefix::DEFRAGMENTER_WARNING) << "Defragmentation is already running" << std::endl;
+        return false;
+    }
+    if (!fs_core_.isMounted()) {
+        output::err(output::prefix::DEFRAGMENTER_ERROR) << "Filesystem not mounted" << std::endl;
+        return false;
+    }
+    if (worker_.joinable()) worker_.join();
+
+    stop_requested_ = false;
+    {
+        std::lock_guard lock(status_mutex_);
+        status_ = Status{};
+        status_.running = true;
+    }
+    worker_ = std::thread(&Defragmenter::run, this, clusters_per_second);
+    return true;
+}
+
+void Defragmenter::stop() {
+    {
+        std::lock_guard lock(status_mutex_);
+        stop_requested_ = true;
+    }
+    stop_cv_.notify_all();
+    if (worker_.joinable()) worker_.join();
+}
+
+Defragmenter::Status Defragmenter::status() const {
+    std::lock_guard lock(status_mutex_);
+    return status_;
+}
+
+void Defragmenter::run(const uint32_t clusters_per_second) {
+    FragmentationReport report = fs_core_.analyze_fragmentation();
+
+    // сначала самые фрагментированные файлы
+    std::sort(report.per_file.begin(), report.per_file.end(), [](const auto &a, const auto &b) {
+        return a.extents > b.extents;
+    });
+
+    for (const auto &file: report.per_file) {
+        if (stop_requested_) break;
+        if (file.extents <= 1) break;
+
+        {
+            std::lock_guard lock(status_mutex_);
+            status_.current_file = file.path;
+        }
+
+        // каждый файл переносится под блокировкой ядра, между файлами клиенты работают без задержек
+        const std::optional<uint32_t> moved = fs_core_.defragment_file(file.path);
+
+        std::unique_lock lock(status_mutex_);
+        if (!moved || *moved == 0) {
+            ++status_.files_skipped;
+            continue;
+        }
+        ++status_.files_defragmented;
+        status_.clusters_moved += *moved;
+
+        if (clusters_per_second != 0) {
+            const auto pause = std::chrono::microseconds(static_cast<uint64_t>(*moved) * 1000000 / clusters_per_second);
+            stop_cv_.wait_for(lock, pause, [this] { return stop_requested_.load(); });
+        }
+    }
+
+    std::lock_guard lock(status_mutex_);
+    status_.running = false;
+    status_.current_file.clear();
+}
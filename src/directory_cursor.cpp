@@ -0,0 +1,185 @@
+#include "../include/directory_cursor.h"
+
+#include <cstddef>
+#include <cstring>
+
+#include "../include/directory_tree.h"
+#include "../include/fat_manager.h"
+#include "../include/output.h"
+#include "../include/volume_manager.h"
+
+namespace {
+    constexpr size_t ENTRY_SIZE = sizeof(FileSystem::DirectoryEntry);
+
+    uint32_t read_field(const char *record, const size_t offset) {
+        uint32_t value;
+        std::memcpy(&value, record + offset, sizeof(value));
+        return value;
+    }
+}
+
+bool DirectoryCursor::EntryView::is_compressed() const {
+    return (static_cast<uint8_t>(record[offsetof(FileSystem::DirectoryEntry, reserved)]) &
+            FileSystem::ENTRY_ATTR_COMPRESSED) != 0;
+}
+
+bool DirectoryCursor::EntryView::is_inline() const {
+    return (static_cast<uint8_t>(record[offsetof(FileSystem::DirectoryEntry, reserved)]) &
+            FileSystem::ENTRY_ATTR_INLINE) != 0;
+}
+
+FileSystem::DirectoryEntry DirectoryCursor::EntryView::copy() const {
+    FileSystem::DirectoryEntry entry;
+    std::memcpy(&entry, record, ENTRY_SIZE);
+    return entry;
+}
+
+DirectoryCursor::DirectoryCursor(const VolumeManager &vol_manager, const FATManager &fat_manager,
+                                 const uint32_t dir_start_cluster)
+    : vol_manager_(vol_manager), fat_manager_(fat_manager), dir_start_cluster_(dir_start_cluster),
+      cluster_idx_(FileSystem::MARKER_FAT_ENTRY_EOF) {
+    if (is_chain_cluster(dir_start_cluster)) cluster_idx_ = dir_start_cluster;
+}
+
+bool DirectoryCursor::is_chain_cluster(const uint32_t cluster_idx) const {
+    return cluster_idx != FileSystem::MARKER_FAT_ENTRY_FREE && cluster_idx != FileSystem::MARKER_FAT_ENTRY_EOF &&
+           cluster_idx < vol_manager_.get_header().total_clusters;
+}
+
+bool DirectoryCursor::seek(const Position position) {
+    if (position & TREE_POSITION) {
+        // лист проверяется при загрузке: он должен оставаться листом дерева этого каталога
+        const auto leaf = static_cast<uint32_t>(position >> 16);
+        const auto slot = static_cast<uint32_t>(position & 0xFFFF);
+        if (slot > FileSystem::DIR_LEAF_CAPACITY) return false;
+        if (!is_chain_cluster(leaf) && (leaf != FileSystem::MARKER_FAT_ENTRY_EOF || slot != 0)) return false;
+        tree_ = true;
+        cluster_idx_ = leaf;
+        slot_ = slot;
+        loaded_ = false;
+        failed_ = false;
+        return true;
+    }
+
+    const auto ordinal = static_cast<uint32_t>(position >> 32);
+    const auto slot = static_cast<uint32_t>(position);
+    if (slot > FileSystem::DIR_ENTRIES_PER_CLUSTER) return false;
+
+    uint32_t cluster = is_chain_cluster(dir_start_cluster_) ? dir_start_cluster_ : FileSystem::MARKER_FAT_ENTRY_EOF;
+    for (uint32_t i = 0; i < ordinal; ++i) {
+        if (!is_chain_cluster(cluster)) return false;
+        const auto next = fat_manager_.get_entry(cluster);
+        if (!next) {
+            failed_ = true;
+            return false;
+        }
+        cluster = is_chain_cluster(*next) ? *next : FileSystem::MARKER_FAT_ENTRY_EOF;
+    }
+    // за последним кластером допустима только позиция конца каталога
+    if (!is_chain_cluster(cluster) && slot != 0) return false;
+
+    tree_ = false;
+    cluster_idx_ = cluster;
+    chain_ordinal_ = ordinal;
+    slot_ = slot;
+    loaded_ = false;
+    failed_ = false;
+    return true;
+}
+
+DirectoryCursor::Position DirectoryCursor::tell() const {
+    if (tree_) return TREE_POSITION | static_cast<Position>(cluster_idx_) << 16 | slot_;
+    return static_cast<Position>(chain_ordinal_) << 32 | slot_;
+}
+
+bool DirectoryCursor::load_current() {
+    if (!buffer_) buffer_ = vol_manager_.lease_cluster_buffer();
+    if (!buffer_ || !vol_manager_.read_cluster(cluster_idx_, buffer_.get())) {
+        output::err(output::prefix::DIRECTORY_MANAGER_ERROR) << "Failed to read directory cluster " << cluster_idx_ <<
+                std::endl;
+        failed_ = true;
+        return false;
+    }
+
+    if (!tree_ && FileSystem::is_directory_node(buffer_.get())) {
+        // позиция обычного каталога после его перестройки в дерево ничего не значит
+        if (chain_ordinal_ != 0 || slot_ != 0) {
+            output::err(output::prefix::DIRECTORY_MANAGER_ERROR) << "Directory " << dir_start_cluster_ <<
+                    " was rebuilt into a tree, position is stale" << std::endl;
+            failed_ = true;
+            return false;
+        }
+        const std::optional<uint32_t> leaf = DirectoryTree::descend(vol_manager_, dir_start_cluster_, prefix_,
+                                                                    buffer_.get());
+        if (!leaf) {
+            failed_ = true;
+            return false;
+        }
+        tree_ = true;
+        cluster_idx_ = *leaf;
+    }
+
+    if (tree_) {
+        const FileSystem::DirectoryNodeHeader header = DirectoryTree::read_header(buffer_.get());
+        if (header.magic != FileSystem::DIR_NODE_MAGIC || header.level != 0 ||
+            header.count > FileSystem::DIR_LEAF_CAPACITY) {
+            output::err(output::prefix::DIRECTORY_MANAGER_ERROR) << "Cluster " << cluster_idx_ <<
+                    " is not a directory tree leaf" << std::endl;
+            failed_ = true;
+            return false;
+        }
+        next_cluster_ = is_chain_cluster(header.next_leaf) ? header.next_leaf : FileSystem::MARKER_FAT_ENTRY_EOF;
+        slot_count_ = header.count;
+        records_offset_ = sizeof(FileSystem::DirectoryNodeHeader);
+    } else {
+        const auto next = fat_manager_.get_entry(cluster_idx_);
+        if (!next) {
+            failed_ = true;
+            return false;
+        }
+        next_cluster_ = is_chain_cluster(*next) ? *next : FileSystem::MARKER_FAT_ENTRY_EOF;
+        slot_count_ = FileSystem::DIR_ENTRIES_PER_CLUSTER;
+        records_offset_ = 0;
+    }
+    if (next_cluster_ != FileSystem::MARKER_FAT_ENTRY_EOF) vol_manager_.prefetch_clusters(next_cluster_, 1);
+    loaded_ = true;
+    return true;
+}
+
+std::optional<DirectoryCursor::EntryView> DirectoryCursor::next() {
+    while (!failed_ && cluster_idx_ != FileSystem::MARKER_FAT_ENTRY_EOF) {
+        if (!loaded_ && !load_current()) return std::nullopt;
+
+        while (slot_ < slot_count_) {
+            const char *record = buffer_.get() + records_offset_ + slot_ * ENTRY_SIZE;
+            ++slot_;
+            if (record[0] == FileSystem::ENTRY_NEVER_USED || record[0] == FileSystem::ENTRY_DELETED) continue;
+
+            const std::string_view name(record, strnlen(record, FileSystem::MAX_FILE_NAME));
+            if (name.compare(0, prefix_.size(), prefix_) != 0) {
+                // в дереве имена упорядочены: после имён с префиксом подходящих больше нет
+                if (tree_ && name > prefix_) {
+                    cluster_idx_ = FileSystem::MARKER_FAT_ENTRY_EOF;
+                    slot_ = 0;
+                    loaded_ = false;
+                    return std::nullopt;
+                }
+                continue;
+            }
+
+            EntryView view{};
+            view.name = name;
+            view.type = static_cast<FileSystem::EntityType>(record[offsetof(FileSystem::DirectoryEntry, type)]);
+            view.first_cluster = read_field(record, offsetof(FileSystem::DirectoryEntry, first_cluster));
+            view.file_size_bytes = read_field(record, offsetof(FileSystem::DirectoryEntry, file_size_bytes));
+            view.record = record;
+            return view;
+        }
+
+        cluster_idx_ = next_cluster_;
+        ++chain_ordinal_;
+        slot_ = 0;
+        loaded_ = false;
+    }
+    return std::nullopt;
+}
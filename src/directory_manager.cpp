@@ -1,7 +1,16 @@
 #include "../include/directory_manager.h"
 
+#include <algorithm>
+
 DirectoryManager::DirectoryManager(VolumeManager &vol_manager, FATManager &fat_manager, BitmapManager &bitmap_manager)
-    : vol_manager_(vol_manager), fat_manager_(fat_manager), bitmap_manager_(bitmap_manager) {
+    : vol_manager_(vol_manager), fat_manager_(fat_manager), bitmap_manager_(bitmap_manager),
+      tree_(vol_manager, fat_manager, bitmap_manager) {
+}
+
+bool DirectoryManager::is_tree(const uint32_t dir_start_cluster) const {
+    const BufferPool::Lease buffer = vol_manager_.lease_cluster_buffer();
+    return buffer && vol_manager_.read_cluster(dir_start_cluster, buffer.get()) &&
+           FileSystem::is_directory_node(buffer.get());
 }
 
 bool DirectoryManager::initialize_root_directory(const FileSystem::Header &header) const {
@@ -30,16 +39,16 @@ std::vector<FileSystem::DirectoryEntry> DirectoryManager::read_all_entries(const
                 std::endl;
         return entries;
     }
-    std::vector<char> buffer(vol_manager_.get_cluster_size());
-    if (!vol_manager_.read_cluster(dir_start_cluster, buffer.data())) {
+    const BufferPool::Lease buffer = vol_manager_.lease_cluster_buffer();
+    if (!buffer || !vol_manager_.read_cluster(dir_start_cluster, buffer.get())) {
         output::err(output::prefix::DIRECTORY_MANAGER_ERROR) << "Failed to read directory cluster " << dir_start_cluster
                 << std::endl;
         return entries;
     }
     entries.resize(FileSystem::DIR_ENTRIES_PER_CLUSTER);
-    const size_t copy_size = std::min(buffer.size(),
-                           FileSystem::DIR_ENTRIES_PER_CLUSTER * sizeof(FileSystem::DirectoryEntry));
-    std::memcpy(entries.data(), buffer.data(), copy_size);
+    const size_t copy_size = std::min<size_t>(vol_manager_.get_cluster_size(),
+                                              FileSystem::DIR_ENTRIES_PER_CLUSTER * sizeof(FileSystem::DirectoryEntry));
+    std::memcpy(entries.data(), buffer.get(), copy_size);
     return entries;
 }
 
@@ -55,13 +64,19 @@ bool DirectoryManager::write_directory_cluster(const uint32_t cluster_idx,
                 "Incorrect num of entries providing for write to cluster" << std::endl;
         return false;
     }
-    std::vector<char> buffer(vol_manager_.get_cluster_size());
-    std::memcpy(buffer.data(), entries_for_this_cluster.data(),
+    const BufferPool::Lease buffer = vol_manager_.lease_cluster_buffer();
+    if (!buffer) {
+        output::err(output::prefix::DIRECTORY_MANAGER_ERROR) << "Out of memory for directory cluster " << cluster_idx <<
+                std::endl;
+        return false;
+    }
+    std::memcpy(buffer.get(), entries_for_this_cluster.data(),
                 FileSystem::DIR_ENTRIES_PER_CLUSTER * sizeof(FileSystem::DirectoryEntry));
-    std::memset(buffer.data() + FileSystem::DIR_ENTRIES_PER_CLUSTER * sizeof(FileSystem::DirectoryEntry), 0,
-                buffer.size() - FileSystem::DIR_ENTRIES_PER_CLUSTER * sizeof(FileSystem::DirectoryEntry));
+    std::memset(buffer.get() + FileSystem::DIR_ENTRIES_PER_CLUSTER * sizeof(FileSystem::DirectoryEntry), 0,
+                vol_manager_.get_cluster_size() - FileSystem::DIR_ENTRIES_PER_CLUSTER *
+                sizeof(FileSystem::DirectoryEntry));
 
-    if (!vol_manager_.write_cluster(cluster_idx, buffer.data())) {
+    if (!vol_manager_.write_cluster(cluster_idx, buffer.get())) {
         output::err(output::prefix::DIRECTORY_MANAGER_ERROR) << "Failed to write directory cluster " << cluster_idx <<
                 std::endl;
         return false;
@@ -76,19 +91,26 @@ std::vector<FileSystem::DirectoryEntry> DirectoryManager::get_directories_list(u
         output::warn(output::prefix::DIRECTORY_MANAGER_WARNING) << "List of entries is empty" << std::endl;
         return all_entries;
     }
-    const std::list<uint32_t> cluster_chain = fat_manager_.get_cluster_chain(directory_start_cluster);
-
-    for (const uint32_t cluster_idx: cluster_chain) {
-        std::vector<FileSystem::DirectoryEntry> entries_for_this_cluster = read_all_entries(cluster_idx);
-        for (const auto &entry: entries_for_this_cluster) {
-            if (entry.name[0] != FileSystem::ENTRY_NEVER_USED && entry.name[0] != FileSystem::ENTRY_DELETED) {
-                all_entries.push_back(entry);
-            }
-        }
+    DirectoryCursor cursor(vol_manager_, fat_manager_, directory_start_cluster);
+    while (const auto view = cursor.next()) {
+        all_entries.push_back(view->copy());
     }
     return all_entries;
 }
 
+std::optional<DirectoryCursor> DirectoryManager::open_cursor(const uint32_t directory_start_cluster,
+                                                             const DirectoryCursor::Position position,
+                                                             const std::string &prefix) const {
+    DirectoryCursor cursor(vol_manager_, fat_manager_, directory_start_cluster);
+    cursor.set_prefix(prefix);
+    if (position != 0 && !cursor.seek(position)) {
+        output::err(output::prefix::DIRECTORY_MANAGER_ERROR) << "Invalid position " << position << " in directory " <<
+                directory_start_cluster << std::endl;
+        return std::nullopt;
+    }
+    return cursor;
+}
+
 std::optional<FileSystem::DirectoryEntry> DirectoryManager::find_entry(const uint32_t dir_start_cluster,
                                                                        const std::string &name) {
     if (auto location_opt = get_entry_location(dir_start_cluster, name)) {
@@ -108,6 +130,12 @@ std::optional<DirectoryManager::EntryLocation> DirectoryManager::get_entry_locat
         output::warn(output::prefix::DIRECTORY_MANAGER_WARNING) << "Cluster is free or eof" << std::endl;
         return std::nullopt;
     }
+    if (is_tree(dir_start_cluster)) {
+        const std::optional<DirectoryTree::Location> location = tree_.find(dir_start_cluster, name);
+        if (!location) return std::nullopt;
+        return EntryLocation{location->leaf_cluster, location->slot, location->entry};
+    }
+
     const std::list<uint32_t> cluster_chain = fat_manager_.get_cluster_chain(dir_start_cluster);
     char search_name_arr[FileSystem::MAX_FILE_NAME] = {0};
     strncpy(search_name_arr, name.c_str(), FileSystem::MAX_FILE_NAME - 1);
@@ -139,6 +167,9 @@ bool DirectoryManager::add_entry(const uint32_t dir_start_cluster, const FileSys
         return false;
     }
 
+    // дерево само находит повтор имени при спуске к листу
+    if (is_tree(dir_start_cluster)) return tree_.insert(dir_start_cluster, new_entry);
+
     if (find_entry(dir_start_cluster,
                    std::string(new_entry.name.data(), strnlen(new_entry.name.data(), FileSystem::MAX_FILE_NAME)))) {
         output::err(output::prefix::DIRECTORY_MANAGER_ERROR) << "Entry with name '" << new_entry.name.data() <<
@@ -163,6 +194,11 @@ bool DirectoryManager::add_entry(const uint32_t dir_start_cluster, const FileSys
         }
     }
 
+    // свободных слотов нет: длинный каталог вместо очередного кластера перестраивается в дерево
+    if (btree_threshold_clusters_ != 0 && clusters_chain.size() >= btree_threshold_clusters_) {
+        return convert_to_tree(dir_start_cluster, clusters_chain) && tree_.insert(dir_start_cluster, new_entry);
+    }
+
     const std::optional<uint32_t> new_cluster_opt = extend_directory(last_cluster_in_chain);
     if (!new_cluster_opt) {
         output::err(output::prefix::DIRECTORY_MANAGER_ERROR) << "Failed to extend directory file" << std::endl;
@@ -175,9 +211,44 @@ bool DirectoryManager::add_entry(const uint32_t dir_start_cluster, const FileSys
     return write_directory_cluster(new_cluster_idx, new_cluster_entries);
 }
 
+bool DirectoryManager::convert_to_tree(const uint32_t dir_start_cluster,
+                                       const std::list<uint32_t> &cluster_chain) const {
+    std::vector<FileSystem::DirectoryEntry> entries = get_directories_list(dir_start_cluster);
+    std::sort(entries.begin(), entries.end(),
+              [](const FileSystem::DirectoryEntry &lhs, const FileSystem::DirectoryEntry &rhs) {
+                  return DirectoryTree::entry_name(lhs.name.data()) < DirectoryTree::entry_name(rhs.name.data());
+              });
+
+    // записи уже в памяти; цепочка укорачивается до корня, дерево растёт из него заново
+    if (cluster_chain.size() > 1) {
+        const uint32_t second = *std::next(cluster_chain.begin());
+        if (!fat_manager_.set_entry(dir_start_cluster, FileSystem::MARKER_FAT_ENTRY_EOF)) return false;
+        const std::optional<std::vector<uint32_t>> released = fat_manager_.free_chain(second);
+        if (!released || !bitmap_manager_.free_clusters(*released)) {
+            output::err(output::prefix::DIRECTORY_MANAGER_ERROR) << "Failed to release chain of directory " <<
+                    dir_start_cluster << std::endl;
+            return false;
+        }
+    }
+    if (!tree_.create(dir_start_cluster)) return false;
+    // отсортированные записи заполняют листья целиком
+    for (const auto &entry: entries) {
+        if (!tree_.insert(dir_start_cluster, entry)) {
+            output::err(output::prefix::DIRECTORY_MANAGER_ERROR) << "Failed to move entry '" <<
+                    DirectoryTree::entry_name(entry.name.data()) << "' into directory tree " << dir_start_cluster <<
+                    std::endl;
+            return false;
+        }
+    }
+    output::succ(output::prefix::DIRECTORY_MANAGER) << "Directory " << dir_start_cluster << " with " <<
+            entries.size() << " entries converted to B+-tree" << std::endl;
+    return true;
+}
+
 std::optional<uint32_t> DirectoryManager::extend_directory(const uint32_t dir_last_cluster_idx) const {
-    // 1. выделяем новый кластер в битовой карте
-    const std::optional<uint32_t> new_cluster_idx_opt = bitmap_manager_.find_and_allocate_free_cluster();
+    // 1. выделяем новый кластер в битовой карте, по возможности сразу за последним кластером каталога
+    const std::optional<uint32_t> new_cluster_idx_opt = bitmap_manager_.allocate_near(
+        dir_last_cluster_idx + 1, bitmap_manager_.group_index(dir_last_cluster_idx));
     if (!new_cluster_idx_opt) {
         output::err(output::prefix::DIRECTORY_MANAGER_ERROR) << "No free clusters for extend directory" << std::endl;
         return std::nullopt;
@@ -213,6 +284,7 @@ bool DirectoryManager::remove_entry(const uint32_t dir_start_cluster, const std:
         return false;
     }
     EntryLocation location = *location_opt;
+    if (is_tree(dir_start_cluster)) return tree_.remove(dir_start_cluster, name);
 
     std::vector<FileSystem::DirectoryEntry> entries_in_cluster = read_all_entries(location.dir_cluster_idx);
 
@@ -242,6 +314,14 @@ bool DirectoryManager::update_entry(uint32_t dir_start_cluster, const std::strin
     }
 
     EntryLocation location = *location_opt;
+    if (is_tree(dir_start_cluster)) {
+        // новое имя меняет положение записи в дереве
+        if (old_name != new_name_str) {
+            return tree_.remove(dir_start_cluster, old_name) && tree_.insert(dir_start_cluster, updated_entry);
+        }
+        return tree_.replace({location.dir_cluster_idx, location.entry_offset, location.entry_data}, updated_entry);
+    }
+
     std::vector<FileSystem::DirectoryEntry> entries_in_cluster = read_all_entries(location.dir_cluster_idx);
 
     entries_in_cluster[location.entry_offset] = updated_entry;
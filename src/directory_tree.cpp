@@ -0,0 +1,361 @@
+#include "../include/directory_tree.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+
+#include "../include/bitmap_manager.h"
+#include "../include/fat_manager.h"
+#include "../include/output.h"
+#include "../include/volume_manager.h"
+
+namespace {
+    constexpr size_t ENTRY_SIZE = sizeof(FileSystem::DirectoryEntry);
+    constexpr size_t KEY_SIZE = sizeof(FileSystem::DirectoryIndexKey);
+    constexpr size_t HEADER_SIZE = sizeof(FileSystem::DirectoryNodeHeader);
+
+    std::string_view key_name(const FileSystem::DirectoryIndexKey &key) {
+        return DirectoryTree::entry_name(key.name.data());
+    }
+
+    std::string_view record_name(const FileSystem::DirectoryEntry &entry) {
+        return DirectoryTree::entry_name(entry.name.data());
+    }
+
+    bool is_live_record(const char *record) {
+        return record[0] != FileSystem::ENTRY_NEVER_USED && record[0] != FileSystem::ENTRY_DELETED;
+    }
+
+    FileSystem::DirectoryNodeHeader node_header(const uint16_t level, const uint32_t next_leaf,
+                                                const uint32_t chain_tail) {
+        return FileSystem::DirectoryNodeHeader{FileSystem::DIR_NODE_MAGIC, level, 0, next_leaf, chain_tail};
+    }
+}
+
+DirectoryTree::DirectoryTree(VolumeManager &vol_manager, FATManager &fat_manager, BitmapManager &bitmap_manager)
+    : vol_manager_(vol_manager), fat_manager_(fat_manager), bitmap_manager_(bitmap_manager) {
+}
+
+FileSystem::DirectoryNodeHeader DirectoryTree::read_header(const char *node) {
+    FileSystem::DirectoryNodeHeader header{};
+    std::memcpy(&header, node, HEADER_SIZE);
+    return header;
+}
+
+std::string_view DirectoryTree::entry_name(const char *record) {
+    return {record, strnlen(record, FileSystem::MAX_FILE_NAME)};
+}
+
+std::optional<uint32_t> DirectoryTree::descend(const VolumeManager &vol_manager, const uint32_t root_cluster,
+                                               const std::string_view name, char *buffer,
+                                               std::vector<uint32_t> *path) {
+    const uint32_t total_clusters = vol_manager.get_header().total_clusters;
+    uint32_t node = root_cluster;
+    for (uint32_t depth = 0; depth < FileSystem::DIR_BTREE_MAX_DEPTH; ++depth) {
+        if (node == FileSystem::MARKER_FAT_ENTRY_FREE || node >= total_clusters ||
+            !vol_manager.read_cluster(node, buffer)) {
+            output::err(output::prefix::DIRECTORY_MANAGER_ERROR) << "Failed to read directory tree node " << node <<
+                    std::endl;
+            return std::nullopt;
+        }
+        const FileSystem::DirectoryNodeHeader header = read_header(buffer);
+        if (header.magic != FileSystem::DIR_NODE_MAGIC ||
+            header.count > (header.level == 0 ? FileSystem::DIR_LEAF_CAPACITY : FileSystem::DIR_INDEX_CAPACITY)) {
+            output::err(output::prefix::DIRECTORY_MANAGER_ERROR) << "Cluster " << node <<
+                    " is not a valid directory tree node" << std::endl;
+            return std::nullopt;
+        }
+        if (header.level == 0) return node;
+
+        if (path) path->push_back(node);
+        // последний ключ, не больший name; если такого нет - первый потомок
+        uint32_t low = 0;
+        uint32_t high = header.count;
+        while (low < high) {
+            const uint32_t mid = (low + high) / 2;
+            const char *key = buffer + FileSystem::DIR_NODE_KEYS_OFFSET + mid * KEY_SIZE;
+            if (entry_name(key) <= name) low = mid + 1;
+            else high = mid;
+        }
+        const size_t child_offset = low == 0
+                                        ? FileSystem::DIR_NODE_FIRST_CHILD_OFFSET
+                                        : FileSystem::DIR_NODE_KEYS_OFFSET + (low - 1) * KEY_SIZE +
+                                          offsetof(FileSystem::DirectoryIndexKey, child);
+        std::memcpy(&node, buffer + child_offset, sizeof(node));
+    }
+    output::err(output::prefix::DIRECTORY_MANAGER_ERROR) << "Directory tree " << root_cluster <<
+            " is deeper than " << FileSystem::DIR_BTREE_MAX_DEPTH << " levels" << std::endl;
+    return std::nullopt;
+}
+
+std::vector<FileSystem::DirectoryEntry> DirectoryTree::leaf_entries(const char *leaf) {
+    const FileSystem::DirectoryNodeHeader header = read_header(leaf);
+    std::vector<FileSystem::DirectoryEntry> entries;
+    entries.reserve(header.count + 1);
+    for (uint32_t slot = 0; slot < header.count; ++slot) {
+        const char *record = leaf + HEADER_SIZE + slot * ENTRY_SIZE;
+        if (!is_live_record(record)) continue; // запись, помеченная fsck удалённой, выпадает при перезаписи листа
+        FileSystem::DirectoryEntry entry;
+        std::memcpy(&entry, record, ENTRY_SIZE);
+        entries.push_back(entry);
+    }
+    return entries;
+}
+
+std::vector<FileSystem::DirectoryIndexKey> DirectoryTree::index_keys(const char *node) {
+    const FileSystem::DirectoryNodeHeader header = read_header(node);
+    std::vector<FileSystem::DirectoryIndexKey> keys(header.count);
+    if (header.count > 0) std::memcpy(keys.data(), node + FileSystem::DIR_NODE_KEYS_OFFSET, header.count * KEY_SIZE);
+    return keys;
+}
+
+bool DirectoryTree::write_leaf(const uint32_t cluster, const FileSystem::DirectoryNodeHeader &header,
+                               const FileSystem::DirectoryEntry *entries, const size_t count) const {
+    const BufferPool::Lease buffer = vol_manager_.lease_cluster_buffer();
+    if (!buffer) return false;
+    FileSystem::DirectoryNodeHeader leaf_header = header;
+    leaf_header.count = static_cast<uint16_t>(count);
+    std::memset(buffer.get(), 0, vol_manager_.get_cluster_size());
+    std::memcpy(buffer.get(), &leaf_header, HEADER_SIZE);
+    if (count > 0) std::memcpy(buffer.get() + HEADER_SIZE, entries, count * ENTRY_SIZE);
+    if (!vol_manager_.write_cluster(cluster, buffer.get())) {
+        output::err(output::prefix::DIRECTORY_MANAGER_ERROR) << "Failed to write directory tree leaf " << cluster <<
+                std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool DirectoryTree::write_index(const uint32_t cluster, const FileSystem::DirectoryNodeHeader &header,
+                                const uint32_t first_child, const FileSystem::DirectoryIndexKey *keys,
+                                const size_t count) const {
+    const BufferPool::Lease buffer = vol_manager_.lease_cluster_buffer();
+    if (!buffer) return false;
+    FileSystem::DirectoryNodeHeader index_header = header;
+    index_header.count = static_cast<uint16_t>(count);
+    std::memset(buffer.get(), 0, vol_manager_.get_cluster_size());
+    std::memcpy(buffer.get(), &index_header, HEADER_SIZE);
+    std::memcpy(buffer.get() + FileSystem::DIR_NODE_FIRST_CHILD_OFFSET, &first_child, sizeof(first_child));
+    if (count > 0) std::memcpy(buffer.get() + FileSystem::DIR_NODE_KEYS_OFFSET, keys, count * KEY_SIZE);
+    if (!vol_manager_.write_cluster(cluster, buffer.get())) {
+        output::err(output::prefix::DIRECTORY_MANAGER_ERROR) << "Failed to write directory tree node " << cluster <<
+                std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool DirectoryTree::create(const uint32_t root_cluster) const {
+    return write_leaf(root_cluster, node_header(0, FileSystem::MARKER_FAT_ENTRY_EOF, root_cluster), nullptr, 0);
+}
+
+std::optional<DirectoryTree::Location> DirectoryTree::find(const uint32_t root_cluster,
+                                                           const std::string_view name) const {
+    const BufferPool::Lease buffer = vol_manager_.lease_cluster_buffer();
+    if (!buffer) return std::nullopt;
+    const std::optional<uint32_t> leaf = descend(vol_manager_, root_cluster, name, buffer.get());
+    if (!leaf) return std::nullopt;
+
+    const FileSystem::DirectoryNodeHeader header = read_header(buffer.get());
+    for (uint32_t slot = 0; slot < header.count; ++slot) {
+        const char *record = buffer.get() + HEADER_SIZE + slot * ENTRY_SIZE;
+        if (!is_live_record(record) || entry_name(record) != name) continue;
+        Location location{*leaf, slot, {}};
+        std::memcpy(&location.entry, record, ENTRY_SIZE);
+        return location;
+    }
+    return std::nullopt;
+}
+
+std::optional<uint32_t> DirectoryTree::allocate_node(const uint32_t root_cluster, uint32_t &tail) const {
+    // конец цепочки из заголовка корня проверяется по FAT; если он устарел, цепочка проходится целиком
+    if (tail == FileSystem::MARKER_FAT_ENTRY_EOF) {
+        const BufferPool::Lease buffer = vol_manager_.lease_cluster_buffer();
+        if (buffer && vol_manager_.read_cluster(root_cluster, buffer.get())) tail = read_header(buffer.get()).chain_tail;
+    }
+    const std::optional<uint32_t> after_tail = tail == FileSystem::MARKER_FAT_ENTRY_EOF
+                                                   ? std::nullopt
+                                                   : fat_manager_.get_entry(tail);
+    if (!after_tail || *after_tail != FileSystem::MARKER_FAT_ENTRY_EOF) {
+        const std::list<uint32_t> chain = fat_manager_.get_cluster_chain(root_cluster);
+        if (chain.empty()) {
+            output::err(output::prefix::DIRECTORY_MANAGER_ERROR) << "Cannot walk directory chain " << root_cluster <<
+                    std::endl;
+            return std::nullopt;
+        }
+        tail = chain.back();
+    }
+
+    // узел ставится за хвостом цепочки каталога, чтобы узлы дерева лежали рядом
+    const std::optional<uint32_t> cluster = bitmap_manager_.allocate_near(tail + 1, bitmap_manager_.group_index(tail));
+    if (!cluster) {
+        output::err(output::prefix::DIRECTORY_MANAGER_ERROR) << "No free clusters for directory tree node" <<
+                std::endl;
+        return std::nullopt;
+    }
+    if (!fat_manager_.append_to_chain(tail, *cluster)) {
+        bitmap_manager_.free_cluster(*cluster);
+        return std::nullopt;
+    }
+    tail = *cluster;
+    return cluster;
+}
+
+bool DirectoryTree::store_chain_tail(const uint32_t root_cluster, const uint32_t tail) const {
+    const BufferPool::Lease buffer = vol_manager_.lease_cluster_buffer();
+    if (!buffer || !vol_manager_.read_cluster(root_cluster, buffer.get())) return false;
+    FileSystem::DirectoryNodeHeader header = read_header(buffer.get());
+    header.chain_tail = tail;
+    std::memcpy(buffer.get(), &header, HEADER_SIZE);
+    return vol_manager_.write_cluster(root_cluster, buffer.get());
+}
+
+bool DirectoryTree::insert(const uint32_t root_cluster, const FileSystem::DirectoryEntry &entry) const {
+    const std::string_view name = record_name(entry);
+    const BufferPool::Lease buffer = vol_manager_.lease_cluster_buffer();
+    if (!buffer) return false;
+    std::vector<uint32_t> path;
+    const std::optional<uint32_t> leaf = descend(vol_manager_, root_cluster, name, buffer.get(), &path);
+    if (!leaf) return false;
+
+    FileSystem::DirectoryNodeHeader header = read_header(buffer.get());
+    std::vector<FileSystem::DirectoryEntry> entries = leaf_entries(buffer.get());
+    const auto position = std::lower_bound(entries.begin(), entries.end(), name,
+                                           [](const FileSystem::DirectoryEntry &lhs, const std::string_view rhs) {
+                                               return record_name(lhs) < rhs;
+                                           });
+    if (position != entries.end() && record_name(*position) == name) {
+        output::err(output::prefix::DIRECTORY_MANAGER_ERROR) << "Entry with name '" << name << "' already exists" <<
+                std::endl;
+        return false;
+    }
+    // вставка в конец последнего листа - последовательное заполнение: левый узел при делении остаётся полным
+    const bool append = position == entries.end() && header.next_leaf == FileSystem::MARKER_FAT_ENTRY_EOF;
+    entries.insert(position, entry);
+    if (entries.size() <= FileSystem::DIR_LEAF_CAPACITY) {
+        return write_leaf(*leaf, header, entries.data(), entries.size());
+    }
+
+    const size_t split = append ? entries.size() - 1 : entries.size() / 2;
+    uint32_t tail = *leaf == root_cluster ? header.chain_tail : FileSystem::MARKER_FAT_ENTRY_EOF;
+    bool success;
+    if (*leaf == root_cluster) {
+        // корень не переезжает: его записи расходятся по двум новым листьям, сам он становится внутренним узлом
+        const std::optional<uint32_t> left = allocate_node(root_cluster, tail);
+        const std::optional<uint32_t> right = left ? allocate_node(root_cluster, tail) : std::nullopt;
+        if (!right) return false;
+        FileSystem::DirectoryIndexKey separator;
+        separator.name = entries[split].name;
+        separator.child = *right;
+        success = write_leaf(*right, node_header(0, FileSystem::MARKER_FAT_ENTRY_EOF, 0), entries.data() + split,
+                             entries.size() - split) &&
+                  write_leaf(*left, node_header(0, *right, 0), entries.data(), split) &&
+                  write_index(root_cluster, node_header(1, FileSystem::MARKER_FAT_ENTRY_EOF, tail), *left,
+                              &separator, 1);
+    } else {
+        const std::optional<uint32_t> right = allocate_node(root_cluster, tail);
+        if (!right) return false;
+        FileSystem::DirectoryIndexKey separator;
+        separator.name = entries[split].name;
+        separator.child = *right;
+        FileSystem::DirectoryNodeHeader left_header = header;
+        left_header.next_leaf = *right;
+        success = write_leaf(*right, node_header(0, header.next_leaf, 0), entries.data() + split,
+                             entries.size() - split) &&
+                  write_leaf(*leaf, left_header, entries.data(), split) &&
+                  insert_separator(root_cluster, path, separator, append, tail);
+    }
+    return store_chain_tail(root_cluster, tail) && success;
+}
+
+bool DirectoryTree::insert_separator(const uint32_t root_cluster, std::vector<uint32_t> &path,
+                                     FileSystem::DirectoryIndexKey separator, const bool append,
+                                     uint32_t &tail) const {
+    const BufferPool::Lease buffer = vol_manager_.lease_cluster_buffer();
+    if (!buffer) return false;
+    while (!path.empty()) {
+        const uint32_t node = path.back();
+        path.pop_back();
+        if (!vol_manager_.read_cluster(node, buffer.get())) return false;
+        FileSystem::DirectoryNodeHeader header = read_header(buffer.get());
+        uint32_t first_child;
+        std::memcpy(&first_child, buffer.get() + FileSystem::DIR_NODE_FIRST_CHILD_OFFSET, sizeof(first_child));
+        std::vector<FileSystem::DirectoryIndexKey> keys = index_keys(buffer.get());
+        const auto position = std::upper_bound(keys.begin(), keys.end(), key_name(separator),
+                                               [](const std::string_view lhs,
+                                                  const FileSystem::DirectoryIndexKey &rhs) {
+                                                   return lhs < key_name(rhs);
+                                               });
+        keys.insert(position, separator);
+        if (keys.size() <= FileSystem::DIR_INDEX_CAPACITY) {
+            return write_index(node, header, first_child, keys.data(), keys.size());
+        }
+
+        // средний ключ уходит на уровень выше, его потомок становится первым потомком правого узла
+        const size_t middle = append ? keys.size() - 1 : keys.size() / 2;
+        const FileSystem::DirectoryIndexKey promoted = keys[middle];
+        const size_t right_count = keys.size() - middle - 1;
+        if (node == root_cluster) {
+            if (header.level + 1u >= FileSystem::DIR_BTREE_MAX_DEPTH) {
+                output::err(output::prefix::DIRECTORY_MANAGER_ERROR) << "Directory tree " << root_cluster <<
+                        " reached maximum depth" << std::endl;
+                return false;
+            }
+            const std::optional<uint32_t> left = allocate_node(root_cluster, tail);
+            const std::optional<uint32_t> right = left ? allocate_node(root_cluster, tail) : std::nullopt;
+            if (!right) return false;
+            FileSystem::DirectoryIndexKey root_key = promoted;
+            root_key.child = *right;
+            const uint16_t level = header.level;
+            return write_index(*right, node_header(level, FileSystem::MARKER_FAT_ENTRY_EOF, 0), promoted.child,
+                               keys.data() + middle + 1, right_count) &&
+                   write_index(*left, node_header(level, FileSystem::MARKER_FAT_ENTRY_EOF, 0), first_child,
+                               keys.data(), middle) &&
+                   write_index(root_cluster, node_header(static_cast<uint16_t>(level + 1), FileSystem::MARKER_FAT_ENTRY_EOF, tail), *left,
+                               &root_key, 1);
+        }
+
+        const std::optional<uint32_t> right = allocate_node(root_cluster, tail);
+        if (!right) return false;
+        if (!write_index(*right, node_header(header.level, FileSystem::MARKER_FAT_ENTRY_EOF, 0), promoted.child,
+                         keys.data() + middle + 1, right_count) ||
+            !write_index(node, header, first_child, keys.data(), middle)) {
+            return false;
+        }
+        separator = promoted;
+        separator.child = *right;
+    }
+    output::err(output::prefix::DIRECTORY_MANAGER_ERROR) << "Directory tree " << root_cluster <<
+            " has no parent for split node" << std::endl;
+    return false;
+}
+
+bool DirectoryTree::remove(const uint32_t root_cluster, const std::string_view name) const {
+    const BufferPool::Lease buffer = vol_manager_.lease_cluster_buffer();
+    if (!buffer) return false;
+    const std::optional<uint32_t> leaf = descend(vol_manager_, root_cluster, name, buffer.get());
+    if (!leaf) return false;
+
+    const FileSystem::DirectoryNodeHeader header = read_header(buffer.get());
+    std::vector<FileSystem::DirectoryEntry> entries = leaf_entries(buffer.get());
+    const auto position = std::find_if(entries.begin(), entries.end(),
+                                       [name](const FileSystem::DirectoryEntry &entry) {
+                                           return record_name(entry) == name;
+                                       });
+    if (position == entries.end()) return false;
+    entries.erase(position);
+    return write_leaf(*leaf, header, entries.data(), entries.size());
+}
+
+bool DirectoryTree::replace(const Location &location, const FileSystem::DirectoryEntry &entry) const {
+    const BufferPool::Lease buffer = vol_manager_.lease_cluster_buffer();
+    if (!buffer || !vol_manager_.read_cluster(location.leaf_cluster, buffer.get())) return false;
+    const FileSystem::DirectoryNodeHeader header = read_header(buffer.get());
+    if (header.magic != FileSystem::DIR_NODE_MAGIC || header.level != 0 || location.slot >= header.count) {
+        output::err(output::prefix::DIRECTORY_MANAGER_ERROR) << "Stale directory tree location in leaf " <<
+                location.leaf_cluster << std::endl;
+        return false;
+    }
+    std::memcpy(buffer.get() + HEADER_SIZE + location.slot * ENTRY_SIZE, &entry, ENTRY_SIZE);
+    return vol_manager_.write_cluster(location.leaf_cluster, buffer.get());
+}
@@ -1,33 +1,70 @@
 #include "../include/fat_manager.h"
 
-#include <unordered_set>
+#include <algorithm>
 
 #include "../include/output.h"
 
 FATManager::FATManager(VolumeManager &vol_manager)
-    : vol_manager_(vol_manager), total_clusters_managed_(0),
-      fat_disk_start_cluster_(0), fat_dist_clusters_count_(0) {
+    : vol_manager_(vol_manager), max_resident_pages_(FileSystem::DEFAULT_METADATA_CACHE_BYTES /
+                                                     FileSystem::CLUSTER_SIZE_BYTES),
+      total_clusters_managed_(0), fat_disk_start_cluster_(0), fat_dist_clusters_count_(0) {
 }
 
-bool FATManager::initialize_and_flush(const FileSystem::Header &header) {
+bool FATManager::attach(const FileSystem::Header &header) {
     total_clusters_managed_ = header.total_clusters;
     fat_disk_start_cluster_ = header.fat_start_cluster;
     fat_dist_clusters_count_ = header.fat_size_clusters;
 
     if (total_clusters_managed_ == 0) {
-        output::err(output::prefix::FAT_MANAGER_ERROR) <<
-                "FATManager Error: total_clusters_managed_ is 0. Cannot initialize"
-                << std::endl;
+        output::err(output::prefix::FAT_MANAGER_ERROR) << "total_clusters_managed_ is 0" << std::endl;
+        return false;
+    }
+    if (static_cast<uint64_t>(fat_dist_clusters_count_) * ENTRIES_PER_PAGE < total_clusters_managed_) {
+        output::err(output::prefix::FAT_MANAGER_ERROR) << "FAT region (" << fat_dist_clusters_count_ <<
+                " clusters) is too small for " << total_clusters_managed_ << " entries" << std::endl;
         return false;
     }
+    fat_cache_ = std::make_unique<MetadataCache>(vol_manager_, fat_disk_start_cluster_, fat_dist_clusters_count_,
+                                                 max_resident_pages_);
+
+    hole_cache_.reset();
+    hole_records_count_ = 0;
+    hole_search_hint_ = 0;
+    if (header.hole_table_size_clusters != 0) {
+        hole_cache_ = std::make_unique<MetadataCache>(vol_manager_, header.hole_table_start_cluster,
+                                                      header.hole_table_size_clusters, 1);
+        hole_records_count_ = static_cast<uint32_t>(std::min<uint64_t>(
+            static_cast<uint64_t>(header.hole_table_size_clusters) * HOLES_PER_PAGE,
+            FileSystem::FAT_RECORD_INDEX_MASK));
+    }
+
+    // ссылки на общие кластеры хранятся в таблице дыр, без неё счётчики не нужны
+    refcount_cache_.reset();
+    if (hole_cache_ && header.refcount_table_size_clusters != 0) {
+        if (static_cast<uint64_t>(header.refcount_table_size_clusters) * ENTRIES_PER_PAGE < total_clusters_managed_) {
+            output::warn(output::prefix::FAT_MANAGER_WARNING) <<
+                    "Reference count table is too small, shared clusters are disabled" << std::endl;
+        } else {
+            refcount_cache_ = std::make_unique<MetadataCache>(vol_manager_, header.refcount_table_start_cluster,
+                                                              header.refcount_table_size_clusters, 1);
+        }
+    }
+    apply_page_limits();
+    return true;
+}
 
-    fat_table_.assign(total_clusters_managed_, FileSystem::MARKER_FAT_ENTRY_FREE);
+bool FATManager::initialize_and_flush(const FileSystem::Header &header) {
+    if (!attach(header)) {
+        output::err(output::prefix::FAT_MANAGER_ERROR) << "Cannot initialize" << std::endl;
+        return false;
+    }
 
+    // том только что создан с обрезкой файла, поэтому область FAT уже заполнена нулями (MARKER_FAT_ENTRY_FREE)
     if (header.root_dir_size_clusters > 0 && header.root_dir_start_cluster < total_clusters_managed_) {
-        fat_table_[header.root_dir_start_cluster] = FileSystem::MARKER_FAT_ENTRY_EOF;
+        if (!write_raw(header.root_dir_start_cluster, FileSystem::MARKER_FAT_ENTRY_EOF)) return false;
     }
 
-    if (!write_fat_to_disk()) {
+    if (!flush()) {
         output::err(output::prefix::FAT_MANAGER_ERROR) << "FATManager Error: Failed to write initialized FAT to disk" <<
                 std::endl;
         return false;
@@ -37,44 +74,44 @@ bool FATManager::initialize_and_flush(const FileSystem::Header &header) {
 }
 
 bool FATManager::load(const FileSystem::Header &header) {
-    total_clusters_managed_ = header.total_clusters;
-    fat_disk_start_cluster_ = header.fat_start_cluster;
-    fat_dist_clusters_count_ = header.fat_size_clusters;
-
-    if (total_clusters_managed_ == 0) {
-        output::err(output::prefix::FAT_MANAGER_ERROR) << "FATManager Error: total_clusters_managed_ is 0. Cannot load"
-                << std::endl;
+    if (!attach(header)) {
+        output::err(output::prefix::FAT_MANAGER_ERROR) << "Cannot load" << std::endl;
         return false;
     }
+    output::succ(output::prefix::FAT_MANAGER) << "Loaded successfully" << std::endl;
+    return true;
+}
 
-    fat_table_.resize(total_clusters_managed_);
-
-    if (!read_fat_from_disk()) {
-        output::err(output::prefix::FAT_MANAGER_ERROR) << "FATManager Error: Failed to load FAT from disk" << std::endl;
-        return false;
-    }
+std::optional<uint32_t> FATManager::read_raw(const uint32_t cluster_idx) const {
+    const MetadataCache::LockedPage page = fat_cache_->lock_page(cluster_idx / ENTRIES_PER_PAGE, false);
+    if (!page) return std::nullopt;
+    uint32_t value;
+    std::memcpy(&value, page.data() + (cluster_idx % ENTRIES_PER_PAGE) * sizeof(uint32_t), sizeof(value));
+    return value;
+}
 
-    output::succ(output::prefix::FAT_MANAGER) << "Loaded successfully" << std::endl;
+bool FATManager::write_raw(const uint32_t cluster_idx, const uint32_t value) {
+    const MetadataCache::LockedPage page = fat_cache_->lock_page(cluster_idx / ENTRIES_PER_PAGE, true);
+    if (!page) return false;
+    std::memcpy(page.data() + (cluster_idx % ENTRIES_PER_PAGE) * sizeof(uint32_t), &value, sizeof(value));
     return true;
 }
 
 std::optional<uint32_t> FATManager::get_entry(const uint32_t cluster_idx) const {
-    if (cluster_idx >= total_clusters_managed_) {
-        output::err(output::prefix::FAT_MANAGER_ERROR) << "FATManager Error: Cluster index " << cluster_idx <<
-                " out of bounds" << std::endl;
+    if (!fat_cache_) {
+        output::err(output::prefix::FAT_MANAGER_ERROR) << "FAT is not loaded" << std::endl;
         return std::nullopt;
     }
-    if (cluster_idx >= fat_table_.size()) {
+    if (cluster_idx >= total_clusters_managed_) {
         output::err(output::prefix::FAT_MANAGER_ERROR) << "FATManager Error: Cluster index " << cluster_idx <<
-                " out of bounds for fat_table_ (size: " <<
-                fat_table_.size() << ")" << std::endl;
+                " out of bounds" << std::endl;
         return std::nullopt;
     }
-    return fat_table_[cluster_idx];
+    return read_raw(cluster_idx);
 }
 
 bool FATManager::set_entry(const uint32_t cluster_idx, const uint32_t value) {
-    if (!vol_manager_.is_open()) {
+    if (!vol_manager_.is_open() || !fat_cache_) {
         output::err(output::prefix::FAT_MANAGER_ERROR) << "FATManager Error: Volume not open" << std::endl;
         return false;
     }
@@ -85,28 +122,9 @@ bool FATManager::set_entry(const uint32_t cluster_idx, const uint32_t value) {
         return false;
     }
 
-    if (cluster_idx >= fat_table_.size()) {
-        output::err(output::prefix::FAT_MANAGER_ERROR) << "FATManager Error: Cluster index " << cluster_idx <<
-                " out of bounds for fat_table_ (size: " <<
-                fat_table_.size() << ")" << std::endl;
-        return false;
-    }
-
-    bool is_value_received = false;
-    auto old_entry = get_entry(cluster_idx);
-    if (!old_entry) {
-        output::err(output::prefix::FAT_MANAGER_ERROR) <<
-                "FATManager Error: Cannot get old value for this cluster index: " << cluster_idx << std::endl;
-        is_value_received = false;
-    } else is_value_received = true;
-    fat_table_[cluster_idx] = value;
-    if (!write_fat_to_disk()) {
+    if (!write_raw(cluster_idx, value)) {
         output::err(output::prefix::FAT_MANAGER_ERROR) <<
-                "FATManager Error: Failed to write FAT to disk after set_entry for cluster " << cluster_idx <<
-                std::endl;
-        if (is_value_received) {
-            fat_table_[cluster_idx] = *old_entry;
-        }
+                "FATManager Error: Failed to update FAT page for cluster " << cluster_idx << std::endl;
         return false;
     }
     return true;
@@ -114,69 +132,129 @@ bool FATManager::set_entry(const uint32_t cluster_idx, const uint32_t value) {
 
 std::list<uint32_t> FATManager::get_cluster_chain(const uint32_t start_cluster) const {
     std::list<uint32_t> chain;
-    if (start_cluster == FileSystem::MARKER_FAT_ENTRY_FREE || start_cluster == FileSystem::MARKER_FAT_ENTRY_EOF ||
-        start_cluster >= total_clusters_managed_) {
+    for (const uint32_t node: get_chain_nodes(start_cluster)) {
+        if (FileSystem::is_shared_ref(node)) {
+            if (const auto record = get_shared(node)) chain.push_back(record->cluster);
+        } else if (!FileSystem::is_hole_ref(node)) {
+            chain.push_back(node);
+        }
+    }
+    return chain;
+}
+
+std::vector<uint32_t> FATManager::get_chain_nodes(const uint32_t start_node) const {
+    std::vector<uint32_t> nodes;
+    if (start_node == FileSystem::MARKER_FAT_ENTRY_FREE || start_node == FileSystem::MARKER_FAT_ENTRY_EOF ||
+        (!is_record_ref(start_node) && start_node >= total_clusters_managed_)) {
         output::warn(output::prefix::FAT_MANAGER_WARNING) << "Cluster chain is empty" << std::endl;
-        return chain;
-    }
-    std::unordered_set<uint32_t> visited_;
-    uint32_t current_cluster = start_cluster;
-    while (current_cluster != FileSystem::MARKER_FAT_ENTRY_EOF &&
-           current_cluster != FileSystem::MARKER_FAT_ENTRY_FREE &&
-           current_cluster < total_clusters_managed_) {
-        visited_.insert(current_cluster);
-        chain.push_back(current_cluster);
-        if (current_cluster >= fat_table_.size()) break;
-        current_cluster = fat_table_[current_cluster];
-        if (chain.size() > total_clusters_managed_) {
+        return nodes;
+    }
+    uint32_t current_node = start_node;
+    while (current_node != FileSystem::MARKER_FAT_ENTRY_EOF &&
+           current_node != FileSystem::MARKER_FAT_ENTRY_FREE &&
+           (is_record_ref(current_node) || current_node < total_clusters_managed_)) {
+        nodes.push_back(current_node);
+        const auto next_node = get_next_node(current_node);
+        if (!next_node) break;
+        current_node = *next_node;
+        if (nodes.size() > static_cast<uint64_t>(total_clusters_managed_) + hole_records_count_) {
             output::warn(output::prefix::FAT_MANAGER_WARNING) << "Potential loop in FAT chain detected starting at " <<
-                    start_cluster
+                    start_node
                     << std::endl;
-            chain.clear();
+            nodes.clear();
             break;
         }
     }
-    return chain;
+    return nodes;
 }
 
-bool FATManager::free_chain(const uint32_t start_cluster) {
-    if (start_cluster == FileSystem::MARKER_FAT_ENTRY_FREE || start_cluster == FileSystem::MARKER_FAT_ENTRY_EOF ||
-        start_cluster >= total_clusters_managed_) {
-        output::warn(output::prefix::FAT_MANAGER_WARNING) << "Nothing to clear" << std::endl;
-        return true;
+std::optional<uint32_t> FATManager::get_next_node(const uint32_t node) const {
+    if (is_record_ref(node)) {
+        const auto record = read_record(node);
+        if (!record || record->length_clusters == 0) return std::nullopt;
+        return record->next;
     }
+    return get_entry(node);
+}
 
-    bool success = true;
+bool FATManager::set_next_node(const uint32_t node, const uint32_t next) {
+    if (!is_record_ref(node)) return set_entry(node, next);
+    std::optional<FileSystem::HoleRecord> record = read_record(node);
+    if (!record || record->length_clusters == 0) {
+        output::err(output::prefix::FAT_MANAGER_ERROR) << "Invalid record reference " << node << std::endl;
+        return false;
+    }
+    record->next = next;
+    return write_record(node, *record);
+}
 
-    std::list<uint32_t> clusters_to_free;
-    uint32_t tmp_current = start_cluster;
+std::optional<std::vector<uint32_t>> FATManager::free_chain(const uint32_t start_node) {
+    std::vector<uint32_t> released;
+    if (start_node == FileSystem::MARKER_FAT_ENTRY_FREE || start_node == FileSystem::MARKER_FAT_ENTRY_EOF ||
+        (!is_record_ref(start_node) && start_node >= total_clusters_managed_)) {
+        output::warn(output::prefix::FAT_MANAGER_WARNING) << "Nothing to clear" << std::endl;
+        return released;
+    }
 
-    while (tmp_current != FileSystem::MARKER_FAT_ENTRY_FREE && tmp_current != FileSystem::MARKER_FAT_ENTRY_EOF &&
-           tmp_current < total_clusters_managed_ && tmp_current < fat_table_.size()) {
-        clusters_to_free.push_back(tmp_current);
-        tmp_current = fat_table_[tmp_current];
-        if (clusters_to_free.size() > total_clusters_managed_) {
-            output::err(output::prefix::FAT_MANAGER_ERROR) << "Loop detected in free_chain for start_cluster " <<
-                    start_cluster <<
-                    std::endl;
-            return false;
-        }
+    const std::vector<uint32_t> nodes_to_free = get_chain_nodes(start_node);
+    if (nodes_to_free.empty()) {
+        output::err(output::prefix::FAT_MANAGER_ERROR) << "Cannot walk chain " << start_node << " to free it" <<
+                std::endl;
+        return std::nullopt;
     }
 
-    for (auto cluster_idx: clusters_to_free) {
-        if (cluster_idx < fat_table_.size()) {
-            if (!set_entry(cluster_idx, FileSystem::MARKER_FAT_ENTRY_FREE)) {
-                output::err(output::prefix::FAT_MANAGER_ERROR) << "Failed to set FAT entry to free for cluster " <<
-                        cluster_idx <<
-                        std::endl;
-                success = false;
-            }
+    for (const auto node: nodes_to_free) {
+        bool freed;
+        if (FileSystem::is_hole_ref(node)) {
+            freed = free_hole(node);
+        } else if (FileSystem::is_shared_ref(node)) {
+            // общий кластер освобождается вместе с последней ссылкой на него
+            const std::optional<FileSystem::SharedRecord> record = get_shared(node);
+            const std::optional<bool> last = record ? release_cluster(record->cluster, false) : std::nullopt;
+            freed = last && free_shared(node);
+            if (freed && *last) released.push_back(record->cluster);
         } else {
-            output::warn(output::prefix::FAT_MANAGER_WARNING) << "Invalid cluster index " << cluster_idx << std::endl;
-            success = false;
+            const std::optional<bool> last = release_cluster(node, true);
+            freed = last.has_value();
+            if (freed && *last) released.push_back(node);
+        }
+        if (!freed) {
+            output::err(output::prefix::FAT_MANAGER_ERROR) << "Failed to free FAT entry " << node <<
+                    " of chain " << start_node << std::endl;
+            return std::nullopt;
         }
     }
-    return success;
+    return released;
+}
+
+std::optional<bool> FATManager::release_cluster(const uint32_t cluster_idx, const bool direct) {
+    if (cluster_idx >= total_clusters_managed_) {
+        output::err(output::prefix::FAT_MANAGER_ERROR) << "Cluster index " << cluster_idx << " out of bounds" <<
+                std::endl;
+        return std::nullopt;
+    }
+    uint32_t refcount = 0;
+    if (refcount_cache_) {
+        const std::optional<uint32_t> stored = get_refcount(cluster_idx);
+        if (!stored) return std::nullopt;
+        refcount = *stored;
+    }
+    if (refcount >= 2) {
+        // кластер остаётся у других ссылок; цепочка, в которой он стоял сам, больше через него не проходит
+        if (!set_refcount(cluster_idx, refcount - 1)) return std::nullopt;
+        if (direct && !write_raw(cluster_idx, FileSystem::MARKER_FAT_ENTRY_EOF)) return std::nullopt;
+        return false;
+    }
+    if (refcount == 1 && !set_refcount(cluster_idx, 0)) return std::nullopt;
+    if (!write_raw(cluster_idx, FileSystem::MARKER_FAT_ENTRY_FREE)) return std::nullopt;
+    return true;
+}
+
+bool FATManager::clear_entries(const std::vector<uint32_t> &clusters) {
+    for (const uint32_t cluster_idx: clusters) {
+        if (!set_entry(cluster_idx, FileSystem::MARKER_FAT_ENTRY_FREE)) return false;
+    }
+    return true;
 }
 
 bool FATManager::append_to_chain(const uint32_t last_cluster_in_chain, const uint32_t new_cluster_idx) {
@@ -211,74 +289,235 @@ bool FATManager::append_to_chain(const uint32_t last_cluster_in_chain, const uin
     return true;
 }
 
-bool FATManager::read_fat_from_disk() {
-    if (fat_dist_clusters_count_ == 0 && fat_table_.empty()) return true;
-    if (fat_dist_clusters_count_ == 0 && !fat_table_.empty()) {
-        output::err(output::prefix::FAT_MANAGER_ERROR) <<
-                "total_clusters_managed_ is 0, but fat_table_ is not empty (size: " <<
-                fat_table_.size() << ")" << std::endl;
+bool FATManager::link_chain(const std::vector<uint32_t> &nodes) {
+    if (!vol_manager_.is_open() || !fat_cache_) {
+        output::err(output::prefix::FAT_MANAGER_ERROR) << "Volume not open" << std::endl;
         return false;
     }
+    if (nodes.empty()) return true;
+    for (const uint32_t node: nodes) {
+        const bool valid = is_record_ref(node)
+                               ? record_index(node).has_value()
+                               : node != FileSystem::MARKER_FAT_ENTRY_FREE && node < total_clusters_managed_;
+        if (!valid) {
+            output::err(output::prefix::FAT_MANAGER_ERROR) << "Invalid node " << node << " in chain to link" <<
+                    std::endl;
+            return false;
+        }
+    }
 
-    uint32_t cluster_size = vol_manager_.get_cluster_size();
-    if (cluster_size == 0) {
-        output::err(output::prefix::FAT_MANAGER_ERROR) << "Cluster size from VolumeManager is 0" << std::endl;
-        return false;
+    // старые значения нужны для отката: у кластера - запись FAT, у дыры и ссылки - следующий узел
+    std::vector<uint32_t> old_entries;
+    old_entries.reserve(nodes.size());
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        const auto old_entry = is_record_ref(nodes[i]) ? get_next_node(nodes[i]) : read_raw(nodes[i]);
+        const uint32_t value = i + 1 < nodes.size() ? nodes[i + 1] : FileSystem::MARKER_FAT_ENTRY_EOF;
+        if (!old_entry || !set_next_node(nodes[i], value)) {
+            output::err(output::prefix::FAT_MANAGER_ERROR) << "Failed to link chain of " << nodes.size() <<
+                    " nodes at " << nodes[i] << std::endl;
+            for (size_t j = old_entries.size(); j-- > 0;) set_next_node(nodes[j], old_entries[j]);
+            return false;
+        }
+        old_entries.push_back(*old_entry);
     }
+    return true;
+}
 
-    std::vector<char> raw_fat_buffer(fat_dist_clusters_count_ * cluster_size);
+std::optional<uint32_t> FATManager::record_index(const uint32_t record_ref) const {
+    if (!hole_cache_ || !is_record_ref(record_ref)) return std::nullopt;
+    const uint32_t idx = record_ref & FileSystem::FAT_RECORD_INDEX_MASK;
+    if (idx >= hole_records_count_) return std::nullopt;
+    return idx;
+}
 
-    for (uint32_t i = 0; i < fat_dist_clusters_count_; ++i) {
-        if (!vol_manager_.read_cluster(fat_disk_start_cluster_ + i, raw_fat_buffer.data() + i * cluster_size)) {
-            output::err(output::prefix::FAT_MANAGER_ERROR) << "Failed to read cluster " << (fat_disk_start_cluster_ + i)
-                    << " for FAT"
-                    << std::endl;
-            return false;
+std::optional<FileSystem::HoleRecord> FATManager::read_record(const uint32_t record_ref) const {
+    const auto idx = record_index(record_ref);
+    if (!idx) {
+        output::err(output::prefix::FAT_MANAGER_ERROR) << "Invalid record reference " << record_ref << std::endl;
+        return std::nullopt;
+    }
+    const char *page = hole_cache_->get_page(*idx / HOLES_PER_PAGE);
+    if (!page) return std::nullopt;
+    FileSystem::HoleRecord record{};
+    std::memcpy(&record, page + (*idx % HOLES_PER_PAGE) * sizeof(record), sizeof(record));
+    return record;
+}
+
+bool FATManager::write_record(const uint32_t record_ref, const FileSystem::HoleRecord &record) {
+    const auto idx = record_index(record_ref);
+    if (!idx) {
+        output::err(output::prefix::FAT_MANAGER_ERROR) << "Invalid record reference " << record_ref << std::endl;
+        return false;
+    }
+    char *page = hole_cache_->get_page_for_write(*idx / HOLES_PER_PAGE);
+    if (!page) return false;
+    std::memcpy(page + (*idx % HOLES_PER_PAGE) * sizeof(record), &record, sizeof(record));
+    return true;
+}
+
+std::optional<uint32_t> FATManager::allocate_record(const FileSystem::HoleRecord &record, const uint32_t flags) {
+    if (!hole_cache_) {
+        output::err(output::prefix::FAT_MANAGER_ERROR) << "Volume has no hole table" << std::endl;
+        return std::nullopt;
+    }
+    // записи до hole_search_hint_ заняты, поиск идёт постранично
+    for (uint32_t idx = hole_search_hint_; idx < hole_records_count_;) {
+        const char *page = hole_cache_->get_page(idx / HOLES_PER_PAGE);
+        if (!page) return std::nullopt;
+        const uint32_t page_end = std::min(hole_records_count_, (idx / HOLES_PER_PAGE + 1) * HOLES_PER_PAGE);
+        for (; idx < page_end; ++idx) {
+            FileSystem::HoleRecord existing{};
+            std::memcpy(&existing, page + (idx % HOLES_PER_PAGE) * sizeof(existing), sizeof(existing));
+            if (existing.length_clusters != 0) continue;
+
+            const uint32_t record_ref = flags | idx;
+            if (!write_record(record_ref, record)) return std::nullopt;
+            hole_search_hint_ = idx + 1;
+            return record_ref;
         }
     }
-    uint64_t fat_table_size_bytes = static_cast<uint64_t>(fat_table_.size()) * sizeof(uint32_t);
-    if (fat_table_size_bytes > raw_fat_buffer.size()) {
-        output::err(output::prefix::FAT_MANAGER_ERROR) << "fat_table_ expected size (" << fat_table_size_bytes <<
-                " bytes) is larger then raw buffer read from disk ("
-                << raw_fat_buffer.size() << " bytes)" << std::endl;
+    hole_search_hint_ = hole_records_count_;
+    output::err(output::prefix::FAT_MANAGER_ERROR) << "Hole table is full" << std::endl;
+    return std::nullopt;
+}
+
+std::optional<FileSystem::HoleRecord> FATManager::get_hole(const uint32_t hole_ref) const {
+    if (!FileSystem::is_hole_ref(hole_ref)) {
+        output::err(output::prefix::FAT_MANAGER_ERROR) << "Invalid hole reference " << hole_ref << std::endl;
+        return std::nullopt;
+    }
+    return read_record(hole_ref);
+}
+
+bool FATManager::set_hole(const uint32_t hole_ref, const FileSystem::HoleRecord &record) {
+    if (!FileSystem::is_hole_ref(hole_ref)) {
+        output::err(output::prefix::FAT_MANAGER_ERROR) << "Invalid hole reference " << hole_ref << std::endl;
         return false;
     }
-    std::memcpy(fat_table_.data(), raw_fat_buffer.data(), fat_table_size_bytes);
+    return write_record(hole_ref, record);
+}
+
+bool FATManager::free_hole(const uint32_t hole_ref) {
+    if (!set_hole(hole_ref, FileSystem::HoleRecord{0, FileSystem::MARKER_FAT_ENTRY_FREE})) return false;
+    hole_search_hint_ = std::min(hole_search_hint_, hole_ref & FileSystem::FAT_RECORD_INDEX_MASK);
     return true;
 }
 
-bool FATManager::write_fat_to_disk() const {
-    if (fat_dist_clusters_count_ == 0 && fat_table_.empty()) return true;
-    if (fat_dist_clusters_count_ == 0 && !fat_table_.empty()) {
-        output::err(output::prefix::FAT_MANAGER_ERROR) << "total_clusters_managed_ is 0, but fat_table_ is not empty" <<
+std::optional<uint32_t> FATManager::create_hole(const uint32_t length_clusters, const uint32_t next) {
+    if (length_clusters == 0) {
+        output::err(output::prefix::FAT_MANAGER_ERROR) << "Hole length cannot be zero" << std::endl;
+        return std::nullopt;
+    }
+    return allocate_record(FileSystem::HoleRecord{length_clusters, next}, FileSystem::FAT_HOLE_FLAG);
+}
+
+std::optional<uint32_t> FATManager::get_refcount(const uint32_t cluster_idx) const {
+    if (!refcount_cache_ || cluster_idx >= total_clusters_managed_) {
+        output::err(output::prefix::FAT_MANAGER_ERROR) << "No reference count for cluster " << cluster_idx <<
                 std::endl;
-        return false;
+        return std::nullopt;
     }
-    uint32_t cluster_size = vol_manager_.get_cluster_size();
-    if (cluster_size == 0) {
-        output::err(output::prefix::FAT_MANAGER_ERROR) <<
-                "FATManager Error Cluster size from VolumeManager is 0 for writing" << std::endl;
+    const char *page = refcount_cache_->get_page(cluster_idx / ENTRIES_PER_PAGE);
+    if (!page) return std::nullopt;
+    uint32_t refcount;
+    std::memcpy(&refcount, page + (cluster_idx % ENTRIES_PER_PAGE) * sizeof(uint32_t), sizeof(refcount));
+    return refcount;
+}
+
+bool FATManager::set_refcount(const uint32_t cluster_idx, const uint32_t refcount) {
+    if (!refcount_cache_ || cluster_idx >= total_clusters_managed_) {
+        output::err(output::prefix::FAT_MANAGER_ERROR) << "No reference count for cluster " << cluster_idx <<
+                std::endl;
         return false;
     }
-    std::vector<char> raw_fat_buffer(fat_dist_clusters_count_ * cluster_size, 0);
+    char *page = refcount_cache_->get_page_for_write(cluster_idx / ENTRIES_PER_PAGE);
+    if (!page) return false;
+    std::memcpy(page + (cluster_idx % ENTRIES_PER_PAGE) * sizeof(uint32_t), &refcount, sizeof(refcount));
+    return true;
+}
 
-    uint64_t fat_table_size_bytes = static_cast<uint64_t>(fat_table_.size()) * sizeof(uint32_t);
+std::optional<FileSystem::SharedRecord> FATManager::get_shared(const uint32_t shared_ref) const {
+    if (!FileSystem::is_shared_ref(shared_ref)) {
+        output::err(output::prefix::FAT_MANAGER_ERROR) << "Invalid shared reference " << shared_ref << std::endl;
+        return std::nullopt;
+    }
+    const std::optional<FileSystem::HoleRecord> record = read_record(shared_ref);
+    if (!record) return std::nullopt;
+    return FileSystem::SharedRecord{record->length_clusters, record->next};
+}
+
+std::optional<uint32_t> FATManager::create_shared(const uint32_t cluster_idx, const uint32_t next) {
+    if (cluster_idx == FileSystem::MARKER_FAT_ENTRY_FREE || cluster_idx >= total_clusters_managed_) {
+        output::err(output::prefix::FAT_MANAGER_ERROR) << "Invalid shared cluster " << cluster_idx << std::endl;
+        return std::nullopt;
+    }
+    return allocate_record(FileSystem::HoleRecord{cluster_idx, next},
+                           FileSystem::FAT_HOLE_FLAG | FileSystem::FAT_SHARED_FLAG);
+}
 
-    if (fat_table_size_bytes > raw_fat_buffer.size()) {
-        output::err(output::prefix::FAT_MANAGER_ERROR) << "fat_table_ expected size (" << fat_table_size_bytes <<
-                " bytes) is larger then disk space allocated for FAT ("
-                << raw_fat_buffer.size() << " bytes)" << std::endl;
+bool FATManager::set_shared(const uint32_t shared_ref, const FileSystem::SharedRecord &record) {
+    if (!FileSystem::is_shared_ref(shared_ref)) {
+        output::err(output::prefix::FAT_MANAGER_ERROR) << "Invalid shared reference " << shared_ref << std::endl;
         return false;
     }
+    return write_record(shared_ref, FileSystem::HoleRecord{record.cluster, record.next});
+}
 
-    std::memcpy(raw_fat_buffer.data(), fat_table_.data(), fat_table_size_bytes);
+bool FATManager::free_shared(const uint32_t shared_ref) {
+    if (!FileSystem::is_shared_ref(shared_ref) ||
+        !write_record(shared_ref, FileSystem::HoleRecord{0, FileSystem::MARKER_FAT_ENTRY_FREE})) {
+        return false;
+    }
+    hole_search_hint_ = std::min(hole_search_hint_, shared_ref & FileSystem::FAT_RECORD_INDEX_MASK);
+    return true;
+}
 
-    for (uint32_t i = 0; i < fat_dist_clusters_count_; ++i) {
-        if (!vol_manager_.write_cluster(fat_disk_start_cluster_ + i, raw_fat_buffer.data() + i * cluster_size)) {
-            output::err(output::prefix::FAT_MANAGER_ERROR) << "Failed to write cluster " << fat_disk_start_cluster_ + i
-                    << " for FAT" << std::endl;
-            return false;
-        }
+bool FATManager::flush() {
+    if (!fat_cache_) return true;
+    if (!fat_cache_->flush() || (hole_cache_ && !hole_cache_->flush()) ||
+        (refcount_cache_ && !refcount_cache_->flush())) {
+        output::err(output::prefix::FAT_MANAGER_ERROR) << "Failed to write FAT pages to disk" << std::endl;
+        return false;
     }
     return true;
 }
+
+void FATManager::set_max_resident_pages(const size_t max_resident_pages) {
+    max_resident_pages_ = max_resident_pages;
+    apply_page_limits();
+}
+
+void FATManager::apply_page_limits() const {
+    if (!fat_cache_) return;
+    const uint64_t hole_region = hole_cache_ ? hole_cache_->page_count() : 0;
+    const uint64_t refcount_region = refcount_cache_ ? refcount_cache_->page_count() : 0;
+    const uint64_t total_region = static_cast<uint64_t>(fat_dist_clusters_count_) + hole_region + refcount_region;
+    size_t reserved_pages = 0;
+    if (hole_cache_) {
+        const size_t hole_pages = std::max<size_t>(1, max_resident_pages_ * hole_region / total_region);
+        hole_cache_->set_max_resident_pages(hole_pages);
+        reserved_pages += hole_pages;
+    }
+    if (refcount_cache_) {
+        const size_t refcount_pages = std::max<size_t>(1, max_resident_pages_ * refcount_region / total_region);
+        refcount_cache_->set_max_resident_pages(refcount_pages);
+        reserved_pages += refcount_pages;
+    }
+    fat_cache_->set_max_resident_pages(max_resident_pages_ > reserved_pages ? max_resident_pages_ - reserved_pages : 1);
+}
+
+MetadataCache::Stats FATManager::cache_stats() const {
+    if (!fat_cache_) return MetadataCache::Stats{};
+    MetadataCache::Stats stats = fat_cache_->stats();
+    for (const auto *cache: {hole_cache_.get(), refcount_cache_.get()}) {
+        if (!cache) continue;
+        const MetadataCache::Stats region = cache->stats();
+        stats.resident_pages += region.resident_pages;
+        stats.max_resident_pages += region.max_resident_pages;
+        stats.total_pages += region.total_pages;
+        stats.hits += region.hits;
+        stats.misses += region.misses;
+        stats.writebacks += region.writebacks;
+    }
+    return stats;
+}
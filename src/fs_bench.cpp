@@ -0,0 +1,804 @@
+#include "crc32c.h"
+#include "fs_core.h"
+#include "lz_codec.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <iterator>
+#include <optional>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+    constexpr size_t IO_CHUNK_BYTES = 256 * 1024; // размер одного вызова read_file / write_file
+    const std::string BENCH_FILE = "bench.dat";
+    const std::string COMPRESSED_BENCH_FILE = "bench.z";
+
+    struct Options {
+        std::string volume_path = "fs_bench.img";
+        uint64_t file_mb = 64; // размер тестового файла
+        unsigned rounds = 5; // количество прогонов чтения для каждого режима
+        bool keep = false; // не удалять образ после замера
+        bool compression = false; // замер сжатия вместо контрольных сумм
+        bool direct_io = false; // сравнение O_DIRECT с вводом-выводом через кэш хоста
+        bool directories = false; // операции над большим каталогом
+        uint64_t entries = 0; // записей в каталоге; 0 - серия 1k / 100k / 1M
+        std::vector<std::string> stripe_members; // сравнение тома из одного образа с чередующимся
+        uint32_t stripe_width = FileSystem::DEFAULT_STRIPE_WIDTH_CLUSTERS;
+        std::vector<std::string> mirror_copies; // сравнение тома из одного образа с зеркальным
+        bool allocation = false; // дозапись из нескольких потоков: скорость и размещение файлов
+        unsigned max_threads = 32; // для --allocation: серия 1, 2, 4, ... до max_threads потоков
+    };
+
+    void printBenchUsage() {
+        std::cout << "Usage: fs_bench [volume_file] [--size MB] [--rounds N] [--keep] [--compression | --direct-io |\n"
+                "                --directories [--entries N] | --stripe <img>[,<img>...] [--stripe-width N] [--direct-io] |\n"
+                "                --mirror <img>[,<img>...] [--direct-io] | --allocation [--threads N]]\n";
+        std::cout << "  --size MB      - size of the test file (default: 64).\n";
+        std::cout << "  --rounds N     - sequential read passes per mode, the best one is reported (default: 5).\n";
+        std::cout << "  --keep         - keep the volume image after the run.\n";
+        std::cout << "  --compression  - measure compression ratio and throughput on log-like data instead of checksums.\n";
+        std::cout << "  --direct-io    - compare O_DIRECT volume I/O with buffered I/O instead of checksums.\n";
+        std::cout << "  --directories  - create, look up, list and prefix-query a large directory instead of checksums.\n";
+        std::cout << "  --entries N    - directory size for --directories (default: 1000, 100000 and 1000000).\n";
+        std::cout << "  --stripe LIST  - compare sequential I/O of a single image with the volume striped across\n"
+                "                   volume_file and the listed images (with --direct-io both use O_DIRECT).\n";
+        std::cout << "  --stripe-width N - clusters per stripe for --stripe (default: " <<
+                FileSystem::DEFAULT_STRIPE_WIDTH_CLUSTERS << ").\n";
+        std::cout << "  --mirror LIST  - compare sequential I/O of a single image with the volume mirrored to the\n"
+                "                   listed images; shows how reads were spread over the copies.\n";
+        std::cout << "  --allocation   - append to one file per thread under the core lock only, and in parallel in\n"
+                "                   a single area, with allocation groups and with groups plus cluster magazines;\n"
+                "                   reports MB/s with speedup over one writer, p50/p99 latency of one append\n"
+                "                   and how the files are laid out.\n";
+        std::cout << "  --threads N    - largest thread count for --allocation (default: 32).\n";
+    }
+
+    double seconds_since(const std::chrono::steady_clock::time_point started) {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    }
+
+    // пропускная способность CRC32C на буферах размером в кластер, МБ/с
+    double measure_crc(uint32_t (*compute)(const void *, size_t, uint32_t), const std::vector<char> &data) {
+        constexpr unsigned passes = 16;
+        uint32_t sink = 0;
+        const auto started = std::chrono::steady_clock::now();
+        for (unsigned pass = 0; pass < passes; ++pass) {
+            for (size_t offset = 0; offset < data.size(); offset += FileSystem::CLUSTER_SIZE_BYTES) {
+                sink ^= compute(data.data() + offset, FileSystem::CLUSTER_SIZE_BYTES, 0);
+            }
+        }
+        const double elapsed = seconds_since(started);
+        if (sink == 0x12345678) std::cout << ""; // результат используется, цикл не выбрасывается компилятором
+        return static_cast<double>(data.size()) * passes / (1024.0 * 1024.0) / elapsed;
+    }
+
+    // последовательное чтение всего файла, МБ/с; отрицательное значение - ошибка
+    double measure_read(FileSystemCore &fs, const std::string &name, const uint64_t file_bytes) {
+        const auto handle = fs.open_file(name, "r");
+        if (!handle) return -1;
+        std::vector<char> buffer(IO_CHUNK_BYTES);
+        uint64_t total = 0;
+        const auto started = std::chrono::steady_clock::now();
+        for (;;) {
+            const int64_t read = fs.read_file(*handle, buffer.data(), buffer.size());
+            if (read <= 0) break;
+            total += static_cast<uint64_t>(read);
+        }
+        const double elapsed = seconds_since(started);
+        fs.close_file(*handle);
+        if (total != file_bytes) return -1;
+        return static_cast<double>(total) / (1024.0 * 1024.0) / elapsed;
+    }
+
+    struct Latency {
+        double p50_us = 0;
+        double p99_us = 0;
+        double max_us = 0;
+    };
+
+    // перцентили задержек отдельных вызовов, мкс; samples сортируется
+    Latency summarize_latency(std::vector<double> &samples) {
+        Latency latency;
+        if (samples.empty()) return latency;
+        std::sort(samples.begin(), samples.end());
+        latency.p50_us = samples[samples.size() / 2];
+        latency.p99_us = samples[samples.size() * 99 / 100];
+        latency.max_us = samples.back();
+        return latency;
+    }
+
+    // чтение кластеров файла в случайном порядке, задержка одного вызова read_file; nullopt - ошибка
+    std::optional<Latency> measure_random_reads(FileSystemCore &fs, const std::string &name, const uint64_t file_bytes,
+                                                const unsigned reads) {
+        const auto handle = fs.open_file(name, "r");
+        if (!handle) return std::nullopt;
+        std::vector<char> buffer(FileSystem::CLUSTER_SIZE_BYTES);
+        std::vector<double> samples;
+        samples.reserve(reads);
+        std::mt19937_64 rng(7);
+        const uint64_t clusters = file_bytes / FileSystem::CLUSTER_SIZE_BYTES;
+        for (unsigned i = 0; i < reads; ++i) {
+            const uint64_t offset = rng() % clusters * FileSystem::CLUSTER_SIZE_BYTES;
+            const auto started = std::chrono::steady_clock::now();
+            if (!fs.seek(*handle, offset, FS_SEEK_SET) ||
+                fs.read_file(*handle, buffer.data(), buffer.size()) != static_cast<int64_t>(buffer.size())) {
+                fs.close_file(*handle);
+                return std::nullopt;
+            }
+            samples.push_back(seconds_since(started) * 1e6);
+        }
+        fs.close_file(*handle);
+        return summarize_latency(samples);
+    }
+
+    // запись data в новый файл (сжатый при compressed) вместе с закрытием, МБ/с; отрицательное значение - ошибка
+    double measure_write(FileSystemCore &fs, const std::string &name, const std::vector<char> &data,
+                         const bool compressed) {
+        const auto started = std::chrono::steady_clock::now();
+        auto handle = fs.open_file(name, "w");
+        if (!handle || !fs.close_file(*handle) || !fs.set_compression(name, compressed)) return -1;
+        handle = fs.open_file(name, "w");
+        if (!handle) return -1;
+        for (size_t written = 0; written < data.size();) {
+            const size_t chunk = std::min(IO_CHUNK_BYTES, data.size() - written);
+            if (fs.write_file(*handle, data.data() + written, chunk) != static_cast<int64_t>(chunk)) {
+                fs.close_file(*handle);
+                return -1;
+            }
+            written += chunk;
+        }
+        fs.close_file(*handle);
+        return static_cast<double>(data.size()) / (1024.0 * 1024.0) / seconds_since(started);
+    }
+
+    // строки журнала сервиса: повторяющийся формат с меняющимися числами, как в архивах логов
+    std::vector<char> make_log_data(const uint64_t bytes) {
+        static const char *levels[] = {"INFO", "INFO", "INFO", "DEBUG", "WARN", "ERROR"};
+        static const char *paths[] = {"/api/v1/items", "/api/v1/users", "/api/v1/orders", "/health"};
+        std::mt19937_64 rng(7);
+        std::vector<char> data;
+        data.reserve(bytes + 256);
+        char line[256];
+        uint64_t millis = 0;
+        while (data.size() < bytes) {
+            millis += rng() % 50;
+            const int length = std::snprintf(line, sizeof(line),
+                                             "2026-10-18T%02u:%02u:%02u.%03uZ %-5s [worker-%u] GET %s/%u status=%u "
+                                             "latency_ms=%u\n",
+                                             static_cast<unsigned>(millis / 3600000 % 24),
+                                             static_cast<unsigned>(millis / 60000 % 60),
+                                             static_cast<unsigned>(millis / 1000 % 60),
+                                             static_cast<unsigned>(millis % 1000), levels[rng() % 6],
+                                             static_cast<unsigned>(rng() % 16), paths[rng() % 4],
+                                             static_cast<unsigned>(rng() % 5000), rng() % 10 ? 200u : 404u,
+                                             static_cast<unsigned>(rng() % 300));
+            data.insert(data.end(), line, line + length);
+        }
+        data.resize(bytes);
+        return data;
+    }
+
+    struct CodecResult {
+        double ratio = 0; // исходный размер / сжатый
+        double compress_mbps = 0;
+        double decompress_mbps = 0;
+    };
+
+    // кодек сам по себе: сжатие и распаковка группами по COMPRESSION_GROUP_BYTES
+    CodecResult measure_codec(const std::vector<char> &data) {
+        constexpr size_t group = FileSystem::COMPRESSION_GROUP_BYTES;
+        const size_t groups = data.size() / group;
+        std::vector<char> packed(groups * lz_codec::max_compressed_size(group));
+        std::vector<size_t> packed_sizes(groups);
+        CodecResult result;
+        if (groups == 0) return result;
+
+        auto started = std::chrono::steady_clock::now();
+        size_t packed_total = 0;
+        for (size_t i = 0; i < groups; ++i) {
+            packed_sizes[i] = lz_codec::compress(data.data() + i * group, group,
+                                                 packed.data() + i * lz_codec::max_compressed_size(group),
+                                                 lz_codec::max_compressed_size(group));
+            packed_total += packed_sizes[i];
+        }
+        const double compress_seconds = seconds_since(started);
+
+        std::vector<char> unpacked(group);
+        started = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < groups; ++i) {
+            lz_codec::decompress(packed.data() + i * lz_codec::max_compressed_size(group), packed_sizes[i],
+                                 unpacked.data(), unpacked.size());
+        }
+        const double decompress_seconds = seconds_since(started);
+
+        const double megabytes = static_cast<double>(groups * group) / (1024.0 * 1024.0);
+        result.ratio = packed_total == 0 ? 0 : static_cast<double>(groups * group) / static_cast<double>(packed_total);
+        result.compress_mbps = megabytes / compress_seconds;
+        result.decompress_mbps = megabytes / decompress_seconds;
+        return result;
+    }
+
+    bool format_and_mount(FileSystemCore &fs, const Options &options) {
+        if (!fs.format(options.volume_path, options.file_mb * 2 + 16)) {
+            std::cerr << "Error: Cannot format volume '" << options.volume_path << "'" << std::endl;
+            return false;
+        }
+        if (!fs.mount(options.volume_path)) {
+            std::cerr << "Error: Cannot mount volume '" << options.volume_path << "'" << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    // занятые кластеры области данных
+    uint64_t used_clusters(const FileSystemCore &fs) {
+        const auto space = fs.get_space_info();
+        return space ? space->used_clusters() : 0;
+    }
+
+    int run_compression_bench(const Options &options) {
+        const uint64_t file_bytes = options.file_mb * 1024 * 1024;
+        const std::vector<char> data = make_log_data(file_bytes);
+
+        // 1. кодек без файловой системы
+        const CodecResult codec = measure_codec(data);
+
+        // 2. один и тот же журнал в обычном и сжатом файле
+        FileSystemCore fs;
+        if (!format_and_mount(fs, options)) return 8;
+        uint64_t used = used_clusters(fs);
+        const double plain_write = measure_write(fs, BENCH_FILE, data, false);
+        const uint64_t plain_clusters = used_clusters(fs) - used;
+        used = used_clusters(fs);
+        const double compressed_write = measure_write(fs, COMPRESSED_BENCH_FILE, data, true);
+        const uint64_t compressed_clusters = used_clusters(fs) - used;
+        if (plain_write < 0 || compressed_write < 0) {
+            std::cerr << "Error: Write of test files failed" << std::endl;
+            return 8;
+        }
+
+        // 3. последовательное чтение; файлы чередуются, чтобы кэш хоста был в равных условиях
+        double best_plain = 0, best_compressed = 0;
+        for (unsigned round = 0; round < options.rounds; ++round) {
+            const double plain = measure_read(fs, BENCH_FILE, file_bytes);
+            const double compressed = measure_read(fs, COMPRESSED_BENCH_FILE, file_bytes);
+            if (plain < 0 || compressed < 0) {
+                std::cerr << "Error: Read of test files failed" << std::endl;
+                return 8;
+            }
+            best_plain = std::max(best_plain, plain);
+            best_compressed = std::max(best_compressed, compressed);
+        }
+        fs.unmount();
+        if (!options.keep) std::remove(options.volume_path.c_str());
+
+        std::cout << "--- fs_bench: compression ---\n";
+        std::cout << "Test data:             " << options.file_mb << " MB of log lines, best of " << options.rounds <<
+                " read passes\n";
+        std::cout << "Codec ratio:           " << codec.ratio << " x\n";
+        std::cout << "Codec compress:        " << codec.compress_mbps << " MB/s\n";
+        std::cout << "Codec decompress:      " << codec.decompress_mbps << " MB/s\n";
+        std::cout << "Clusters, plain:       " << plain_clusters << "\n";
+        std::cout << "Clusters, compressed:  " << compressed_clusters << "\n";
+        std::cout << "Ratio on volume:       " << (compressed_clusters == 0
+                                                      ? 0.0
+                                                      : static_cast<double>(plain_clusters) /
+                                                        static_cast<double>(compressed_clusters)) << " x\n";
+        std::cout << "Write, plain:          " << plain_write << " MB/s\n";
+        std::cout << "Write, compressed:     " << compressed_write << " MB/s\n";
+        std::cout << "Sequential read, plain:      " << best_plain << " MB/s\n";
+        std::cout << "Sequential read, compressed: " << best_compressed << " MB/s\n";
+        std::cout << "-----------------------------\n";
+        return 0;
+    }
+
+    struct IoModeResult {
+        double write_mbps = 0;
+        double read_mbps = 0;
+        Latency random_read;
+    };
+
+    int run_direct_io_bench(const Options &options) {
+        const uint64_t file_bytes = options.file_mb * 1024 * 1024;
+        std::vector<char> data(file_bytes);
+        std::mt19937_64 rng(42);
+        for (auto &byte: data) byte = static_cast<char>(rng());
+        constexpr unsigned random_reads = 4096;
+
+        FileSystemCore fs;
+        if (!format_and_mount(fs, options)) return 8;
+        fs.unmount();
+
+        // режимы чередуются в каждом прогоне; том перемонтируется, так как режим применяется при монтировании
+        IoModeResult best[2];
+        bool direct_active = false;
+        for (unsigned round = 0; round < options.rounds; ++round) {
+            for (const bool direct: {false, true}) {
+                fs.set_direct_io(direct);
+                if (!fs.mount(options.volume_path)) {
+                    std::cerr << "Error: Cannot mount volume '" << options.volume_path << "'" << std::endl;
+                    return 8;
+                }
+                if (direct) direct_active = fs.isDirectIO();
+                const double write = measure_write(fs, BENCH_FILE, data, false);
+                const double read = measure_read(fs, BENCH_FILE, file_bytes);
+                const auto latency = measure_random_reads(fs, BENCH_FILE, file_bytes, random_reads);
+                fs.unmount();
+                if (write < 0 || read < 0 || !latency) {
+                    std::cerr << "Error: I/O on test file failed" << std::endl;
+                    return 8;
+                }
+                IoModeResult &result = best[direct ? 1 : 0];
+                result.write_mbps = std::max(result.write_mbps, write);
+                result.read_mbps = std::max(result.read_mbps, read);
+                if (round == 0 || latency->p99_us < result.random_read.p99_us) result.random_read = *latency;
+            }
+        }
+        if (!options.keep) std::remove(options.volume_path.c_str());
+
+        std::cout << "--- fs_bench: direct I/O ---\n";
+        std::cout << "Test file:             " << options.file_mb << " MB, best of " << options.rounds << " passes\n";
+        if (!direct_active) std::cout << "O_DIRECT is not available here, both modes are buffered\n";
+        const char *names[] = {"Buffered I/O", "Direct I/O"};
+        for (int mode = 0; mode < 2; ++mode) {
+            const IoModeResult &result = best[mode];
+            std::cout << names[mode] << ":\n";
+            std::cout << "  Write:                 " << result.write_mbps << " MB/s\n";
+            std::cout << "  Sequential read:       " << result.read_mbps << " MB/s\n";
+            std::cout << "  Random 4K read:        p50 " << result.random_read.p50_us << " us, p99 " <<
+                    result.random_read.p99_us << " us, max " << result.random_read.max_us << " us\n";
+        }
+        std::cout << "----------------------------\n";
+        return 0;
+    }
+
+    // последовательная запись и чтение на томе из одного образа и на томе, разложенном по options.stripe_members
+    // или зеркалированном в options.mirror_copies; чтение - после перемонтирования, чтобы данные не приходили
+    // из буфера дескриптора
+    int run_layout_bench(const Options &options) {
+        const bool mirror = !options.mirror_copies.empty();
+        const std::vector<std::string> &images = mirror ? options.mirror_copies : options.stripe_members;
+        const uint64_t file_bytes = options.file_mb * 1024 * 1024;
+        std::vector<char> data(file_bytes);
+        std::mt19937_64 rng(42);
+        for (auto &byte: data) byte = static_cast<char>(rng());
+
+        FileSystemCore fs;
+        fs.set_direct_io(options.direct_io);
+        IoModeResult best[2];
+        std::vector<VolumeManager::ImageStats> image_stats; // чтения по копиям зеркала за последний прогон
+        for (unsigned round = 0; round < options.rounds; ++round) {
+            for (const bool layered: {false, true}) {
+                const std::vector<std::string> &layout = layered ? images : std::vector<std::string>{};
+                if (!fs.set_stripe_layout(mirror ? std::vector<std::string>{} : layout, options.stripe_width) ||
+                    !fs.set_mirror_layout(mirror ? layout : std::vector<std::string>{}) ||
+                    !format_and_mount(fs, options)) {
+                    return 8;
+                }
+                const double write = measure_write(fs, BENCH_FILE, data, false);
+                fs.unmount();
+                if (!fs.mount(options.volume_path)) {
+                    std::cerr << "Error: Cannot mount volume '" << options.volume_path << "'" << std::endl;
+                    return 8;
+                }
+                const double read = measure_read(fs, BENCH_FILE, file_bytes);
+                if (layered) image_stats = fs.volume_image_stats();
+                fs.unmount();
+                if (write < 0 || read < 0) {
+                    std::cerr << "Error: I/O on test file failed" << std::endl;
+                    return 8;
+                }
+                IoModeResult &result = best[layered ? 1 : 0];
+                result.write_mbps = std::max(result.write_mbps, write);
+                result.read_mbps = std::max(result.read_mbps, read);
+            }
+        }
+        if (!options.keep) {
+            std::remove(options.volume_path.c_str());
+            for (const auto &image: images) std::remove(image.c_str());
+        }
+
+        std::cout << (mirror ? "--- fs_bench: mirroring ---\n" : "--- fs_bench: striping ---\n");
+        std::cout << "Test file:             " << options.file_mb << " MB, best of " << options.rounds << " passes, " <<
+                (options.direct_io ? "direct" : "buffered") << " I/O\n";
+        if (mirror) {
+            std::cout << "Mirrored layout:       " << images.size() + 1 << " copies\n";
+        } else {
+            std::cout << "Striped layout:        " << images.size() + 1 << " images, " << options.stripe_width <<
+                    " clusters per stripe\n";
+        }
+        const char *names[] = {"Single image", mirror ? "Mirrored" : "Striped"};
+        for (int mode = 0; mode < 2; ++mode) {
+            std::cout << names[mode] << ":\n";
+            std::cout << "  Write:                 " << best[mode].write_mbps << " MB/s\n";
+            std::cout << "  Sequential read:       " << best[mode].read_mbps << " MB/s\n";
+        }
+        if (best[0].read_mbps > 0) {
+            std::cout << "Read speedup:          " << best[1].read_mbps / best[0].read_mbps << " x\n";
+        }
+        if (mirror) {
+            for (size_t copy = 0; copy < image_stats.size(); ++copy) {
+                std::cout << "Copy " << copy << " reads:         " << image_stats[copy].read_bytes / (1024 * 1024) <<
+                        " MB in " << image_stats[copy].reads << " requests, " << image_stats[copy].service_us <<
+                        " us/cluster\n";
+            }
+        }
+        std::cout << "--------------------------\n";
+        return 0;
+    }
+
+    struct AllocationResult {
+        double mbps = 0;
+        double extents_per_file = 0;
+        double mean_extent_clusters = 0;
+        std::vector<double> append_us; // задержки отдельных вызовов write_file всех потоков, мкс
+    };
+
+    // режим замера дозаписи из нескольких потоков
+    struct AllocationMode {
+        const char *label;
+        bool parallel; // дозапись под разделяемым захватом ядра
+        bool groups;
+        bool magazines;
+    };
+
+    // threads потоков дописывают по кластеру в свои файлы tN.dat, всего file_mb; nullopt - ошибка
+    std::optional<AllocationResult> measure_parallel_appends(const Options &options, const AllocationMode &mode,
+                                                             const unsigned threads) {
+        FileSystemCore fs;
+        fs.set_allocation_groups(mode.groups);
+        fs.set_cluster_magazines(mode.magazines);
+        fs.set_parallel_appends(mode.parallel);
+        if (!format_and_mount(fs, options)) return std::nullopt;
+        const uint64_t per_thread = options.file_mb * 1024 * 1024 / threads / FileSystem::CLUSTER_SIZE_BYTES;
+        std::vector<uint32_t> handles;
+        for (unsigned t = 0; t < threads; ++t) {
+            const auto handle = fs.open_file("t" + std::to_string(t) + ".dat", "w");
+            if (!handle) return std::nullopt;
+            handles.push_back(*handle);
+        }
+
+        const std::vector<char> cluster(FileSystem::CLUSTER_SIZE_BYTES, 'a');
+        std::atomic<bool> start{false};
+        std::atomic<bool> failed{false};
+        std::vector<std::vector<double>> samples(threads);
+        std::vector<std::thread> workers;
+        for (unsigned t = 0; t < threads; ++t) {
+            workers.emplace_back([&, t] {
+                samples[t].reserve(per_thread);
+                while (!start) std::this_thread::yield();
+                for (uint64_t i = 0; i < per_thread; ++i) {
+                    const auto started = std::chrono::steady_clock::now();
+                    if (fs.write_file(handles[t], cluster.data(), cluster.size()) !=
+                        static_cast<int64_t>(cluster.size())) {
+                        failed = true;
+                        return;
+                    }
+                    samples[t].push_back(seconds_since(started) * 1e6);
+                }
+            });
+        }
+        const auto started = std::chrono::steady_clock::now();
+        start = true;
+        for (auto &worker: workers) worker.join();
+        for (const uint32_t handle: handles) failed = !fs.close_file(handle) || failed;
+        const double elapsed = seconds_since(started);
+        if (failed) return std::nullopt;
+
+        const FragmentationReport report = fs.analyze_fragmentation();
+        fs.unmount();
+        AllocationResult result;
+        result.mbps = static_cast<double>(per_thread * threads * FileSystem::CLUSTER_SIZE_BYTES) / (1024.0 * 1024.0) /
+                      elapsed;
+        for (const auto &thread_samples: samples) {
+            result.append_us.insert(result.append_us.end(), thread_samples.begin(), thread_samples.end());
+        }
+        if (report.files != 0 && report.extents != 0) {
+            result.extents_per_file = static_cast<double>(report.extents) / static_cast<double>(report.files);
+            result.mean_extent_clusters = static_cast<double>(report.clusters) / static_cast<double>(report.extents);
+        }
+        return result;
+    }
+
+    // потоки 1..max_threads пишут каждый в свой файл. Под одним замком ядра дозапись не масштабируется;
+    // под разделяемым захватом в общей области потоки ждут замок единственной группы, с группами размещения -
+    // только свои, а запас дескриптора обращается к битовой карте раз на участок: задержка дозаписи с запасом
+    // сравнивается с группами без него
+    int run_allocation_bench(const Options &options) {
+        std::cout << "--- fs_bench: parallel appends ---\n";
+        std::cout << "Test data:             " << options.file_mb << " MB in cluster-sized appends, best of " <<
+                options.rounds << " runs (layout averaged)\n";
+        std::cout << "Hardware threads:      " << std::thread::hardware_concurrency() << "\n";
+        static constexpr AllocationMode MODES[] = {
+            {"  Core lock only:        ", false, true, true},
+            {"  Single area:           ", true, false, false},
+            {"  Allocation groups:     ", true, true, false},
+            {"  Groups + magazines:    ", true, true, true},
+        };
+        static constexpr size_t MODE_COUNT = std::size(MODES);
+        double single_thread_mbps[MODE_COUNT] = {};
+        for (unsigned threads = 1; threads <= options.max_threads; threads *= 2) {
+            AllocationResult total[MODE_COUNT];
+            for (unsigned round = 0; round < options.rounds; ++round) {
+                for (size_t mode = 0; mode < MODE_COUNT; ++mode) {
+                    const auto result = measure_parallel_appends(options, MODES[mode], threads);
+                    if (!result) {
+                        std::cerr << "Error: parallel appends with " << threads << " threads failed" << std::endl;
+                        return 8;
+                    }
+                    total[mode].mbps = std::max(total[mode].mbps, result->mbps);
+                    total[mode].extents_per_file += result->extents_per_file;
+                    total[mode].mean_extent_clusters += result->mean_extent_clusters;
+                    total[mode].append_us.insert(total[mode].append_us.end(), result->append_us.begin(),
+                                                 result->append_us.end());
+                }
+            }
+            std::cout << threads << (threads == 1 ? " writer:\n" : " writers:\n");
+            for (size_t mode = 0; mode < MODE_COUNT; ++mode) {
+                if (threads == 1) single_thread_mbps[mode] = total[mode].mbps;
+                const double speedup = single_thread_mbps[mode] > 0 ? total[mode].mbps / single_thread_mbps[mode] : 0;
+                const Latency append = summarize_latency(total[mode].append_us);
+                std::cout << MODES[mode].label << total[mode].mbps << " MB/s (x" << speedup << "), append p50 " <<
+                        append.p50_us << " us, p99 " << append.p99_us << " us\n";
+                std::cout << "                         " << total[mode].extents_per_file / options.rounds <<
+                        " extents per file, mean extent " << total[mode].mean_extent_clusters / options.rounds <<
+                        " clusters\n";
+            }
+        }
+        if (!options.keep) std::remove(options.volume_path.c_str());
+        std::cout << "-----------------------------------\n";
+        return 0;
+    }
+
+    struct DirectoryResult {
+        double create_per_second = 0;
+        double lookup_us = 0; // open + close существующего файла
+        double listing_ms = 0; // полный обход курсором
+        bool listing_sorted = false;
+        uint64_t listed = 0;
+        double prefix_ms = 0; // обход с фильтром по префиксу
+        uint64_t prefix_matches = 0;
+    };
+
+    // имена вида data-0000042, каждое сотое - log-2026-00042; создаются в случайном порядке
+    std::vector<std::string> make_entry_names(const uint64_t count) {
+        std::vector<std::string> names;
+        names.reserve(count);
+        char name[32];
+        for (uint64_t i = 0; i < count; ++i) {
+            if (i % 100 == 99) std::snprintf(name, sizeof(name), "log-2026-%05u", static_cast<unsigned>(i / 100));
+            else std::snprintf(name, sizeof(name), "data-%07u", static_cast<unsigned>(i));
+            names.emplace_back(name);
+        }
+        std::shuffle(names.begin(), names.end(), std::mt19937_64(42));
+        return names;
+    }
+
+    // обход корневого каталога курсором; nullopt - ошибка
+    std::optional<uint64_t> walk_directory(FileSystemCore &fs, const std::string &prefix, bool *sorted) {
+        const auto dir_id = fs.open_directory("/", 0, prefix);
+        if (!dir_id) return std::nullopt;
+        uint64_t count = 0;
+        std::string previous;
+        if (sorted) *sorted = true;
+        while (const auto entry = fs.read_directory(*dir_id)) {
+            if (sorted && count > 0 && entry->name < previous) *sorted = false;
+            if (sorted) previous.assign(entry->name);
+            ++count;
+        }
+        fs.close_directory(*dir_id);
+        return count;
+    }
+
+    std::optional<DirectoryResult> measure_directory(const Options &options, const std::vector<std::string> &names,
+                                                     const bool tree) {
+        // лист дерева заполнен не меньше чем наполовину: до 600 байт образа на запись вместе с FAT и суммами
+        const uint64_t volume_mb = names.size() * 600 / (1024 * 1024) + 16;
+        FileSystemCore fs;
+        fs.set_directory_btree_threshold(tree ? FileSystem::DIR_BTREE_THRESHOLD_CLUSTERS : 0);
+        if (!fs.format(options.volume_path, volume_mb) || !fs.mount(options.volume_path)) {
+            std::cerr << "Error: Cannot prepare volume '" << options.volume_path << "'" << std::endl;
+            return std::nullopt;
+        }
+
+        DirectoryResult result;
+        auto started = std::chrono::steady_clock::now();
+        for (const auto &name: names) {
+            const auto handle = fs.open_file(name, "w");
+            if (!handle || !fs.close_file(*handle)) {
+                std::cerr << "Error: Cannot create '" << name << "'" << std::endl;
+                return std::nullopt;
+            }
+        }
+        result.create_per_second = static_cast<double>(names.size()) / seconds_since(started);
+
+        const size_t lookups = std::min<size_t>(names.size(), 10000);
+        std::mt19937_64 rng(7);
+        started = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < lookups; ++i) {
+            const auto handle = fs.open_file(names[rng() % names.size()], "r");
+            if (!handle || !fs.close_file(*handle)) {
+                std::cerr << "Error: Lookup failed" << std::endl;
+                return std::nullopt;
+            }
+        }
+        result.lookup_us = seconds_since(started) * 1e6 / static_cast<double>(lookups);
+
+        started = std::chrono::steady_clock::now();
+        const auto listed = walk_directory(fs, "", &result.listing_sorted);
+        result.listing_ms = seconds_since(started) * 1e3;
+        started = std::chrono::steady_clock::now();
+        const auto matches = walk_directory(fs, "log-2026", nullptr);
+        result.prefix_ms = seconds_since(started) * 1e3;
+        fs.unmount();
+        if (!options.keep) std::remove(options.volume_path.c_str());
+        if (!listed || !matches) {
+            std::cerr << "Error: Directory walk failed" << std::endl;
+            return std::nullopt;
+        }
+        result.listed = *listed;
+        result.prefix_matches = *matches;
+        return result;
+    }
+
+    int run_directory_bench(const Options &options) {
+        // линейный каталог вставляет за O(n) чтений кластеров: для сравнения берутся только небольшие размеры
+        constexpr uint64_t linear_max_entries = 10000;
+        const std::vector<uint64_t> sizes = options.entries != 0
+                                                ? std::vector<uint64_t>{options.entries}
+                                                : std::vector<uint64_t>{1000, 100000, 1000000};
+
+        std::cout << "--- fs_bench: directories ---\n";
+        for (const uint64_t size: sizes) {
+            const std::vector<std::string> names = make_entry_names(size);
+            for (const bool tree: {false, true}) {
+                if (!tree && size > linear_max_entries) continue;
+                const auto result = measure_directory(options, names, tree);
+                if (!result) return 8;
+                std::cout << size << " entries, " << (tree ? "B+-tree" : "linear") << ":\n";
+                std::cout << "  Create:                " << result->create_per_second << " entries/s\n";
+                std::cout << "  Lookup (open+close):   " << result->lookup_us << " us\n";
+                std::cout << "  Full listing:          " << result->listing_ms << " ms, " << result->listed <<
+                        " entries" << (result->listing_sorted ? ", sorted" : "") << "\n";
+                std::cout << "  Prefix 'log-2026':     " << result->prefix_ms << " ms, " << result->prefix_matches <<
+                        " matches\n";
+            }
+        }
+        std::cout << "-----------------------------\n";
+        return 0;
+    }
+
+    int run_checksum_bench(const Options &options) {
+        const uint64_t file_bytes = options.file_mb * 1024 * 1024;
+
+        // 1. CRC32C сама по себе
+        std::vector<char> data(IO_CHUNK_BYTES);
+        std::mt19937_64 rng(42);
+        for (auto &byte: data) byte = static_cast<char>(rng());
+        const double hw_mbps = measure_crc(crc32c::compute, data);
+        const double table_mbps = measure_crc(crc32c::compute_portable, data);
+
+        // 2. том с тестовым файлом; половина тома остаётся под метаданные и запас
+        FileSystemCore fs;
+        if (!format_and_mount(fs, options)) return 8;
+        const auto handle = fs.open_file(BENCH_FILE, "w+");
+        if (!handle) {
+            std::cerr << "Error: Cannot create test file" << std::endl;
+            return 8;
+        }
+        for (uint64_t written = 0; written < file_bytes;) {
+            const uint64_t chunk = std::min<uint64_t>(data.size(), file_bytes - written);
+            if (fs.write_file(*handle, data.data(), chunk) != static_cast<int64_t>(chunk)) {
+                std::cerr << "Error: Write of test file failed" << std::endl;
+                return 8;
+            }
+            written += chunk;
+        }
+        fs.close_file(*handle);
+
+        // 3. последовательное чтение с проверкой сумм и без; режимы чередуются, чтобы кэш хоста был в равных условиях
+        measure_read(fs, BENCH_FILE, file_bytes); // прогрев
+        double best_off = 0, best_on = 0;
+        for (unsigned round = 0; round < options.rounds; ++round) {
+            fs.set_checksum_verification(false);
+            const double off = measure_read(fs, BENCH_FILE, file_bytes);
+            fs.set_checksum_verification(true);
+            const double on = measure_read(fs, BENCH_FILE, file_bytes);
+            if (off < 0 || on < 0) {
+                std::cerr << "Error: Read of test file failed" << std::endl;
+                return 8;
+            }
+            best_off = std::max(best_off, off);
+            best_on = std::max(best_on, on);
+        }
+        fs.unmount();
+        if (!options.keep) std::remove(options.volume_path.c_str());
+
+        const double overhead = best_off > 0 ? (best_off - best_on) / best_off * 100.0 : 0;
+        std::cout << "--- fs_bench: checksum overhead ---\n";
+        std::cout << "CRC32C implementation: " << crc32c::implementation() << "\n";
+        std::cout << "CRC32C (selected):     " << hw_mbps << " MB/s\n";
+        std::cout << "CRC32C (table):        " << table_mbps << " MB/s\n";
+        std::cout << "Test file:             " << options.file_mb << " MB, best of " << options.rounds << " passes\n";
+        std::cout << "Sequential read, verification off: " << best_off << " MB/s\n";
+        std::cout << "Sequential read, verification on:  " << best_on << " MB/s\n";
+        std::cout << "Overhead:              " << overhead << " %\n";
+        std::cout << "-----------------------------------\n";
+        return 0;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    Options options;
+    bool path_set = false;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        try {
+            if (arg == "--size" && i + 1 < argc) {
+                options.file_mb = std::stoull(argv[++i]);
+            } else if (arg == "--rounds" && i + 1 < argc) {
+                options.rounds = static_cast<unsigned>(std::stoul(argv[++i]));
+            } else if (arg == "--keep") {
+                options.keep = true;
+            } else if (arg == "--compression") {
+                options.compression = true;
+            } else if (arg == "--direct-io") {
+                options.direct_io = true;
+            } else if (arg == "--directories") {
+                options.directories = true;
+            } else if (arg == "--entries" && i + 1 < argc) {
+                options.entries = std::stoull(argv[++i]);
+            } else if (arg == "--stripe" && i + 1 < argc) {
+                std::stringstream members(argv[++i]);
+                for (std::string member; std::getline(members, member, ',');) {
+                    if (!member.empty()) options.stripe_members.push_back(member);
+                }
+            } else if (arg == "--allocation") {
+                options.allocation = true;
+            } else if (arg == "--threads" && i + 1 < argc) {
+                const unsigned long threads = std::stoul(argv[++i]);
+                if (threads == 0 || threads > 1024) throw std::out_of_range("thread count");
+                options.max_threads = static_cast<unsigned>(threads);
+            } else if (arg == "--mirror" && i + 1 < argc) {
+                std::stringstream copies(argv[++i]);
+                for (std::string copy; std::getline(copies, copy, ',');) {
+                    if (!copy.empty()) options.mirror_copies.push_back(copy);
+                }
+            } else if (arg == "--stripe-width" && i + 1 < argc) {
+                const unsigned long width = std::stoul(argv[++i]);
+                if (width == 0 || width > UINT32_MAX) throw std::out_of_range("stripe width");
+                options.stripe_width = static_cast<uint32_t>(width);
+            } else if (!path_set && arg.rfind("--", 0) != 0) {
+                options.volume_path = arg;
+                path_set = true;
+            } else {
+                printBenchUsage();
+                return 2;
+            }
+        } catch (const std::exception &e) {
+            std::cerr << "Error: Invalid value for " << arg << ". " << e.what() << std::endl;
+            return 2;
+        }
+    }
+    const bool striped = !options.stripe_members.empty();
+    const bool mirrored = !options.mirror_copies.empty();
+    const bool layered = striped || mirrored;
+    if (options.file_mb == 0 || options.rounds == 0 ||
+        options.compression + (options.direct_io && !layered) + options.directories + striped + mirrored +
+        options.allocation > 1) {
+        printBenchUsage();
+        return 2;
+    }
+    if (layered) return run_layout_bench(options);
+    if (options.allocation) return run_allocation_bench(options);
+    if (options.direct_io) return run_direct_io_bench(options);
+    if (options.directories) return run_directory_bench(options);
+    return options.compression ? run_compression_bench(options) : run_checksum_bench(options);
+}
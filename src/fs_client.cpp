@@ -0,0 +1,418 @@
+#include "../include/fs_client.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "../include/output.h"
+
+namespace {
+    constexpr size_t RECEIVE_CHUNK_BYTES = 256 * 1024; // одно чтение из сокета
+    // участки общей памяти выравниваются по кластеру: сервер с O_DIRECT читает и пишет в них без промежуточного буфера
+    constexpr uint64_t SHARED_ALIGNMENT = FileSystem::CLUSTER_SIZE_BYTES;
+
+    bool is_transfer(const FsProtocol::Opcode opcode) {
+        using FsProtocol::Opcode;
+        return opcode == Opcode::READ || opcode == Opcode::WRITE || opcode == Opcode::PREAD ||
+               opcode == Opcode::PWRITE;
+    }
+}
+
+FsClient::~FsClient() {
+    disconnect();
+}
+
+bool FsClient::connect(const std::string &socket_path) {
+    disconnect();
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (socket_path.empty() || socket_path.size() >= sizeof(address.sun_path)) {
+        output::err(output::prefix::FS_CLIENT_ERROR) << "Socket path '" << socket_path << "' is invalid" << std::endl;
+        return false;
+    }
+    std::memcpy(address.sun_path, socket_path.c_str(), socket_path.size() + 1);
+    fd_ = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd_ < 0 || ::connect(fd_, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0) {
+        return fail("Failed to connect to '" + socket_path + "' (" + std::strerror(errno) + ")");
+    }
+
+    // HELLO отправляется и принимается синхронно: вместе с ответом приходит дескриптор общей памяти
+    FsProtocol::Request hello{};
+    hello.id = next_request_id_++;
+    hello.opcode = FsProtocol::Opcode::HELLO;
+    hello.offset = FsProtocol::MAGIC;
+    hello.length = FsProtocol::VERSION;
+    if (::send(fd_, &hello, sizeof(hello), MSG_NOSIGNAL) != static_cast<ssize_t>(sizeof(hello))) {
+        return fail("Failed to send HELLO");
+    }
+
+    FsProtocol::Reply reply{};
+    iovec data{&reply, sizeof(reply)};
+    msghdr message{};
+    message.msg_iov = &data;
+    message.msg_iovlen = 1;
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))]{};
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    ssize_t received;
+    do {
+        received = ::recvmsg(fd_, &message, MSG_CMSG_CLOEXEC);
+    } while (received < 0 && errno == EINTR);
+    if (received <= 0) return fail("Server closed the connection during HELLO");
+
+    int shared_fd = -1;
+    for (cmsghdr *header = CMSG_FIRSTHDR(&message); header; header = CMSG_NXTHDR(&message, header)) {
+        if (header->cmsg_level == SOL_SOCKET && header->cmsg_type == SCM_RIGHTS) {
+            std::memcpy(&shared_fd, CMSG_DATA(header), sizeof(int));
+        }
+    }
+    for (auto done = static_cast<size_t>(received); done < sizeof(reply);) {
+        const ssize_t more = ::recv(fd_, reinterpret_cast<char *>(&reply) + done, sizeof(reply) - done, 0);
+        if (more == 0 || (more < 0 && errno != EINTR)) {
+            if (shared_fd >= 0) ::close(shared_fd);
+            return fail("Server closed the connection during HELLO");
+        }
+        if (more > 0) done += static_cast<size_t>(more);
+    }
+    if (reply.id != hello.id || reply.status != 0) {
+        if (shared_fd >= 0) ::close(shared_fd);
+        return fail("Server rejected HELLO");
+    }
+
+    if (shared_fd >= 0 && reply.result > 0) {
+        void *mapping = ::mmap(nullptr, static_cast<size_t>(reply.result), PROT_READ | PROT_WRITE, MAP_SHARED,
+                               shared_fd, 0);
+        if (mapping != MAP_FAILED) {
+            shared_ = static_cast<char *>(mapping);
+            shared_bytes_ = static_cast<uint64_t>(reply.result);
+        }
+    }
+    // отображение держит память, дескриптор больше не нужен
+    if (shared_fd >= 0) ::close(shared_fd);
+
+    const int flags = ::fcntl(fd_, F_GETFL, 0);
+    if (flags < 0 || ::fcntl(fd_, F_SETFL, flags | O_NONBLOCK) != 0) return fail("Failed to configure the socket");
+    return true;
+}
+
+void FsClient::disconnect() {
+    if (shared_) ::munmap(shared_, shared_bytes_);
+    shared_ = nullptr;
+    shared_bytes_ = 0;
+    shared_used_ = 0;
+    if (fd_ >= 0) ::close(fd_);
+    fd_ = -1;
+    send_buffer_.clear();
+    receive_buffer_.clear();
+    in_flight_.clear();
+    // незавершённые операции завершаются ошибкой
+    for (auto &[ticket, operation]: operations_) {
+        if (operation.outstanding > 0) operation.failed = true;
+        operation.outstanding = 0;
+    }
+}
+
+bool FsClient::fail(const std::string &message) {
+    output::err(output::prefix::FS_CLIENT_ERROR) << message << std::endl;
+    disconnect();
+    return false;
+}
+
+std::optional<uint32_t> FsClient::open(const std::string &path, const std::string &mode) {
+    FsProtocol::Request request{};
+    request.opcode = FsProtocol::Opcode::OPEN;
+    std::string name = path;
+    name.push_back('\0');
+    name += mode;
+    const std::optional<Operation> operation = complete(submit_simple(request, name));
+    if (!operation || operation->failed) return std::nullopt;
+    return static_cast<uint32_t>(operation->result);
+}
+
+bool FsClient::close(const uint32_t handle) {
+    FsProtocol::Request request{};
+    request.opcode = FsProtocol::Opcode::CLOSE;
+    request.handle = handle;
+    const std::optional<Operation> operation = complete(submit_simple(request, {}));
+    return operation && !operation->failed;
+}
+
+int64_t FsClient::read(const uint32_t handle, char *buffer, const uint64_t bytes) {
+    const Ticket ticket = new_operation();
+    if (!submit_transfer(ticket, FsProtocol::Opcode::READ, handle, buffer, nullptr, bytes, 0)) return -1;
+    return wait(ticket);
+}
+
+int64_t FsClient::write(const uint32_t handle, const char *buffer, const uint64_t bytes) {
+    const Ticket ticket = new_operation();
+    if (!submit_transfer(ticket, FsProtocol::Opcode::WRITE, handle, nullptr, buffer, bytes, 0)) return -1;
+    return wait(ticket);
+}
+
+int64_t FsClient::pread(const uint32_t handle, char *buffer, const uint64_t bytes, const uint64_t offset) {
+    return wait(submit_pread(handle, buffer, bytes, offset));
+}
+
+int64_t FsClient::pwrite(const uint32_t handle, const char *buffer, const uint64_t bytes, const uint64_t offset) {
+    return wait(submit_pwrite(handle, buffer, bytes, offset));
+}
+
+std::optional<uint64_t> FsClient::seek(const uint32_t handle, const uint64_t offset, const int whence) {
+    FsProtocol::Request request{};
+    request.opcode = FsProtocol::Opcode::SEEK;
+    request.handle = handle;
+    request.offset = offset;
+    request.length = static_cast<uint64_t>(whence);
+    const std::optional<Operation> operation = complete(submit_simple(request, {}));
+    if (!operation || operation->failed) return std::nullopt;
+    return static_cast<uint64_t>(operation->result);
+}
+
+std::optional<std::vector<FsClient::Entry>> FsClient::list(const std::string &path) {
+    std::vector<Entry> entries;
+    uint64_t position = 0;
+    // каталог приходит страницами, каждая следующая продолжает обход с позиции курсора предыдущей
+    while (true) {
+        FsProtocol::Request request{};
+        request.opcode = FsProtocol::Opcode::LIST;
+        request.offset = position;
+        const std::optional<Operation> operation = complete(submit_simple(request, path));
+        if (!operation || operation->failed) return std::nullopt;
+
+        const std::vector<char> &page = operation->payload;
+        for (size_t at = 0; at + sizeof(FsProtocol::ListEntry) <= page.size();) {
+            FsProtocol::ListEntry record{};
+            std::memcpy(&record, page.data() + at, sizeof(record));
+            at += sizeof(record);
+            if (at + record.name_length > page.size()) break;
+            entries.push_back({std::string(page.data() + at, record.name_length),
+                               static_cast<FileSystem::EntityType>(record.type), record.size_bytes});
+            at += record.name_length;
+        }
+        if (!(operation->flags & FsProtocol::FLAG_MORE)) return entries;
+        position = static_cast<uint64_t>(operation->result);
+    }
+}
+
+bool FsClient::remove(const std::string &path) {
+    FsProtocol::Request request{};
+    request.opcode = FsProtocol::Opcode::REMOVE;
+    const std::optional<Operation> operation = complete(submit_simple(request, path));
+    return operation && !operation->failed;
+}
+
+FsClient::Ticket FsClient::submit_pread(const uint32_t handle, char *buffer, const uint64_t bytes,
+                                        const uint64_t offset) {
+    const Ticket ticket = new_operation();
+    return submit_transfer(ticket, FsProtocol::Opcode::PREAD, handle, buffer, nullptr, bytes, offset) ? ticket : 0;
+}
+
+FsClient::Ticket FsClient::submit_pwrite(const uint32_t handle, const char *buffer, const uint64_t bytes,
+                                         const uint64_t offset) {
+    const Ticket ticket = new_operation();
+    return submit_transfer(ticket, FsProtocol::Opcode::PWRITE, handle, nullptr, buffer, bytes, offset) ? ticket : 0;
+}
+
+int64_t FsClient::wait(const Ticket ticket) {
+    const std::optional<Operation> operation = complete(ticket);
+    return operation && !operation->failed ? operation->result : -1;
+}
+
+FsClient::Ticket FsClient::new_operation() {
+    Ticket ticket = next_ticket_++;
+    if (ticket == 0) ticket = next_ticket_++;
+    operations_[ticket] = Operation{};
+    return ticket;
+}
+
+bool FsClient::submit_transfer(const Ticket ticket, const FsProtocol::Opcode opcode, const uint32_t handle,
+                               char *target, const char *source, const uint64_t bytes, const uint64_t offset) {
+    if (!connected()) {
+        operations_.erase(ticket);
+        return fail("Not connected");
+    }
+    // мелкие передачи идут в сокете и копятся в общем буфере отправки, крупные - через общую память частями,
+    // чтобы сервер обрабатывал одну часть, пока клиент готовит следующую
+    const bool shared = shared_ && bytes > FsProtocol::INLINE_PAYLOAD_MAX;
+    const uint64_t chunk_limit = shared ? shared_bytes_ / 4 : FsProtocol::MAX_MESSAGE_PAYLOAD;
+    uint64_t done = 0;
+    do {
+        const uint64_t chunk = std::min(chunk_limit, bytes - done);
+        FsProtocol::Request request{};
+        request.id = next_request_id_++;
+        request.opcode = opcode;
+        request.handle = handle;
+        request.offset = offset + done;
+        request.length = chunk;
+        InFlight flight{request.id, ticket, opcode, target ? target + done : nullptr, chunk, shared, 0};
+        if (shared) {
+            const std::optional<uint32_t> shared_offset = reserve_shared(chunk);
+            if (!shared_offset) return false;
+            request.flags = FsProtocol::FLAG_SHARED;
+            request.shared_offset = *shared_offset;
+            flight.shared_offset = *shared_offset;
+            if (source) std::memcpy(shared_ + *shared_offset, source + done, chunk);
+        }
+        in_flight_.push_back(flight);
+        ++operations_[ticket].outstanding;
+        enqueue(request, {}, shared ? nullptr : source ? source + done : nullptr);
+        done += chunk;
+    } while (done < bytes && connected());
+    return connected();
+}
+
+FsClient::Ticket FsClient::submit_simple(FsProtocol::Request request, const std::string &name) {
+    if (!connected()) {
+        fail("Not connected");
+        return 0;
+    }
+    if (name.size() > FsProtocol::MAX_NAME_LENGTH) {
+        output::err(output::prefix::FS_CLIENT_ERROR) << "Name '" << name << "' is too long" << std::endl;
+        return 0;
+    }
+    const Ticket ticket = new_operation();
+    request.id = next_request_id_++;
+    request.name_length = static_cast<uint16_t>(name.size());
+    in_flight_.push_back({request.id, ticket, request.opcode, nullptr, 0, false, 0});
+    ++operations_[ticket].outstanding;
+    enqueue(request, name, nullptr);
+    return ticket;
+}
+
+void FsClient::enqueue(const FsProtocol::Request &request, const std::string &name, const char *payload) {
+    const auto *header = reinterpret_cast<const char *>(&request);
+    send_buffer_.insert(send_buffer_.end(), header, header + sizeof(request));
+    send_buffer_.insert(send_buffer_.end(), name.begin(), name.end());
+    if (payload) send_buffer_.insert(send_buffer_.end(), payload, payload + FsProtocol::inline_request_payload(request));
+    if (send_buffer_.size() >= FsProtocol::BATCH_BYTES) flush();
+}
+
+std::optional<uint32_t> FsClient::reserve_shared(const uint64_t bytes) {
+    const uint64_t aligned = (bytes + SHARED_ALIGNMENT - 1) / SHARED_ALIGNMENT * SHARED_ALIGNMENT;
+    if (in_flight_.empty()) shared_used_ = 0;
+    if (shared_used_ + aligned > shared_bytes_) {
+        // участки освобождаются все сразу, когда ответы на занявшие их запросы получены
+        if (!flush()) return std::nullopt;
+        while (!in_flight_.empty()) {
+            if (!receive(true)) return std::nullopt;
+        }
+        shared_used_ = 0;
+    }
+    const auto offset = static_cast<uint32_t>(shared_used_);
+    shared_used_ += aligned;
+    return offset;
+}
+
+bool FsClient::flush() {
+    size_t sent_total = 0;
+    while (sent_total < send_buffer_.size()) {
+        if (!connected()) return false;
+        // пока сервер не может принять запросы, он может ждать, что клиент заберёт ответы
+        pollfd descriptor{fd_, POLLOUT | POLLIN, 0};
+        if (::poll(&descriptor, 1, -1) < 0) {
+            if (errno == EINTR) continue;
+            return fail(std::string("poll failed (") + std::strerror(errno) + ")");
+        }
+        if ((descriptor.revents & POLLIN) && !receive(false)) return false;
+        if (descriptor.revents & (POLLERR | POLLHUP)) return fail("Server closed the connection");
+        if (!(descriptor.revents & POLLOUT)) continue;
+        const ssize_t sent = ::send(fd_, send_buffer_.data() + sent_total, send_buffer_.size() - sent_total,
+                                    MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK) continue;
+            return fail(std::string("send failed (") + std::strerror(errno) + ")");
+        }
+        sent_total += static_cast<size_t>(sent);
+    }
+    send_buffer_.clear();
+    return true;
+}
+
+bool FsClient::receive(const bool block) {
+    while (connected()) {
+        receive_chunk_.resize(RECEIVE_CHUNK_BYTES);
+        const ssize_t received = ::recv(fd_, receive_chunk_.data(), receive_chunk_.size(), 0);
+        if (received == 0) return fail("Server closed the connection");
+        if (received < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                return fail(std::string("recv failed (") + std::strerror(errno) + ")");
+            }
+            if (!block) return true;
+            pollfd descriptor{fd_, POLLIN, 0};
+            if (::poll(&descriptor, 1, -1) < 0 && errno != EINTR) {
+                return fail(std::string("poll failed (") + std::strerror(errno) + ")");
+            }
+            continue;
+        }
+        receive_buffer_.insert(receive_buffer_.end(), receive_chunk_.data(), receive_chunk_.data() + received);
+
+        size_t position = 0;
+        size_t handled = 0;
+        while (receive_buffer_.size() - position >= sizeof(FsProtocol::Reply)) {
+            FsProtocol::Reply reply{};
+            std::memcpy(&reply, receive_buffer_.data() + position, sizeof(reply));
+            if (receive_buffer_.size() - position - sizeof(reply) < reply.payload_length) break;
+            if (!handle_reply(reply, receive_buffer_.data() + position + sizeof(reply))) return false;
+            position += sizeof(reply) + reply.payload_length;
+            ++handled;
+        }
+        receive_buffer_.erase(receive_buffer_.begin(), receive_buffer_.begin() + static_cast<std::ptrdiff_t>(position));
+        if (handled > 0 || !block) return true;
+    }
+    return false;
+}
+
+bool FsClient::handle_reply(const FsProtocol::Reply &reply, const char *payload) {
+    if (in_flight_.empty() || in_flight_.front().request_id != reply.id) {
+        return fail("Unexpected reply " + std::to_string(reply.id));
+    }
+    const InFlight flight = in_flight_.front();
+    in_flight_.pop_front();
+    const auto found = operations_.find(flight.ticket);
+    if (found == operations_.end()) return true; // операцию уже не ждут
+    Operation &operation = found->second;
+    --operation.outstanding;
+    if (reply.status != 0) {
+        operation.failed = true;
+        return true;
+    }
+
+    if (!is_transfer(flight.opcode)) {
+        operation.result = reply.result;
+        operation.flags = reply.flags;
+        operation.payload.assign(payload, payload + reply.payload_length);
+        return true;
+    }
+    if (reply.result < 0 || static_cast<uint64_t>(reply.result) > flight.length) {
+        operation.failed = true;
+        return true;
+    }
+    if (flight.target) {
+        const char *data = flight.shared ? shared_ + flight.shared_offset : payload;
+        const uint64_t available = flight.shared ? static_cast<uint64_t>(reply.result) : reply.payload_length;
+        std::memcpy(flight.target, data, std::min(available, static_cast<uint64_t>(reply.result)));
+    }
+    operation.result += reply.result;
+    return true;
+}
+
+std::optional<FsClient::Operation> FsClient::complete(const Ticket ticket) {
+    const auto found = operations_.find(ticket);
+    if (found == operations_.end()) return std::nullopt;
+    if (found->second.outstanding > 0 && flush()) {
+        while (found->second.outstanding > 0 && receive(true)) {
+        }
+    }
+    Operation operation = std::move(found->second);
+    operations_.erase(found);
+    if (operation.outstanding > 0) operation.failed = true;
+    return operation;
+}
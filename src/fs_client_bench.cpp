@@ -0,0 +1,200 @@
+#include "fs_client.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <deque>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+    struct Options {
+        std::string socket_path;
+        unsigned clients = 4; // процессы-клиенты
+        uint64_t ops = 20000; // операций на клиента в каждом режиме
+        uint64_t size = 4096; // байт на операцию
+        unsigned depth = 32; // запросов в полёте в конвейерном режиме
+        unsigned read_percent = 50; // доля чтений
+        uint64_t file_mb = 16; // файл каждого клиента
+    };
+
+    // итог одного клиента в одном режиме, передаётся родителю через канал
+    struct Result {
+        uint64_t ops = 0;
+        uint64_t bytes = 0;
+        double seconds = 0;
+        uint64_t errors = 0;
+    };
+
+    void printClientBenchUsage() {
+        std::cout << "Usage: fs_client_bench <socket_path> [--clients N] [--ops N] [--size BYTES] [--depth N]\n"
+                "                       [--reads PERCENT] [--file-mb MB]\n";
+        std::cout << "  Load generator for fs_daemon: each client process opens its own file and issues random\n";
+        std::cout << "  preads / pwrites, first one at a time, then with --depth requests in flight.\n";
+        std::cout << "  --clients N    - client processes (default: 4).\n";
+        std::cout << "  --ops N        - operations per client and mode (default: 20000).\n";
+        std::cout << "  --size BYTES   - bytes per operation (default: 4096).\n";
+        std::cout << "  --depth N      - requests in flight in the pipelined mode (default: 32).\n";
+        std::cout << "  --reads PCT    - share of reads (default: 50).\n";
+        std::cout << "  --file-mb MB   - size of each client's file (default: 16).\n";
+    }
+
+    Result run_mode(FsClient &client, const uint32_t handle, const Options &options, const unsigned depth,
+                    std::mt19937_64 &random) {
+        const uint64_t slots = std::max<uint64_t>(1, options.file_mb * 1024 * 1024 / options.size);
+        std::vector<std::vector<char>> buffers(depth, std::vector<char>(options.size, 'b'));
+        std::deque<std::pair<FsClient::Ticket, uint64_t>> pending; // номер операции и её длина
+        Result result;
+        const auto started = std::chrono::steady_clock::now();
+        for (uint64_t op = 0; op < options.ops; ++op) {
+            if (pending.size() == depth) {
+                const int64_t done = client.wait(pending.front().first);
+                if (done == static_cast<int64_t>(pending.front().second)) {
+                    result.bytes += static_cast<uint64_t>(done);
+                } else {
+                    ++result.errors;
+                }
+                pending.pop_front();
+            }
+            char *buffer = buffers[op % depth].data();
+            const uint64_t offset = random() % slots * options.size;
+            const bool read = random() % 100 < options.read_percent;
+            const FsClient::Ticket ticket = read
+                                                ? client.submit_pread(handle, buffer, options.size, offset)
+                                                : client.submit_pwrite(handle, buffer, options.size, offset);
+            pending.emplace_back(ticket, options.size);
+        }
+        for (const auto &[ticket, length]: pending) {
+            const int64_t done = client.wait(ticket);
+            if (done == static_cast<int64_t>(length)) {
+                result.bytes += static_cast<uint64_t>(done);
+            } else {
+                ++result.errors;
+            }
+        }
+        result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+        result.ops = options.ops;
+        return result;
+    }
+
+    // тело процесса-клиента: результаты обоих режимов пишутся в канал
+    int run_client(const Options &options, const unsigned index, const int result_fd) {
+        FsClient client;
+        if (!client.connect(options.socket_path)) return 1;
+        const std::string path = "client_bench_" + std::to_string(index) + ".dat";
+        const std::optional<uint32_t> handle = client.open(path, "w+");
+        if (!handle) return 1;
+
+        // файл заполняется крупными записями: они идут через общую память частями
+        const std::vector<char> fill(1024 * 1024, 'a');
+        for (uint64_t mb = 0; mb < options.file_mb; ++mb) {
+            if (client.write(*handle, fill.data(), fill.size()) != static_cast<int64_t>(fill.size())) return 1;
+        }
+
+        std::mt19937_64 random(index + 1);
+        const Result results[2] = {
+            run_mode(client, *handle, options, 1, random),
+            run_mode(client, *handle, options, options.depth, random),
+        };
+        client.close(*handle);
+        client.remove(path);
+        return ::write(result_fd, results, sizeof(results)) == static_cast<ssize_t>(sizeof(results)) ? 0 : 1;
+    }
+
+    void print_mode(const char *name, const std::vector<Result> &results) {
+        Result total;
+        for (const Result &result: results) {
+            total.ops += result.ops;
+            total.bytes += result.bytes;
+            total.errors += result.errors;
+            total.seconds = std::max(total.seconds, result.seconds);
+        }
+        const double seconds = std::max(total.seconds, 1e-9);
+        std::printf("%-12s %10.0f ops/s %9.1f MB/s %8.2f us/op  errors: %llu\n", name,
+                    static_cast<double>(total.ops) / seconds,
+                    static_cast<double>(total.bytes) / (1024.0 * 1024.0) / seconds,
+                    seconds * 1e6 * static_cast<double>(results.size()) / static_cast<double>(std::max<uint64_t>(total.ops, 1)),
+                    static_cast<unsigned long long>(total.errors));
+    }
+}
+
+int main(int argc, char *argv[]) {
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        try {
+            if (arg == "--clients" && i + 1 < argc) {
+                options.clients = static_cast<unsigned>(std::stoul(argv[++i]));
+            } else if (arg == "--ops" && i + 1 < argc) {
+                options.ops = std::stoull(argv[++i]);
+            } else if (arg == "--size" && i + 1 < argc) {
+                options.size = std::stoull(argv[++i]);
+            } else if (arg == "--depth" && i + 1 < argc) {
+                options.depth = static_cast<unsigned>(std::stoul(argv[++i]));
+            } else if (arg == "--reads" && i + 1 < argc) {
+                options.read_percent = static_cast<unsigned>(std::stoul(argv[++i]));
+            } else if (arg == "--file-mb" && i + 1 < argc) {
+                options.file_mb = std::stoull(argv[++i]);
+            } else if (options.socket_path.empty() && arg.rfind("--", 0) != 0) {
+                options.socket_path = arg;
+            } else {
+                printClientBenchUsage();
+                return 2;
+            }
+        } catch (const std::exception &e) {
+            std::cerr << "Error: Invalid value for " << arg << ". " << e.what() << std::endl;
+            return 2;
+        }
+    }
+    if (options.socket_path.empty() || options.clients == 0 || options.ops == 0 || options.size == 0 ||
+        options.depth == 0 || options.read_percent > 100 || options.file_mb == 0) {
+        printClientBenchUsage();
+        return 2;
+    }
+
+    int pipe_fds[2];
+    if (::pipe(pipe_fds) != 0) {
+        std::perror("pipe");
+        return 1;
+    }
+    std::vector<pid_t> children;
+    for (unsigned i = 0; i < options.clients; ++i) {
+        const pid_t pid = ::fork();
+        if (pid == 0) {
+            ::close(pipe_fds[0]);
+            ::_exit(run_client(options, i, pipe_fds[1]));
+        }
+        if (pid < 0) {
+            std::perror("fork");
+            break;
+        }
+        children.push_back(pid);
+    }
+    ::close(pipe_fds[1]);
+
+    std::vector<Result> sequential, pipelined;
+    Result pair[2];
+    while (::read(pipe_fds[0], pair, sizeof(pair)) == static_cast<ssize_t>(sizeof(pair))) {
+        sequential.push_back(pair[0]);
+        pipelined.push_back(pair[1]);
+    }
+    ::close(pipe_fds[0]);
+    int failed = 0;
+    for (const pid_t pid: children) {
+        int status = 0;
+        ::waitpid(pid, &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) ++failed;
+    }
+
+    std::cout << options.clients << " clients, " << options.ops << " ops of " << options.size << " bytes each, " <<
+            options.read_percent << "% reads\n";
+    print_mode("depth 1", sequential);
+    print_mode(("depth " + std::to_string(options.depth)).c_str(), pipelined);
+    if (failed) std::cout << failed << " client(s) failed\n";
+    return failed ? 1 : 0;
+}
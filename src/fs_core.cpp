@@ -1,13 +1,153 @@
 #include "fs_core.h"
+#include "crc32c.h"
+#include "lz_codec.h"
 #include "output.h"
 #include <memory>
 #include <optional>
 #include <list>
 #include <cstring>
 #include <algorithm>
+#include <functional>
 #include <limits>
+#include <shared_mutex>
+
+namespace {
+    // последовательный обход сегментов FsIoVec при позиционном вводе-выводе
+    class IoVecCursor {
+    public:
+        IoVecCursor(const FsIoVec *iov, const size_t count) : iov_(iov), count_(count) { skip_empty(); }
+
+        // непрерывный участок текущего сегмента; length уменьшается до того, что в нём осталось
+        [[nodiscard]] char *contiguous(uint64_t &length) const {
+            if (index_ == count_) {
+                length = 0;
+                return nullptr;
+            }
+            length = std::min(length, iov_[index_].length - offset_);
+            return static_cast<char *>(iov_[index_].base) + offset_;
+        }
+
+        void advance(uint64_t bytes) {
+            while (bytes > 0 && index_ < count_) {
+                const uint64_t step = std::min(bytes, iov_[index_].length - offset_);
+                offset_ += step;
+                bytes -= step;
+                skip_empty();
+            }
+        }
+
+        // копирует bytes байт из source в сегменты (чтение) или из сегментов в target (запись)
+        void scatter(const char *source, uint64_t bytes) {
+            for (uint64_t length = bytes; bytes > 0; length = bytes) {
+                char *target = contiguous(length);
+                if (length == 0) break;
+                if (source) {
+                    std::memcpy(target, source, length);
+                    source += length;
+                } else {
+                    std::memset(target, 0, length);
+                }
+                advance(length);
+                bytes -= length;
+            }
+        }
+
+        void gather(char *target, uint64_t bytes) {
+            for (uint64_t length = bytes; bytes > 0; length = bytes) {
+                const char *source = contiguous(length);
+                if (length == 0) break;
+                std::memcpy(target, source, length);
+                target += length;
+                advance(length);
+                bytes -= length;
+            }
+        }
+
+    private:
+        const FsIoVec *iov_;
+        size_t count_;
+        size_t index_ = 0;
+        uint64_t offset_ = 0; // смещение внутри текущего сегмента
+
+        void skip_empty() {
+            while (index_ < count_ && offset_ >= iov_[index_].length) {
+                ++index_;
+                offset_ = 0;
+            }
+        }
+    };
+
+    uint64_t total_length(const FsIoVec *iov, const size_t count) {
+        uint64_t total = 0;
+        for (size_t i = 0; i < count; ++i) total += iov[i].length;
+        return total;
+    }
+
+    // вложенность записываемых в трассу вызовов в текущем потоке: вызовы изнутри других
+    // (readv_file -> preadv_file, set_compression -> open_file) в трассу не попадают
+    thread_local unsigned trace_depth = 0;
+
+    struct TraceNesting {
+        TraceNesting() { ++trace_depth; }
+        ~TraceNesting() { --trace_depth; }
+    };
+
+    int64_t trace_result(const int64_t result) { return result; }
+    int64_t trace_result(const bool result) { return result ? 1 : 0; }
+    int64_t trace_result(const std::optional<uint32_t> &result) { return result ? *result : -1; }
+    int64_t trace_result(const std::vector<FileSystem::DirectoryEntry> &result) {
+        return static_cast<int64_t>(result.size());
+    }
+    int64_t trace_result(const std::optional<DirectoryCursor::EntryView> &result) { return result ? 1 : 0; }
+
+    // запись трассы с аргументами вызова; время и результат заполняет traced()
+    FsTrace::Record trace_record(const FsTrace::Op op, const uint32_t handle = 0, const uint64_t offset = 0,
+                                 const uint64_t size = 0, const uint32_t segments = 0) {
+        FsTrace::Record record;
+        record.op = op;
+        record.handle = handle;
+        record.offset = offset;
+        record.size = size;
+        record.segments = segments;
+        return record;
+    }
+}
+
+template<typename Call>
+auto FileSystemCore::traced(FsTrace::Record record, const std::string &path, const std::string &second,
+                            Call &&call) const {
+    if (!trace_writer_.active() || trace_depth > 0) return call();
+
+    const bool cursor_op = record.op == FsTrace::Op::READ || record.op == FsTrace::Op::WRITE ||
+                           record.op == FsTrace::Op::READV || record.op == FsTrace::Op::WRITEV;
+    if (cursor_op) {
+        std::lock_guard lock(fs_mutex_);
+        if (const FileSystem::FileHandle *handle = opened_files_table_.find(record.handle)) {
+            record.offset = handle->current_pos_bytes;
+        }
+    }
+    record.start_ns = trace_writer_.now_ns();
+    auto result = [&] {
+        const TraceNesting nesting;
+        return call();
+    }();
+    record.latency_ns = trace_writer_.now_ns() - record.start_ns;
+    record.result = trace_result(result);
+    if (record.op == FsTrace::Op::OPEN && record.result >= 0) {
+        std::lock_guard lock(fs_mutex_);
+        if (const FileSystem::FileHandle *handle = opened_files_table_.find(static_cast<uint32_t>(record.result))) {
+            record.size = handle->dir_entry.file_size_bytes;
+        }
+    }
+    trace_writer_.record(record, path, second);
+    return result;
+}
 
-FileSystemCore::FileSystemCore(): mounted_(false), next_handle_id(1) {
+FileSystemCore::FileSystemCore(): mounted_(false),
+                                  handle_buffers_(FileSystem::CLUSTER_SIZE_BYTES, FileSystem::CLUSTER_SIZE_BYTES,
+                                                  FileSystem::HANDLE_BUFFERS_PER_CHUNK),
+                                  compression_scratch_(FileSystem::COMPRESSION_GROUP_BYTES),
+                                  dedup_scratch_(FileSystem::CLUSTER_SIZE_BYTES) {
 }
 
 FileSystemCore::~FileSystemCore() {
@@ -15,34 +155,54 @@ FileSystemCore::~FileSystemCore() {
 }
 
 bool FileSystemCore::isMounted() const {
+    std::lock_guard lock(fs_mutex_);
     return mounted_;
 }
 
+bool FileSystemCore::isReadOnly() const {
+    std::lock_guard lock(fs_mutex_);
+    return mounted_ && read_only_;
+}
+
 void FileSystemCore::unmount() {
+    std::lock_guard lock(fs_mutex_);
     if (mounted_) {
         // Закрываем все открытые файлы
         std::vector<uint32_t> handle_ids;
         handle_ids.reserve(opened_files_table_.size());
-        for (const auto &[handle_id, handle]: opened_files_table_) {
-            handle_ids.push_back(handle_id);
+        for (const FileSystem::FileHandle &handle: opened_files_table_) {
+            handle_ids.push_back(handle.handle_id);
         }
         for (const uint32_t id: handle_ids) {
             close_file(id);
         }
         opened_files_table_.clear();
-
+        open_directories_.clear();
+
+        // снимок монтировался без изменения заголовка, записывать нечего
+        if (!read_only_) {
+            flush_metadata();
+            // счётчики помечаются достоверными, только если они не требуют перестроения
+            header_.volume_state = bitmap_manager_->store_free_counters(header_)
+                                       ? FileSystem::VOLUME_STATE_CLEAN
+                                       : FileSystem::VOLUME_STATE_DIRTY;
+            vol_manager_.update_header(header_);
+        }
         vol_manager_.close_volume();
 
         bitmap_manager_.reset();
         fat_manager_.reset();
         directory_manager_.reset();
+        dedup_index_.reset();
         mounted_ = false;
+        read_only_ = false;
 
         output::succ(output::prefix::FILE_SYSTEM_CORE) << "Volume unmounted" << std::endl;
     }
 }
 
-bool FileSystemCore::format(const std::string &volume_path, uint64_t volume_size_mb) {
+bool FileSystemCore::format(const std::string &volume_path, uint64_t volume_size_mb, const bool preallocate) {
+    std::lock_guard lock(fs_mutex_);
     if (mounted_) {
         unmount();
     }
@@ -54,7 +214,7 @@ bool FileSystemCore::format(const std::string &volume_path, uint64_t volume_size
     }
 
     FileSystem::Header _header_tmp{};
-    if (!vol_manager_.create_and_format(volume_path, volume_size_bytes, _header_tmp)) {
+    if (!vol_manager_.create_and_format(volume_path, volume_size_bytes, _header_tmp, preallocate)) {
         output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "VolumeManager failed to create and format" << std::endl;
         return false;
     }
@@ -62,18 +222,21 @@ bool FileSystemCore::format(const std::string &volume_path, uint64_t volume_size
     header_ = _header_tmp;
 
     bitmap_manager_ = std::make_unique<BitmapManager>(vol_manager_);
+    bitmap_manager_->set_allocation_groups(allocation_groups_);
+    fat_manager_ = std::make_unique<FATManager>(vol_manager_);
+    apply_metadata_cache_budget();
     if (!bitmap_manager_->initialize_and_flush(header_)) {
         output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "BitmapManager failed to initialize" << std::endl;
         return false;
     }
 
-    fat_manager_ = std::make_unique<FATManager>(vol_manager_);
     if (!fat_manager_->initialize_and_flush(header_)) {
         output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "FATManager failed to initialize" << std::endl;
         return false;
     }
 
     directory_manager_ = std::make_unique<DirectoryManager>(vol_manager_, *fat_manager_, *bitmap_manager_);
+    directory_manager_->set_btree_threshold(btree_threshold_clusters_);
     if (!directory_manager_->initialize_root_directory(header_)) {
         output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "DirectoryManager failed to initialize" << std::endl;
         return false;
@@ -87,12 +250,55 @@ bool FileSystemCore::format(const std::string &volume_path, uint64_t volume_size
         }
     }
 
+    if (!flush_metadata()) {
+        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Failed to write metadata after format" << std::endl;
+        return false;
+    }
+    if (!bitmap_manager_->store_free_counters(header_)) {
+        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Failed to write free space counters" << std::endl;
+        return false;
+    }
+    header_.volume_state = FileSystem::VOLUME_STATE_CLEAN;
+    if (!vol_manager_.update_header(header_)) {
+        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Failed to write header after format" << std::endl;
+        return false;
+    }
+
     output::succ(output::prefix::FILE_SYSTEM_CORE) << "Filesystem formatted successfully" << std::endl;
     vol_manager_.close_volume();
     return true;
 }
 
 bool FileSystemCore::mount(const std::string &volume_path) {
+    std::lock_guard lock(fs_mutex_);
+    if (!mount_volume(volume_path, false)) return false;
+    output::succ(output::prefix::FILE_SYSTEM_CORE) << "Volume mounted successfully from " << volume_path << std::endl;
+    return true;
+}
+
+bool FileSystemCore::mount_snapshot(const std::string &volume_path, const std::string &snapshot_name) {
+    std::lock_guard lock(fs_mutex_);
+    if (!mount_volume(volume_path, true)) return false;
+
+    // корнем становится каталог снимка; заголовок на диске не меняется
+    const std::optional<FileSystem::DirectoryEntry> snapshot =
+            header_.snapshot_dir_cluster != FileSystem::MARKER_FAT_ENTRY_FREE
+                ? directory_manager_->find_entry(header_.snapshot_dir_cluster, snapshot_name)
+                : std::nullopt;
+    if (!snapshot || snapshot->type != FileSystem::EntityType::DIRECTORY) {
+        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Snapshot '" << snapshot_name << "' not found" <<
+                std::endl;
+        unmount();
+        return false;
+    }
+    header_.root_dir_start_cluster = snapshot->first_cluster;
+
+    output::succ(output::prefix::FILE_SYSTEM_CORE) << "Snapshot '" << snapshot_name << "' mounted read-only from " <<
+            volume_path << std::endl;
+    return true;
+}
+
+bool FileSystemCore::mount_volume(const std::string &volume_path, const bool read_only) {
     if (mounted_) {
         unmount();
     }
@@ -105,23 +311,57 @@ bool FileSystemCore::mount(const std::string &volume_path) {
     header_ = vol_manager_.get_header();
 
     bitmap_manager_ = std::make_unique<BitmapManager>(vol_manager_);
+    bitmap_manager_->set_allocation_groups(allocation_groups_);
+    fat_manager_ = std::make_unique<FATManager>(vol_manager_);
+    dedup_index_ = std::make_unique<DedupIndex>(vol_manager_);
+    apply_metadata_cache_budget();
+    bitmap_manager_->set_discard_freed(discard_freed_);
     if (!bitmap_manager_->load(header_)) {
         output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "BitmapManager failed to load" << std::endl;
         vol_manager_.close_volume();
         return false;
     }
 
-    fat_manager_ = std::make_unique<FATManager>(vol_manager_);
     if (!fat_manager_->load(header_)) {
         output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "FATManager failed to load" << std::endl;
         vol_manager_.close_volume();
         return false;
     }
 
+    // индекс без счётчиков ссылок бесполезен: кластер нельзя сделать общим
+    if (read_only || !fat_manager_->sharing_supported() || !dedup_index_->load(header_)) {
+        dedup_index_.reset();
+        if (dedup_enabled_ && !read_only) {
+            output::warn(output::prefix::FILE_SYSTEM_CORE_WARNING) <<
+                    "Volume has no deduplication index, written clusters are not deduplicated" << std::endl;
+        }
+    }
+
     directory_manager_ = std::make_unique<DirectoryManager>(vol_manager_, *fat_manager_, *bitmap_manager_);
+    directory_manager_->set_btree_threshold(btree_threshold_clusters_);
+
+    if (!read_only && is_legacy_bitmap(header_) && !rebuild_legacy_bitmap()) {
+        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Failed to rebuild bitmap of an old volume" << std::endl;
+        vol_manager_.close_volume();
+        return false;
+    }
+
+    if (!read_only && header_.volume_state != FileSystem::VOLUME_STATE_CLEAN && !reclaim_reserved_clusters()) {
+        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Failed to reclaim reserved clusters" << std::endl;
+        vol_manager_.close_volume();
+        return false;
+    }
+
+    // до корректного размонтирования счётчики свободного места на диске считаются недостоверными
+    header_.volume_state = FileSystem::VOLUME_STATE_DIRTY;
+    if (!read_only && !vol_manager_.update_header(header_)) {
+        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Failed to mark volume as mounted" << std::endl;
+        vol_manager_.close_volume();
+        return false;
+    }
 
     mounted_ = true;
-    output::succ(output::prefix::FILE_SYSTEM_CORE) << "Volume mounted successfully from " << volume_path << std::endl;
+    read_only_ = read_only;
     return true;
 }
 
@@ -157,6 +397,10 @@ std::optional<FileSystemCore::OpenMode> FileSystemCore::parse_mode(const std::st
     return open_mode;
 }
 
+bool FileSystemCore::has_chain(const uint32_t first_node) {
+    return first_node != FileSystem::MARKER_FAT_ENTRY_FREE && first_node != FileSystem::MARKER_FAT_ENTRY_EOF;
+}
+
 bool FileSystemCore::is_valid_cluster(uint32_t cluster_idx) const {
     return cluster_idx >= header_.data_start_cluster &&
            cluster_idx < header_.total_clusters &&
@@ -165,6 +409,11 @@ bool FileSystemCore::is_valid_cluster(uint32_t cluster_idx) const {
 }
 
 std::optional<uint32_t> FileSystemCore::open_file(const std::string &path, const std::string &mode) {
+    return traced(trace_record(FsTrace::Op::OPEN), path, mode, [&] { return open_file_untraced(path, mode); });
+}
+
+std::optional<uint32_t> FileSystemCore::open_file_untraced(const std::string &path, const std::string &mode) {
+    std::lock_guard lock(fs_mutex_);
     if (!mounted_) {
         output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Filesystem not mounted. Cannot open file" << std::endl;
         return std::nullopt;
@@ -173,6 +422,9 @@ std::optional<uint32_t> FileSystemCore::open_file(const std::string &path, const
     const std::optional<OpenMode> open_mode = parse_mode(mode);
     if (!open_mode) return std::nullopt;
     OpenMode _mode = *open_mode;
+    if ((_mode.write || _mode.append || _mode.truncate || _mode.create_if_not_exists) && !check_writable()) {
+        return std::nullopt;
+    }
 
     std::string filename = get_filename_from_path(path);
     uint32_t dir_cluster = get_containing_directory_cluster(path);
@@ -192,12 +444,11 @@ std::optional<uint32_t> FileSystemCore::open_file(const std::string &path, const
         if (_mode.truncate) {
             if (entry_data.first_cluster != FileSystem::MARKER_FAT_ENTRY_EOF &&
                 entry_data.first_cluster != FileSystem::MARKER_FAT_ENTRY_FREE) {
-                std::list<uint32_t> chain = fat_manager_->get_cluster_chain(entry_data.first_cluster);
-                fat_manager_->free_chain(entry_data.first_cluster);
-                for (uint32_t cluster_idx: chain) {
-                    bitmap_manager_->free_cluster(cluster_idx);
-                }
+                const std::optional<std::vector<uint32_t>> released =
+                        fat_manager_->free_chain(entry_data.first_cluster);
+                if (released) bitmap_manager_->free_clusters(*released);
             }
+            if (entry_data.is_inline()) entry_data.set_inline(false);
             entry_data.first_cluster = FileSystem::MARKER_FAT_ENTRY_FREE;
             entry_data.file_size_bytes = 0;
             if (!directory_manager_->update_entry(dir_cluster, filename, entry_data)) {
@@ -205,6 +456,7 @@ std::optional<uint32_t> FileSystemCore::open_file(const std::string &path, const
                         "Failed to update directory entry after truncate for '" << path << "'" << std::endl;
                 return std::nullopt;
             }
+            flush_metadata();
         }
     } else {
         if (_mode.create_if_not_exists) {
@@ -225,8 +477,7 @@ std::optional<uint32_t> FileSystemCore::open_file(const std::string &path, const
     }
 
     FileSystem::FileHandle handle;
-    handle.handle_id = next_handle_id++;
-    handle.path = path;
+    handle.dir_cluster = dir_cluster;
     handle.dir_entry = entry_data;
     handle.is_open_to_write = _mode.write || _mode.append;
     handle.buffered_cluster_idx = FileSystem::MARKER_FAT_ENTRY_EOF;
@@ -235,35 +486,61 @@ std::optional<uint32_t> FileSystemCore::open_file(const std::string &path, const
     handle.current_cluster_in_chain = entry_data.first_cluster;
     handle.offset_in_buffered_cluster = 0;
     handle.modified = false;
+    // пространство имён плоское: группа выбирается по имени, и файл при каждом открытии растёт в той же группе
+    handle.allocation_group = bitmap_manager_->group_for_key(static_cast<uint32_t>(std::hash<std::string>{}(filename)));
+    // если путь называет существующий каталог, файл размещается рядом с ним
+    if (const size_t last_slash = path.find_last_of('/'); last_slash != std::string::npos && last_slash > 0) {
+        const std::string parent = get_filename_from_path(path.substr(0, last_slash));
+        const std::optional<FileSystem::DirectoryEntry> directory = directory_manager_->find_entry(dir_cluster, parent);
+        if (directory && directory->type == FileSystem::EntityType::DIRECTORY &&
+            is_valid_cluster(directory->first_cluster)) {
+            handle.placement_goal = directory->first_cluster;
+            handle.allocation_group = bitmap_manager_->group_index(directory->first_cluster);
+        }
+    }
+
+    if (entry_data.is_compressed() && !build_group_index(handle)) {
+        return std::nullopt;
+    }
 
     // ИСПРАВЛЕНО: Сначала добавим в таблицу, потом вызовем seek
-    opened_files_table_[handle.handle_id] = handle;
+    const std::optional<uint32_t> handle_id = opened_files_table_.insert(std::move(handle));
+    if (!handle_id) {
+        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Too many open files, cannot open '" << path << "'" <<
+                std::endl;
+        return std::nullopt;
+    }
 
     uint64_t position_to_seek = 0;
     if (_mode.append) {
         position_to_seek = entry_data.file_size_bytes;
     }
 
-    if (!seek(handle.handle_id, position_to_seek, FS_SEEK_SET)) {
-        output::warn(output::prefix::FILE_SYSTEM_CORE_WARNING) << "Initial seek failed for handle " << handle.handle_id
+    if (!seek(*handle_id, position_to_seek, FS_SEEK_SET)) {
+        output::warn(output::prefix::FILE_SYSTEM_CORE_WARNING) << "Initial seek failed for handle " << *handle_id
                 << " for path '" << path << "' to position " << position_to_seek << std::endl;
-        opened_files_table_.erase(handle.handle_id);
+        release_handle(*handle_id);
         return std::nullopt;
     }
 
-    return handle.handle_id;
+    return handle_id;
 }
 
 bool FileSystemCore::close_file(const uint32_t handle_id) {
-    const auto _it = opened_files_table_.find(handle_id);
-    if (_it == opened_files_table_.end()) {
+    return traced(trace_record(FsTrace::Op::CLOSE, handle_id), {}, {}, [&] { return close_file_untraced(handle_id); });
+}
+
+bool FileSystemCore::close_file_untraced(const uint32_t handle_id) {
+    std::lock_guard lock(fs_mutex_);
+    FileSystem::FileHandle *const handle_ptr = opened_files_table_.find(handle_id);
+    if (!handle_ptr) {
         output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Invalid file handle " << handle_id << std::endl;
         return false;
     }
 
-    FileSystem::FileHandle &handle = _it->second;
+    FileSystem::FileHandle &handle = *handle_ptr;
 
-    if (!flush_cluster(handle)) {
+    if (!flush_cluster(handle) || !store_group(handle)) {
         output::warn(output::prefix::FILE_SYSTEM_CORE_WARNING) << "Failed to flush buffer for handle " << handle_id << std::endl;
     }
 
@@ -274,7 +551,31 @@ bool FileSystemCore::close_file(const uint32_t handle_id) {
         }
     }
 
-    opened_files_table_.erase(handle_id);
+    release_handle(handle_id);
+    if (!flush_metadata()) {
+        output::warn(output::prefix::FILE_SYSTEM_CORE_WARNING) << "Failed to write metadata for handle " << handle_id <<
+                std::endl;
+    }
+    return true;
+}
+
+void FileSystemCore::release_handle(const uint32_t handle_id) {
+    if (FileSystem::FileHandle *handle = opened_files_table_.find(handle_id)) {
+        return_reserved_clusters(*handle);
+        handle_buffers_.release(handle->buffer);
+        handle->buffer = nullptr;
+        opened_files_table_.erase(handle_id);
+    }
+}
+
+bool FileSystemCore::attach_buffer(FileSystem::FileHandle &handle) const {
+    if (handle.buffer) return true;
+    handle.buffer = handle_buffers_.acquire();
+    if (!handle.buffer) {
+        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Failed to allocate buffer for handle " <<
+                handle.handle_id << std::endl;
+        return false;
+    }
     return true;
 }
 
@@ -284,12 +585,35 @@ bool FileSystemCore::flush_cluster(FileSystem::FileHandle &handle) const {
         handle.buffered_cluster_idx != FileSystem::MARKER_FAT_ENTRY_FREE &&
         is_valid_cluster(handle.buffered_cluster_idx)) {
 
-        if (!vol_manager_.write_cluster(handle.buffered_cluster_idx, handle.buffer.data())) {
+        const bool dedup = dedup_enabled_ && dedup_index_ && !handle.dir_entry.is_compressed();
+        const uint32_t checksum = dedup ? crc32c::compute(handle.buffer, FileSystem::CLUSTER_SIZE_BYTES) : 0;
+        // кластер, на котором стоит дескриптор, заменяется ссылкой на такой же без записи на диск
+        if (dedup && handle.current_cluster_in_chain == handle.buffered_cluster_idx) {
+            if (const std::optional<uint32_t> duplicate = find_duplicate(handle.buffer, checksum,
+                                                                         handle.buffered_cluster_idx)) {
+                const std::optional<uint32_t> shared = share_node(handle.previous_node_in_chain,
+                                                                  handle.buffered_cluster_idx, *duplicate,
+                                                                  handle.dir_entry.first_cluster);
+                if (shared) {
+                    handle.current_cluster_in_chain = *shared;
+                    handle.buffered_cluster_idx = *duplicate;
+                    handle.buffer_dirty = false;
+                    handle.modified = true;
+                    return true;
+                }
+            }
+        }
+
+        if (!vol_manager_.write_cluster(handle.buffered_cluster_idx, handle.buffer)) {
             output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Failed to write buffered cluster " <<
                     handle.buffered_cluster_idx << " to disk" << std::endl;
             return false;
         }
         handle.buffer_dirty = false;
+        if (dedup && !track_cluster(handle.buffered_cluster_idx, checksum)) {
+            output::warn(output::prefix::FILE_SYSTEM_CORE_WARNING) << "Failed to index cluster " <<
+                    handle.buffered_cluster_idx << " for deduplication" << std::endl;
+        }
     }
     return true;
 }
@@ -305,11 +629,11 @@ bool FileSystemCore::load_cluster_info_buffer(FileSystem::FileHandle &handle, ui
         return true;
     }
 
-    if (!flush_cluster(handle)) {
+    if (!flush_cluster(handle) || !attach_buffer(handle)) {
         return false;
     }
 
-    if (!vol_manager_.read_cluster(cluster_to_load, handle.buffer.data())) {
+    if (!vol_manager_.read_cluster(cluster_to_load, handle.buffer)) {
         output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Failed to read cluster " << cluster_to_load <<
                 " into handle buffer" << std::endl;
         return false;
@@ -320,188 +644,1094 @@ bool FileSystemCore::load_cluster_info_buffer(FileSystem::FileHandle &handle, ui
     return true;
 }
 
-std::optional<uint32_t> FileSystemCore::allocate_and_link_cluster(FileSystem::FileHandle &handle) const {
+std::optional<uint32_t> FileSystemCore::take_reserved_cluster(FileSystem::FileHandle &handle) {
+    if (const std::optional<uint32_t> cluster = pop_reserved_cluster(handle)) return cluster;
+    if (!cluster_magazines_) return std::nullopt;
+    // свободное место может быть разобрано по запасам других дескрипторов
+    bool returned = false;
+    for (FileSystem::FileHandle &other: opened_files_table_) {
+        returned |= !other.reserved_clusters.empty();
+        return_reserved_clusters(other);
+    }
+    if (!returned) return std::nullopt;
+    const std::optional<uint32_t> last = node_cluster(handle.previous_node_in_chain);
+    const std::vector<uint32_t> reserved = bitmap_manager_->reserve_near(last ? *last + 1 : handle.placement_goal,
+                                                                         handle.allocation_group, 1);
+    if (reserved.empty()) return std::nullopt;
+    return reserved.front();
+}
+
+std::optional<uint32_t> FileSystemCore::pop_reserved_cluster(FileSystem::FileHandle &handle) const {
+    // новый кластер ставится сразу за последним кластером файла, первый - за кластером каталога
+    const std::optional<uint32_t> last = node_cluster(handle.previous_node_in_chain);
+    const uint32_t goal = last ? *last + 1 : handle.placement_goal;
+    if (!cluster_magazines_) return bitmap_manager_->allocate_near(goal, handle.allocation_group);
+    if (handle.reserved_clusters.empty()) {
+        // запас растёт вместе с файлом: короткий файл не держит лишнего, длинный пополняет запас реже
+        const uint64_t written_clusters = handle.current_pos_bytes / FileSystem::CLUSTER_SIZE_BYTES;
+        const auto batch = static_cast<uint32_t>(std::clamp<uint64_t>(written_clusters, 1,
+                                                                      FileSystem::CLUSTER_MAGAZINE_MAX_CLUSTERS));
+        const std::vector<uint32_t> reserved = bitmap_manager_->reserve_near(goal, handle.allocation_group, batch);
+        if (reserved.empty()) return std::nullopt;
+        handle.reserved_clusters.assign(reserved.rbegin(), reserved.rend());
+    }
+    const uint32_t cluster = handle.reserved_clusters.back();
+    handle.reserved_clusters.pop_back();
+    return cluster;
+}
+
+void FileSystemCore::return_reserved_clusters(FileSystem::FileHandle &handle) const {
+    if (handle.reserved_clusters.empty()) return;
+    if (!bitmap_manager_->release_reserved(handle.reserved_clusters)) {
+        output::warn(output::prefix::FILE_SYSTEM_CORE_WARNING) << "Failed to return " <<
+                handle.reserved_clusters.size() << " reserved cluster(s) of '" << handle.name() << "'" << std::endl;
+    }
+    handle.reserved_clusters.clear();
+}
+
+bool FileSystemCore::is_legacy_bitmap(const FileSystem::Header &header) {
+    // состояние тома и таблица регионов появились вместе с побайтовой битовой картой
+    return header.volume_state == 0 && header.free_counts_size_clusters == 0;
+}
+
+bool FileSystemCore::rebuild_legacy_bitmap() const {
+    // в прежней раскладке бит кластера c лежал в байте 4 * (c / 8), а на диск попадала только первая четверть
+    // карты; такой карте верить нельзя, а FAT у занятого кластера данных всегда не свободна
+    const bool rebuilt = bitmap_manager_->rebuild([this](const uint32_t cluster) -> std::optional<bool> {
+        const std::optional<uint32_t> entry = fat_manager_->get_entry(cluster);
+        if (!entry) return std::nullopt;
+        return *entry != FileSystem::MARKER_FAT_ENTRY_FREE;
+    });
+    if (!rebuilt) return false;
+    output::warn(output::prefix::FILE_SYSTEM_CORE_WARNING) <<
+            "Volume was written by an older version, bitmap rebuilt from FAT" << std::endl;
+    return true;
+}
+
+bool FileSystemCore::reclaim_reserved_clusters() const {
+    // у каждого кластера данных, принадлежащего цепочке, запись FAT не FREE: освобождение общего кластера
+    // оставляет его EOF, а последнее - очищает запись вместе с битом
+    std::vector<uint32_t> unlinked;
+    bool fat_read = true;
+    const bool walked = bitmap_manager_->for_each_used_cluster([&](const uint32_t cluster) {
+        const std::optional<uint32_t> entry = fat_manager_->get_entry(cluster);
+        if (!entry) {
+            fat_read = false;
+            return false;
+        }
+        if (*entry == FileSystem::MARKER_FAT_ENTRY_FREE) unlinked.push_back(cluster);
+        return true;
+    });
+    if (!walked || !fat_read) return false;
+    if (unlinked.empty()) return true;
+    if (!bitmap_manager_->release_reserved(unlinked) || !bitmap_manager_->flush()) return false;
+    output::warn(output::prefix::FILE_SYSTEM_CORE_WARNING) << "Volume was not cleanly unmounted, " <<
+            unlinked.size() << " reserved cluster(s) returned to free space" << std::endl;
+    return true;
+}
+
+std::optional<uint32_t> FileSystemCore::allocate_and_link_cluster(FileSystem::FileHandle &handle) {
     if (!handle.is_open_to_write) {
         output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) <<
                 "Cannot allocate cluster for file not opened in write mode" << std::endl;
         return std::nullopt;
     }
 
-    std::optional<uint32_t> new_cluster_opt = bitmap_manager_->find_and_allocate_free_cluster();
+    // логические кластеры между концом цепочки и позицией записи (запись после seek за конец файла)
+    const uint64_t chain_clusters = (static_cast<uint64_t>(handle.dir_entry.file_size_bytes) +
+                                     FileSystem::CLUSTER_SIZE_BYTES - 1) / FileSystem::CLUSTER_SIZE_BYTES;
+    const uint64_t target_cluster = handle.current_pos_bytes / FileSystem::CLUSTER_SIZE_BYTES;
+    uint64_t gap = target_cluster > chain_clusters ? target_cluster - chain_clusters : 0;
+
+    // на томе без таблицы дыр промежуток заполняется нулевыми кластерами
+    if (gap > 0 && !fat_manager_->sparse_supported()) {
+        const std::vector<char> zeros(FileSystem::CLUSTER_SIZE_BYTES, 0);
+        for (; gap > 0; --gap) {
+            const std::optional<uint32_t> zero_cluster = take_reserved_cluster(handle);
+            if (!zero_cluster) {
+                output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "No free clusters available to extend file '" <<
+                        handle.name() << "'" << std::endl;
+                return std::nullopt;
+            }
+            if (!vol_manager_.write_cluster(*zero_cluster, zeros.data()) ||
+                !fat_manager_->set_entry(*zero_cluster, FileSystem::MARKER_FAT_ENTRY_EOF) ||
+                !link_after_previous(handle, *zero_cluster)) {
+                bitmap_manager_->free_cluster(*zero_cluster);
+                return std::nullopt;
+            }
+            handle.previous_node_in_chain = *zero_cluster;
+            handle.modified = true;
+        }
+    }
+
+    std::optional<uint32_t> new_cluster_opt = take_reserved_cluster(handle);
     if (!new_cluster_opt) {
         output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "No free clusters available to extend file '" <<
-                handle.path << "'" << std::endl;
+                handle.name() << "'" << std::endl;
         return std::nullopt;
     }
 
-    uint32_t new_cluster_idx = *new_cluster_opt;
-
-    if (handle.dir_entry.first_cluster == FileSystem::MARKER_FAT_ENTRY_FREE ||
-        handle.dir_entry.first_cluster == FileSystem::MARKER_FAT_ENTRY_EOF) {
-
-        if (!fat_manager_->set_entry(new_cluster_idx, FileSystem::MARKER_FAT_ENTRY_EOF)) {
-            bitmap_manager_->free_cluster(new_cluster_idx);
-            return std::nullopt;
-        }
-        handle.dir_entry.first_cluster = new_cluster_idx;
-    } else {
-        uint32_t last_known_cluster_in_chain = handle.current_cluster_in_chain;
-
-        if (last_known_cluster_in_chain == FileSystem::MARKER_FAT_ENTRY_FREE ||
-            last_known_cluster_in_chain == FileSystem::MARKER_FAT_ENTRY_EOF) {
+    const uint32_t new_cluster_idx = *new_cluster_opt;
+    if (!fat_manager_->set_entry(new_cluster_idx, FileSystem::MARKER_FAT_ENTRY_EOF)) {
+        bitmap_manager_->free_cluster(new_cluster_idx);
+        return std::nullopt;
+    }
 
-            std::list<uint32_t> chain = fat_manager_->get_cluster_chain(handle.dir_entry.first_cluster);
-            if (chain.empty()) {
-                output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "File has first cluster but chain is empty" << std::endl;
+    uint32_t linked_node = new_cluster_idx;
+    if (gap > 0) {
+        const uint32_t previous = handle.previous_node_in_chain;
+        if (FileSystem::is_hole_ref(previous)) {
+            // цепочка уже заканчивается дырой - удлиняем её
+            std::optional<FileSystem::HoleRecord> record = fat_manager_->get_hole(previous);
+            if (!record) {
+                bitmap_manager_->free_cluster(new_cluster_idx);
+                return std::nullopt;
+            }
+            record->length_clusters += static_cast<uint32_t>(gap);
+            record->next = new_cluster_idx;
+            if (!fat_manager_->set_hole(previous, *record)) {
                 bitmap_manager_->free_cluster(new_cluster_idx);
                 return std::nullopt;
             }
-            last_known_cluster_in_chain = chain.back();
+            handle.modified = true;
+            return new_cluster_idx;
         }
-
-        if (!fat_manager_->set_entry(last_known_cluster_in_chain, new_cluster_idx)) {
+        const std::optional<uint32_t> hole_ref = fat_manager_->create_hole(static_cast<uint32_t>(gap), new_cluster_idx);
+        if (!hole_ref) {
             bitmap_manager_->free_cluster(new_cluster_idx);
             return std::nullopt;
         }
+        linked_node = *hole_ref;
+    }
 
-        if (!fat_manager_->set_entry(new_cluster_idx, FileSystem::MARKER_FAT_ENTRY_EOF)) {
-            bitmap_manager_->free_cluster(new_cluster_idx);
-            return std::nullopt;
-        }
+    if (!link_after_previous(handle, linked_node)) {
+        if (linked_node != new_cluster_idx) fat_manager_->free_hole(linked_node);
+        bitmap_manager_->free_cluster(new_cluster_idx);
+        return std::nullopt;
     }
+    // перед новым кластером теперь стоит созданная дыра
+    if (linked_node != new_cluster_idx) handle.previous_node_in_chain = linked_node;
 
     handle.modified = true;
     return new_cluster_idx;
 }
 
-bool FileSystemCore::update_directory_entry_for_file(const FileSystem::FileHandle &handle) const {
-    FileSystem::DirectoryEntry updated_de = handle.dir_entry;
+std::optional<uint32_t> FileSystemCore::fill_hole_cluster(FileSystem::FileHandle &handle) const {
+    const uint32_t hole_ref = handle.current_cluster_in_chain;
+    std::optional<FileSystem::HoleRecord> record = fat_manager_->get_hole(hole_ref);
+    if (!record || handle.hole_offset_clusters >= record->length_clusters) {
+        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Broken hole " << hole_ref << " in file '" <<
+                handle.name() << "'" << std::endl;
+        return std::nullopt;
+    }
 
-    std::string filename = get_filename_from_path(handle.path);
-    uint32_t dir_cluster = get_containing_directory_cluster(handle.path);
+    const std::optional<uint32_t> new_cluster_opt = bitmap_manager_->allocate_in_group(handle.allocation_group);
+    if (!new_cluster_opt) {
+        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "No free clusters available to fill hole in '" <<
+                handle.name() << "'" << std::endl;
+        return std::nullopt;
+    }
+    const uint32_t new_cluster_idx = *new_cluster_opt;
+    const uint32_t offset = handle.hole_offset_clusters;
 
-    if (!directory_manager_->update_entry(dir_cluster, filename, updated_de)) {
-        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Failed to update directory entry for file '" <<
-                handle.path << "'" << std::endl;
-        return false;
+    // дыра делится на части до и после нового кластера; пустые части не создаются
+    bool linked;
+    if (offset == 0) {
+        if (record->length_clusters == 1) {
+            linked = fat_manager_->set_entry(new_cluster_idx, record->next) &&
+                     link_after_previous(handle, new_cluster_idx) && fat_manager_->free_hole(hole_ref);
+        } else {
+            --record->length_clusters;
+            linked = fat_manager_->set_entry(new_cluster_idx, hole_ref) && fat_manager_->set_hole(hole_ref, *record) &&
+                     link_after_previous(handle, new_cluster_idx);
+        }
+    } else {
+        uint32_t after = record->next;
+        if (offset + 1 < record->length_clusters) {
+            const std::optional<uint32_t> tail = fat_manager_->create_hole(record->length_clusters - offset - 1,
+                                                                           record->next);
+            if (!tail) {
+                bitmap_manager_->free_cluster(new_cluster_idx);
+                return std::nullopt;
+            }
+            after = *tail;
+        }
+        record->length_clusters = offset;
+        record->next = new_cluster_idx;
+        linked = fat_manager_->set_entry(new_cluster_idx, after) && fat_manager_->set_hole(hole_ref, *record);
+        if (linked) handle.previous_node_in_chain = hole_ref;
     }
-    return true;
+
+    if (!linked) {
+        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Failed to link cluster " << new_cluster_idx <<
+                " into hole of '" << handle.name() << "'" << std::endl;
+        bitmap_manager_->free_cluster(new_cluster_idx);
+        return std::nullopt;
+    }
+    handle.modified = true;
+    return new_cluster_idx;
 }
 
-int64_t FileSystemCore::read_file(uint32_t handle_id, char *buffer, uint64_t bytes_to_read) {
-    auto it = opened_files_table_.find(handle_id);
-    if (it == opened_files_table_.end()) {
-        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Invalid file handle " << handle_id << std::endl;
-        return -1;
+bool FileSystemCore::link_after_previous(FileSystem::FileHandle &handle, const uint32_t node) const {
+    const uint32_t previous = handle.previous_node_in_chain;
+    if (previous == FileSystem::MARKER_FAT_ENTRY_FREE) {
+        handle.dir_entry.first_cluster = node;
+        handle.modified = true;
+        return true;
     }
+    return fat_manager_->set_next_node(previous, node);
+}
 
-    FileSystem::FileHandle &handle = it->second;
+std::optional<uint32_t> FileSystemCore::resolve_data_cluster(const uint32_t node) const {
+    std::lock_guard lock(fs_mutex_);
+    if (!mounted_) return std::nullopt;
+    return node_cluster(node);
+}
 
-    if (bytes_to_read == 0) return 0;
-    if (handle.current_pos_bytes >= handle.dir_entry.file_size_bytes) {
-        return 0; // EOF
+std::optional<uint32_t> FileSystemCore::node_cluster(const uint32_t node) const {
+    if (FileSystem::is_shared_ref(node)) {
+        const std::optional<FileSystem::SharedRecord> record = fat_manager_->get_shared(node);
+        if (!record || !is_valid_cluster(record->cluster)) return std::nullopt;
+        return record->cluster;
     }
+    if (!is_valid_cluster(node)) return std::nullopt;
+    return node;
+}
 
-    uint64_t total_bytes_read = 0;
-    uint64_t remaining_file_size = handle.dir_entry.file_size_bytes - handle.current_pos_bytes;
-    uint64_t effective_bytes_to_read = std::min(bytes_to_read, remaining_file_size);
-
-    while (total_bytes_read < effective_bytes_to_read) {
-        // Проверка правильности кластера в буфере
-        if (handle.buffered_cluster_idx != handle.current_cluster_in_chain) {
-            if (!is_valid_cluster(handle.current_cluster_in_chain)) {
-                output::warn(output::prefix::FILE_SYSTEM_CORE_WARNING) << "Unexpected end of cluster chain for file '" <<
-                        handle.path << "'" << std::endl;
-                break;
-            }
+bool FileSystemCore::advance_in_chain(FileSystem::FileHandle &handle) const {
+    const uint32_t current = handle.current_cluster_in_chain;
+    if (current == FileSystem::MARKER_FAT_ENTRY_FREE || current == FileSystem::MARKER_FAT_ENTRY_EOF) {
+        return true;
+    }
 
-            if (!load_cluster_info_buffer(handle, handle.current_cluster_in_chain)) {
-                output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Failed to load cluster " <<
-                        handle.current_cluster_in_chain << " for reading" << std::endl;
-                return -1;
-            }
+    uint32_t next;
+    if (FileSystem::is_hole_ref(current)) {
+        const std::optional<FileSystem::HoleRecord> record = fat_manager_->get_hole(current);
+        if (!record) return false;
+        if (handle.hole_offset_clusters + 1 < record->length_clusters) {
+            ++handle.hole_offset_clusters;
+            return true;
         }
+        next = record->next;
+    } else {
+        const std::optional<uint32_t> next_opt = fat_manager_->get_next_node(current);
+        if (!next_opt) return false;
+        next = *next_opt;
+    }
 
-        // Расчёт количества байт для чтения из текущего буфера
-        uint32_t bytes_in_current_cluster_buffer = FileSystem::CLUSTER_SIZE_BYTES - handle.offset_in_buffered_cluster;
-        uint64_t bytes_to_read_this_iteration = std::min(static_cast<uint64_t>(bytes_in_current_cluster_buffer),
-                                                         effective_bytes_to_read - total_bytes_read);
-
-        std::memcpy(buffer + total_bytes_read, handle.buffer.data() + handle.offset_in_buffered_cluster,
-                    bytes_to_read_this_iteration);
+    handle.previous_node_in_chain = current;
+    handle.hole_offset_clusters = 0;
+    handle.current_cluster_in_chain = next == FileSystem::MARKER_FAT_ENTRY_FREE ? FileSystem::MARKER_FAT_ENTRY_EOF : next;
+    return true;
+}
 
-        handle.current_pos_bytes += bytes_to_read_this_iteration;
-        handle.offset_in_buffered_cluster += static_cast<uint32_t>(bytes_to_read_this_iteration);
-        total_bytes_read += bytes_to_read_this_iteration;
+bool FileSystemCore::position_in_chain(FileSystem::FileHandle &handle) const {
+    const uint64_t target_cluster = handle.current_pos_bytes / FileSystem::CLUSTER_SIZE_BYTES;
+    handle.offset_in_buffered_cluster = static_cast<uint32_t>(handle.current_pos_bytes % FileSystem::CLUSTER_SIZE_BYTES);
+    handle.previous_node_in_chain = FileSystem::MARKER_FAT_ENTRY_FREE;
+    handle.hole_offset_clusters = 0;
 
-        // Переход к следующему кластеру если текущий закончился
-        if (handle.offset_in_buffered_cluster >= FileSystem::CLUSTER_SIZE_BYTES) {
-            auto next_cluster_opt = fat_manager_->get_entry(handle.current_cluster_in_chain);
-            if (!next_cluster_opt ||
-                *next_cluster_opt == FileSystem::MARKER_FAT_ENTRY_FREE ||
-                *next_cluster_opt == FileSystem::MARKER_FAT_ENTRY_EOF) {
+    // Обработка пустого файла
+    if (!has_chain(handle.dir_entry.first_cluster)) {
+        handle.current_cluster_in_chain = handle.dir_entry.first_cluster;
+        return true;
+    }
 
-                handle.current_cluster_in_chain = FileSystem::MARKER_FAT_ENTRY_EOF;
-                if (total_bytes_read < effective_bytes_to_read) {
-                    output::warn(output::prefix::FILE_SYSTEM_CORE_WARNING) <<
-                            "File size mismatch. EOF in FAT chain reached early for '" << handle.path << "'" << std::endl;
-                }
-                break;
+    // Найти нужный узел для новой позиции: кластер (свой или общий) занимает один логический кластер,
+    // дыра - length_clusters
+    uint32_t node = handle.dir_entry.first_cluster;
+    uint64_t logical_cluster = 0;
+    while (FileSystem::is_hole_ref(node) || FileSystem::is_shared_ref(node) || is_valid_cluster(node)) {
+        uint32_t length = 1;
+        uint32_t next;
+        if (FileSystem::is_hole_ref(node)) {
+            const std::optional<FileSystem::HoleRecord> record = fat_manager_->get_hole(node);
+            if (!record || record->length_clusters == 0) {
+                output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Broken hole " << node <<
+                        " during seek in '" << handle.name() << "'" << std::endl;
+                return false;
             }
-            handle.current_cluster_in_chain = *next_cluster_opt;
-            handle.offset_in_buffered_cluster = 0;
+            length = record->length_clusters;
+            next = record->next;
+        } else {
+            const auto next_cluster_opt = fat_manager_->get_next_node(node);
+            if (!next_cluster_opt) {
+                output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "FAT entry missing during seek for cluster " <<
+                        node << std::endl;
+                return false;
+            }
+            next = *next_cluster_opt;
+        }
+
+        if (target_cluster < logical_cluster + length) {
+            handle.current_cluster_in_chain = node;
+            handle.hole_offset_clusters = static_cast<uint32_t>(target_cluster - logical_cluster);
+            return true;
         }
+        logical_cluster += length;
+        handle.previous_node_in_chain = node;
+        node = next;
     }
 
-    return static_cast<int64_t>(total_bytes_read);
+    // позиция за концом цепочки: кластер будет выделен при записи
+    handle.current_cluster_in_chain = FileSystem::MARKER_FAT_ENTRY_EOF;
+    return true;
 }
 
-int64_t FileSystemCore::write_file(uint32_t handle_id, const char *user_buffer, uint64_t bytes_to_write) {
-    auto it = opened_files_table_.find(handle_id);
-    if (it == opened_files_table_.end()) {
-        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Invalid file handle " << handle_id << " for write" << std::endl;
-        return -1;
-    }
+std::optional<uint64_t> FileSystemCore::find_data_or_hole(const FileSystem::FileHandle &handle, const uint64_t offset,
+                                                          const bool find_data) const {
+    const uint64_t file_size = handle.dir_entry.file_size_bytes;
+    if (offset >= file_size) return std::nullopt;
+    // дыры сжатого файла хранят остаток групп, а не нули: весь файл - данные
+    if (handle.dir_entry.is_compressed()) return find_data ? offset : file_size;
+
+    uint32_t node = handle.dir_entry.first_cluster;
+    uint64_t logical_cluster = 0;
+    while (has_chain(node) && logical_cluster * FileSystem::CLUSTER_SIZE_BYTES < file_size) {
+        const bool is_hole = FileSystem::is_hole_ref(node);
+        uint32_t length = 1;
+        std::optional<uint32_t> next;
+        if (is_hole) {
+            const std::optional<FileSystem::HoleRecord> record = fat_manager_->get_hole(node);
+            if (!record || record->length_clusters == 0) return std::nullopt;
+            length = record->length_clusters;
+            next = record->next;
+        } else {
+            next = fat_manager_->get_next_node(node);
+            if (!next) return std::nullopt;
+        }
 
-    FileSystem::FileHandle &handle = it->second;
+        const uint64_t begin = logical_cluster * FileSystem::CLUSTER_SIZE_BYTES;
+        const uint64_t end = std::min(file_size, (logical_cluster + length) * FileSystem::CLUSTER_SIZE_BYTES);
+        if (is_hole != find_data && end > offset) {
+            return std::max(offset, begin);
+        }
+        logical_cluster += length;
+        node = *next;
+    }
+    // за последними данными файла начинается неявная дыра
+    return find_data ? std::nullopt : std::optional<uint64_t>(file_size);
+}
 
-    if (!handle.is_open_to_write) {
-        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "File with handle " << handle_id <<
-                " not opened in write mode" << std::endl;
-        return -1;
+int64_t FileSystemCore::write_inline(FileSystem::FileHandle &handle, const char *user_buffer,
+                                     const uint64_t bytes_to_write) const {
+    FileSystem::DirectoryEntry &entry = handle.dir_entry;
+    entry.set_inline(true);
+    char *data = entry.inline_data();
+    // промежуток после seek за конец файла читается нулями
+    if (handle.current_pos_bytes > entry.file_size_bytes) {
+        std::memset(data + entry.file_size_bytes, 0, handle.current_pos_bytes - entry.file_size_bytes);
+    }
+    std::memcpy(data + handle.current_pos_bytes, user_buffer, bytes_to_write);
+    handle.current_pos_bytes += bytes_to_write;
+    if (handle.current_pos_bytes > entry.file_size_bytes) {
+        entry.file_size_bytes = static_cast<uint32_t>(handle.current_pos_bytes);
     }
+    handle.modified = true;
+    return static_cast<int64_t>(bytes_to_write);
+}
 
-    if (bytes_to_write == 0) return 0;
+bool FileSystemCore::spill_inline_data(FileSystem::DirectoryEntry &entry) const {
+    const std::optional<uint32_t> cluster_opt = bitmap_manager_->find_and_allocate_free_cluster();
+    if (!cluster_opt) {
+        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "No free clusters for inline data" << std::endl;
+        return false;
+    }
+    std::vector<char> cluster(FileSystem::CLUSTER_SIZE_BYTES, 0);
+    std::memcpy(cluster.data(), entry.inline_data(), entry.file_size_bytes);
+    if (!vol_manager_.write_cluster(*cluster_opt, cluster.data()) ||
+        !fat_manager_->set_entry(*cluster_opt, FileSystem::MARKER_FAT_ENTRY_EOF)) {
+        bitmap_manager_->free_cluster(*cluster_opt);
+        return false;
+    }
+    entry.set_inline(false);
+    entry.first_cluster = *cluster_opt;
+    return true;
+}
 
-    uint64_t total_bytes_written = 0;
+bool FileSystemCore::update_directory_entry_for_file(const FileSystem::FileHandle &handle) const {
+    FileSystem::DirectoryEntry updated_de = handle.dir_entry;
 
-    while (total_bytes_written < bytes_to_write) {
-        // Если текущий кластер невалиден, выделяем новый
-        if (handle.current_cluster_in_chain == FileSystem::MARKER_FAT_ENTRY_FREE ||
-            handle.current_cluster_in_chain == FileSystem::MARKER_FAT_ENTRY_EOF) {
+    if (!directory_manager_->update_entry(handle.dir_cluster, std::string(handle.name()), updated_de)) {
+        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Failed to update directory entry for file '" <<
+                handle.name() << "'" << std::endl;
+        return false;
+    }
+    return true;
+}
 
-            std::optional<uint32_t> new_cluster_idx_opt = allocate_and_link_cluster(handle);
-            if (!new_cluster_idx_opt) {
-                output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Failed to allocate new cluster for file '" <<
-                        handle.path << "' during write" << std::endl;
+bool FileSystemCore::unshare_buffered_cluster(FileSystem::FileHandle &handle) const {
+    if (!fat_manager_->sharing_supported()) return true;
+    const uint32_t cluster_idx = handle.buffered_cluster_idx;
+    const std::optional<uint32_t> refcount = fat_manager_->get_refcount(cluster_idx);
+    if (!refcount) return false;
+    if (*refcount < 2) return true;
+
+    const uint32_t node = handle.current_cluster_in_chain;
+    const std::optional<uint32_t> next = fat_manager_->get_next_node(node);
+    if (!next) return false;
+    const std::optional<uint32_t> copy = bitmap_manager_->allocate_in_group(handle.allocation_group);
+    if (!copy) {
+        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "No free clusters to copy shared cluster of '" <<
+                handle.name() << "'" << std::endl;
+        return false;
+    }
+    // копия встаёт на место узла, содержимое попадёт в неё из буфера при сбросе
+    if (!fat_manager_->set_entry(*copy, *next) || !link_after_previous(handle, *copy)) {
+        bitmap_manager_->free_cluster(*copy);
+        return false;
+    }
+    const bool shared = FileSystem::is_shared_ref(node);
+    const std::optional<bool> last = fat_manager_->release_cluster(cluster_idx, !shared);
+    if (!last || (shared && !fat_manager_->free_shared(node))) return false;
+    if (*last) bitmap_manager_->free_cluster(cluster_idx);
+
+    handle.current_cluster_in_chain = *copy;
+    handle.buffered_cluster_idx = *copy;
+    handle.buffer_dirty = true;
+    handle.modified = true;
+    return true;
+}
+
+std::optional<uint32_t> FileSystemCore::find_duplicate(const char *data, const uint32_t checksum,
+                                                       const uint32_t exclude) const {
+    const std::optional<std::vector<uint32_t>> candidates = dedup_index_->lookup(checksum);
+    if (!candidates) return std::nullopt;
+    for (const uint32_t candidate: *candidates) {
+        if (candidate == exclude || !is_valid_cluster(candidate)) continue;
+        // индекс не чистится: кластер мог быть освобождён или перезаписан
+        const std::optional<uint32_t> refcount = fat_manager_->get_refcount(candidate);
+        if (!refcount || *refcount == 0) continue;
+        const bool pending = std::any_of(opened_files_table_.begin(), opened_files_table_.end(),
+                                         [&](const FileSystem::FileHandle &handle) {
+                                             return handle.buffer_dirty && handle.buffered_cluster_idx == candidate;
+                                         });
+        if (pending || !vol_manager_.checksum_matches(candidate, data)) continue;
+        if (vol_manager_.read_cluster(candidate, dedup_scratch_.data()) &&
+            std::memcmp(dedup_scratch_.data(), data, FileSystem::CLUSTER_SIZE_BYTES) == 0) {
+            return candidate;
+        }
+    }
+    return std::nullopt;
+}
+
+bool FileSystemCore::track_cluster(const uint32_t cluster_idx, const uint32_t checksum) const {
+    const std::optional<uint32_t> refcount = fat_manager_->get_refcount(cluster_idx);
+    if (!refcount) return false;
+    // кандидатом может быть только кластер со счётчиком: его освобождение и изменение видны по счётчику
+    if (*refcount == 0 && !fat_manager_->set_refcount(cluster_idx, 1)) return false;
+    return dedup_index_->insert(checksum, cluster_idx);
+}
+
+std::optional<uint32_t> FileSystemCore::share_node(const uint32_t previous, const uint32_t node, const uint32_t target,
+                                                   uint32_t &first_node) const {
+    // previous должен указывать на node, иначе ссылка встанет не на своё место
+    const std::optional<uint32_t> linked = previous == FileSystem::MARKER_FAT_ENTRY_FREE
+                                               ? std::optional<uint32_t>(first_node)
+                                               : fat_manager_->get_next_node(previous);
+    const std::optional<uint32_t> next = fat_manager_->get_next_node(node);
+    const std::optional<uint32_t> target_refcount = fat_manager_->get_refcount(target);
+    if (!linked || *linked != node || !next || !target_refcount || *target_refcount == 0) return std::nullopt;
+
+    const std::optional<uint32_t> shared = fat_manager_->create_shared(target, *next);
+    if (!shared) return std::nullopt;
+    if (!fat_manager_->set_refcount(target, *target_refcount + 1)) {
+        fat_manager_->free_shared(*shared);
+        return std::nullopt;
+    }
+    if (previous == FileSystem::MARKER_FAT_ENTRY_FREE) {
+        first_node = *shared;
+    } else if (!fat_manager_->set_next_node(previous, *shared)) {
+        fat_manager_->set_refcount(target, *target_refcount);
+        fat_manager_->free_shared(*shared);
+        return std::nullopt;
+    }
+
+    const std::optional<bool> last = fat_manager_->release_cluster(node, true);
+    if (last && *last) bitmap_manager_->free_cluster(node);
+    return shared;
+}
+
+bool FileSystemCore::build_group_index(FileSystem::FileHandle &handle) const {
+    handle.groups.clear();
+    handle.group_buffer.assign(FileSystem::COMPRESSION_GROUP_BYTES, 0);
+    handle.buffered_group = FileSystem::MARKER_FAT_ENTRY_EOF;
+    handle.group_dirty = false;
+
+    // группа начинается с кластера на границе COMPRESSION_GROUP_CLUSTERS и может заканчиваться дырой
+    uint32_t node = handle.dir_entry.first_cluster;
+    uint64_t logical_cluster = 0;
+    while (has_chain(node)) {
+        if (logical_cluster % FileSystem::COMPRESSION_GROUP_CLUSTERS != 0 || !is_valid_cluster(node)) {
+            output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Broken compressed group at cluster " <<
+                    logical_cluster << " of '" << handle.name() << "'" << std::endl;
+            return false;
+        }
+        FileSystem::CompressedGroup group{node, 0, FileSystem::MARKER_FAT_ENTRY_FREE};
+        while (is_valid_cluster(node) && group.data_clusters < FileSystem::COMPRESSION_GROUP_CLUSTERS) {
+            const std::optional<uint32_t> next = fat_manager_->get_entry(node);
+            if (!next) return false;
+            ++group.data_clusters;
+            node = *next;
+        }
+        logical_cluster += group.data_clusters;
+        if (FileSystem::is_hole_ref(node)) {
+            const std::optional<FileSystem::HoleRecord> record = fat_manager_->get_hole(node);
+            if (!record || record->length_clusters == 0 ||
+                group.data_clusters + record->length_clusters > FileSystem::COMPRESSION_GROUP_CLUSTERS) {
+                output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Broken hole " << node <<
+                        " in compressed file '" << handle.name() << "'" << std::endl;
+                return false;
+            }
+            group.hole_ref = node;
+            logical_cluster += record->length_clusters;
+            node = record->next;
+        }
+        handle.groups.push_back(group);
+    }
+    return true;
+}
+
+std::optional<std::vector<uint32_t>> FileSystemCore::group_clusters(const FileSystem::CompressedGroup &group) const {
+    std::vector<uint32_t> clusters;
+    clusters.reserve(group.data_clusters);
+    uint32_t node = group.first_cluster;
+    for (uint32_t i = 0; i < group.data_clusters; ++i) {
+        if (!is_valid_cluster(node)) return std::nullopt;
+        clusters.push_back(node);
+        if (i + 1 < group.data_clusters) {
+            const std::optional<uint32_t> next = fat_manager_->get_entry(node);
+            if (!next) return std::nullopt;
+            node = *next;
+        }
+    }
+    return clusters;
+}
+
+bool FileSystemCore::load_group(FileSystem::FileHandle &handle, const uint32_t group) const {
+    if (handle.buffered_group == group) return true;
+    if (!store_group(handle)) return false;
+
+    handle.buffered_group = FileSystem::MARKER_FAT_ENTRY_EOF;
+    std::fill(handle.group_buffer.begin(), handle.group_buffer.end(), 0);
+    if (group >= handle.groups.size()) {
+        handle.buffered_group = group;
+        return true;
+    }
+
+    const FileSystem::CompressedGroup &entry = handle.groups[group];
+    const std::optional<std::vector<uint32_t>> clusters = group_clusters(entry);
+    if (!clusters) {
+        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Broken chain of compressed group " << group <<
+                " in '" << handle.name() << "'" << std::endl;
+        return false;
+    }
+
+    // сжатая группа читается в промежуточный буфер, несжатая - сразу на место
+    const bool compressed = entry.hole_ref != FileSystem::MARKER_FAT_ENTRY_FREE;
+    char *target = compressed ? compression_scratch_.data() : handle.group_buffer.data();
+    for (uint32_t pos = 0; pos < clusters->size();) {
+        uint32_t run = 1;
+        while (pos + run < clusters->size() && (*clusters)[pos + run] == (*clusters)[pos] + run) ++run;
+        if (!vol_manager_.read_clusters((*clusters)[pos], run,
+                                        target + static_cast<size_t>(pos) * FileSystem::CLUSTER_SIZE_BYTES)) {
+            output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Failed to read compressed group " << group <<
+                    " of '" << handle.name() << "'" << std::endl;
+            return false;
+        }
+        pos += run;
+    }
+
+    if (compressed) {
+        FileSystem::CompressedGroupHeader header{};
+        std::memcpy(&header, target, sizeof(header));
+        const uint64_t stored_bytes = static_cast<uint64_t>(entry.data_clusters) * FileSystem::CLUSTER_SIZE_BYTES;
+        std::optional<size_t> unpacked;
+        if (sizeof(header) + static_cast<uint64_t>(header.compressed_bytes) <= stored_bytes &&
+            header.raw_bytes <= FileSystem::COMPRESSION_GROUP_BYTES) {
+            unpacked = lz_codec::decompress(target + sizeof(header), header.compressed_bytes,
+                                            handle.group_buffer.data(), header.raw_bytes);
+        }
+        if (!unpacked || *unpacked != header.raw_bytes) {
+            output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Corrupted compressed group " << group <<
+                    " in '" << handle.name() << "'" << std::endl;
+            std::fill(handle.group_buffer.begin(), handle.group_buffer.end(), 0);
+            return false;
+        }
+    }
+    handle.buffered_group = group;
+    return true;
+}
+
+bool FileSystemCore::store_group(FileSystem::FileHandle &handle) const {
+    if (!handle.group_dirty) return true;
+    const uint32_t group = handle.buffered_group;
+    const uint64_t group_start = static_cast<uint64_t>(group) * FileSystem::COMPRESSION_GROUP_BYTES;
+    const uint64_t file_size = handle.dir_entry.file_size_bytes;
+    if (file_size <= group_start || group > handle.groups.size()) {
+        handle.group_dirty = false;
+        return true;
+    }
+
+    const auto raw_bytes = static_cast<uint32_t>(std::min<uint64_t>(FileSystem::COMPRESSION_GROUP_BYTES,
+                                                                     file_size - group_start));
+    const uint32_t logical_clusters = (raw_bytes + FileSystem::CLUSTER_SIZE_BYTES - 1) / FileSystem::CLUSTER_SIZE_BYTES;
+
+    // группа хранится сжатой, только если это экономит хотя бы один кластер
+    uint32_t data_clusters = logical_clusters;
+    const char *payload = handle.group_buffer.data();
+    if (logical_clusters > 1) {
+        constexpr size_t header_size = sizeof(FileSystem::CompressedGroupHeader);
+        const size_t capacity = static_cast<size_t>(logical_clusters - 1) * FileSystem::CLUSTER_SIZE_BYTES - header_size;
+        const size_t compressed = lz_codec::compress(handle.group_buffer.data(), raw_bytes,
+                                                     compression_scratch_.data() + header_size, capacity);
+        if (compressed != 0) {
+            const FileSystem::CompressedGroupHeader header{static_cast<uint32_t>(compressed), raw_bytes};
+            std::memcpy(compression_scratch_.data(), &header, header_size);
+            data_clusters = static_cast<uint32_t>((header_size + compressed + FileSystem::CLUSTER_SIZE_BYTES - 1) /
+                                                  FileSystem::CLUSTER_SIZE_BYTES);
+            std::fill(compression_scratch_.begin() + static_cast<std::ptrdiff_t>(header_size + compressed),
+                      compression_scratch_.begin() +
+                      static_cast<std::ptrdiff_t>(data_clusters) * FileSystem::CLUSTER_SIZE_BYTES, 0);
+            payload = compression_scratch_.data();
+        }
+    }
+
+    // прежние кластеры группы переиспользуются, лишние освобождаются, недостающие выделяются
+    const bool is_new = group == handle.groups.size();
+    std::vector<uint32_t> clusters;
+    if (!is_new) {
+        std::optional<std::vector<uint32_t>> old_clusters = group_clusters(handle.groups[group]);
+        if (!old_clusters) {
+            output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Broken chain of compressed group " << group <<
+                    " in '" << handle.name() << "'" << std::endl;
+            return false;
+        }
+        clusters = std::move(*old_clusters);
+    }
+    std::vector<uint32_t> released;
+    if (clusters.size() > data_clusters) {
+        released.assign(clusters.begin() + data_clusters, clusters.end());
+        clusters.resize(data_clusters);
+    }
+    std::vector<uint32_t> allocated;
+    while (clusters.size() < data_clusters) {
+        const std::optional<uint32_t> cluster = bitmap_manager_->allocate_in_group(handle.allocation_group);
+        if (!cluster) {
+            output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "No free clusters available for compressed group of '"
+                    << handle.name() << "'" << std::endl;
+            bitmap_manager_->free_clusters(allocated);
+            return false;
+        }
+        allocated.push_back(*cluster);
+        clusters.push_back(*cluster);
+    }
+
+    // данные пишутся до перестроения цепочки, непрерывными участками
+    for (uint32_t pos = 0; pos < data_clusters;) {
+        uint32_t run = 1;
+        while (pos + run < data_clusters && clusters[pos + run] == clusters[pos] + run) ++run;
+        if (!vol_manager_.write_clusters(clusters[pos], run,
+                                         payload + static_cast<size_t>(pos) * FileSystem::CLUSTER_SIZE_BYTES)) {
+            output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Failed to write compressed group " << group <<
+                    " of '" << handle.name() << "'" << std::endl;
+            bitmap_manager_->free_clusters(allocated);
+            return false;
+        }
+        pos += run;
+    }
+
+    // дыра закрывает остаток группы и ведёт к следующей группе
+    const uint32_t next_node = group + 1 < handle.groups.size() ? handle.groups[group + 1].first_cluster
+                                                                  : FileSystem::MARKER_FAT_ENTRY_EOF;
+    uint32_t hole_ref = is_new ? FileSystem::MARKER_FAT_ENTRY_FREE : handle.groups[group].hole_ref;
+    bool linked = true;
+    if (data_clusters < logical_clusters) {
+        const FileSystem::HoleRecord record{logical_clusters - data_clusters, next_node};
+        if (hole_ref != FileSystem::MARKER_FAT_ENTRY_FREE) {
+            linked = fat_manager_->set_hole(hole_ref, record);
+        } else {
+            const std::optional<uint32_t> created = fat_manager_->create_hole(record.length_clusters, next_node);
+            linked = created.has_value();
+            if (created) hole_ref = *created;
+        }
+    } else if (hole_ref != FileSystem::MARKER_FAT_ENTRY_FREE) {
+        linked = fat_manager_->free_hole(hole_ref);
+        hole_ref = FileSystem::MARKER_FAT_ENTRY_FREE;
+    }
+    if (!linked) {
+        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Failed to update hole of compressed group " << group <<
+                " of '" << handle.name() << "'" << std::endl;
+        bitmap_manager_->free_clusters(allocated);
+        return false;
+    }
+    const uint32_t after_data = hole_ref != FileSystem::MARKER_FAT_ENTRY_FREE ? hole_ref : next_node;
+    for (uint32_t i = 0; linked && i < data_clusters; ++i) {
+        linked = fat_manager_->set_entry(clusters[i], i + 1 < data_clusters ? clusters[i + 1] : after_data);
+    }
+
+    // новая группа подключается за последним узлом предыдущей
+    if (linked && is_new) {
+        if (group == 0) {
+            handle.dir_entry.first_cluster = clusters.front();
+        } else {
+            const FileSystem::CompressedGroup &previous = handle.groups[group - 1];
+            if (previous.hole_ref != FileSystem::MARKER_FAT_ENTRY_FREE) {
+                std::optional<FileSystem::HoleRecord> record = fat_manager_->get_hole(previous.hole_ref);
+                linked = record.has_value();
+                if (record) {
+                    record->next = clusters.front();
+                    linked = fat_manager_->set_hole(previous.hole_ref, *record);
+                }
+            } else {
+                const std::optional<std::vector<uint32_t>> previous_clusters = group_clusters(previous);
+                linked = previous_clusters && fat_manager_->set_entry(previous_clusters->back(), clusters.front());
+            }
+        }
+    }
+    if (!linked) {
+        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Failed to link compressed group " << group <<
+                " of '" << handle.name() << "'" << std::endl;
+        return false;
+    }
+
+    if (!released.empty() && (!fat_manager_->clear_entries(released) || !bitmap_manager_->free_clusters(released))) {
+        output::warn(output::prefix::FILE_SYSTEM_CORE_WARNING) << "Failed to release clusters of compressed group " <<
+                group << " of '" << handle.name() << "'" << std::endl;
+    }
+
+    const FileSystem::CompressedGroup stored{clusters.front(), data_clusters, hole_ref};
+    if (is_new) {
+        handle.groups.push_back(stored);
+    } else {
+        handle.groups[group] = stored;
+    }
+    handle.group_dirty = false;
+    handle.modified = true;
+    return true;
+}
+
+bool FileSystemCore::extend_groups(FileSystem::FileHandle &handle, const uint32_t group) const {
+    if (!store_group(handle)) return false;
+
+    // последняя группа, записанная короче полной длины, сжимается заново уже на всю группу
+    if (!handle.groups.empty()) {
+        const auto last = static_cast<uint32_t>(handle.groups.size() - 1);
+        const FileSystem::CompressedGroup &entry = handle.groups[last];
+        uint32_t span = entry.data_clusters;
+        if (entry.hole_ref != FileSystem::MARKER_FAT_ENTRY_FREE) {
+            const std::optional<FileSystem::HoleRecord> record = fat_manager_->get_hole(entry.hole_ref);
+            if (!record) return false;
+            span += record->length_clusters;
+        }
+        if (span < FileSystem::COMPRESSION_GROUP_CLUSTERS) {
+            if (!load_group(handle, last)) return false;
+            const uint64_t group_end = static_cast<uint64_t>(last + 1) * FileSystem::COMPRESSION_GROUP_BYTES;
+            handle.dir_entry.file_size_bytes = static_cast<uint32_t>(
+                std::max<uint64_t>(handle.dir_entry.file_size_bytes, group_end));
+            handle.group_dirty = true;
+            if (!store_group(handle)) return false;
+        }
+    }
+
+    // промежуток до group (запись после seek за конец файла) занимают нулевые группы по одному кластеру
+    for (auto next = static_cast<uint32_t>(handle.groups.size()); next < group; ++next) {
+        std::fill(handle.group_buffer.begin(), handle.group_buffer.end(), 0);
+        handle.buffered_group = next;
+        const uint64_t group_end = static_cast<uint64_t>(next + 1) * FileSystem::COMPRESSION_GROUP_BYTES;
+        handle.dir_entry.file_size_bytes = static_cast<uint32_t>(
+            std::max<uint64_t>(handle.dir_entry.file_size_bytes, group_end));
+        handle.group_dirty = true;
+        if (!store_group(handle)) return false;
+    }
+    return true;
+}
+
+int64_t FileSystemCore::read_compressed(FileSystem::FileHandle &handle, char *buffer,
+                                        const uint64_t bytes_to_read) const {
+    uint64_t total_bytes_read = 0;
+    while (total_bytes_read < bytes_to_read) {
+        const auto group = static_cast<uint32_t>(handle.current_pos_bytes / FileSystem::COMPRESSION_GROUP_BYTES);
+        if (!load_group(handle, group)) return -1;
+        const auto offset = static_cast<uint32_t>(handle.current_pos_bytes % FileSystem::COMPRESSION_GROUP_BYTES);
+        const uint64_t chunk = std::min<uint64_t>(FileSystem::COMPRESSION_GROUP_BYTES - offset,
+                                                  bytes_to_read - total_bytes_read);
+        std::memcpy(buffer + total_bytes_read, handle.group_buffer.data() + offset, chunk);
+        handle.current_pos_bytes += chunk;
+        total_bytes_read += chunk;
+    }
+    return static_cast<int64_t>(total_bytes_read);
+}
+
+int64_t FileSystemCore::write_compressed(FileSystem::FileHandle &handle, const char *user_buffer,
+                                         const uint64_t bytes_to_write) const {
+    uint64_t total_bytes_written = 0;
+    while (total_bytes_written < bytes_to_write) {
+        const auto group = static_cast<uint32_t>(handle.current_pos_bytes / FileSystem::COMPRESSION_GROUP_BYTES);
+        if (group >= handle.groups.size() && handle.buffered_group != group && !extend_groups(handle, group)) break;
+        if (!load_group(handle, group)) break;
+
+        const auto offset = static_cast<uint32_t>(handle.current_pos_bytes % FileSystem::COMPRESSION_GROUP_BYTES);
+        const uint64_t chunk = std::min<uint64_t>(FileSystem::COMPRESSION_GROUP_BYTES - offset,
+                                                  bytes_to_write - total_bytes_written);
+        std::memcpy(handle.group_buffer.data() + offset, user_buffer + total_bytes_written, chunk);
+        handle.group_dirty = true;
+        handle.current_pos_bytes += chunk;
+        total_bytes_written += chunk;
+        if (handle.current_pos_bytes > handle.dir_entry.file_size_bytes) {
+            handle.dir_entry.file_size_bytes = static_cast<uint32_t>(handle.current_pos_bytes);
+            handle.modified = true;
+        }
+    }
+    if (total_bytes_written < bytes_to_write) {
+        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Failed to write compressed data of '" << handle.name() <<
+                "'" << std::endl;
+    }
+    return static_cast<int64_t>(total_bytes_written);
+}
+
+int64_t FileSystemCore::read_file(const uint32_t handle_id, char *buffer, const uint64_t bytes_to_read) {
+    return traced(trace_record(FsTrace::Op::READ, handle_id, 0, bytes_to_read, 1), {}, {},
+                  [&] { return read_file_untraced(handle_id, buffer, bytes_to_read); });
+}
+
+int64_t FileSystemCore::read_file_untraced(uint32_t handle_id, char *buffer, uint64_t bytes_to_read) {
+    std::lock_guard lock(fs_mutex_);
+    FileSystem::FileHandle *const handle_ptr = opened_files_table_.find(handle_id);
+    if (!handle_ptr) {
+        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Invalid file handle " << handle_id << std::endl;
+        return -1;
+    }
+
+    FileSystem::FileHandle &handle = *handle_ptr;
+
+    if (bytes_to_read == 0) return 0;
+    if (handle.current_pos_bytes >= handle.dir_entry.file_size_bytes) {
+        return 0; // EOF
+    }
+
+    uint64_t total_bytes_read = 0;
+    uint64_t remaining_file_size = handle.dir_entry.file_size_bytes - handle.current_pos_bytes;
+    uint64_t effective_bytes_to_read = std::min(bytes_to_read, remaining_file_size);
+
+    // встроенные данные уже находятся в копии записи каталога - ни FAT, ни кластеры не нужны
+    if (handle.dir_entry.is_inline()) {
+        std::memcpy(buffer, handle.dir_entry.inline_data() + handle.current_pos_bytes, effective_bytes_to_read);
+        handle.current_pos_bytes += effective_bytes_to_read;
+        return static_cast<int64_t>(effective_bytes_to_read);
+    }
+
+    if (handle.dir_entry.is_compressed()) {
+        return read_compressed(handle, buffer, effective_bytes_to_read);
+    }
+
+    while (total_bytes_read < effective_bytes_to_read) {
+        // дыра разреженного файла читается нулями без обращения к диску
+        const bool in_hole = FileSystem::is_hole_ref(handle.current_cluster_in_chain);
+
+        // Проверка правильности кластера в буфере
+        if (!in_hole) {
+            const std::optional<uint32_t> data_cluster = node_cluster(handle.current_cluster_in_chain);
+            if (!data_cluster) {
+                output::warn(output::prefix::FILE_SYSTEM_CORE_WARNING) << "Unexpected end of cluster chain for file '" <<
+                        handle.name() << "'" << std::endl;
                 break;
             }
-            handle.current_cluster_in_chain = *new_cluster_idx_opt;
+
+            if (handle.buffered_cluster_idx != *data_cluster && !load_cluster_info_buffer(handle, *data_cluster)) {
+                output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Failed to load cluster " <<
+                        *data_cluster << " for reading" << std::endl;
+                return -1;
+            }
+        }
+
+        // Расчёт количества байт для чтения из текущего буфера
+        uint32_t bytes_in_current_cluster_buffer = FileSystem::CLUSTER_SIZE_BYTES - handle.offset_in_buffered_cluster;
+        uint64_t bytes_to_read_this_iteration = std::min(static_cast<uint64_t>(bytes_in_current_cluster_buffer),
+                                                         effective_bytes_to_read - total_bytes_read);
+
+        if (in_hole) {
+            std::memset(buffer + total_bytes_read, 0, bytes_to_read_this_iteration);
+        } else {
+            std::memcpy(buffer + total_bytes_read, handle.buffer + handle.offset_in_buffered_cluster,
+                        bytes_to_read_this_iteration);
+        }
+
+        handle.current_pos_bytes += bytes_to_read_this_iteration;
+        handle.offset_in_buffered_cluster += static_cast<uint32_t>(bytes_to_read_this_iteration);
+        total_bytes_read += bytes_to_read_this_iteration;
+
+        // Переход к следующему кластеру если текущий закончился
+        if (handle.offset_in_buffered_cluster >= FileSystem::CLUSTER_SIZE_BYTES) {
             handle.offset_in_buffered_cluster = 0;
+            if (!advance_in_chain(handle)) {
+                handle.current_cluster_in_chain = FileSystem::MARKER_FAT_ENTRY_EOF;
+            }
+            if (handle.current_cluster_in_chain == FileSystem::MARKER_FAT_ENTRY_EOF) {
+                if (total_bytes_read < effective_bytes_to_read) {
+                    output::warn(output::prefix::FILE_SYSTEM_CORE_WARNING) <<
+                            "File size mismatch. EOF in FAT chain reached early for '" << handle.name() << "'" << std::endl;
+                }
+                break;
+            }
+        }
+    }
+
+    return static_cast<int64_t>(total_bytes_read);
+}
 
-            if (handle.buffered_cluster_idx != handle.current_cluster_in_chain) {
-                if (!flush_cluster(handle)) break;
-                handle.buffered_cluster_idx = FileSystem::MARKER_FAT_ENTRY_EOF;
+int64_t FileSystemCore::write_file(const uint32_t handle_id, const char *buffer, const uint64_t bytes_to_write) {
+    return traced(trace_record(FsTrace::Op::WRITE, handle_id, 0, bytes_to_write, 1), {}, {},
+                  [&] { return write_file_untraced(handle_id, buffer, bytes_to_write); });
+}
+
+uint64_t FileSystemCore::append_shared(const uint32_t handle_id, const char *user_buffer,
+                                       const uint64_t bytes_to_write) {
+    // под исключительным захватом (вложенный вызов, дефрагментация) запись идёт обычным путём
+    if (fs_mutex_.held_exclusively()) return 0;
+    std::shared_lock lock(fs_mutex_);
+    if (!mounted_ || read_only_ || !parallel_appends_ || dedup_enabled_ || !vol_manager_.parallel_writes_supported()) {
+        return 0;
+    }
+    FileSystem::FileHandle *const handle_ptr = opened_files_table_.find(handle_id);
+    if (!handle_ptr) return 0;
+    FileSystem::FileHandle &handle = *handle_ptr;
+    std::lock_guard handle_lock(append_locks_[handle_id % append_locks_.size()]);
+    // дописывается только цепочка из собственных кластеров: дыры, общие кластеры и встроенные данные меняют
+    // записи каталога и таблицы дыр, которые под разделяемым захватом не трогаются
+    if (!handle.is_open_to_write || handle.dir_entry.is_compressed() || handle.dir_entry.is_inline() ||
+        !has_chain(handle.dir_entry.first_cluster) || !handle.buffer ||
+        handle.current_pos_bytes != handle.dir_entry.file_size_bytes) {
+        return 0;
+    }
+
+    uint64_t total_bytes_written = 0;
+    while (total_bytes_written < bytes_to_write) {
+        if (handle.current_cluster_in_chain == FileSystem::MARKER_FAT_ENTRY_EOF) {
+            // конец цепочки на границе кластера: новый кластер подключается за последним собственным
+            if (handle.offset_in_buffered_cluster != 0 || !is_valid_cluster(handle.previous_node_in_chain)) break;
+            const std::optional<uint32_t> cluster = pop_reserved_cluster(handle);
+            if (!cluster) break;
+            if (!fat_manager_->set_entry(*cluster, FileSystem::MARKER_FAT_ENTRY_EOF) ||
+                !fat_manager_->set_entry(handle.previous_node_in_chain, *cluster)) {
+                bitmap_manager_->free_cluster(*cluster);
+                break;
             }
+            handle.current_cluster_in_chain = *cluster;
+            handle.hole_offset_clusters = 0;
+            std::fill_n(handle.buffer, FileSystem::CLUSTER_SIZE_BYTES, 0);
+            handle.buffered_cluster_idx = *cluster;
+            handle.buffer_dirty = true;
+            handle.modified = true;
+        } else if (handle.buffered_cluster_idx != handle.current_cluster_in_chain || !handle.buffer_dirty ||
+                   !is_valid_cluster(handle.current_cluster_in_chain)) {
+            // последний кластер не в буфере или может оказаться общим
+            break;
         }
 
-        // Убедиться, что правильный кластер в буфере
-        if (handle.buffered_cluster_idx != handle.current_cluster_in_chain) {
-            if (!load_cluster_info_buffer(handle, handle.current_cluster_in_chain)) {
-                output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Failed to load cluster " <<
-                        handle.current_cluster_in_chain << " for writing" << std::endl;
+        const uint64_t bytes_this_iteration = std::min<uint64_t>(
+            FileSystem::CLUSTER_SIZE_BYTES - handle.offset_in_buffered_cluster, bytes_to_write - total_bytes_written);
+        std::memcpy(handle.buffer + handle.offset_in_buffered_cluster, user_buffer + total_bytes_written,
+                    bytes_this_iteration);
+        handle.current_pos_bytes += bytes_this_iteration;
+        handle.offset_in_buffered_cluster += static_cast<uint32_t>(bytes_this_iteration);
+        handle.dir_entry.file_size_bytes = handle.current_pos_bytes;
+        handle.modified = true;
+        total_bytes_written += bytes_this_iteration;
+
+        if (handle.offset_in_buffered_cluster >= FileSystem::CLUSTER_SIZE_BYTES) {
+            if (!flush_cluster(handle)) break;
+            if (!advance_in_chain(handle)) handle.current_cluster_in_chain = FileSystem::MARKER_FAT_ENTRY_EOF;
+            handle.offset_in_buffered_cluster = 0;
+            handle.buffered_cluster_idx = FileSystem::MARKER_FAT_ENTRY_EOF;
+        }
+    }
+    return total_bytes_written;
+}
+
+int64_t FileSystemCore::write_file_untraced(uint32_t handle_id, const char *user_buffer, uint64_t bytes_to_write) {
+    // дописывание в конец файла идёт под разделяемым захватом, остаток - под исключительным
+    const uint64_t appended = append_shared(handle_id, user_buffer, bytes_to_write);
+    if (appended != 0 && appended == bytes_to_write) return static_cast<int64_t>(appended);
+    user_buffer += appended;
+    bytes_to_write -= appended;
+
+    std::lock_guard lock(fs_mutex_);
+    FileSystem::FileHandle *const handle_ptr = opened_files_table_.find(handle_id);
+    if (!handle_ptr) {
+        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Invalid file handle " << handle_id << " for write" << std::endl;
+        return -1;
+    }
+
+    FileSystem::FileHandle &handle = *handle_ptr;
+
+    if (!handle.is_open_to_write) {
+        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "File with handle " << handle_id <<
+                " not opened in write mode" << std::endl;
+        return -1;
+    }
+
+    if (bytes_to_write == 0) return 0;
+
+    if (handle.dir_entry.is_compressed()) {
+        return write_compressed(handle, user_buffer, bytes_to_write);
+    }
+
+    // маленький файл без кластеров хранится в записи каталога, пока данные помещаются в неё
+    if (!has_chain(handle.dir_entry.first_cluster) &&
+        (handle.dir_entry.is_inline() || handle.dir_entry.file_size_bytes == 0)) {
+        if (handle.current_pos_bytes + bytes_to_write <= handle.dir_entry.inline_capacity()) {
+            return write_inline(handle, user_buffer, bytes_to_write);
+        }
+        if (handle.dir_entry.is_inline()) {
+            if (!spill_inline_data(handle.dir_entry) || !position_in_chain(handle)) {
+                output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Failed to move inline data of '" <<
+                        handle.name() << "' to a cluster" << std::endl;
+                return -1;
+            }
+            handle.modified = true;
+        }
+    }
+
+    uint64_t total_bytes_written = 0;
+
+    while (total_bytes_written < bytes_to_write) {
+        // За концом цепочки или внутри дыры выделяем новый кластер; он не читается с диска, а начинается с нулей
+        const bool in_hole = FileSystem::is_hole_ref(handle.current_cluster_in_chain);
+        if (in_hole || handle.current_cluster_in_chain == FileSystem::MARKER_FAT_ENTRY_FREE ||
+            handle.current_cluster_in_chain == FileSystem::MARKER_FAT_ENTRY_EOF) {
+            if (!flush_cluster(handle)) break;
+
+            std::optional<uint32_t> new_cluster_idx_opt = in_hole ? fill_hole_cluster(handle)
+                                                                  : allocate_and_link_cluster(handle);
+            if (!new_cluster_idx_opt) {
+                output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Failed to allocate new cluster for file '" <<
+                        handle.name() << "' during write" << std::endl;
                 break;
             }
+            handle.current_cluster_in_chain = *new_cluster_idx_opt;
+            handle.hole_offset_clusters = 0;
+            handle.offset_in_buffered_cluster = static_cast<uint32_t>(handle.current_pos_bytes %
+                                                                      FileSystem::CLUSTER_SIZE_BYTES);
+            if (!attach_buffer(handle)) break;
+            std::fill_n(handle.buffer, FileSystem::CLUSTER_SIZE_BYTES, 0);
+            handle.buffered_cluster_idx = handle.current_cluster_in_chain;
+            handle.buffer_dirty = true;
+        }
+
+        // Убедиться, что правильный кластер в буфере
+        const std::optional<uint32_t> data_cluster = node_cluster(handle.current_cluster_in_chain);
+        if (!data_cluster || (handle.buffered_cluster_idx != *data_cluster &&
+                              !load_cluster_info_buffer(handle, *data_cluster))) {
+            output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Failed to load cluster " <<
+                    handle.current_cluster_in_chain << " for writing" << std::endl;
+            break;
+        }
+        // общий кластер не меняется на месте: файл получает собственную копию
+        if (!handle.buffer_dirty && !unshare_buffered_cluster(handle)) {
+            output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Failed to copy shared cluster " <<
+                    *data_cluster << " of '" << handle.name() << "'" << std::endl;
+            break;
         }
 
         // Вычисляем сколько байт можно записать в текущий буфер
@@ -509,7 +1739,7 @@ int64_t FileSystemCore::write_file(uint32_t handle_id, const char *user_buffer,
         const uint64_t bytes_to_write_this_iteration = std::min(static_cast<uint64_t>(bytes_to_fill_in_cluster),
                                                                 bytes_to_write - total_bytes_written);
 
-        std::memcpy(handle.buffer.data() + handle.offset_in_buffered_cluster,
+        std::memcpy(handle.buffer + handle.offset_in_buffered_cluster,
                     user_buffer + total_bytes_written,
                     bytes_to_write_this_iteration);
         handle.buffer_dirty = true;
@@ -531,30 +1761,32 @@ int64_t FileSystemCore::write_file(uint32_t handle_id, const char *user_buffer,
                 break;
             }
 
-            auto next_cluster_opt = fat_manager_->get_entry(handle.current_cluster_in_chain);
-            if (!next_cluster_opt ||
-                *next_cluster_opt == FileSystem::MARKER_FAT_ENTRY_EOF ||
-                *next_cluster_opt == FileSystem::MARKER_FAT_ENTRY_FREE) {
+            if (!advance_in_chain(handle)) {
                 handle.current_cluster_in_chain = FileSystem::MARKER_FAT_ENTRY_EOF;
-            } else {
-                handle.current_cluster_in_chain = *next_cluster_opt;
             }
             handle.offset_in_buffered_cluster = 0;
             handle.buffered_cluster_idx = FileSystem::MARKER_FAT_ENTRY_EOF;
         }
     }
 
-    return static_cast<int64_t>(total_bytes_written);
+    return static_cast<int64_t>(appended + total_bytes_written);
+}
+
+bool FileSystemCore::seek(const uint32_t handle_id, const uint64_t offset, const int whence) {
+    FsTrace::Record record = trace_record(FsTrace::Op::SEEK, handle_id, offset);
+    record.whence = static_cast<uint8_t>(whence);
+    return traced(record, {}, {}, [&] { return seek_untraced(handle_id, offset, whence); });
 }
 
-bool FileSystemCore::seek(uint32_t handle_id, uint64_t offset, int whence) {
-    const auto it = opened_files_table_.find(handle_id);
-    if (it == opened_files_table_.end()) {
+bool FileSystemCore::seek_untraced(uint32_t handle_id, uint64_t offset, int whence) {
+    std::lock_guard lock(fs_mutex_);
+    FileSystem::FileHandle *const handle_ptr = opened_files_table_.find(handle_id);
+    if (!handle_ptr) {
         output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Invalid file handle " << handle_id << " for seek" << std::endl;
         return false;
     }
 
-    FileSystem::FileHandle &handle = it->second;
+    FileSystem::FileHandle &handle = *handle_ptr;
 
     uint64_t new_pos_bytes;
     uint64_t file_size = handle.dir_entry.file_size_bytes;
@@ -577,6 +1809,17 @@ bool FileSystemCore::seek(uint32_t handle_id, uint64_t offset, int whence) {
             }
             new_pos_bytes = file_size + offset;
             break;
+        case FS_SEEK_DATA:
+        case FS_SEEK_HOLE: {
+            const std::optional<uint64_t> found = find_data_or_hole(handle, offset, whence == FS_SEEK_DATA);
+            if (!found) {
+                output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "No " <<
+                        (whence == FS_SEEK_DATA ? "data" : "hole") << " at or after offset " << offset << std::endl;
+                return false;
+            }
+            new_pos_bytes = *found;
+            break;
+        }
         default:
             output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Invalid 'whence' parameter for seek" << std::endl;
             return false;
@@ -587,282 +1830,1672 @@ bool FileSystemCore::seek(uint32_t handle_id, uint64_t offset, int whence) {
         new_pos_bytes = file_size;
     }
 
-    // ИСПРАВЛЕНО: Оптимизация - если позиция не изменилась, ничего не делаем
-    if (new_pos_bytes == handle.current_pos_bytes) {
-        return true;
+    // ИСПРАВЛЕНО: Оптимизация - если позиция не изменилась, ничего не делаем
+    if (new_pos_bytes == handle.current_pos_bytes) {
+        return true;
+    }
+
+    // у сжатого файла группа находится по индексу при следующем чтении или записи
+    if (handle.dir_entry.is_compressed()) {
+        handle.current_pos_bytes = new_pos_bytes;
+        return true;
+    }
+
+    if (!flush_cluster(handle)) {
+        return false;
+    }
+    handle.buffered_cluster_idx = FileSystem::MARKER_FAT_ENTRY_EOF;
+
+    handle.current_pos_bytes = new_pos_bytes;
+    return position_in_chain(handle);
+}
+
+std::optional<uint64_t> FileSystemCore::tell(const uint32_t handle_id) const {
+    std::lock_guard lock(fs_mutex_);
+    const FileSystem::FileHandle *const handle = opened_files_table_.find(handle_id);
+    if (!handle) {
+        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Invalid file handle " << handle_id << std::endl;
+        return std::nullopt;
+    }
+    return handle->current_pos_bytes;
+}
+
+int64_t FileSystemCore::pread_file(const uint32_t handle_id, char *buffer, const uint64_t bytes_to_read,
+                                   const uint64_t offset) {
+    const FsIoVec segment{buffer, bytes_to_read};
+    return traced(trace_record(FsTrace::Op::PREAD, handle_id, offset, bytes_to_read, 1), {}, {},
+                  [&] { return preadv_file(handle_id, &segment, 1, offset); });
+}
+
+int64_t FileSystemCore::pwrite_file(const uint32_t handle_id, const char *buffer, const uint64_t bytes_to_write,
+                                    const uint64_t offset) {
+    const FsIoVec segment{const_cast<char *>(buffer), bytes_to_write};
+    return traced(trace_record(FsTrace::Op::PWRITE, handle_id, offset, bytes_to_write, 1), {}, {},
+                  [&] { return pwritev_file(handle_id, &segment, 1, offset); });
+}
+
+int64_t FileSystemCore::preadv_file(const uint32_t handle_id, const FsIoVec *iov, const size_t iov_count,
+                                    const uint64_t offset) {
+    const FsTrace::Record record = trace_record(FsTrace::Op::PREADV, handle_id, offset, total_length(iov, iov_count),
+                                                static_cast<uint32_t>(iov_count));
+    return traced(record, {}, {}, [&] { return preadv_file_untraced(handle_id, iov, iov_count, offset); });
+}
+
+int64_t FileSystemCore::preadv_file_untraced(const uint32_t handle_id, const FsIoVec *iov, const size_t iov_count,
+                                             const uint64_t offset) {
+    std::lock_guard lock(fs_mutex_);
+    FileSystem::FileHandle *const handle = opened_files_table_.find(handle_id);
+    if (!handle) {
+        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Invalid file handle " << handle_id << std::endl;
+        return -1;
+    }
+    return read_at(handle_id, *handle, iov, iov_count, offset);
+}
+
+int64_t FileSystemCore::pwritev_file(const uint32_t handle_id, const FsIoVec *iov, const size_t iov_count,
+                                     const uint64_t offset) {
+    const FsTrace::Record record = trace_record(FsTrace::Op::PWRITEV, handle_id, offset, total_length(iov, iov_count),
+                                                static_cast<uint32_t>(iov_count));
+    return traced(record, {}, {}, [&] { return pwritev_file_untraced(handle_id, iov, iov_count, offset); });
+}
+
+int64_t FileSystemCore::pwritev_file_untraced(const uint32_t handle_id, const FsIoVec *iov, const size_t iov_count,
+                                              const uint64_t offset) {
+    std::lock_guard lock(fs_mutex_);
+    FileSystem::FileHandle *const handle = opened_files_table_.find(handle_id);
+    if (!handle) {
+        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Invalid file handle " << handle_id << " for write" <<
+                std::endl;
+        return -1;
+    }
+    if (!handle->is_open_to_write) {
+        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "File with handle " << handle_id <<
+                " not opened in write mode" << std::endl;
+        return -1;
+    }
+    return write_at(handle_id, *handle, iov, iov_count, offset);
+}
+
+int64_t FileSystemCore::readv_file(const uint32_t handle_id, const FsIoVec *iov, const size_t iov_count) {
+    const FsTrace::Record record = trace_record(FsTrace::Op::READV, handle_id, 0, total_length(iov, iov_count),
+                                                static_cast<uint32_t>(iov_count));
+    return traced(record, {}, {}, [&]() -> int64_t {
+        std::lock_guard lock(fs_mutex_);
+        const std::optional<uint64_t> position = tell(handle_id);
+        if (!position) return -1;
+        const int64_t read = preadv_file(handle_id, iov, iov_count, *position);
+        if (read > 0 && !seek(handle_id, *position + static_cast<uint64_t>(read), FS_SEEK_SET)) return -1;
+        return read;
+    });
+}
+
+int64_t FileSystemCore::writev_file(const uint32_t handle_id, const FsIoVec *iov, const size_t iov_count) {
+    const FsTrace::Record record = trace_record(FsTrace::Op::WRITEV, handle_id, 0, total_length(iov, iov_count),
+                                                static_cast<uint32_t>(iov_count));
+    return traced(record, {}, {}, [&]() -> int64_t {
+        std::lock_guard lock(fs_mutex_);
+        const std::optional<uint64_t> position = tell(handle_id);
+        if (!position) return -1;
+        const int64_t written = pwritev_file(handle_id, iov, iov_count, *position);
+        if (written > 0 && !seek(handle_id, *position + static_cast<uint64_t>(written), FS_SEEK_SET)) return -1;
+        return written;
+    });
+}
+
+std::optional<std::vector<uint32_t>> FileSystemCore::resolve_nodes(const FileSystem::FileHandle &handle,
+                                                                   const uint64_t first, const uint64_t count) const {
+    std::vector<uint32_t> nodes(count, FileSystem::MARKER_FAT_ENTRY_FREE);
+    if (!has_chain(handle.dir_entry.first_cluster)) return nodes;
+
+    // узел дескриптора известен вместе со своим логическим номером: повторные запросы вперёд не проходят
+    // цепочку с начала
+    uint32_t node = handle.dir_entry.first_cluster;
+    uint64_t logical_cluster = 0;
+    const uint32_t current = handle.current_cluster_in_chain;
+    if (FileSystem::is_hole_ref(current) || FileSystem::is_shared_ref(current) || is_valid_cluster(current)) {
+        const uint64_t current_logical = handle.current_pos_bytes / FileSystem::CLUSTER_SIZE_BYTES -
+                                         handle.hole_offset_clusters;
+        if (current_logical <= first) {
+            node = current;
+            logical_cluster = current_logical;
+        }
+    }
+
+    const uint64_t end = first + count;
+    while (logical_cluster < end &&
+           (FileSystem::is_hole_ref(node) || FileSystem::is_shared_ref(node) || is_valid_cluster(node))) {
+        uint64_t length = 1;
+        uint32_t next;
+        if (FileSystem::is_hole_ref(node)) {
+            const std::optional<FileSystem::HoleRecord> record = fat_manager_->get_hole(node);
+            if (!record || record->length_clusters == 0) {
+                output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Broken hole " << node << " in '" <<
+                        handle.name() << "'" << std::endl;
+                return std::nullopt;
+            }
+            length = record->length_clusters;
+            next = record->next;
+        } else {
+            const std::optional<uint32_t> next_opt = fat_manager_->get_next_node(node);
+            if (!next_opt) {
+                output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "FAT entry missing for cluster " << node <<
+                        " of '" << handle.name() << "'" << std::endl;
+                return std::nullopt;
+            }
+            next = *next_opt;
+            if (logical_cluster >= first) nodes[logical_cluster - first] = node;
+        }
+        logical_cluster += length;
+        node = next;
+    }
+    return nodes;
+}
+
+int64_t FileSystemCore::read_at(const uint32_t handle_id, FileSystem::FileHandle &handle, const FsIoVec *iov,
+                                const size_t iov_count, const uint64_t offset) {
+    const uint64_t file_size = handle.dir_entry.file_size_bytes;
+    if (offset >= file_size) return 0;
+    const uint64_t total = std::min(total_length(iov, iov_count), file_size - offset);
+    if (total == 0) return 0;
+    if (handle.dir_entry.is_inline() || handle.dir_entry.is_compressed()) {
+        return transfer_with_cursor(handle_id, iov, iov_count, offset, false);
+    }
+    // несохранённый кластер дескриптора должен оказаться на диске до чтения мимо его буфера
+    if (!flush_cluster(handle)) return -1;
+
+    const uint64_t first = offset / FileSystem::CLUSTER_SIZE_BYTES;
+    const uint64_t count = (offset + total - 1) / FileSystem::CLUSTER_SIZE_BYTES - first + 1;
+    const std::optional<std::vector<uint32_t>> nodes = resolve_nodes(handle, first, count);
+    if (!nodes) return -1;
+
+    IoVecCursor output_segments(iov, iov_count);
+    const uint64_t end = offset + total;
+    for (uint64_t i = 0; i < count;) {
+        const uint64_t cluster_begin = (first + i) * FileSystem::CLUSTER_SIZE_BYTES;
+        const uint64_t begin = std::max(cluster_begin, offset);
+        // дыра и место за концом цепочки читаются нулями
+        if ((*nodes)[i] == FileSystem::MARKER_FAT_ENTRY_FREE) {
+            output_segments.scatter(nullptr, std::min(cluster_begin + FileSystem::CLUSTER_SIZE_BYTES, end) - begin);
+            ++i;
+            continue;
+        }
+        const std::optional<uint32_t> cluster = node_cluster((*nodes)[i]);
+        if (!cluster) return -1;
+        uint32_t run = 1;
+        while (i + run < count && run < FileSystem::VECTOR_IO_MAX_RUN_CLUSTERS &&
+               (*nodes)[i + run] != FileSystem::MARKER_FAT_ENTRY_FREE &&
+               node_cluster((*nodes)[i + run]) == *cluster + run) {
+            ++run;
+        }
+        const uint64_t run_bytes = std::min(cluster_begin + run * FileSystem::CLUSTER_SIZE_BYTES, end) - begin;
+
+        // выровненный участок, целиком попадающий в один сегмент, читается прямо в него
+        uint64_t contiguous = run_bytes;
+        char *target = output_segments.contiguous(contiguous);
+        if (begin == cluster_begin && run_bytes == run * FileSystem::CLUSTER_SIZE_BYTES && contiguous == run_bytes) {
+            if (!vol_manager_.read_clusters(*cluster, run, target)) return -1;
+            output_segments.advance(run_bytes);
+        } else {
+            vector_io_scratch_.resize(static_cast<size_t>(run) * FileSystem::CLUSTER_SIZE_BYTES);
+            if (!vol_manager_.read_clusters(*cluster, run, vector_io_scratch_.data())) return -1;
+            output_segments.scatter(vector_io_scratch_.data() + (begin - cluster_begin), run_bytes);
+        }
+        i += run;
+    }
+    return static_cast<int64_t>(total);
+}
+
+int64_t FileSystemCore::write_at(const uint32_t handle_id, FileSystem::FileHandle &handle, const FsIoVec *iov,
+                                 const size_t iov_count, const uint64_t offset) {
+    const uint64_t total = total_length(iov, iov_count);
+    if (total == 0) return 0;
+    const uint64_t end = offset + total;
+    if (handle.dir_entry.is_inline() || handle.dir_entry.is_compressed() ||
+        !has_chain(handle.dir_entry.first_cluster) || end > handle.dir_entry.file_size_bytes) {
+        return transfer_with_cursor(handle_id, iov, iov_count, offset, true);
+    }
+    if (!flush_cluster(handle)) return -1;
+
+    const uint64_t first = offset / FileSystem::CLUSTER_SIZE_BYTES;
+    const uint64_t count = (end - 1) / FileSystem::CLUSTER_SIZE_BYTES - first + 1;
+    const std::optional<std::vector<uint32_t>> nodes = resolve_nodes(handle, first, count);
+    if (!nodes) return -1;
+    for (const uint32_t node: *nodes) {
+        // дыра или общий кластер требуют изменения цепочки
+        if (node == FileSystem::MARKER_FAT_ENTRY_FREE || FileSystem::is_shared_ref(node)) {
+            return transfer_with_cursor(handle_id, iov, iov_count, offset, true);
+        }
+        if (fat_manager_->sharing_supported()) {
+            const std::optional<uint32_t> refcount = fat_manager_->get_refcount(node);
+            if (!refcount) return -1;
+            if (*refcount >= 2) return transfer_with_cursor(handle_id, iov, iov_count, offset, true);
+        }
+    }
+
+    const bool dedup = dedup_enabled_ && dedup_index_;
+    IoVecCursor input_segments(iov, iov_count);
+    for (uint64_t i = 0; i < count;) {
+        const uint32_t cluster = (*nodes)[i];
+        uint32_t run = 1;
+        while (i + run < count && run < FileSystem::VECTOR_IO_MAX_RUN_CLUSTERS && (*nodes)[i + run] == cluster + run) {
+            ++run;
+        }
+        const uint64_t cluster_begin = (first + i) * FileSystem::CLUSTER_SIZE_BYTES;
+        const uint64_t run_end = cluster_begin + run * FileSystem::CLUSTER_SIZE_BYTES;
+        const uint64_t begin = std::max(cluster_begin, offset);
+        const uint64_t run_bytes = std::min(run_end, end) - begin;
+
+        uint64_t contiguous = run_bytes;
+        const char *source = input_segments.contiguous(contiguous);
+        if (begin == cluster_begin && run_bytes == run * FileSystem::CLUSTER_SIZE_BYTES && contiguous == run_bytes) {
+            if (!vol_manager_.write_clusters(cluster, run, source)) return -1;
+            input_segments.advance(run_bytes);
+        } else {
+            // неполные крайние кластеры дописываются поверх их содержимого на диске
+            vector_io_scratch_.resize(static_cast<size_t>(run) * FileSystem::CLUSTER_SIZE_BYTES);
+            char *scratch = vector_io_scratch_.data();
+            if (begin != cluster_begin && !vol_manager_.read_cluster(cluster, scratch)) return -1;
+            if (end < run_end && (run > 1 || begin == cluster_begin) &&
+                !vol_manager_.read_cluster(cluster + run - 1,
+                                           scratch + (run - 1) * FileSystem::CLUSTER_SIZE_BYTES)) {
+                return -1;
+            }
+            input_segments.gather(scratch + (begin - cluster_begin), run_bytes);
+            if (!vol_manager_.write_clusters(cluster, run, scratch)) return -1;
+            source = scratch;
+        }
+        for (uint32_t c = 0; dedup && c < run; ++c) {
+            const char *data = source + static_cast<size_t>(c) * FileSystem::CLUSTER_SIZE_BYTES;
+            if (!track_cluster(cluster + c, crc32c::compute(data, FileSystem::CLUSTER_SIZE_BYTES))) {
+                output::warn(output::prefix::FILE_SYSTEM_CORE_WARNING) << "Failed to index cluster " << cluster + c <<
+                        " for deduplication" << std::endl;
+            }
+        }
+        // буфер дескриптора не должен отдавать старое содержимое перезаписанного кластера
+        if (handle.buffered_cluster_idx >= cluster && handle.buffered_cluster_idx < cluster + run) {
+            handle.buffered_cluster_idx = FileSystem::MARKER_FAT_ENTRY_EOF;
+        }
+        i += run;
+    }
+    handle.modified = true;
+    return static_cast<int64_t>(total);
+}
+
+int64_t FileSystemCore::transfer_with_cursor(const uint32_t handle_id, const FsIoVec *iov, const size_t iov_count,
+                                             const uint64_t offset, const bool write) {
+    const std::optional<uint64_t> saved_position = tell(handle_id);
+    if (!saved_position || !seek(handle_id, offset, FS_SEEK_SET)) return -1;
+    int64_t total = 0;
+    for (size_t i = 0; i < iov_count; ++i) {
+        if (iov[i].length == 0) continue;
+        const int64_t done = write
+                                 ? write_file(handle_id, static_cast<const char *>(iov[i].base), iov[i].length)
+                                 : read_file(handle_id, static_cast<char *>(iov[i].base), iov[i].length);
+        if (done < 0) {
+            total = -1;
+            break;
+        }
+        total += done;
+        if (static_cast<uint64_t>(done) < iov[i].length) break;
+    }
+    if (!seek(handle_id, *saved_position, FS_SEEK_SET)) return -1;
+    return total;
+}
+
+bool FileSystemCore::remove_file(const std::string &path) const {
+    return traced(trace_record(FsTrace::Op::REMOVE), path, {}, [&] { return remove_file_untraced(path); });
+}
+
+bool FileSystemCore::remove_file_untraced(const std::string &path) const {
+    std::lock_guard lock(fs_mutex_);
+    if (!mounted_) {
+        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Filesystem not mounted. Cannot remove file" << std::endl;
+        return false;
+    }
+    if (!check_writable()) return false;
+
+    const std::string filename = get_filename_from_path(path);
+    const uint32_t dir_cluster = get_containing_directory_cluster(path);
+
+    const auto entry_loc_opt = directory_manager_->get_entry_location(dir_cluster, filename);
+    if (!entry_loc_opt) {
+        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "File '" << path << "' not found for removal" << std::endl;
+        return false;
+    }
+
+    FileSystem::DirectoryEntry entry_to_remove = entry_loc_opt->entry_data;
+
+    if (entry_to_remove.type == FileSystem::EntityType::DIRECTORY) {
+        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "'" << path << "' is a directory. Use remove_directory" << std::endl;
+        return false;
+    }
+
+    // Освободить кластеры файла в FAT и Bitmap
+    if (entry_to_remove.first_cluster != FileSystem::MARKER_FAT_ENTRY_FREE &&
+        entry_to_remove.first_cluster != FileSystem::MARKER_FAT_ENTRY_EOF) {
+
+        // общие кластеры, на которые остались ссылки других файлов, не освобождаются
+        const std::optional<std::vector<uint32_t>> released = fat_manager_->free_chain(entry_to_remove.first_cluster);
+        if (!released) {
+            output::warn(output::prefix::FILE_SYSTEM_CORE_WARNING) << "Failed to fully free FAT chain for '" << path << "'" << std::endl;
+        } else if (!bitmap_manager_->free_clusters(*released)) {
+            output::warn(output::prefix::FILE_SYSTEM_CORE_WARNING) << "Failed to free clusters in bitmap for '" <<
+                    path << "'" << std::endl;
+        }
+    }
+
+    // Удалить запись из каталога
+    if (!directory_manager_->remove_entry(dir_cluster, filename)) {
+        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Failed to remove directory entry for '" << path << "'" << std::endl;
+        return false;
+    }
+
+    return flush_metadata();
+}
+
+bool FileSystemCore::rename_file(const std::string &old_path, const std::string &new_path) {
+    return traced(trace_record(FsTrace::Op::RENAME), old_path, new_path,
+                  [&] { return rename_file_untraced(old_path, new_path); });
+}
+
+bool FileSystemCore::rename_file_untraced(const std::string &old_path, const std::string &new_path) {
+    std::lock_guard lock(fs_mutex_);
+    if (!mounted_) {
+        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Filesystem not mounted" << std::endl;
+        return false;
+    }
+    if (!check_writable()) return false;
+
+    const std::string old_filename = get_filename_from_path(old_path);
+    const std::string new_filename = get_filename_from_path(new_path);
+    const uint32_t dir_cluster = get_containing_directory_cluster(old_path);
+
+    if (new_filename.empty() || new_filename.length() >= FileSystem::MAX_FILE_NAME) {
+        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "New filename '" << new_filename << "' is invalid" << std::endl;
+        return false;
+    }
+
+    // Проверить, не существует ли уже файл/каталог с новым именем
+    if (directory_manager_->find_entry(dir_cluster, new_filename)) {
+        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Target filename '" << new_filename << "' already exists" << std::endl;
+        return false;
+    }
+
+    auto entry_loc_opt = directory_manager_->get_entry_location(dir_cluster, old_filename);
+    if (!entry_loc_opt) {
+        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Source file/directory '" << old_filename << "' not found" << std::endl;
+        return false;
+    }
+
+    // встроенные данные открытого файла хранятся в дескрипторе, переносить их в кластер здесь нельзя
+    for (const FileSystem::FileHandle &file_handle: opened_files_table_) {
+        if (FileSystem::DirectoryEntry probe = file_handle.dir_entry;
+            file_handle.refers_to(dir_cluster, old_filename) && !probe.set_name(new_filename)) {
+            output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Inline file '" << old_path <<
+                    "' is open and its data does not fit next to the new name" << std::endl;
+            return false;
+        }
+    }
+
+    FileSystem::DirectoryEntry entry_to_rename = entry_loc_opt->entry_data;
+    // Обновляем имя в копии записи; встроенные данные, которым не хватает места рядом с новым именем, переносятся в кластер
+    if (!entry_to_rename.set_name(new_filename)) {
+        if (!spill_inline_data(entry_to_rename) || !entry_to_rename.set_name(new_filename)) {
+            output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Failed to move inline data of '" << old_path <<
+                    "' before rename" << std::endl;
+            return false;
+        }
+    }
+
+    if (!directory_manager_->update_entry(dir_cluster, old_filename, entry_to_rename)) {
+        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Failed to update directory entry during rename from '" <<
+                old_filename << "' to '" << new_filename << "'" << std::endl;
+        return false;
+    }
+
+    // Если переименовывается открытый файл, имя меняется в копии записи дескриптора
+    // (встроенные данные дескриптора сохраняются, место проверено выше)
+    for (FileSystem::FileHandle &file_handle: opened_files_table_) {
+        if (file_handle.refers_to(dir_cluster, old_filename)) file_handle.dir_entry.set_name(new_filename);
+    }
+
+    return true;
+}
+
+bool FileSystemCore::create_directory(const std::string &path) const {
+    return traced(trace_record(FsTrace::Op::MKDIR), path, {}, [&] { return create_directory_untraced(path); });
+}
+
+bool FileSystemCore::create_directory_untraced(const std::string &path) const {
+    std::lock_guard lock(fs_mutex_);
+    if (!mounted_) {
+        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Filesystem not mounted" << std::endl;
+        return false;
+    }
+    if (!check_writable()) return false;
+
+    const std::string dirname = get_filename_from_path(path);
+    const uint32_t parent_dir_cluster = get_containing_directory_cluster(path);
+
+    if (dirname.empty() || dirname.length() >= FileSystem::MAX_FILE_NAME) {
+        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Directory name '" << dirname << "' is invalid" << std::endl;
+        return false;
+    }
+
+    if (directory_manager_->find_entry(parent_dir_cluster, dirname)) {
+        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Directory or file '" << dirname << "' already exists" << std::endl;
+        return false;
+    }
+
+    // Выделяем и очищаем кластер для данных нового каталога; каталоги расходятся по самым свободным группам,
+    // а их файлы размещаются рядом с ними
+    const std::optional<uint32_t> group = bitmap_manager_->most_free_group();
+    const std::optional<uint32_t> new_dir_data_cluster_opt = group ? new_directory_cluster(*group) : std::nullopt;
+    if (!new_dir_data_cluster_opt) {
+        return false;
+    }
+    const uint32_t new_dir_data_cluster = *new_dir_data_cluster_opt;
+
+    // Создаем запись для нового каталога в родительском каталоге
+    FileSystem::DirectoryEntry new_dir_entry;
+    std::strncpy(new_dir_entry.name.data(), dirname.c_str(), FileSystem::MAX_FILE_NAME - 1);
+    new_dir_entry.name[FileSystem::MAX_FILE_NAME - 1] = '\0';
+    new_dir_entry.type = FileSystem::EntityType::DIRECTORY;
+    new_dir_entry.first_cluster = new_dir_data_cluster;
+    new_dir_entry.file_size_bytes = 0;
+
+    if (!directory_manager_->add_entry(parent_dir_cluster, new_dir_entry)) {
+        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Failed to add directory entry for '" << dirname << "'" << std::endl;
+        fat_manager_->set_entry(new_dir_data_cluster, FileSystem::MARKER_FAT_ENTRY_FREE);
+        bitmap_manager_->free_cluster(new_dir_data_cluster);
+        return false;
+    }
+
+    return flush_metadata();
+}
+
+bool FileSystemCore::remove_directory(const std::string &path) {
+    return traced(trace_record(FsTrace::Op::RMDIR), path, {}, [&] { return remove_directory_untraced(path); });
+}
+
+bool FileSystemCore::remove_directory_untraced(const std::string &path) {
+    std::lock_guard lock(fs_mutex_);
+    if (!mounted_) {
+        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Filesystem not mounted" << std::endl;
+        return false;
+    }
+    if (!check_writable()) return false;
+
+    const std::string dirname = get_filename_from_path(path);
+    const uint32_t parent_dir_cluster = get_containing_directory_cluster(path);
+
+    const auto entry_loc_opt = directory_manager_->get_entry_location(parent_dir_cluster, dirname);
+    if (!entry_loc_opt) {
+        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Directory '" << path << "' not found for removal" << std::endl;
+        return false;
+    }
+
+    const FileSystem::DirectoryEntry dir_to_remove = entry_loc_opt->entry_data;
+
+    if (dir_to_remove.type != FileSystem::EntityType::DIRECTORY) {
+        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "'" << path << "' is not a directory. Use remove_file" << std::endl;
+        return false;
+    }
+
+    // Проверить, пуст ли каталог: достаточно первой записи
+    DirectoryCursor cursor(vol_manager_, *fat_manager_, dir_to_remove.first_cluster);
+    if (cursor.next()) {
+        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Directory '" << path << "' is not empty" << std::endl;
+        return false;
+    }
+    if (cursor.failed()) return false;
+
+    // курсоры, открытые на удаляемом каталоге, больше не читают его кластеры
+    for (auto it = open_directories_.begin(); it != open_directories_.end();) {
+        it = it->second.dir_start_cluster() == dir_to_remove.first_cluster ? open_directories_.erase(it) : ++it;
+    }
+
+    // Освободить кластеры данных каталога в FAT и Bitmap
+    if (dir_to_remove.first_cluster != FileSystem::MARKER_FAT_ENTRY_FREE &&
+        dir_to_remove.first_cluster != FileSystem::MARKER_FAT_ENTRY_EOF) {
+
+        const std::optional<std::vector<uint32_t>> released = fat_manager_->free_chain(dir_to_remove.first_cluster);
+        if (released) bitmap_manager_->free_clusters(*released);
+    }
+
+    // Удалить запись каталога из родительского каталога
+    if (!directory_manager_->remove_entry(parent_dir_cluster, dirname)) {
+        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Failed to remove directory entry for '" << path << "'" << std::endl;
+        return false;
+    }
+
+    return flush_metadata();
+}
+
+std::vector<FileSystem::DirectoryEntry> FileSystemCore::list_directory(const std::string &path) const {
+    return traced(trace_record(FsTrace::Op::LIST), path, {}, [&] { return list_directory_untraced(path); });
+}
+
+std::vector<FileSystem::DirectoryEntry> FileSystemCore::list_directory_untraced(const std::string &path) const {
+    std::lock_guard lock(fs_mutex_);
+    std::vector<FileSystem::DirectoryEntry> result;
+    if (!mounted_) {
+        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Filesystem not mounted" << std::endl;
+        return result;
+    }
+
+    if (const auto dir_cluster = find_directory_cluster(path)) {
+        return directory_manager_->get_directories_list(*dir_cluster);
+    }
+    return result;
+}
+
+std::optional<uint32_t> FileSystemCore::find_directory_cluster(const std::string &path) const {
+    if (path == "/") {
+        return header_.root_dir_start_cluster;
+    }
+
+    const std::string dirname = get_filename_from_path(path);
+    if (const auto entry_opt = directory_manager_->find_entry(header_.root_dir_start_cluster, dirname);
+        entry_opt && entry_opt->type == FileSystem::EntityType::DIRECTORY) {
+        return entry_opt->first_cluster;
+    }
+
+    output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Directory '" << path << "' not found or is not a directory" << std::endl;
+    return std::nullopt;
+}
+
+std::optional<uint32_t> FileSystemCore::open_directory(const std::string &path,
+                                                       const DirectoryCursor::Position position,
+                                                       const std::string &prefix) {
+    return traced(trace_record(FsTrace::Op::OPENDIR, 0, position), path, prefix,
+                  [&] { return open_directory_untraced(path, position, prefix); });
+}
+
+std::optional<uint32_t> FileSystemCore::open_directory_untraced(const std::string &path,
+                                                                const DirectoryCursor::Position position,
+                                                                const std::string &prefix) {
+    std::lock_guard lock(fs_mutex_);
+    if (!mounted_) {
+        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Filesystem not mounted" << std::endl;
+        return std::nullopt;
+    }
+    const auto dir_cluster = find_directory_cluster(path);
+    if (!dir_cluster) return std::nullopt;
+    std::optional<DirectoryCursor> cursor = directory_manager_->open_cursor(*dir_cluster, position, prefix);
+    if (!cursor) return std::nullopt;
+
+    const uint32_t dir_id = next_directory_id_++;
+    if (next_directory_id_ == 0) next_directory_id_ = 1;
+    open_directories_.emplace(dir_id, std::move(*cursor));
+    return dir_id;
+}
+
+std::optional<DirectoryCursor::EntryView> FileSystemCore::read_directory(const uint32_t dir_id) {
+    return traced(trace_record(FsTrace::Op::READDIR, dir_id), {}, {},
+                  [&]() -> std::optional<DirectoryCursor::EntryView> {
+                      std::lock_guard lock(fs_mutex_);
+                      const auto it = open_directories_.find(dir_id);
+                      if (it == open_directories_.end()) {
+                          output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Invalid directory cursor " <<
+                                  dir_id << std::endl;
+                          return std::nullopt;
+                      }
+                      return it->second.next();
+                  });
+}
+
+std::optional<DirectoryCursor::Position> FileSystemCore::tell_directory(const uint32_t dir_id) const {
+    std::lock_guard lock(fs_mutex_);
+    const auto it = open_directories_.find(dir_id);
+    if (it == open_directories_.end()) {
+        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Invalid directory cursor " << dir_id << std::endl;
+        return std::nullopt;
+    }
+    return it->second.tell();
+}
+
+bool FileSystemCore::close_directory(const uint32_t dir_id) {
+    return traced(trace_record(FsTrace::Op::CLOSEDIR, dir_id), {}, {}, [&] {
+        std::lock_guard lock(fs_mutex_);
+        return open_directories_.erase(dir_id) != 0;
+    });
+}
+
+uint32_t FileSystemCore::count_extents(const std::list<uint32_t> &chain) {
+    uint32_t extents = 0;
+    uint32_t previous = FileSystem::MARKER_FAT_ENTRY_EOF;
+    for (const uint32_t cluster_idx: chain) {
+        if (previous == FileSystem::MARKER_FAT_ENTRY_EOF || cluster_idx != previous + 1) {
+            ++extents;
+        }
+        previous = cluster_idx;
+    }
+    return extents;
+}
+
+FragmentationReport FileSystemCore::analyze_fragmentation() const {
+    std::lock_guard lock(fs_mutex_);
+    FragmentationReport report;
+    if (!mounted_) {
+        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Filesystem not mounted" << std::endl;
+        return report;
+    }
+
+    // обход каталогов в ширину, начиная с корневого
+    std::vector<std::pair<std::string, uint32_t>> directories{{"", header_.root_dir_start_cluster}};
+    for (size_t i = 0; i < directories.size(); ++i) {
+        const auto [dir_path, dir_cluster] = directories[i];
+        DirectoryCursor cursor(vol_manager_, *fat_manager_, dir_cluster);
+        while (const auto entry = cursor.next()) {
+            const std::string path = dir_path + "/" + std::string(entry->name);
+            if (entry->type == FileSystem::EntityType::DIRECTORY) {
+                directories.emplace_back(path, entry->first_cluster);
+                continue;
+            }
+            if (!has_chain(entry->first_cluster)) continue;
+
+            const std::list<uint32_t> chain = fat_manager_->get_cluster_chain(entry->first_cluster);
+            FileFragmentation file;
+            file.path = path;
+            file.clusters = static_cast<uint32_t>(chain.size());
+            file.extents = count_extents(chain);
+
+            ++report.files;
+            if (file.extents > 1) ++report.fragmented_files;
+            report.clusters += file.clusters;
+            report.extents += file.extents;
+            report.per_file.push_back(file);
+        }
+    }
+    return report;
+}
+
+std::optional<uint32_t> FileSystemCore::defragment_file(const std::string &path) {
+    std::lock_guard lock(fs_mutex_);
+    if (!mounted_) {
+        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Filesystem not mounted" << std::endl;
+        return std::nullopt;
+    }
+    if (!check_writable()) return std::nullopt;
+
+    const std::string filename = get_filename_from_path(path);
+    const uint32_t dir_cluster = get_containing_directory_cluster(path);
+    const auto entry_loc_opt = directory_manager_->get_entry_location(dir_cluster, filename);
+    if (!entry_loc_opt) {
+        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "File '" << path << "' not found for defragmentation" <<
+                std::endl;
+        return std::nullopt;
+    }
+    FileSystem::DirectoryEntry entry = entry_loc_opt->entry_data;
+    if (entry.type == FileSystem::EntityType::DIRECTORY) {
+        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "'" << path << "' is a directory" << std::endl;
+        return std::nullopt;
+    }
+    if (!has_chain(entry.first_cluster)) {
+        return 0;
+    }
+
+    auto is_same_file = [&](const FileSystem::FileHandle &handle) { return handle.refers_to(dir_cluster, filename); };
+
+    // цепочка файла, изменённого через открытый дескриптор, ещё не совпадает с записью каталога - переносим после закрытия
+    for (const FileSystem::FileHandle &handle: opened_files_table_) {
+        if (is_same_file(handle) && handle.modified) {
+            output::warn(output::prefix::FILE_SYSTEM_CORE_WARNING) << "File '" << path <<
+                    "' is being modified, defragmentation skipped" << std::endl;
+            return 0;
+        }
+    }
+
+    // данные открытых дескрипторов должны попасть на диск до копирования
+    for (FileSystem::FileHandle &handle: opened_files_table_) {
+        if (is_same_file(handle) && !flush_cluster(handle)) return std::nullopt;
+    }
+
+    // дыры остаются на своих местах в цепочке, переносятся только кластеры с данными
+    const std::vector<uint32_t> old_nodes = fat_manager_->get_chain_nodes(entry.first_cluster);
+    std::list<uint32_t> chain;
+    std::vector<uint32_t> refcounts; // счётчики переходят к новым кластерам
+    for (const uint32_t node: old_nodes) {
+        if (FileSystem::is_hole_ref(node)) continue;
+        // общие кластеры остаются на месте: на них ссылаются другие файлы
+        const std::optional<uint32_t> refcount = FileSystem::is_shared_ref(node)
+                                                     ? std::nullopt
+                                                     : fat_manager_->sharing_supported()
+                                                           ? fat_manager_->get_refcount(node)
+                                                           : std::optional<uint32_t>(0);
+        if (!refcount || *refcount > 1) {
+            output::warn(output::prefix::FILE_SYSTEM_CORE_WARNING) << "File '" << path <<
+                    "' shares clusters with other files, defragmentation skipped" << std::endl;
+            return 0;
+        }
+        chain.push_back(node);
+        refcounts.push_back(*refcount);
+    }
+    if (count_extents(chain) <= 1) {
+        return 0;
+    }
+    const auto cluster_count = static_cast<uint32_t>(chain.size());
+
+    const std::optional<uint32_t> run_start_opt = bitmap_manager_->find_and_allocate_free_run(cluster_count);
+    if (!run_start_opt) {
+        output::warn(output::prefix::FILE_SYSTEM_CORE_WARNING) << "No contiguous run of " << cluster_count <<
+                " free clusters for '" << path << "'" << std::endl;
+        return 0;
+    }
+    const uint32_t run_start = *run_start_opt;
+    std::vector<uint32_t> new_clusters(cluster_count);
+    for (uint32_t i = 0; i < cluster_count; ++i) new_clusters[i] = run_start + i;
+    std::vector<uint32_t> new_nodes = old_nodes;
+    for (uint32_t i = 0, node_idx = 0; node_idx < new_nodes.size(); ++node_idx) {
+        if (!FileSystem::is_hole_ref(new_nodes[node_idx])) new_nodes[node_idx] = new_clusters[i++];
+    }
+
+    // копируем данные непрерывными участками исходной цепочки
+    constexpr uint32_t max_batch_clusters = 256;
+    std::vector<char> batch_buffer(static_cast<size_t>(max_batch_clusters) * FileSystem::CLUSTER_SIZE_BYTES);
+    std::vector<uint32_t> old_clusters(chain.begin(), chain.end());
+    for (uint32_t pos = 0; pos < cluster_count;) {
+        uint32_t batch = 1;
+        while (pos + batch < cluster_count && batch < max_batch_clusters &&
+               old_clusters[pos + batch] == old_clusters[pos] + batch) {
+            ++batch;
+        }
+        if (!vol_manager_.read_clusters(old_clusters[pos], batch, batch_buffer.data()) ||
+            !vol_manager_.write_clusters(run_start + pos, batch, batch_buffer.data())) {
+            output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Failed to copy clusters of '" << path <<
+                    "' during defragmentation" << std::endl;
+            bitmap_manager_->free_clusters(new_clusters);
+            return std::nullopt;
+        }
+        pos += batch;
+    }
+
+    if (!fat_manager_->link_chain(new_nodes)) {
+        bitmap_manager_->free_clusters(new_clusters);
+        return std::nullopt;
+    }
+
+    entry.first_cluster = new_nodes.front();
+    if (!directory_manager_->update_entry(dir_cluster, filename, entry)) {
+        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Failed to update directory entry of '" << path <<
+                "' during defragmentation" << std::endl;
+        // дыры уже ссылаются на новые кластеры - возвращаем им старые связи
+        fat_manager_->link_chain(old_nodes);
+        fat_manager_->clear_entries(new_clusters);
+        bitmap_manager_->free_clusters(new_clusters);
+        return std::nullopt;
+    }
+
+    // открытые дескрипторы продолжают работу с перенесёнными кластерами
+    for (FileSystem::FileHandle &handle: opened_files_table_) {
+        if (!is_same_file(handle)) continue;
+        handle.dir_entry.first_cluster = entry.first_cluster;
+        for (uint32_t i = 0; i < cluster_count; ++i) {
+            if (handle.current_cluster_in_chain == old_clusters[i]) handle.current_cluster_in_chain = run_start + i;
+            if (handle.buffered_cluster_idx == old_clusters[i]) handle.buffered_cluster_idx = run_start + i;
+            if (handle.previous_node_in_chain == old_clusters[i]) handle.previous_node_in_chain = run_start + i;
+        }
+        // первые кластеры групп сжатого файла идут в том же порядке, что и кластеры цепочки
+        for (uint32_t i = 0, group = 0; i < cluster_count && group < handle.groups.size(); ++i) {
+            if (handle.groups[group].first_cluster == old_clusters[i]) handle.groups[group++].first_cluster = run_start + i;
+        }
+    }
+
+    for (uint32_t i = 0; i < cluster_count; ++i) {
+        if (refcounts[i] == 0) continue;
+        fat_manager_->set_refcount(old_clusters[i], 0);
+        fat_manager_->set_refcount(run_start + i, refcounts[i]);
+    }
+    if (!fat_manager_->clear_entries(old_clusters) || !bitmap_manager_->free_clusters(old_clusters)) {
+        output::warn(output::prefix::FILE_SYSTEM_CORE_WARNING) << "Failed to release old clusters of '" << path <<
+                "'" << std::endl;
+    }
+    flush_metadata();
+    return cluster_count;
+}
+
+std::optional<SpaceInfo> FileSystemCore::get_space_info() const {
+    std::lock_guard lock(fs_mutex_);
+    if (!mounted_) {
+        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Filesystem not mounted" << std::endl;
+        return std::nullopt;
+    }
+    const std::optional<uint64_t> free_clusters = bitmap_manager_->free_cluster_count();
+    if (!free_clusters) {
+        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Failed to get free space counters" << std::endl;
+        return std::nullopt;
+    }
+    SpaceInfo info;
+    info.cluster_size = header_.cluster_size_bytes;
+    info.total_clusters = header_.total_clusters;
+    info.data_clusters = header_.total_clusters - header_.data_start_cluster;
+    info.free_clusters = *free_clusters;
+    info.regions = bitmap_manager_->region_count();
+    info.allocation_groups = bitmap_manager_->group_count();
+    return info;
+}
+
+std::optional<uint32_t> FileSystemCore::get_group_free_clusters(const uint32_t group) const {
+    std::lock_guard lock(fs_mutex_);
+    if (!mounted_) return std::nullopt;
+    return bitmap_manager_->group_free_count(group);
+}
+
+void FileSystemCore::set_allocation_groups(const bool enabled) {
+    std::lock_guard lock(fs_mutex_);
+    allocation_groups_ = enabled;
+}
+
+void FileSystemCore::set_parallel_appends(const bool enabled) {
+    std::lock_guard lock(fs_mutex_);
+    parallel_appends_ = enabled;
+}
+
+void FileSystemCore::set_cluster_magazines(const bool enabled) {
+    std::lock_guard lock(fs_mutex_);
+    cluster_magazines_ = enabled;
+    if (enabled) return;
+    for (FileSystem::FileHandle &handle: opened_files_table_) return_reserved_clusters(handle);
+}
+
+std::optional<uint32_t> FileSystemCore::get_region_free_clusters(const uint32_t region_idx) const {
+    std::lock_guard lock(fs_mutex_);
+    if (!mounted_) return std::nullopt;
+    return bitmap_manager_->region_free_count(region_idx);
+}
+
+void FileSystemCore::set_directory_btree_threshold(const uint32_t clusters) {
+    std::lock_guard lock(fs_mutex_);
+    btree_threshold_clusters_ = clusters;
+    if (mounted_) directory_manager_->set_btree_threshold(clusters);
+}
+
+void FileSystemCore::set_discard_freed(const bool discard_freed) {
+    std::lock_guard lock(fs_mutex_);
+    discard_freed_ = discard_freed;
+    if (mounted_) bitmap_manager_->set_discard_freed(discard_freed);
+}
+
+bool FileSystemCore::set_compression(const std::string &path, const bool enabled) {
+    std::lock_guard lock(fs_mutex_);
+    if (!mounted_) {
+        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Filesystem not mounted" << std::endl;
+        return false;
+    }
+    if (!check_writable()) return false;
+
+    const std::string filename = get_filename_from_path(path);
+    const uint32_t dir_cluster = get_containing_directory_cluster(path);
+    const auto entry_loc_opt = directory_manager_->get_entry_location(dir_cluster, filename);
+    if (!entry_loc_opt) {
+        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "File '" << path << "' not found" << std::endl;
+        return false;
+    }
+    FileSystem::DirectoryEntry entry = entry_loc_opt->entry_data;
+    if (entry.type == FileSystem::EntityType::DIRECTORY) {
+        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "'" << path << "' is a directory" << std::endl;
+        return false;
+    }
+    if (entry.is_compressed() == enabled) return true;
+    // остаток группы после сжатых данных хранится дырой
+    if (enabled && !fat_manager_->sparse_supported()) {
+        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Volume has no hole table, compression is not supported" <<
+                std::endl;
+        return false;
+    }
+    for (const FileSystem::FileHandle &handle: opened_files_table_) {
+        if (handle.refers_to(dir_cluster, filename)) {
+            output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "File '" << path << "' is open" << std::endl;
+            return false;
+        }
+    }
+
+    // у пустого файла меняется только атрибут
+    if (entry.file_size_bytes == 0 && !has_chain(entry.first_cluster)) {
+        if (entry.is_inline()) entry.set_inline(false);
+        entry.set_compressed(enabled);
+        if (!directory_manager_->update_entry(dir_cluster, filename, entry)) {
+            output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Failed to update directory entry of '" << path <<
+                    "'" << std::endl;
+            return false;
+        }
+        return flush_metadata();
+    }
+
+    // данные копируются во временный файл с нужным атрибутом, который затем занимает место исходного
+    const std::string temp_path = path + ".~pack";
+    const std::string temp_name = get_filename_from_path(temp_path);
+    if (temp_name.length() >= FileSystem::MAX_FILE_NAME || directory_manager_->find_entry(dir_cluster, temp_name)) {
+        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Cannot create temporary file '" << temp_path << "'" <<
+                std::endl;
+        return false;
+    }
+    const std::optional<uint32_t> source = open_file(path, "r");
+    const std::optional<uint32_t> target = source ? open_file(temp_path, "w") : std::nullopt;
+    if (!target) {
+        if (source) close_file(*source);
+        return false;
+    }
+
+    FileSystem::FileHandle &target_handle = *opened_files_table_.find(*target);
+    target_handle.dir_entry.set_compressed(enabled);
+    target_handle.modified = true;
+    bool copied = !enabled || build_group_index(target_handle);
+    std::vector<char> chunk(FileSystem::COMPRESSION_GROUP_BYTES);
+    while (copied) {
+        const int64_t read = read_file(*source, chunk.data(), chunk.size());
+        if (read <= 0) {
+            copied = read == 0;
+            break;
+        }
+        copied = write_file(*target, chunk.data(), static_cast<uint64_t>(read)) == read;
     }
+    close_file(*source);
+    close_file(*target);
 
-    if (!flush_cluster(handle)) {
+    if (!copied) {
+        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Failed to repack '" << path << "'" << std::endl;
+        remove_file(temp_path);
         return false;
     }
-    handle.buffered_cluster_idx = FileSystem::MARKER_FAT_ENTRY_EOF;
+    return remove_file(path) && rename_file(temp_path, path);
+}
 
-    handle.current_pos_bytes = new_pos_bytes;
+void FileSystemCore::set_dedup(const bool enabled) {
+    std::lock_guard lock(fs_mutex_);
+    dedup_enabled_ = enabled;
+    if (enabled && mounted_ && !dedup_index_) {
+        output::warn(output::prefix::FILE_SYSTEM_CORE_WARNING) <<
+                "Volume has no deduplication index, written clusters are not deduplicated" << std::endl;
+    }
+}
 
-    // Обработка пустого файла
-    if (handle.dir_entry.first_cluster == FileSystem::MARKER_FAT_ENTRY_FREE ||
-        handle.dir_entry.first_cluster == FileSystem::MARKER_FAT_ENTRY_EOF) {
-        handle.current_cluster_in_chain = handle.dir_entry.first_cluster;
-        handle.offset_in_buffered_cluster = 0;
-        return true;
+std::optional<DedupReport> FileSystemCore::deduplicate_volume() {
+    std::lock_guard lock(fs_mutex_);
+    if (!mounted_) {
+        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Filesystem not mounted" << std::endl;
+        return std::nullopt;
+    }
+    if (!check_writable()) return std::nullopt;
+    if (!dedup_index_) {
+        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Volume has no deduplication index" << std::endl;
+        return std::nullopt;
     }
 
-    // Найти нужный кластер для новой позиции
-    uint32_t target_cluster = handle.dir_entry.first_cluster;
-    uint64_t bytes_to_skip = new_pos_bytes;
+    DedupReport report;
+    std::vector<char> cluster(FileSystem::CLUSTER_SIZE_BYTES);
+    // обход каталогов в ширину, начиная с корневого
+    std::vector<uint32_t> directories{header_.root_dir_start_cluster};
+    for (size_t i = 0; i < directories.size(); ++i) {
+        const uint32_t dir_cluster = directories[i];
+        for (FileSystem::DirectoryEntry entry: directory_manager_->get_directories_list(dir_cluster)) {
+            if (entry.type == FileSystem::EntityType::DIRECTORY) {
+                directories.push_back(entry.first_cluster);
+                continue;
+            }
+            if (!has_chain(entry.first_cluster)) continue;
+            ++report.files;
+
+            const std::string filename(entry.name.data(), strnlen(entry.name.data(), FileSystem::MAX_FILE_NAME));
+            const bool open = std::any_of(opened_files_table_.begin(), opened_files_table_.end(),
+                                          [&](const FileSystem::FileHandle &handle) {
+                                              return handle.refers_to(dir_cluster, filename);
+                                          });
+            // сжатые группы не делятся на кластеры с одинаковым содержимым
+            if (open || entry.is_compressed()) {
+                ++report.skipped_files;
+                continue;
+            }
 
-    while (bytes_to_skip >= FileSystem::CLUSTER_SIZE_BYTES) {
-        if (!is_valid_cluster(target_cluster)) {
-            handle.current_cluster_in_chain = target_cluster;
-            handle.offset_in_buffered_cluster = 0;
-            return true;
-        }
+            uint32_t first_node = entry.first_cluster;
+            uint32_t previous = FileSystem::MARKER_FAT_ENTRY_FREE;
+            for (uint32_t node = first_node; has_chain(node);) {
+                const std::optional<uint32_t> next = fat_manager_->get_next_node(node);
+                if (!next) {
+                    output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Broken chain of '" << filename << "'" <<
+                            std::endl;
+                    break;
+                }
+                const std::optional<uint32_t> refcount = is_valid_cluster(node)
+                                                             ? fat_manager_->get_refcount(node)
+                                                             : std::nullopt;
+                if (refcount && *refcount <= 1 && vol_manager_.read_cluster(node, cluster.data())) {
+                    ++report.clusters;
+                    const uint32_t checksum = crc32c::compute(cluster.data(), FileSystem::CLUSTER_SIZE_BYTES);
+                    const std::optional<uint32_t> duplicate = find_duplicate(cluster.data(), checksum, node);
+                    const std::optional<uint32_t> shared = duplicate
+                                                               ? share_node(previous, node, *duplicate, first_node)
+                                                               : std::nullopt;
+                    if (shared) {
+                        ++report.deduplicated_clusters;
+                        node = *shared;
+                    } else {
+                        track_cluster(node, checksum);
+                    }
+                }
+                previous = node;
+                node = *next;
+            }
 
-        auto next_cluster_opt = fat_manager_->get_entry(target_cluster);
-        if (!next_cluster_opt) {
-            output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "FAT entry missing during seek for cluster " <<
-                    target_cluster << std::endl;
-            return false;
+            if (first_node != entry.first_cluster) {
+                entry.first_cluster = first_node;
+                if (!directory_manager_->update_entry(dir_cluster, filename, entry)) {
+                    output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Failed to update directory entry of '" <<
+                            filename << "'" << std::endl;
+                    flush_metadata();
+                    return std::nullopt;
+                }
+            }
         }
-        target_cluster = *next_cluster_opt;
-        bytes_to_skip -= FileSystem::CLUSTER_SIZE_BYTES;
     }
 
-    handle.current_cluster_in_chain = target_cluster;
-    handle.offset_in_buffered_cluster = static_cast<uint32_t>(bytes_to_skip);
+    if (!flush_metadata()) return std::nullopt;
+    return report;
+}
 
-    return true;
+bool FileSystemCore::clone_file(const std::string &src_path, const std::string &dst_path) {
+    return traced(trace_record(FsTrace::Op::CLONE), src_path, dst_path,
+                  [&] { return clone_file_untraced(src_path, dst_path); });
 }
 
-bool FileSystemCore::remove_file(const std::string &path) const {
+bool FileSystemCore::clone_file_untraced(const std::string &src_path, const std::string &dst_path) {
+    std::lock_guard lock(fs_mutex_);
     if (!mounted_) {
-        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Filesystem not mounted. Cannot remove file" << std::endl;
+        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Filesystem not mounted" << std::endl;
         return false;
     }
-
-    const std::string filename = get_filename_from_path(path);
-    const uint32_t dir_cluster = get_containing_directory_cluster(path);
-
-    const auto entry_loc_opt = directory_manager_->get_entry_location(dir_cluster, filename);
-    if (!entry_loc_opt) {
-        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "File '" << path << "' not found for removal" << std::endl;
+    if (!check_writable()) return false;
+    if (!fat_manager_->sharing_supported()) {
+        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Volume has no refcount table, cloning is not supported" <<
+                std::endl;
         return false;
     }
 
-    FileSystem::DirectoryEntry entry_to_remove = entry_loc_opt->entry_data;
-
-    if (entry_to_remove.type == FileSystem::EntityType::DIRECTORY) {
-        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "'" << path << "' is a directory. Use remove_directory" << std::endl;
+    const std::string src_name = get_filename_from_path(src_path);
+    const std::string dst_name = get_filename_from_path(dst_path);
+    const uint32_t src_dir_cluster = get_containing_directory_cluster(src_path);
+    const uint32_t dst_dir_cluster = get_containing_directory_cluster(dst_path);
+    if (dst_name.empty() || dst_name.length() >= FileSystem::MAX_FILE_NAME) {
+        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Filename '" << dst_name << "' is invalid" << std::endl;
+        return false;
+    }
+    if (directory_manager_->find_entry(dst_dir_cluster, dst_name)) {
+        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Target filename '" << dst_name << "' already exists" <<
+                std::endl;
         return false;
     }
 
-    // Освободить кластеры файла в FAT и Bitmap
-    if (entry_to_remove.first_cluster != FileSystem::MARKER_FAT_ENTRY_FREE &&
-        entry_to_remove.first_cluster != FileSystem::MARKER_FAT_ENTRY_EOF) {
-
-        const std::list<uint32_t> cluster_chain = fat_manager_->get_cluster_chain(entry_to_remove.first_cluster);
-        if (!fat_manager_->free_chain(entry_to_remove.first_cluster)) {
-            output::warn(output::prefix::FILE_SYSTEM_CORE_WARNING) << "Failed to fully free FAT chain for '" << path << "'" << std::endl;
-        }
-        for (uint32_t cluster_idx: cluster_chain) {
-            if (!bitmap_manager_->free_cluster(cluster_idx)) {
-                output::warn(output::prefix::FILE_SYSTEM_CORE_WARNING) << "Failed to free cluster " << cluster_idx <<
-                        " in bitmap for '" << path << "'" << std::endl;
-            }
-        }
+    // клон получает данные, записанные через открытые дескрипторы
+    if (!sync_open_files()) {
+        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Failed to flush open files before cloning" << std::endl;
+        return false;
+    }
+    const std::optional<FileSystem::DirectoryEntry> source = directory_manager_->find_entry(src_dir_cluster, src_name);
+    if (!source) {
+        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "File '" << src_path << "' not found" << std::endl;
+        return false;
+    }
+    if (source->type == FileSystem::EntityType::DIRECTORY) {
+        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "'" << src_path << "' is a directory" << std::endl;
+        return false;
     }
 
-    // Удалить запись из каталога
-    if (!directory_manager_->remove_entry(dir_cluster, filename)) {
-        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Failed to remove directory entry for '" << path << "'" << std::endl;
+    const std::optional<uint32_t> first_node = clone_chain(*source);
+    if (!first_node) return false;
+    FileSystem::DirectoryEntry clone = *source;
+    clone.first_cluster = *first_node;
+    // встроенные данные, которым не хватает места рядом с новым именем, переносятся в кластер
+    if (!clone.set_name(dst_name) && (!spill_inline_data(clone) || !clone.set_name(dst_name))) {
+        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Failed to move inline data of '" << src_path <<
+                "' for the clone" << std::endl;
         return false;
     }
+    if (!directory_manager_->add_entry(dst_dir_cluster, clone)) {
+        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Failed to create directory entry for '" << dst_path <<
+                "'" << std::endl;
+        release_chain(clone.first_cluster);
+        flush_metadata();
+        return false;
+    }
+    return flush_metadata();
+}
 
-    return true;
+bool FileSystemCore::copy_file(const std::string &src_path, const std::string &dst_path) {
+    return traced(trace_record(FsTrace::Op::COPY), src_path, dst_path,
+                  [&] { return copy_file_untraced(src_path, dst_path); });
 }
 
-bool FileSystemCore::rename_file(const std::string &old_path, const std::string &new_path) {
+bool FileSystemCore::copy_file_untraced(const std::string &src_path, const std::string &dst_path) {
+    std::lock_guard lock(fs_mutex_);
     if (!mounted_) {
         output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Filesystem not mounted" << std::endl;
         return false;
     }
+    if (!check_writable()) return false;
 
-    const std::string old_filename = get_filename_from_path(old_path);
-    const std::string new_filename = get_filename_from_path(new_path);
-    const uint32_t dir_cluster = get_containing_directory_cluster(old_path);
-
-    if (new_filename.empty() || new_filename.length() >= FileSystem::MAX_FILE_NAME) {
-        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "New filename '" << new_filename << "' is invalid" << std::endl;
+    const std::string src_name = get_filename_from_path(src_path);
+    const std::string dst_name = get_filename_from_path(dst_path);
+    const uint32_t src_dir_cluster = get_containing_directory_cluster(src_path);
+    const uint32_t dst_dir_cluster = get_containing_directory_cluster(dst_path);
+    if (dst_name.empty() || dst_name.length() >= FileSystem::MAX_FILE_NAME) {
+        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Filename '" << dst_name << "' is invalid" << std::endl;
         return false;
     }
-
-    // Проверить, не существует ли уже файл/каталог с новым именем
-    if (directory_manager_->find_entry(dir_cluster, new_filename)) {
-        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Target filename '" << new_filename << "' already exists" << std::endl;
+    if (directory_manager_->find_entry(dst_dir_cluster, dst_name)) {
+        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Target filename '" << dst_name << "' already exists" <<
+                std::endl;
         return false;
     }
 
-    auto entry_loc_opt = directory_manager_->get_entry_location(dir_cluster, old_filename);
-    if (!entry_loc_opt) {
-        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Source file/directory '" << old_filename << "' not found" << std::endl;
+    // копия получает данные, записанные через открытые дескрипторы
+    if (!sync_open_files()) {
+        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Failed to flush open files before copying" << std::endl;
+        return false;
+    }
+    const std::optional<FileSystem::DirectoryEntry> source = directory_manager_->find_entry(src_dir_cluster, src_name);
+    if (!source) {
+        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "File '" << src_path << "' not found" << std::endl;
+        return false;
+    }
+    if (source->type == FileSystem::EntityType::DIRECTORY) {
+        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "'" << src_path << "' is a directory" << std::endl;
         return false;
     }
 
-    FileSystem::DirectoryEntry entry_to_rename = entry_loc_opt->entry_data;
-    // Обновляем имя в копии записи
-    std::strncpy(entry_to_rename.name.data(), new_filename.c_str(), FileSystem::MAX_FILE_NAME - 1);
-    entry_to_rename.name[FileSystem::MAX_FILE_NAME - 1] = '\0';
+    const std::optional<uint32_t> first_node = copy_chain(*source);
+    if (!first_node) return false;
+    FileSystem::DirectoryEntry copy = *source;
+    copy.first_cluster = *first_node;
+    if (!copy.set_name(dst_name) && (!spill_inline_data(copy) || !copy.set_name(dst_name))) {
+        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Failed to move inline data of '" << src_path <<
+                "' for the copy" << std::endl;
+        return false;
+    }
+    if (!directory_manager_->add_entry(dst_dir_cluster, copy)) {
+        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Failed to create directory entry for '" << dst_path <<
+                "'" << std::endl;
+        release_chain(copy.first_cluster);
+        flush_metadata();
+        return false;
+    }
+    return flush_metadata();
+}
 
-    if (!directory_manager_->update_entry(dir_cluster, old_filename, entry_to_rename)) {
-        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Failed to update directory entry during rename from '" <<
-                old_filename << "' to '" << new_filename << "'" << std::endl;
+bool FileSystemCore::create_snapshot(const std::string &name) {
+    std::lock_guard lock(fs_mutex_);
+    if (!mounted_) {
+        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Filesystem not mounted" << std::endl;
+        return false;
+    }
+    if (!check_writable()) return false;
+    if (!fat_manager_->sharing_supported()) {
+        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) <<
+                "Volume has no refcount table, snapshots are not supported" << std::endl;
+        return false;
+    }
+    if (name.empty() || name.length() >= FileSystem::MAX_FILE_NAME || name.find('/') != std::string::npos) {
+        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Snapshot name '" << name << "' is invalid" << std::endl;
+        return false;
+    }
+    if (!sync_open_files()) {
+        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Failed to flush open files before snapshot" << std::endl;
         return false;
     }
 
-    // Если переименовывается открытый файл, нужно обновить его путь в opened_files_table_
-    for (auto &[handle_id, file_handle]: opened_files_table_) {
-        if (file_handle.path == old_path) {
-            file_handle.path = new_path;
-            // Также обновить dir_entry в handle
-            std::strncpy(file_handle.dir_entry.name.data(), new_filename.c_str(), FileSystem::MAX_FILE_NAME - 1);
-            file_handle.dir_entry.name[FileSystem::MAX_FILE_NAME - 1] = '\0';
+    // каталог снимков создаётся при первом снимке и виден только через заголовок
+    if (header_.snapshot_dir_cluster == FileSystem::MARKER_FAT_ENTRY_FREE) {
+        const std::optional<uint32_t> snapshot_dir = new_directory_cluster(0);
+        if (!snapshot_dir) return false;
+        header_.snapshot_dir_cluster = *snapshot_dir;
+        if (!vol_manager_.update_header(header_)) {
+            output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Failed to write header" << std::endl;
+            header_.snapshot_dir_cluster = FileSystem::MARKER_FAT_ENTRY_FREE;
+            release_chain(*snapshot_dir);
+            return false;
         }
+    } else if (directory_manager_->find_entry(header_.snapshot_dir_cluster, name)) {
+        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Snapshot '" << name << "' already exists" << std::endl;
+        return false;
     }
 
-    return true;
+    const std::optional<uint32_t> snapshot_root = new_directory_cluster(0);
+    if (!snapshot_root) return false;
+    FileSystem::DirectoryEntry entry;
+    entry.set_name(name);
+    entry.type = FileSystem::EntityType::DIRECTORY;
+    entry.first_cluster = *snapshot_root;
+    entry.file_size_bytes = 0;
+    if (!clone_directory(header_.root_dir_start_cluster, *snapshot_root) ||
+        !directory_manager_->add_entry(header_.snapshot_dir_cluster, entry)) {
+        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Failed to create snapshot '" << name << "'" << std::endl;
+        free_directory_tree(*snapshot_root);
+        flush_metadata();
+        return false;
+    }
+    return flush_metadata();
 }
 
-bool FileSystemCore::create_directory(const std::string &path) const {
+bool FileSystemCore::delete_snapshot(const std::string &name) {
+    std::lock_guard lock(fs_mutex_);
     if (!mounted_) {
         output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Filesystem not mounted" << std::endl;
         return false;
     }
+    if (!check_writable()) return false;
 
-    const std::string dirname = get_filename_from_path(path);
-    const uint32_t parent_dir_cluster = get_containing_directory_cluster(path);
-
-    if (dirname.empty() || dirname.length() >= FileSystem::MAX_FILE_NAME) {
-        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Directory name '" << dirname << "' is invalid" << std::endl;
+    const std::optional<FileSystem::DirectoryEntry> snapshot =
+            header_.snapshot_dir_cluster != FileSystem::MARKER_FAT_ENTRY_FREE
+                ? directory_manager_->find_entry(header_.snapshot_dir_cluster, name)
+                : std::nullopt;
+    if (!snapshot) {
+        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Snapshot '" << name << "' not found" << std::endl;
         return false;
     }
-
-    if (directory_manager_->find_entry(parent_dir_cluster, dirname)) {
-        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Directory or file '" << dirname << "' already exists" << std::endl;
+    // сначала удаляется запись: при сбое освобождения останутся только потерянные кластеры, которые уберёт fsck
+    if (!directory_manager_->remove_entry(header_.snapshot_dir_cluster, name)) {
+        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Failed to remove snapshot entry '" << name << "'" <<
+                std::endl;
         return false;
     }
+    if (!free_directory_tree(snapshot->first_cluster)) {
+        output::warn(output::prefix::FILE_SYSTEM_CORE_WARNING) << "Failed to fully release snapshot '" << name << "'" <<
+                std::endl;
+    }
+    return flush_metadata();
+}
+
+std::vector<std::string> FileSystemCore::list_snapshots() const {
+    std::lock_guard lock(fs_mutex_);
+    std::vector<std::string> names;
+    if (!mounted_) {
+        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Filesystem not mounted" << std::endl;
+        return names;
+    }
+    if (header_.snapshot_dir_cluster == FileSystem::MARKER_FAT_ENTRY_FREE) return names;
+    DirectoryCursor cursor(vol_manager_, *fat_manager_, header_.snapshot_dir_cluster);
+    while (const auto entry = cursor.next()) {
+        names.emplace_back(entry->name);
+    }
+    return names;
+}
 
-    // Выделяем кластер для данных нового каталога
-    const std::optional<uint32_t> new_dir_data_cluster_opt = bitmap_manager_->find_and_allocate_free_cluster();
-    if (!new_dir_data_cluster_opt) {
+bool FileSystemCore::check_writable() const {
+    if (!read_only_) return true;
+    output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Snapshot is mounted read-only" << std::endl;
+    return false;
+}
+
+bool FileSystemCore::sync_open_files() {
+    bool success = true;
+    for (FileSystem::FileHandle &handle: opened_files_table_) {
+        if (!flush_cluster(handle) || !store_group(handle)) {
+            success = false;
+        } else if (handle.modified && !update_directory_entry_for_file(handle)) {
+            success = false;
+        }
+    }
+    return success;
+}
+
+std::optional<uint32_t> FileSystemCore::new_directory_cluster(const uint32_t group) const {
+    const std::optional<uint32_t> cluster_opt = bitmap_manager_->allocate_in_group(group);
+    if (!cluster_opt) {
         output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "No free cluster for new directory data" << std::endl;
-        return false;
+        return std::nullopt;
     }
-    const uint32_t new_dir_data_cluster = *new_dir_data_cluster_opt;
+    const uint32_t cluster = *cluster_opt;
 
     // Помечаем этот кластер как конец цепочки в FAT
-    if (!fat_manager_->set_entry(new_dir_data_cluster, FileSystem::MARKER_FAT_ENTRY_EOF)) {
+    if (!fat_manager_->set_entry(cluster, FileSystem::MARKER_FAT_ENTRY_EOF)) {
         output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Failed to set FAT entry for new directory cluster " <<
-                new_dir_data_cluster << std::endl;
-        bitmap_manager_->free_cluster(new_dir_data_cluster);
-        return false;
+                cluster << std::endl;
+        bitmap_manager_->free_cluster(cluster);
+        return std::nullopt;
     }
 
     // Инициализируем сам кластер данных каталога
-    std::vector<FileSystem::DirectoryEntry> empty_entries(FileSystem::DIR_ENTRIES_PER_CLUSTER);
-    if (!directory_manager_->write_directory_cluster(new_dir_data_cluster, empty_entries)) {
+    const std::vector<FileSystem::DirectoryEntry> empty_entries(FileSystem::DIR_ENTRIES_PER_CLUSTER);
+    if (!directory_manager_->write_directory_cluster(cluster, empty_entries)) {
         output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Failed to initialize new directory data cluster " <<
-                new_dir_data_cluster << std::endl;
-        fat_manager_->set_entry(new_dir_data_cluster, FileSystem::MARKER_FAT_ENTRY_FREE);
-        bitmap_manager_->free_cluster(new_dir_data_cluster);
-        return false;
+                cluster << std::endl;
+        fat_manager_->set_entry(cluster, FileSystem::MARKER_FAT_ENTRY_FREE);
+        bitmap_manager_->free_cluster(cluster);
+        return std::nullopt;
     }
+    return cluster;
+}
 
-    // Создаем запись для нового каталога в родительском каталоге
-    FileSystem::DirectoryEntry new_dir_entry;
-    std::strncpy(new_dir_entry.name.data(), dirname.c_str(), FileSystem::MAX_FILE_NAME - 1);
-    new_dir_entry.name[FileSystem::MAX_FILE_NAME - 1] = '\0';
-    new_dir_entry.type = FileSystem::EntityType::DIRECTORY;
-    new_dir_entry.first_cluster = new_dir_data_cluster;
-    new_dir_entry.file_size_bytes = 0;
-
-    if (!directory_manager_->add_entry(parent_dir_cluster, new_dir_entry)) {
-        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Failed to add directory entry for '" << dirname << "'" << std::endl;
-        fat_manager_->set_entry(new_dir_data_cluster, FileSystem::MARKER_FAT_ENTRY_FREE);
-        bitmap_manager_->free_cluster(new_dir_data_cluster);
-        return false;
+std::optional<uint32_t> FileSystemCore::clone_chain(const FileSystem::DirectoryEntry &entry) const {
+    if (!has_chain(entry.first_cluster)) return entry.first_cluster;
+    const std::vector<uint32_t> nodes = fat_manager_->get_chain_nodes(entry.first_cluster);
+    if (nodes.empty()) return std::nullopt;
+
+    std::vector<uint32_t> cloned;
+    cloned.reserve(nodes.size());
+    std::vector<char> cluster_data;
+    bool success = true;
+    for (const uint32_t node: nodes) {
+        std::optional<uint32_t> copy;
+        if (FileSystem::is_hole_ref(node)) {
+            const std::optional<FileSystem::HoleRecord> hole = fat_manager_->get_hole(node);
+            if (hole) copy = fat_manager_->create_hole(hole->length_clusters, FileSystem::MARKER_FAT_ENTRY_EOF);
+        } else if (entry.is_compressed()) {
+            // индекс групп сжатого файла строится по собственным кластерам - данные копируются
+            cluster_data.resize(FileSystem::CLUSTER_SIZE_BYTES);
+            copy = bitmap_manager_->find_and_allocate_free_cluster();
+            if (copy && (!vol_manager_.read_cluster(node, cluster_data.data()) ||
+                         !vol_manager_.write_cluster(*copy, cluster_data.data()) ||
+                         !fat_manager_->set_entry(*copy, FileSystem::MARKER_FAT_ENTRY_EOF))) {
+                bitmap_manager_->free_cluster(*copy);
+                copy = std::nullopt;
+            }
+        } else if (const std::optional<uint32_t> cluster = node_cluster(node)) {
+            // ссылка на кластер исходного файла; счётчик учитывает и ссылку самого исходного файла
+            const std::optional<uint32_t> refcount = fat_manager_->get_refcount(*cluster);
+            if (refcount) copy = fat_manager_->create_shared(*cluster, FileSystem::MARKER_FAT_ENTRY_EOF);
+            if (copy && !fat_manager_->set_refcount(*cluster, *refcount == 0 ? 2 : *refcount + 1)) {
+                fat_manager_->free_shared(*copy);
+                copy = std::nullopt;
+            }
+        }
+        if (!copy) {
+            success = false;
+            break;
+        }
+        cloned.push_back(*copy);
     }
 
-    return true;
+    if (success && fat_manager_->link_chain(cloned)) return cloned.front();
+    output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Failed to clone chain of '" <<
+            std::string(entry.name.data(), strnlen(entry.name.data(), FileSystem::MAX_FILE_NAME)) << "'" << std::endl;
+    // созданные узлы связываются в цепочку, чтобы снять ссылки и освободить их обычным путём
+    if (!cloned.empty() && fat_manager_->link_chain(cloned)) release_chain(cloned.front());
+    return std::nullopt;
 }
 
-bool FileSystemCore::remove_directory(const std::string &path) const {
-    if (!mounted_) {
-        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Filesystem not mounted" << std::endl;
-        return false;
+std::optional<uint32_t> FileSystemCore::copy_chain(const FileSystem::DirectoryEntry &entry) const {
+    if (!has_chain(entry.first_cluster)) return entry.first_cluster;
+    const std::vector<uint32_t> nodes = fat_manager_->get_chain_nodes(entry.first_cluster);
+    if (nodes.empty()) return std::nullopt;
+
+    // кластеры с данными по порядку цепочки; сжатый файл копируется так же - группы лежат в своих кластерах
+    std::vector<uint32_t> source_clusters;
+    source_clusters.reserve(nodes.size());
+    for (const uint32_t node: nodes) {
+        if (FileSystem::is_hole_ref(node)) continue;
+        const std::optional<uint32_t> cluster = node_cluster(node);
+        if (!cluster) {
+            output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Broken chain node " << node << std::endl;
+            return std::nullopt;
+        }
+        source_clusters.push_back(*cluster);
+    }
+    const std::optional<std::vector<uint32_t>> target_clusters =
+            allocate_extents(static_cast<uint32_t>(source_clusters.size()));
+    if (!target_clusters) {
+        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Not enough free space to copy " <<
+                source_clusters.size() << " clusters" << std::endl;
+        return std::nullopt;
     }
 
-    const std::string dirname = get_filename_from_path(path);
-    const uint32_t parent_dir_cluster = get_containing_directory_cluster(path);
-
-    const auto entry_loc_opt = directory_manager_->get_entry_location(parent_dir_cluster, dirname);
-    if (!entry_loc_opt) {
-        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Directory '" << path << "' not found for removal" << std::endl;
-        return false;
+    // копируем участками, непрерывными и в исходной цепочке, и в выделенном месте
+    const auto cluster_count = static_cast<uint32_t>(source_clusters.size());
+    for (uint32_t pos = 0; pos < cluster_count;) {
+        uint32_t batch = 1;
+        while (pos + batch < cluster_count && batch < FileSystem::COPY_BATCH_CLUSTERS &&
+               source_clusters[pos + batch] == source_clusters[pos] + batch &&
+               (*target_clusters)[pos + batch] == (*target_clusters)[pos] + batch) {
+            ++batch;
+        }
+        if (!vol_manager_.copy_clusters(source_clusters[pos], (*target_clusters)[pos], batch)) {
+            bitmap_manager_->free_clusters(*target_clusters);
+            return std::nullopt;
+        }
+        pos += batch;
     }
 
-    const FileSystem::DirectoryEntry dir_to_remove = entry_loc_opt->entry_data;
+    std::vector<uint32_t> copied;
+    copied.reserve(nodes.size());
+    bool success = true;
+    for (uint32_t i = 0, data_idx = 0; i < nodes.size() && success; ++i) {
+        if (!FileSystem::is_hole_ref(nodes[i])) {
+            copied.push_back((*target_clusters)[data_idx++]);
+            continue;
+        }
+        const std::optional<FileSystem::HoleRecord> hole = fat_manager_->get_hole(nodes[i]);
+        const std::optional<uint32_t> hole_copy = hole
+                                                      ? fat_manager_->create_hole(hole->length_clusters,
+                                                                                  FileSystem::MARKER_FAT_ENTRY_EOF)
+                                                      : std::nullopt;
+        if (hole_copy) {
+            copied.push_back(*hole_copy);
+        } else {
+            success = false;
+        }
+    }
 
-    if (dir_to_remove.type != FileSystem::EntityType::DIRECTORY) {
-        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "'" << path << "' is not a directory. Use remove_file" << std::endl;
-        return false;
+    if (success && fat_manager_->link_chain(copied)) return copied.front();
+    output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Failed to copy chain of '" <<
+            std::string(entry.name.data(), strnlen(entry.name.data(), FileSystem::MAX_FILE_NAME)) << "'" << std::endl;
+    // кластеры, ещё не связанные в цепочку, освобождаются напрямую, связанные узлы - обычным путём
+    std::vector<uint32_t> unlinked(target_clusters->begin(), target_clusters->end());
+    if (!copied.empty() && fat_manager_->link_chain(copied)) {
+        release_chain(copied.front());
+        unlinked.erase(unlinked.begin(), unlinked.begin() + static_cast<std::ptrdiff_t>(
+                           std::count_if(copied.begin(), copied.end(),
+                                         [](const uint32_t node) { return !FileSystem::is_hole_ref(node); })));
     }
+    bitmap_manager_->free_clusters(unlinked);
+    return std::nullopt;
+}
 
-    // Проверить, пуст ли каталог
-    std::vector<FileSystem::DirectoryEntry> entries_in_dir = directory_manager_->get_directories_list(dir_to_remove.first_cluster);
-    if (!entries_in_dir.empty()) {
-        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Directory '" << path << "' is not empty" << std::endl;
-        return false;
+std::optional<std::vector<uint32_t>> FileSystemCore::allocate_extents(const uint32_t count) const {
+    std::vector<uint32_t> clusters;
+    clusters.reserve(count);
+    // сначала ищется один участок на весь файл; при неудаче запрашиваемая длина уменьшается вдвое,
+    // пока не найдутся участки под остаток
+    uint32_t request = count;
+    while (clusters.size() < count) {
+        const std::optional<uint32_t> run_start = bitmap_manager_->find_and_allocate_free_run(request);
+        if (!run_start) {
+            request /= 2;
+            if (request == 0) {
+                bitmap_manager_->free_clusters(clusters);
+                return std::nullopt;
+            }
+            continue;
+        }
+        for (uint32_t i = 0; i < request; ++i) clusters.push_back(*run_start + i);
+        request = std::min(request, count - static_cast<uint32_t>(clusters.size()));
     }
+    return clusters;
+}
 
-    // Освободить кластеры данных каталога в FAT и Bitmap
-    if (dir_to_remove.first_cluster != FileSystem::MARKER_FAT_ENTRY_FREE &&
-        dir_to_remove.first_cluster != FileSystem::MARKER_FAT_ENTRY_EOF) {
+bool FileSystemCore::clone_directory(const uint32_t src_dir_cluster, const uint32_t dst_dir_cluster) const {
+    for (const auto &entry: directory_manager_->get_directories_list(src_dir_cluster)) {
+        FileSystem::DirectoryEntry clone = entry;
+        if (entry.type == FileSystem::EntityType::DIRECTORY) {
+            const std::optional<uint32_t> child = new_directory_cluster(0);
+            if (!child) return false;
+            clone.first_cluster = *child;
+            if (!directory_manager_->add_entry(dst_dir_cluster, clone)) {
+                release_chain(*child);
+                return false;
+            }
+            if (!clone_directory(entry.first_cluster, *child)) return false;
+            continue;
+        }
 
-        const std::list<uint32_t> cluster_chain = fat_manager_->get_cluster_chain(dir_to_remove.first_cluster);
-        fat_manager_->free_chain(dir_to_remove.first_cluster);
-        for (const uint32_t cluster_idx: cluster_chain) {
-            bitmap_manager_->free_cluster(cluster_idx);
+        const std::optional<uint32_t> first_node = clone_chain(entry);
+        if (!first_node) return false;
+        clone.first_cluster = *first_node;
+        if (!directory_manager_->add_entry(dst_dir_cluster, clone)) {
+            release_chain(*first_node);
+            return false;
         }
     }
+    return true;
+}
 
-    // Удалить запись каталога из родительского каталога
-    if (!directory_manager_->remove_entry(parent_dir_cluster, dirname)) {
-        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Failed to remove directory entry for '" << path << "'" << std::endl;
-        return false;
+bool FileSystemCore::free_directory_tree(const uint32_t dir_cluster) const {
+    bool success = true;
+    for (const auto &entry: directory_manager_->get_directories_list(dir_cluster)) {
+        if (entry.type == FileSystem::EntityType::DIRECTORY) {
+            if (!free_directory_tree(entry.first_cluster)) success = false;
+        } else if (!release_chain(entry.first_cluster)) {
+            success = false;
+        }
     }
+    return release_chain(dir_cluster) && success;
+}
 
-    return true;
+bool FileSystemCore::release_chain(const uint32_t first_node) const {
+    if (!has_chain(first_node)) return true;
+    const std::optional<std::vector<uint32_t>> released = fat_manager_->free_chain(first_node);
+    return released && bitmap_manager_->free_clusters(*released);
 }
 
-std::vector<FileSystem::DirectoryEntry> FileSystemCore::list_directory(const std::string &path) const {
-    std::vector<FileSystem::DirectoryEntry> result;
+bool FileSystemCore::start_trace(const std::string &trace_path) {
+    return trace_writer_.open(trace_path);
+}
+
+std::optional<uint64_t> FileSystemCore::stop_trace() {
+    if (!trace_writer_.active()) return std::nullopt;
+    const uint64_t records = trace_writer_.records();
+    if (!trace_writer_.close()) return std::nullopt;
+    return records;
+}
+
+bool FileSystemCore::isTracing() const {
+    return trace_writer_.active();
+}
+
+void FileSystemCore::set_checksum_verification(const bool enabled) {
+    std::lock_guard lock(fs_mutex_);
+    vol_manager_.set_checksum_verification(enabled);
+}
+
+void FileSystemCore::set_direct_io(const bool enabled) {
+    std::lock_guard lock(fs_mutex_);
+    vol_manager_.set_direct_io(enabled);
+}
+
+bool FileSystemCore::isDirectIO() const {
+    std::lock_guard lock(fs_mutex_);
+    return mounted_ && vol_manager_.direct_io();
+}
+
+bool FileSystemCore::set_stripe_layout(const std::vector<std::string> &member_paths, const uint32_t width_clusters) {
+    std::lock_guard lock(fs_mutex_);
+    return vol_manager_.set_stripe_layout(member_paths, width_clusters);
+}
+
+bool FileSystemCore::set_mirror_layout(const std::vector<std::string> &mirror_paths) {
+    std::lock_guard lock(fs_mutex_);
+    return vol_manager_.set_mirror_layout(mirror_paths);
+}
+
+std::vector<std::string> FileSystemCore::volume_image_paths() const {
+    std::lock_guard lock(fs_mutex_);
+    if (!mounted_) return {};
+    return vol_manager_.image_paths();
+}
+
+std::vector<VolumeManager::ImageStats> FileSystemCore::volume_image_stats() const {
+    std::lock_guard lock(fs_mutex_);
+    if (!mounted_) return {};
+    return vol_manager_.image_stats();
+}
+
+bool FileSystemCore::isMirrorResyncing() const {
+    std::lock_guard lock(fs_mutex_);
+    return mounted_ && vol_manager_.mirror_resync_active();
+}
+
+bool FileSystemCore::isMirrorDegraded() const {
+    std::lock_guard lock(fs_mutex_);
+    return mounted_ && vol_manager_.mirror_degraded();
+}
+
+std::optional<uint64_t> FileSystemCore::compact_volume() {
+    std::lock_guard lock(fs_mutex_);
     if (!mounted_) {
         output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Filesystem not mounted" << std::endl;
-        return result;
+        return std::nullopt;
     }
-
-    if (path == "/") {
-        return directory_manager_->get_directories_list(header_.root_dir_start_cluster);
+    if (!check_writable()) return std::nullopt;
+    // несохранённые буферы открытых файлов не должны попасть в кластеры после пробивания дыр
+    for (FileSystem::FileHandle &handle: opened_files_table_) flush_cluster(handle);
+    flush_metadata();
+
+    const std::optional<uint64_t> before = vol_manager_.get_allocated_bytes();
+    bool punched = true;
+    const bool walked = bitmap_manager_->for_each_free_run([this, &punched](const uint32_t first, const uint32_t count) {
+        punched = vol_manager_.punch_holes(first, count);
+        return punched;
+    });
+    if (!walked || !punched) {
+        output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Failed to compact volume" << std::endl;
+        return std::nullopt;
     }
+    const std::optional<uint64_t> after = vol_manager_.get_allocated_bytes();
+    if (!before || !after) return 0;
+    return *before > *after ? *before - *after : 0;
+}
 
-    const std::string dirname = get_filename_from_path(path);
-    if (const auto entry_opt = directory_manager_->find_entry(header_.root_dir_start_cluster, dirname);
-        entry_opt && entry_opt->type == FileSystem::EntityType::DIRECTORY) {
-        return directory_manager_->get_directories_list(entry_opt->first_cluster);
-    }
+std::optional<uint64_t> FileSystemCore::get_allocated_bytes() const {
+    std::lock_guard lock(fs_mutex_);
+    if (!mounted_) return std::nullopt;
+    return vol_manager_.get_allocated_bytes();
+}
 
-    output::err(output::prefix::FILE_SYSTEM_CORE_ERROR) << "Directory '" << path << "' not found or is not a directory" << std::endl;
-    return result;
+void FileSystemCore::set_metadata_cache_budget(const uint64_t bytes) {
+    std::lock_guard lock(fs_mutex_);
+    metadata_cache_bytes_ = bytes;
+    if (mounted_) apply_metadata_cache_budget();
+}
+
+MetadataCacheUsage FileSystemCore::get_metadata_cache_usage() const {
+    std::lock_guard lock(fs_mutex_);
+    MetadataCacheUsage usage;
+    if (!mounted_) return usage;
+    usage.fat = fat_manager_->cache_stats();
+    usage.bitmap = bitmap_manager_->cache_stats();
+    usage.checksums = vol_manager_.checksum_cache_stats();
+    if (dedup_index_) usage.dedup = dedup_index_->cache_stats();
+    return usage;
+}
+
+void FileSystemCore::apply_metadata_cache_budget() {
+    // бюджет делится пропорционально размерам областей, каждой области достаётся хотя бы одна страница
+    const uint64_t budget_pages = metadata_cache_bytes_ / FileSystem::CLUSTER_SIZE_BYTES;
+    const uint64_t fat_region = static_cast<uint64_t>(header_.fat_size_clusters) + header_.hole_table_size_clusters +
+                                header_.refcount_table_size_clusters;
+    const uint64_t bitmap_region = header_.bitmap_size_cluster;
+    const uint64_t checksum_region = header_.checksum_table_size_clusters;
+    const uint64_t dedup_region = header_.dedup_index_size_clusters;
+    const uint64_t total_region = std::max<uint64_t>(1, fat_region + bitmap_region + checksum_region + dedup_region);
+    const uint64_t bitmap_pages = std::max<uint64_t>(1, budget_pages * bitmap_region / total_region);
+    const uint64_t checksum_pages = std::max<uint64_t>(1, budget_pages * checksum_region / total_region);
+    const uint64_t dedup_pages = std::max<uint64_t>(1, budget_pages * dedup_region / total_region);
+    const uint64_t reserved_pages = bitmap_pages + checksum_pages + dedup_pages;
+    const uint64_t fat_pages = std::max<uint64_t>(1, budget_pages > reserved_pages ? budget_pages - reserved_pages : 0);
+    bitmap_manager_->set_max_resident_pages(bitmap_pages);
+    fat_manager_->set_max_resident_pages(fat_pages);
+    vol_manager_.set_checksum_cache_pages(checksum_pages);
+    if (dedup_index_) dedup_index_->set_max_resident_pages(dedup_pages);
+}
+
+bool FileSystemCore::flush_metadata() const {
+    if (read_only_) return true;
+    bool success = true;
+    if (fat_manager_ && !fat_manager_->flush()) success = false;
+    if (bitmap_manager_ && !bitmap_manager_->flush()) success = false;
+    if (dedup_index_ && !dedup_index_->flush()) success = false;
+    // суммы записываются последними: сброс страниц FAT, битовой карты и индекса обновляет их
+    if (!vol_manager_.flush_checksums()) success = false;
+    return success;
 }
 
 std::string FileSystemCore::get_filename_from_path(const std::string &path) {
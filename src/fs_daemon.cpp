@@ -0,0 +1,90 @@
+#include "fs_core.h"
+#include "fs_server.h"
+
+#include <csignal>
+#include <iostream>
+#include <string>
+
+namespace {
+    FsServer *running_server = nullptr; // сервер, которому обработчик сигнала передаёт остановку
+
+    void handle_stop_signal(int) {
+        if (running_server) running_server->stop();
+    }
+
+    void printDaemonUsage() {
+        std::cout << "Usage: fs_daemon <volume_file> <socket_path> [--direct-io] [--dedup] [--trace <file>]\n";
+        std::cout << "  Mounts the volume once and serves it to FsClient processes over a Unix socket\n";
+        std::cout << "  until SIGINT or SIGTERM.\n";
+        std::cout << "  --direct-io    - O_DIRECT volume I/O bypassing the host page cache.\n";
+        std::cout << "  --dedup        - share written clusters with identical ones on the volume.\n";
+        std::cout << "  --trace <file> - record every served call to a trace for fs_replay.\n";
+    }
+}
+
+int main(int argc, char *argv[]) {
+    std::string volume_path;
+    std::string socket_path;
+    bool direct_io = false;
+    bool dedup = false;
+    std::string trace_path;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (arg == "--direct-io") {
+            direct_io = true;
+        } else if (arg == "--dedup") {
+            dedup = true;
+        } else if (arg == "--trace" && i + 1 < argc) {
+            trace_path = argv[++i];
+        } else if (volume_path.empty() && arg.rfind("--", 0) != 0) {
+            volume_path = arg;
+        } else if (socket_path.empty() && arg.rfind("--", 0) != 0) {
+            socket_path = arg;
+        } else {
+            printDaemonUsage();
+            return 2;
+        }
+    }
+    if (volume_path.empty() || socket_path.empty()) {
+        printDaemonUsage();
+        return 2;
+    }
+
+    FileSystemCore fs_core;
+    fs_core.set_direct_io(direct_io);
+    if (!fs_core.mount(volume_path)) return 1;
+    if (dedup) fs_core.set_dedup(true);
+    if (!trace_path.empty() && !fs_core.start_trace(trace_path)) {
+        fs_core.unmount();
+        return 1;
+    }
+
+    int exit_code = 0;
+    {
+        FsServer server(fs_core);
+        if (server.listen(socket_path)) {
+            running_server = &server;
+            std::signal(SIGINT, handle_stop_signal);
+            std::signal(SIGTERM, handle_stop_signal);
+            if (!server.run()) exit_code = 1;
+            running_server = nullptr;
+
+            const FsServer::Stats stats = server.stats();
+            std::cout << "Clients served: " << stats.clients_accepted << "\n";
+            std::cout << "Requests: " << stats.requests << " in " << stats.batches << " batches\n";
+            std::cout << "Data via socket: " << stats.inline_bytes << " bytes, via shared memory: " <<
+                    stats.shared_bytes << " bytes\n";
+        } else {
+            exit_code = 1;
+        }
+    }
+    if (fs_core.isTracing()) {
+        if (const auto records = fs_core.stop_trace()) {
+            std::cout << "Trace: " << *records << " calls recorded to '" << trace_path << "'\n";
+        } else {
+            exit_code = 1;
+        }
+    }
+    fs_core.unmount();
+    return exit_code;
+}
@@ -0,0 +1,534 @@
+#include "fs_core.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Генератор нагрузки по файлу заданий (похож на fio): каждая секция [имя] - задание, [global] - параметры тома
+// и значения по умолчанию для заданий. Задания выполняются по очереди, потоки задания - одновременно,
+// все через один FileSystemCore.
+namespace {
+    constexpr size_t DATA_POOL_BYTES = 1024 * 1024; // несжимаемые данные, из которых берутся записываемые блоки
+    constexpr uint64_t DEFAULT_OPS = 10000;
+
+    enum class Workload { READ, WRITE, RW, RANDREAD, RANDWRITE, RANDRW, CREATE, CHURN, LIST };
+
+    // классы операций в отчёте
+    enum OpClass : uint8_t { OP_READ, OP_WRITE, OP_CREATE, OP_DELETE, OP_LIST, OP_CLASS_COUNT };
+    constexpr const char *OP_CLASS_NAMES[OP_CLASS_COUNT] = {"read", "write", "create", "delete", "list"};
+
+    struct Global {
+        std::string volume_path = "fs_load.img";
+        uint64_t volume_mb = 512;
+        bool direct_io = false;
+        bool dedup = false;
+        bool verify = true;
+        uint64_t cache_bytes = 0; // 0 - лимит по умолчанию
+        bool keep = false; // не удалять образ после прогона
+    };
+
+    struct Job {
+        std::string name;
+        Workload workload = Workload::RANDREAD;
+        uint64_t block_size = 4096;
+        unsigned threads = 1;
+        uint64_t files = 1; // файлов на поток
+        uint64_t file_size_min = 16 * 1024 * 1024;
+        uint64_t file_size_max = 16 * 1024 * 1024;
+        bool lognormal = false; // размеры файлов - логнормальные в [min, max] вместо равномерных
+        uint64_t dirs = 0; // каталогов, по которым раскладываются файлы; 0 - корень
+        unsigned read_percent = 50; // доля чтений в rw / randrw
+        uint64_t ops = 0; // операций на поток; 0 - DEFAULT_OPS, если не задан runtime
+        double runtime = 0; // секунд
+        uint64_t seed = 1;
+    };
+
+    struct LoadFile {
+        std::string path;
+        uint64_t size; // целевой размер
+        std::optional<uint32_t> handle;
+    };
+
+    struct ThreadResult {
+        std::array<std::vector<uint64_t>, OP_CLASS_COUNT> latencies; // наносекунды
+        std::array<uint64_t, OP_CLASS_COUNT> bytes{};
+        std::array<uint64_t, OP_CLASS_COUNT> errors{};
+    };
+
+    void printLoadUsage() {
+        std::cout << "Usage: fs_load <job_file> [--volume FILE] [--keep]\n";
+        std::cout << "  Runs the jobs of an fio-style job file against a fresh volume and prints IOPS, MB/s\n";
+        std::cout << "  and latency percentiles per job. See documentation/LoadReadme.md for the keys.\n";
+        std::cout << "  --volume FILE  - volume image (overrides 'volume' in [global]).\n";
+        std::cout << "  --keep         - keep the volume image after the run.\n";
+    }
+
+    std::string trim(const std::string &text) {
+        const size_t first = text.find_first_not_of(" \t\r");
+        if (first == std::string::npos) return {};
+        return text.substr(first, text.find_last_not_of(" \t\r") - first + 1);
+    }
+
+    // число с необязательным суффиксом k / m / g (степени 1024)
+    uint64_t parse_size(const std::string &value) {
+        size_t used = 0;
+        const uint64_t number = std::stoull(value, &used);
+        const std::string suffix = value.substr(used);
+        if (suffix.empty()) return number;
+        if (suffix == "k" || suffix == "K") return number * 1024;
+        if (suffix == "m" || suffix == "M") return number * 1024 * 1024;
+        if (suffix == "g" || suffix == "G") return number * 1024 * 1024 * 1024;
+        throw std::invalid_argument("unknown size suffix '" + suffix + "'");
+    }
+
+    bool parse_flag(const std::string &value) {
+        if (value == "1" || value == "true" || value == "on") return true;
+        if (value == "0" || value == "false" || value == "off") return false;
+        throw std::invalid_argument("expected 0 or 1");
+    }
+
+    std::optional<Workload> parse_workload(const std::string &value) {
+        if (value == "read") return Workload::READ;
+        if (value == "write") return Workload::WRITE;
+        if (value == "rw") return Workload::RW;
+        if (value == "randread") return Workload::RANDREAD;
+        if (value == "randwrite") return Workload::RANDWRITE;
+        if (value == "randrw") return Workload::RANDRW;
+        if (value == "create") return Workload::CREATE;
+        if (value == "churn") return Workload::CHURN;
+        if (value == "list") return Workload::LIST;
+        return std::nullopt;
+    }
+
+    // false - ключ не относится к заданию
+    bool apply_job_key(Job &job, const std::string &key, const std::string &value) {
+        if (key == "rw") {
+            const auto workload = parse_workload(value);
+            if (!workload) throw std::invalid_argument("unknown workload '" + value + "'");
+            job.workload = *workload;
+        } else if (key == "bs") {
+            job.block_size = parse_size(value);
+        } else if (key == "threads") {
+            job.threads = static_cast<unsigned>(std::stoul(value));
+        } else if (key == "nrfiles") {
+            job.files = std::stoull(value);
+        } else if (key == "filesize") {
+            const size_t dash = value.find('-');
+            job.file_size_min = parse_size(value.substr(0, dash));
+            job.file_size_max = dash == std::string::npos ? job.file_size_min : parse_size(value.substr(dash + 1));
+            if (job.file_size_max < job.file_size_min) throw std::invalid_argument("empty size range");
+        } else if (key == "filesize_dist") {
+            if (value != "uniform" && value != "lognormal") throw std::invalid_argument("uniform or lognormal");
+            job.lognormal = value == "lognormal";
+        } else if (key == "dirs") {
+            job.dirs = std::stoull(value);
+        } else if (key == "rwmixread") {
+            job.read_percent = static_cast<unsigned>(std::stoul(value));
+            if (job.read_percent > 100) throw std::invalid_argument("percentage above 100");
+        } else if (key == "ops") {
+            job.ops = std::stoull(value);
+        } else if (key == "runtime") {
+            job.runtime = std::stod(value);
+        } else if (key == "seed") {
+            job.seed = std::stoull(value);
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    bool apply_global_key(Global &global, const std::string &key, const std::string &value) {
+        if (key == "volume") {
+            global.volume_path = value;
+        } else if (key == "volume_size") {
+            global.volume_mb = parse_size(value) / (1024 * 1024);
+        } else if (key == "direct_io") {
+            global.direct_io = parse_flag(value);
+        } else if (key == "dedup") {
+            global.dedup = parse_flag(value);
+        } else if (key == "verify") {
+            global.verify = parse_flag(value);
+        } else if (key == "cache") {
+            global.cache_bytes = parse_size(value);
+        } else if (key == "keep") {
+            global.keep = parse_flag(value);
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    // разбирает файл заданий; nullopt - ошибка (сообщение уже выведено)
+    std::optional<std::vector<Job>> parse_job_file(const std::string &path, Global &global) {
+        std::ifstream file(path);
+        if (!file) {
+            std::cerr << "Error: Cannot open job file '" << path << "'" << std::endl;
+            return std::nullopt;
+        }
+        Job defaults;
+        std::vector<Job> jobs;
+        bool in_global = false;
+        std::string line;
+        for (unsigned line_number = 1; std::getline(file, line); ++line_number) {
+            line = trim(line.substr(0, line.find_first_of(";#")));
+            if (line.empty()) continue;
+            if (line.front() == '[' && line.back() == ']') {
+                const std::string section = trim(line.substr(1, line.size() - 2));
+                in_global = section == "global";
+                if (!in_global) {
+                    jobs.push_back(defaults);
+                    jobs.back().name = section;
+                }
+                continue;
+            }
+            const size_t equals = line.find('=');
+            const std::string key = trim(line.substr(0, equals));
+            const std::string value = equals == std::string::npos ? "1" : trim(line.substr(equals + 1));
+            try {
+                bool known;
+                if (in_global) {
+                    known = apply_global_key(global, key, value) || apply_job_key(defaults, key, value);
+                } else if (jobs.empty()) {
+                    throw std::invalid_argument("key outside of a section");
+                } else {
+                    known = apply_job_key(jobs.back(), key, value);
+                }
+                if (!known) throw std::invalid_argument("unknown key");
+            } catch (const std::exception &e) {
+                std::cerr << "Error: " << path << ":" << line_number << ": '" << key << "': " << e.what() << std::endl;
+                return std::nullopt;
+            }
+        }
+        for (Job &job: jobs) {
+            if (job.threads == 0 || job.block_size == 0) {
+                std::cerr << "Error: Job '" << job.name << "' needs threads and bs above zero" << std::endl;
+                return std::nullopt;
+            }
+            if (job.ops == 0 && job.runtime <= 0) job.ops = DEFAULT_OPS;
+        }
+        if (jobs.empty()) std::cerr << "Error: No jobs in '" << path << "'" << std::endl;
+        return jobs.empty() ? std::nullopt : std::optional(jobs);
+    }
+
+    uint64_t pick_file_size(const Job &job, std::mt19937_64 &random) {
+        if (job.file_size_min == job.file_size_max) return job.file_size_min;
+        if (!job.lognormal) {
+            return std::uniform_int_distribution<uint64_t>(job.file_size_min, job.file_size_max)(random);
+        }
+        // медиана - среднее геометрическое границ, разброс - чтобы границы попадали примерно в ±2 сигмы
+        const double low = std::log(static_cast<double>(std::max<uint64_t>(job.file_size_min, 1)));
+        const double high = std::log(static_cast<double>(job.file_size_max));
+        std::lognormal_distribution<double> distribution((low + high) / 2, (high - low) / 4);
+        return std::clamp(static_cast<uint64_t>(distribution(random)), job.file_size_min, job.file_size_max);
+    }
+
+    std::string directory_of(const Job &job, const uint64_t index) {
+        return job.dirs == 0 ? std::string() : "/load_d" + std::to_string(index % job.dirs);
+    }
+
+    bool is_read_workload(const Workload workload) {
+        return workload == Workload::READ || workload == Workload::RANDREAD;
+    }
+
+    // пишет size байт в открытый файл блоками bs
+    bool fill_file(FileSystemCore &fs, const uint32_t handle, const uint64_t size, const uint64_t block_size,
+                   const std::vector<char> &data, std::mt19937_64 &random) {
+        for (uint64_t written = 0; written < size;) {
+            const uint64_t chunk = std::min({size - written, block_size, static_cast<uint64_t>(data.size())});
+            const uint64_t source = random() % (data.size() - chunk + 1);
+            if (fs.write_file(handle, data.data() + source, chunk) != static_cast<int64_t>(chunk)) return false;
+            written += chunk;
+        }
+        return true;
+    }
+
+    class LoadThread {
+    public:
+        LoadThread(FileSystemCore &fs, const Job &job, const unsigned index, const std::vector<char> &data)
+            : fs_(fs), job_(job), index_(index), data_(data), random_(job.seed * 1000003 + index),
+              buffer_(job.block_size) {
+            // блок крупнее пула данных записывается из своего буфера, заполненного повторами пула
+            for (size_t offset = 0; job.block_size > data.size() && offset < buffer_.size(); offset += data.size()) {
+                std::copy_n(data.begin(), std::min(data.size(), buffer_.size() - offset), buffer_.begin() + offset);
+            }
+        }
+
+        // создаёт файлы потока; время подготовки в замер не входит
+        bool prepare() {
+            const bool filled = job_.workload != Workload::WRITE && job_.workload != Workload::CREATE;
+            const bool keep_open = job_.workload != Workload::CREATE && job_.workload != Workload::CHURN &&
+                                   job_.workload != Workload::LIST;
+            for (uint64_t i = 0; i < job_.files; ++i) {
+                LoadFile file{next_path(), pick_file_size(job_, random_), std::nullopt};
+                const auto handle = fs_.open_file(file.path, "w+");
+                if (!handle) return false;
+                const bool ok = !filled || fill_file(fs_, *handle, file.size, DATA_POOL_BYTES, data_, random_);
+                if (!ok || !fs_.close_file(*handle)) return false;
+                if (keep_open) {
+                    // задания чтения держат файлы открытыми только на чтение
+                    file.handle = fs_.open_file(file.path, is_read_workload(job_.workload) ? "r" : "r+");
+                    if (!file.handle) return false;
+                }
+                files_.push_back(std::move(file));
+            }
+            return true;
+        }
+
+        void run(const std::chrono::steady_clock::time_point deadline) {
+            const bool timed = job_.runtime > 0;
+            for (uint64_t op = 0; job_.ops == 0 || op < job_.ops; ++op) {
+                if (timed && (op & 15) == 0 && std::chrono::steady_clock::now() >= deadline) break;
+                if (!step()) break;
+            }
+        }
+
+        void cleanup() {
+            for (LoadFile &file: files_) {
+                if (file.handle) fs_.close_file(*file.handle);
+                fs_.remove_file(file.path);
+            }
+            files_.clear();
+        }
+
+        [[nodiscard]] ThreadResult &result() { return result_; }
+
+    private:
+        FileSystemCore &fs_;
+        const Job &job_;
+        unsigned index_;
+        const std::vector<char> &data_;
+        std::mt19937_64 random_;
+        std::vector<char> buffer_;
+        std::vector<LoadFile> files_;
+        uint64_t created_ = 0; // имён выдано
+        size_t sequential_file_ = 0; // файл и позиция последовательной нагрузки
+        uint64_t sequential_offset_ = 0;
+        ThreadResult result_;
+
+        std::string next_path() {
+            const uint64_t number = created_++;
+            return directory_of(job_, number + index_) + "/" + job_.name + "_" + std::to_string(index_) + "_" +
+                   std::to_string(number);
+        }
+
+        template<typename Call>
+        int64_t timed(const OpClass op_class, Call &&call) {
+            const auto started = std::chrono::steady_clock::now();
+            const int64_t done = call();
+            const auto latency = std::chrono::steady_clock::now() - started;
+            result_.latencies[op_class].push_back(
+                static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(latency).count()));
+            if (done < 0) {
+                ++result_.errors[op_class];
+            } else {
+                result_.bytes[op_class] += static_cast<uint64_t>(done);
+            }
+            return done;
+        }
+
+        // блок для операции ввода-вывода: следующий по порядку или случайный; nullopt - файлы пусты
+        std::optional<std::pair<LoadFile *, uint64_t>> next_block(const bool random_access) {
+            if (files_.empty()) return std::nullopt;
+            if (random_access) {
+                LoadFile &file = files_[random_() % files_.size()];
+                const uint64_t blocks = file.size / job_.block_size;
+                if (blocks == 0) return std::nullopt;
+                return std::make_pair(&file, random_() % blocks * job_.block_size);
+            }
+            for (size_t attempts = 0; attempts <= files_.size(); ++attempts) {
+                LoadFile &file = files_[sequential_file_];
+                if (sequential_offset_ + job_.block_size <= file.size) {
+                    const uint64_t offset = sequential_offset_;
+                    sequential_offset_ += job_.block_size;
+                    return std::make_pair(&file, offset);
+                }
+                sequential_file_ = (sequential_file_ + 1) % files_.size();
+                sequential_offset_ = 0;
+            }
+            return std::nullopt;
+        }
+
+        bool transfer(const bool read, const bool random_access) {
+            const auto block = next_block(random_access);
+            if (!block) {
+                ++result_.errors[read ? OP_READ : OP_WRITE];
+                return false;
+            }
+            const auto &[file, offset] = *block;
+            const uint64_t size = job_.block_size;
+            if (read) {
+                return timed(OP_READ, [&] { return fs_.pread_file(*file->handle, buffer_.data(), size, offset); }) >= 0;
+            }
+            const char *source = size > data_.size()
+                                     ? buffer_.data()
+                                     : data_.data() + random_() % (data_.size() - size + 1);
+            return timed(OP_WRITE, [&] { return fs_.pwrite_file(*file->handle, source, size, offset); }) >= 0;
+        }
+
+        bool create_file() {
+            LoadFile file{next_path(), pick_file_size(job_, random_), std::nullopt};
+            const int64_t done = timed(OP_CREATE, [&]() -> int64_t {
+                const auto handle = fs_.open_file(file.path, "w");
+                if (!handle) return -1;
+                const bool ok = fill_file(fs_, *handle, file.size, job_.block_size, data_, random_);
+                return fs_.close_file(*handle) && ok ? static_cast<int64_t>(file.size) : -1;
+            });
+            files_.push_back(std::move(file));
+            return done >= 0;
+        }
+
+        bool delete_file() {
+            if (files_.empty()) return true;
+            const size_t victim = random_() % files_.size();
+            const std::string path = files_[victim].path;
+            files_[victim] = std::move(files_.back());
+            files_.pop_back();
+            return timed(OP_DELETE, [&]() -> int64_t { return fs_.remove_file(path) ? 0 : -1; }) >= 0;
+        }
+
+        bool list_directory() {
+            const std::string path = job_.dirs == 0 ? "/" : directory_of(job_, random_());
+            return timed(OP_LIST, [&]() -> int64_t {
+                const auto cursor = fs_.open_directory(path);
+                if (!cursor) return -1;
+                while (fs_.read_directory(*cursor)) {
+                }
+                return fs_.close_directory(*cursor) ? 0 : -1;
+            }) >= 0;
+        }
+
+        bool step() {
+            switch (job_.workload) {
+                case Workload::READ: return transfer(true, false);
+                case Workload::WRITE: return transfer(false, false);
+                case Workload::RW: return transfer(random_() % 100 < job_.read_percent, false);
+                case Workload::RANDREAD: return transfer(true, true);
+                case Workload::RANDWRITE: return transfer(false, true);
+                case Workload::RANDRW: return transfer(random_() % 100 < job_.read_percent, true);
+                case Workload::CREATE: return create_file();
+                case Workload::CHURN: return delete_file() && create_file();
+                case Workload::LIST: return list_directory();
+            }
+            return false;
+        }
+    };
+
+    double percentile_us(const std::vector<uint64_t> &sorted, const unsigned per_mille) {
+        if (sorted.empty()) return 0;
+        return static_cast<double>(sorted[std::min(sorted.size() - 1, sorted.size() * per_mille / 1000)]) / 1000.0;
+    }
+
+    void print_job(const Job &job, const double seconds, std::vector<std::unique_ptr<LoadThread>> &threads) {
+        std::printf("[%s] %u thread(s), %.2f s\n", job.name.c_str(), job.threads, seconds);
+        std::printf("  %-7s %10s %11s %9s %9s %9s %9s %8s\n", "op", "ops", "IOPS", "MB/s", "p50 us", "p99 us",
+                    "p999 us", "errors");
+        for (uint8_t op_class = 0; op_class < OP_CLASS_COUNT; ++op_class) {
+            std::vector<uint64_t> latencies;
+            uint64_t bytes = 0, errors = 0;
+            for (const auto &thread: threads) {
+                const ThreadResult &result = thread->result();
+                latencies.insert(latencies.end(), result.latencies[op_class].begin(), result.latencies[op_class].end());
+                bytes += result.bytes[op_class];
+                errors += result.errors[op_class];
+            }
+            if (latencies.empty() && errors == 0) continue;
+            std::sort(latencies.begin(), latencies.end());
+            const double elapsed = std::max(seconds, 1e-9);
+            std::printf("  %-7s %10zu %11.0f %9.1f %9.1f %9.1f %9.1f %8llu\n", OP_CLASS_NAMES[op_class],
+                        latencies.size(), static_cast<double>(latencies.size()) / elapsed,
+                        static_cast<double>(bytes) / (1024.0 * 1024.0) / elapsed, percentile_us(latencies, 500),
+                        percentile_us(latencies, 990), percentile_us(latencies, 999),
+                        static_cast<unsigned long long>(errors));
+        }
+    }
+
+    // подготовка, прогон и уборка одного задания; false - не удалось подготовить файлы
+    bool run_job(FileSystemCore &fs, const Job &job, const std::vector<char> &data) {
+        for (uint64_t dir = 0; dir < job.dirs; ++dir) fs.create_directory(directory_of(job, dir));
+        std::vector<std::unique_ptr<LoadThread>> threads;
+        for (unsigned i = 0; i < job.threads; ++i) {
+            threads.push_back(std::make_unique<LoadThread>(fs, job, i, data));
+            if (!threads.back()->prepare()) {
+                std::cerr << "Error: Job '" << job.name << "' failed to create its files" << std::endl;
+                for (const auto &thread: threads) thread->cleanup();
+                return false;
+            }
+        }
+
+        const auto started = std::chrono::steady_clock::now();
+        const auto deadline = started + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                  std::chrono::duration<double>(job.runtime));
+        std::vector<std::thread> workers;
+        for (const auto &thread: threads) workers.emplace_back([&thread, deadline] { thread->run(deadline); });
+        for (std::thread &worker: workers) worker.join();
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+
+        print_job(job, seconds, threads);
+        for (const auto &thread: threads) thread->cleanup();
+        for (uint64_t dir = 0; dir < job.dirs; ++dir) fs.remove_directory(directory_of(job, dir));
+        return true;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    std::string job_path;
+    std::optional<std::string> volume_override;
+    bool keep = false;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (arg == "--volume" && i + 1 < argc) {
+            volume_override = argv[++i];
+        } else if (arg == "--keep") {
+            keep = true;
+        } else if (job_path.empty() && arg.rfind("--", 0) != 0) {
+            job_path = arg;
+        } else {
+            printLoadUsage();
+            return 2;
+        }
+    }
+    if (job_path.empty()) {
+        printLoadUsage();
+        return 2;
+    }
+
+    Global global;
+    const std::optional<std::vector<Job>> jobs = parse_job_file(job_path, global);
+    if (!jobs) return 2;
+    if (volume_override) global.volume_path = *volume_override;
+    global.keep = global.keep || keep;
+
+    FileSystemCore fs;
+    fs.set_direct_io(global.direct_io);
+    fs.set_checksum_verification(global.verify);
+    if (global.cache_bytes) fs.set_metadata_cache_budget(global.cache_bytes);
+    if (!fs.format(global.volume_path, global.volume_mb) || !fs.mount(global.volume_path)) {
+        std::cerr << "Error: Cannot prepare volume '" << global.volume_path << "'" << std::endl;
+        return 1;
+    }
+    if (global.dedup) fs.set_dedup(true);
+
+    std::vector<char> data(DATA_POOL_BYTES);
+    std::mt19937_64 random(42);
+    for (char &byte: data) byte = static_cast<char>(random());
+
+    std::cout << "Volume " << global.volume_path << ", " << global.volume_mb << " MB" <<
+            (global.direct_io ? ", O_DIRECT" : "") << (global.dedup ? ", dedup" : "") << "\n";
+    int exit_code = 0;
+    for (const Job &job: *jobs) {
+        if (!run_job(fs, job, data)) exit_code = 1;
+    }
+    fs.unmount();
+    if (!global.keep) std::remove(global.volume_path.c_str());
+    return exit_code;
+}
@@ -0,0 +1,304 @@
+#include "fs_core.h"
+#include "fs_trace.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace {
+    constexpr uint64_t PREPARE_CHUNK_BYTES = 1024 * 1024; // запись содержимого недостающих файлов
+
+    struct Options {
+        std::string trace_path;
+        std::string volume_path;
+        uint64_t volume_mb = 256; // размер нового тома
+        bool timed = false; // выдерживать интервалы между вызовами, как при записи
+        bool direct_io = false;
+    };
+
+    // задержки одной операции при записи трассы и при воспроизведении, наносекунды
+    struct OpLatencies {
+        std::vector<uint64_t> recorded;
+        std::vector<uint64_t> replayed;
+    };
+
+    struct Totals {
+        uint64_t ops = 0;
+        uint64_t bytes_read = 0;
+        uint64_t bytes_written = 0;
+        uint64_t diverged = 0; // результат отличается от записанного
+        uint64_t skipped = 0; // дескриптор не открыт при воспроизведении
+        uint64_t prepared_files = 0; // файлы, существовавшие до записи трассы и созданные заново
+    };
+
+    void printReplayUsage() {
+        std::cout << "Usage: fs_replay <trace_file> <volume_file> [--size MB] [--timed] [--direct-io]\n";
+        std::cout << "  Formats a fresh volume and replays a trace recorded by FileSystemCore::start_trace\n";
+        std::cout << "  (shell 'trace start', fs_daemon --trace), then prints per-operation latencies.\n";
+        std::cout << "  --size MB      - size of the fresh volume (default: 256).\n";
+        std::cout << "  --timed        - keep the recorded intervals between calls (default: as fast as possible).\n";
+        std::cout << "  --direct-io    - O_DIRECT volume I/O bypassing the host page cache.\n";
+    }
+
+    bool is_read(const FsTrace::Op op) {
+        return op == FsTrace::Op::READ || op == FsTrace::Op::PREAD || op == FsTrace::Op::READV ||
+               op == FsTrace::Op::PREADV;
+    }
+
+    bool is_write(const FsTrace::Op op) {
+        return op == FsTrace::Op::WRITE || op == FsTrace::Op::PWRITE || op == FsTrace::Op::WRITEV ||
+               op == FsTrace::Op::PWRITEV;
+    }
+
+    // файл, открытый в трассе без создания, должен существовать и быть не короче, чем при записи:
+    // недостающие данные дописываются до начала замера
+    bool prepare_file(FileSystemCore &fs, const std::string &path, const uint64_t size, const std::vector<char> &data,
+                      bool &created) {
+        std::optional<uint32_t> handle = fs.open_file(path, "r+");
+        created = !handle;
+        if (!handle) handle = fs.open_file(path, "w");
+        if (!handle) return false;
+        bool ok = fs.seek(*handle, 0, FS_SEEK_END);
+        uint64_t position = ok ? fs.tell(*handle).value_or(size) : size;
+        while (ok && position < size) {
+            const uint64_t chunk = std::min<uint64_t>(size - position, data.size());
+            ok = fs.pwrite_file(*handle, data.data(), chunk, position) == static_cast<int64_t>(chunk);
+            position += chunk;
+        }
+        return fs.close_file(*handle) && ok;
+    }
+
+    // сегменты векторного вызова: size байт буфера, поровну на segments частей
+    std::vector<FsIoVec> split_segments(std::vector<char> &buffer, const uint64_t size, const uint32_t segments) {
+        const uint64_t count = std::max<uint64_t>(1, std::min<uint64_t>(segments, std::max<uint64_t>(size, 1)));
+        std::vector<FsIoVec> iov;
+        iov.reserve(count);
+        uint64_t offset = 0;
+        for (uint64_t i = 0; i < count; ++i) {
+            const uint64_t length = size / count + (i < size % count ? 1 : 0);
+            iov.push_back({buffer.data() + offset, length});
+            offset += length;
+        }
+        return iov;
+    }
+
+    double percentile_us(const std::vector<uint64_t> &sorted, const unsigned per_mille) {
+        if (sorted.empty()) return 0;
+        return static_cast<double>(sorted[std::min(sorted.size() - 1, sorted.size() * per_mille / 1000)]) / 1000.0;
+    }
+
+    void print_latencies(std::array<OpLatencies, FsTrace::OP_COUNT> &latencies) {
+        std::printf("%-8s %9s %10s %10s %10s %10s   %s\n", "op", "count", "p50 us", "p99 us", "p999 us", "max us",
+                    "recorded p50 / p99 us");
+        for (uint8_t op = 1; op < FsTrace::OP_COUNT; ++op) {
+            OpLatencies &samples = latencies[op];
+            if (samples.replayed.empty()) continue;
+            std::sort(samples.replayed.begin(), samples.replayed.end());
+            std::sort(samples.recorded.begin(), samples.recorded.end());
+            std::printf("%-8s %9zu %10.1f %10.1f %10.1f %10.1f   %.1f / %.1f\n",
+                        FsTrace::op_name(static_cast<FsTrace::Op>(op)), samples.replayed.size(),
+                        percentile_us(samples.replayed, 500), percentile_us(samples.replayed, 990),
+                        percentile_us(samples.replayed, 999), static_cast<double>(samples.replayed.back()) / 1000.0,
+                        percentile_us(samples.recorded, 500), percentile_us(samples.recorded, 990));
+        }
+    }
+}
+
+int main(int argc, char *argv[]) {
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        try {
+            if (arg == "--size" && i + 1 < argc) {
+                options.volume_mb = std::stoull(argv[++i]);
+            } else if (arg == "--timed") {
+                options.timed = true;
+            } else if (arg == "--direct-io") {
+                options.direct_io = true;
+            } else if (options.trace_path.empty() && arg.rfind("--", 0) != 0) {
+                options.trace_path = arg;
+            } else if (options.volume_path.empty() && arg.rfind("--", 0) != 0) {
+                options.volume_path = arg;
+            } else {
+                printReplayUsage();
+                return 2;
+            }
+        } catch (const std::exception &e) {
+            std::cerr << "Error: Invalid value for " << arg << ". " << e.what() << std::endl;
+            return 2;
+        }
+    }
+    if (options.trace_path.empty() || options.volume_path.empty() || options.volume_mb == 0) {
+        printReplayUsage();
+        return 2;
+    }
+
+    FsTrace::TraceReader reader;
+    if (!reader.open(options.trace_path)) return 1;
+
+    FileSystemCore fs;
+    fs.set_direct_io(options.direct_io);
+    if (!fs.format(options.volume_path, options.volume_mb) || !fs.mount(options.volume_path)) {
+        std::cerr << "Error: Cannot prepare volume '" << options.volume_path << "'" << std::endl;
+        return 1;
+    }
+
+    std::vector<char> buffer(PREPARE_CHUNK_BYTES, 'r');
+    std::unordered_map<uint32_t, uint32_t> handles; // дескриптор из трассы -> дескриптор воспроизведения
+    std::unordered_map<uint32_t, uint32_t> cursors; // то же для курсоров каталогов
+    std::unordered_set<std::string> seen_paths; // файлы, уже открывавшиеся при воспроизведении
+    std::array<OpLatencies, FsTrace::OP_COUNT> latencies;
+    Totals totals;
+
+    const auto started = std::chrono::steady_clock::now();
+    auto prepare_time = std::chrono::steady_clock::duration::zero(); // подготовка файлов не входит в замер
+    while (const std::optional<FsTrace::Entry> entry = reader.next()) {
+        const FsTrace::Record &record = entry->record;
+        if (options.timed) {
+            std::this_thread::sleep_until(started + prepare_time + std::chrono::nanoseconds(record.start_ns));
+        }
+
+        uint32_t handle = 0;
+        const bool uses_cursor = record.op == FsTrace::Op::READDIR || record.op == FsTrace::Op::CLOSEDIR;
+        const bool uses_handle = uses_cursor || record.op == FsTrace::Op::CLOSE || record.op == FsTrace::Op::SEEK ||
+                                 is_read(record.op) || is_write(record.op);
+        if (uses_handle) {
+            std::unordered_map<uint32_t, uint32_t> &map = uses_cursor ? cursors : handles;
+            const auto mapped = map.find(record.handle);
+            if (mapped == map.end()) {
+                ++totals.skipped;
+                continue;
+            }
+            handle = mapped->second;
+        }
+        if (record.op == FsTrace::Op::OPEN && record.result >= 0 && record.size > 0 &&
+            entry->second.find('w') == std::string::npos && seen_paths.insert(entry->path).second) {
+            const auto prepare_started = std::chrono::steady_clock::now();
+            bool created = false;
+            if (prepare_file(fs, entry->path, record.size, buffer, created) && created) ++totals.prepared_files;
+            prepare_time += std::chrono::steady_clock::now() - prepare_started;
+        }
+        if (buffer.size() < record.size) buffer.resize(record.size, 'r');
+
+        int64_t result = -1;
+        const auto call_started = std::chrono::steady_clock::now();
+        switch (record.op) {
+            case FsTrace::Op::OPEN: {
+                const std::optional<uint32_t> opened = fs.open_file(entry->path, entry->second);
+                if (opened) result = *opened;
+                break;
+            }
+            case FsTrace::Op::CLOSE:
+                result = fs.close_file(handle) ? 1 : 0;
+                break;
+            case FsTrace::Op::READ:
+                result = fs.read_file(handle, buffer.data(), record.size);
+                break;
+            case FsTrace::Op::WRITE:
+                result = fs.write_file(handle, buffer.data(), record.size);
+                break;
+            case FsTrace::Op::PREAD:
+                result = fs.pread_file(handle, buffer.data(), record.size, record.offset);
+                break;
+            case FsTrace::Op::PWRITE:
+                result = fs.pwrite_file(handle, buffer.data(), record.size, record.offset);
+                break;
+            case FsTrace::Op::PREADV:
+            case FsTrace::Op::PWRITEV:
+            case FsTrace::Op::READV:
+            case FsTrace::Op::WRITEV: {
+                const std::vector<FsIoVec> iov = split_segments(buffer, record.size, record.segments);
+                if (record.op == FsTrace::Op::PREADV) {
+                    result = fs.preadv_file(handle, iov.data(), iov.size(), record.offset);
+                } else if (record.op == FsTrace::Op::PWRITEV) {
+                    result = fs.pwritev_file(handle, iov.data(), iov.size(), record.offset);
+                } else if (record.op == FsTrace::Op::READV) {
+                    result = fs.readv_file(handle, iov.data(), iov.size());
+                } else {
+                    result = fs.writev_file(handle, iov.data(), iov.size());
+                }
+                break;
+            }
+            case FsTrace::Op::SEEK:
+                result = fs.seek(handle, record.offset, record.whence) ? 1 : 0;
+                break;
+            case FsTrace::Op::REMOVE:
+                result = fs.remove_file(entry->path) ? 1 : 0;
+                break;
+            case FsTrace::Op::RENAME:
+                result = fs.rename_file(entry->path, entry->second) ? 1 : 0;
+                break;
+            case FsTrace::Op::MKDIR:
+                result = fs.create_directory(entry->path) ? 1 : 0;
+                break;
+            case FsTrace::Op::RMDIR:
+                result = fs.remove_directory(entry->path) ? 1 : 0;
+                break;
+            case FsTrace::Op::LIST:
+                result = static_cast<int64_t>(fs.list_directory(entry->path).size());
+                break;
+            case FsTrace::Op::CLONE:
+                result = fs.clone_file(entry->path, entry->second) ? 1 : 0;
+                break;
+            case FsTrace::Op::COPY:
+                result = fs.copy_file(entry->path, entry->second) ? 1 : 0;
+                break;
+            case FsTrace::Op::OPENDIR: {
+                const std::optional<uint32_t> opened = fs.open_directory(entry->path, record.offset, entry->second);
+                if (opened) result = *opened;
+                break;
+            }
+            case FsTrace::Op::READDIR:
+                result = fs.read_directory(handle) ? 1 : 0;
+                break;
+            case FsTrace::Op::CLOSEDIR:
+                result = fs.close_directory(handle) ? 1 : 0;
+                break;
+        }
+        const auto latency = std::chrono::steady_clock::now() - call_started;
+
+        OpLatencies &samples = latencies[static_cast<uint8_t>(record.op)];
+        samples.replayed.push_back(
+            static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(latency).count()));
+        samples.recorded.push_back(record.latency_ns);
+        ++totals.ops;
+        if (is_read(record.op) && result > 0) totals.bytes_read += static_cast<uint64_t>(result);
+        if (is_write(record.op) && result > 0) totals.bytes_written += static_cast<uint64_t>(result);
+
+        if (record.op == FsTrace::Op::OPEN || record.op == FsTrace::Op::OPENDIR) {
+            if (record.op == FsTrace::Op::OPEN) seen_paths.insert(entry->path);
+            if (result >= 0 && record.result >= 0) {
+                (record.op == FsTrace::Op::OPEN ? handles : cursors)[static_cast<uint32_t>(record.result)] =
+                        static_cast<uint32_t>(result);
+            }
+            if ((result >= 0) != (record.result >= 0)) ++totals.diverged;
+        } else {
+            if (record.op == FsTrace::Op::CLOSE && result == 1) handles.erase(record.handle);
+            if (record.op == FsTrace::Op::CLOSEDIR && result == 1) cursors.erase(record.handle);
+            if (result != record.result) ++totals.diverged;
+        }
+    }
+    const double seconds =
+            std::chrono::duration<double>(std::chrono::steady_clock::now() - started - prepare_time).count();
+
+    for (const auto &[recorded, replayed]: handles) fs.close_file(replayed);
+    for (const auto &[recorded, replayed]: cursors) fs.close_directory(replayed);
+    fs.unmount();
+
+    if (reader.truncated()) std::cout << "Warning: the trace ends with an incomplete record\n";
+    std::cout << "Replayed " << totals.ops << " calls in " << seconds << " s (" <<
+            static_cast<double>(totals.ops) / std::max(seconds, 1e-9) << " ops/s" <<
+            (options.timed ? ", recorded timing" : "") << ")\n";
+    std::cout << "Read " << totals.bytes_read / 1024 << " KB, written " << totals.bytes_written / 1024 << " KB\n";
+    std::cout << "Results differing from the trace: " << totals.diverged << ", calls on handles not open: " <<
+            totals.skipped << ", files recreated before their first open: " << totals.prepared_files << "\n\n";
+    print_latencies(latencies);
+    return 0;
+}
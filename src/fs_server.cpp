@@ -0,0 +1,434 @@
+#include "../include/fs_server.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "../include/output.h"
+
+namespace {
+    constexpr size_t RECEIVE_CHUNK_BYTES = 256 * 1024; // одно чтение из сокета клиента
+    // пока неотправленных ответов больше, новые запросы клиента не выполняются и не читаются
+    constexpr size_t MAX_PENDING_OUTPUT = 8 * 1024 * 1024;
+    constexpr int POLL_TIMEOUT_MS = 200; // как часто run() проверяет stop()
+
+    bool set_nonblocking(const int fd) {
+        const int flags = ::fcntl(fd, F_GETFL, 0);
+        return flags >= 0 && ::fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+    }
+
+    bool is_file_opcode(const FsProtocol::Opcode opcode) {
+        using FsProtocol::Opcode;
+        return opcode == Opcode::CLOSE || opcode == Opcode::READ || opcode == Opcode::WRITE ||
+               opcode == Opcode::PREAD || opcode == Opcode::PWRITE || opcode == Opcode::SEEK;
+    }
+}
+
+FsServer::FsServer(FileSystemCore &fs_core) : fs_core_(fs_core) {
+}
+
+FsServer::~FsServer() {
+    for (const auto &client: clients_) disconnect(*client);
+    clients_.clear();
+    if (listen_fd_ >= 0) {
+        ::close(listen_fd_);
+        ::unlink(socket_path_.c_str());
+    }
+}
+
+bool FsServer::listen(const std::string &socket_path) {
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (socket_path.empty() || socket_path.size() >= sizeof(address.sun_path)) {
+        output::err(output::prefix::FS_SERVER_ERROR) << "Socket path '" << socket_path << "' is invalid" << std::endl;
+        return false;
+    }
+    std::memcpy(address.sun_path, socket_path.c_str(), socket_path.size() + 1);
+
+    // сокет прошлого запуска мешает bind; другие файлы по этому пути не трогаем
+    struct stat existing{};
+    if (::lstat(socket_path.c_str(), &existing) == 0 && S_ISSOCK(existing.st_mode)) ::unlink(socket_path.c_str());
+
+    listen_fd_ = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listen_fd_ < 0 || ::bind(listen_fd_, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 ||
+        ::listen(listen_fd_, SOMAXCONN) != 0 || !set_nonblocking(listen_fd_)) {
+        output::err(output::prefix::FS_SERVER_ERROR) << "Failed to listen on '" << socket_path << "' (" <<
+                std::strerror(errno) << ")" << std::endl;
+        if (listen_fd_ >= 0) ::close(listen_fd_);
+        listen_fd_ = -1;
+        return false;
+    }
+    socket_path_ = socket_path;
+    output::succ(output::prefix::FS_SERVER) << "Listening on " << socket_path << std::endl;
+    return true;
+}
+
+bool FsServer::run() {
+    if (listen_fd_ < 0) {
+        output::err(output::prefix::FS_SERVER_ERROR) << "Server is not listening" << std::endl;
+        return false;
+    }
+    stop_requested_ = false;
+    std::vector<pollfd> fds;
+    while (!stop_requested_) {
+        fds.clear();
+        fds.push_back({listen_fd_, POLLIN, 0});
+        for (const auto &client: clients_) {
+            const bool output_pending = client->output_sent < client->output.size();
+            short events = output_pending ? POLLOUT : 0;
+            if (client->output.size() - client->output_sent < MAX_PENDING_OUTPUT) events |= POLLIN;
+            fds.push_back({client->fd, events, 0});
+        }
+
+        if (::poll(fds.data(), fds.size(), POLL_TIMEOUT_MS) < 0) {
+            if (errno == EINTR) continue;
+            output::err(output::prefix::FS_SERVER_ERROR) << "poll failed (" << std::strerror(errno) << ")" <<
+                    std::endl;
+            return false;
+        }
+
+        for (size_t i = 1; i < fds.size(); ++i) {
+            Client &client = *clients_[i - 1];
+            const short revents = fds[i].revents;
+            bool alive = true;
+            if (revents & (POLLIN | POLLHUP | POLLERR)) alive = receive(client);
+            if (alive && (revents & POLLOUT)) {
+                // освободившееся место под ответы позволяет выполнить отложенные запросы
+                alive = send_pending(client) && process_requests(client) && send_pending(client);
+            }
+            if (!alive) client.closed = true;
+        }
+        for (const auto &client: clients_) {
+            if (client->closed) disconnect(*client);
+        }
+        clients_.erase(std::remove_if(clients_.begin(), clients_.end(),
+                                      [](const std::unique_ptr<Client> &client) { return client->closed; }),
+                       clients_.end());
+
+        if (fds[0].revents & POLLIN) accept_clients();
+    }
+    return true;
+}
+
+void FsServer::accept_clients() {
+    while (true) {
+        const int fd = ::accept4(listen_fd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                output::warn(output::prefix::FS_SERVER_WARNING) << "accept failed (" << std::strerror(errno) << ")" <<
+                        std::endl;
+            }
+            return;
+        }
+        auto client = std::make_unique<Client>();
+        client->fd = fd;
+        clients_.push_back(std::move(client));
+        ++stats_.clients_accepted;
+    }
+}
+
+bool FsServer::receive(Client &client) {
+    receive_chunk_.resize(RECEIVE_CHUNK_BYTES);
+    ssize_t received;
+    do {
+        received = ::recv(client.fd, receive_chunk_.data(), receive_chunk_.size(), 0);
+    } while (received < 0 && errno == EINTR);
+    if (received == 0) return false;
+    if (received < 0) return errno == EAGAIN || errno == EWOULDBLOCK;
+    client.input.insert(client.input.end(), receive_chunk_.data(), receive_chunk_.data() + received);
+
+    const uint64_t requests_before = stats_.requests;
+    if (!process_requests(client)) return false;
+    if (stats_.requests != requests_before) ++stats_.batches;
+    return send_pending(client);
+}
+
+bool FsServer::process_requests(Client &client) {
+    size_t position = 0;
+    while (client.input.size() - position >= sizeof(FsProtocol::Request) &&
+           client.output.size() - client.output_sent < MAX_PENDING_OUTPUT) {
+        FsProtocol::Request request{};
+        std::memcpy(&request, client.input.data() + position, sizeof(request));
+        const uint64_t payload_bytes = FsProtocol::inline_request_payload(request);
+        if (request.name_length > FsProtocol::MAX_NAME_LENGTH || payload_bytes > FsProtocol::MAX_MESSAGE_PAYLOAD) {
+            output::warn(output::prefix::FS_SERVER_WARNING) << "Oversized request " << request.id <<
+                    ", dropping client" << std::endl;
+            return false;
+        }
+        const size_t message_bytes = sizeof(request) + request.name_length + payload_bytes;
+        if (client.input.size() - position < message_bytes) break;
+
+        if (!client.greeted && request.opcode != FsProtocol::Opcode::HELLO) {
+            output::warn(output::prefix::FS_SERVER_WARNING) << "Client did not start with HELLO, dropping it" <<
+                    std::endl;
+            return false;
+        }
+        const char *name_start = client.input.data() + position + sizeof(request);
+        const std::string name(name_start, request.name_length);
+        if (request.opcode == FsProtocol::Opcode::HELLO) {
+            if (!greet(client, request)) return false;
+        } else {
+            execute(client, request, name, name_start + request.name_length);
+        }
+        ++stats_.requests;
+        position += message_bytes;
+    }
+    client.input.erase(client.input.begin(), client.input.begin() + static_cast<std::ptrdiff_t>(position));
+    return true;
+}
+
+bool FsServer::send_pending(Client &client) {
+    while (client.output_sent < client.output.size()) {
+        const ssize_t sent = ::send(client.fd, client.output.data() + client.output_sent,
+                                    client.output.size() - client.output_sent, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        client.output_sent += static_cast<size_t>(sent);
+    }
+    client.output.clear();
+    client.output_sent = 0;
+    return true;
+}
+
+bool FsServer::greet(Client &client, const FsProtocol::Request &request) {
+    if (client.greeted || request.offset != FsProtocol::MAGIC || request.length != FsProtocol::VERSION) {
+        output::warn(output::prefix::FS_SERVER_WARNING) << "Client sent an unexpected HELLO, dropping it" <<
+                std::endl;
+        return false;
+    }
+    client.greeted = true;
+
+    // без общей памяти клиент передаёт все данные через сокет
+#ifdef MFD_CLOEXEC
+    client.shared_fd = ::memfd_create("fs_server_shared", MFD_CLOEXEC);
+#endif
+    if (client.shared_fd >= 0) {
+        void *mapping = MAP_FAILED;
+        if (::ftruncate(client.shared_fd, static_cast<off_t>(FsProtocol::SHARED_BUFFER_BYTES)) == 0) {
+            mapping = ::mmap(nullptr, FsProtocol::SHARED_BUFFER_BYTES, PROT_READ | PROT_WRITE, MAP_SHARED,
+                             client.shared_fd, 0);
+        }
+        if (mapping == MAP_FAILED) {
+            ::close(client.shared_fd);
+            client.shared_fd = -1;
+        } else {
+            client.shared = static_cast<char *>(mapping);
+            client.shared_bytes = FsProtocol::SHARED_BUFFER_BYTES;
+        }
+    }
+    if (client.shared_fd < 0) {
+        output::warn(output::prefix::FS_SERVER_WARNING) << "Shared memory is not available, client " << client.fd <<
+                " uses the socket only" << std::endl;
+    }
+
+    // HELLO - первый запрос, очередь ответов пуста: ответ с дескриптором уходит сразу
+    FsProtocol::Reply reply{};
+    reply.id = request.id;
+    reply.result = static_cast<int64_t>(client.shared_bytes);
+    iovec data{&reply, sizeof(reply)};
+    msghdr message{};
+    message.msg_iov = &data;
+    message.msg_iovlen = 1;
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))]{};
+    if (client.shared_fd >= 0) {
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+        cmsghdr *header = CMSG_FIRSTHDR(&message);
+        header->cmsg_level = SOL_SOCKET;
+        header->cmsg_type = SCM_RIGHTS;
+        header->cmsg_len = CMSG_LEN(sizeof(int));
+        std::memcpy(CMSG_DATA(header), &client.shared_fd, sizeof(int));
+    }
+    ssize_t sent;
+    do {
+        sent = ::sendmsg(client.fd, &message, MSG_NOSIGNAL);
+    } while (sent < 0 && errno == EINTR);
+    if (sent < 0) return false;
+    // остаток ответа (сокет почти пуст, но частичная отправка не исключена) уходит обычным путём
+    const auto *reply_bytes = reinterpret_cast<const char *>(&reply);
+    client.output.insert(client.output.end(), reply_bytes + sent, reply_bytes + sizeof(reply));
+    return true;
+}
+
+char *FsServer::shared_range(const Client &client, const FsProtocol::Request &request) const {
+    if (!client.shared || request.shared_offset > client.shared_bytes ||
+        request.length > client.shared_bytes - request.shared_offset) {
+        return nullptr;
+    }
+    return client.shared + request.shared_offset;
+}
+
+void FsServer::append_reply(Client &client, const FsProtocol::Request &request, const int64_t result,
+                            const uint8_t flags, const uint32_t payload_length) {
+    FsProtocol::Reply reply{};
+    reply.id = request.id;
+    reply.status = result < 0 ? -1 : 0;
+    reply.result = result;
+    reply.payload_length = payload_length;
+    reply.flags = flags;
+    const auto *bytes = reinterpret_cast<const char *>(&reply);
+    client.output.insert(client.output.end(), bytes, bytes + sizeof(reply));
+}
+
+void FsServer::append_error(Client &client, const FsProtocol::Request &request) {
+    append_reply(client, request, -1);
+}
+
+void FsServer::execute(Client &client, const FsProtocol::Request &request, const std::string &name,
+                       const char *payload) {
+    using FsProtocol::Opcode;
+    // дескрипторы других клиентов недоступны
+    if (is_file_opcode(request.opcode) && !client.handles.count(request.handle)) {
+        append_error(client, request);
+        return;
+    }
+
+    const bool shared = request.flags & FsProtocol::FLAG_SHARED;
+    switch (request.opcode) {
+        case Opcode::OPEN: {
+            const size_t separator = name.find('\0');
+            const std::string path = name.substr(0, separator);
+            const std::string mode = separator == std::string::npos ? "r" : name.substr(separator + 1);
+            const std::optional<uint32_t> handle = fs_core_.open_file(path, mode);
+            if (handle) client.handles.insert(*handle);
+            append_reply(client, request, handle ? static_cast<int64_t>(*handle) : -1);
+            return;
+        }
+        case Opcode::CLOSE: {
+            client.handles.erase(request.handle);
+            append_reply(client, request, fs_core_.close_file(request.handle) ? 0 : -1);
+            return;
+        }
+        case Opcode::READ:
+        case Opcode::PREAD: {
+            const bool positional = request.opcode == Opcode::PREAD;
+            if (shared) {
+                char *target = shared_range(client, request);
+                if (!target) {
+                    append_error(client, request);
+                    return;
+                }
+                const int64_t read = positional
+                                         ? fs_core_.pread_file(request.handle, target, request.length, request.offset)
+                                         : fs_core_.read_file(request.handle, target, request.length);
+                if (read > 0) stats_.shared_bytes += static_cast<uint64_t>(read);
+                append_reply(client, request, read, FsProtocol::FLAG_SHARED);
+                return;
+            }
+            if (request.length > FsProtocol::MAX_MESSAGE_PAYLOAD) {
+                append_error(client, request);
+                return;
+            }
+            // данные читаются сразу в очередь ответов, за заголовком
+            const size_t reply_at = client.output.size();
+            client.output.resize(reply_at + sizeof(FsProtocol::Reply) + request.length);
+            char *target = client.output.data() + reply_at + sizeof(FsProtocol::Reply);
+            const int64_t read = positional
+                                     ? fs_core_.pread_file(request.handle, target, request.length, request.offset)
+                                     : fs_core_.read_file(request.handle, target, request.length);
+            const auto payload_length = static_cast<uint32_t>(std::max<int64_t>(read, 0));
+            stats_.inline_bytes += payload_length;
+            FsProtocol::Reply reply{};
+            reply.id = request.id;
+            reply.status = read < 0 ? -1 : 0;
+            reply.result = read;
+            reply.payload_length = payload_length;
+            std::memcpy(client.output.data() + reply_at, &reply, sizeof(reply));
+            client.output.resize(reply_at + sizeof(FsProtocol::Reply) + payload_length);
+            return;
+        }
+        case Opcode::WRITE:
+        case Opcode::PWRITE: {
+            const char *source = shared ? shared_range(client, request) : payload;
+            if (!source) {
+                append_error(client, request);
+                return;
+            }
+            const int64_t written = request.opcode == Opcode::PWRITE
+                                        ? fs_core_.pwrite_file(request.handle, source, request.length, request.offset)
+                                        : fs_core_.write_file(request.handle, source, request.length);
+            if (written > 0) (shared ? stats_.shared_bytes : stats_.inline_bytes) += static_cast<uint64_t>(written);
+            append_reply(client, request, written);
+            return;
+        }
+        case Opcode::SEEK: {
+            const bool moved = request.length <= FS_SEEK_HOLE &&
+                               fs_core_.seek(request.handle, request.offset, static_cast<int>(request.length));
+            const std::optional<uint64_t> position = moved ? fs_core_.tell(request.handle) : std::nullopt;
+            append_reply(client, request, position ? static_cast<int64_t>(*position) : -1);
+            return;
+        }
+        case Opcode::LIST:
+            list_directory(client, request, name);
+            return;
+        case Opcode::REMOVE:
+            append_reply(client, request, fs_core_.remove_file(name) ? 0 : -1);
+            return;
+        default:
+            append_error(client, request);
+    }
+}
+
+void FsServer::list_directory(Client &client, const FsProtocol::Request &request, const std::string &path) {
+    const std::optional<uint32_t> dir = fs_core_.open_directory(path.empty() ? "/" : path, request.offset);
+    if (!dir) {
+        append_error(client, request);
+        return;
+    }
+    // страница собирается прямо в очереди ответов, заголовок заполняется в конце
+    const size_t reply_at = client.output.size();
+    client.output.resize(reply_at + sizeof(FsProtocol::Reply));
+    constexpr size_t max_entry_bytes = sizeof(FsProtocol::ListEntry) + FileSystem::MAX_FILE_NAME;
+    uint8_t flags = 0;
+    bool failed = false;
+    while (true) {
+        if (client.output.size() - reply_at - sizeof(FsProtocol::Reply) + max_entry_bytes >
+            FsProtocol::LIST_PAGE_BYTES) {
+            flags = FsProtocol::FLAG_MORE;
+            break;
+        }
+        const std::optional<DirectoryCursor::EntryView> entry = fs_core_.read_directory(*dir);
+        if (!entry) break;
+        FsProtocol::ListEntry record{};
+        record.type = static_cast<uint8_t>(entry->type);
+        record.name_length = static_cast<uint8_t>(std::min<size_t>(entry->name.size(), UINT8_MAX));
+        record.size_bytes = entry->file_size_bytes;
+        const auto *bytes = reinterpret_cast<const char *>(&record);
+        client.output.insert(client.output.end(), bytes, bytes + sizeof(record));
+        client.output.insert(client.output.end(), entry->name.begin(), entry->name.begin() + record.name_length);
+    }
+    const std::optional<DirectoryCursor::Position> position = fs_core_.tell_directory(*dir);
+    if (!position) failed = true;
+    fs_core_.close_directory(*dir);
+
+    const auto payload_length = static_cast<uint32_t>(client.output.size() - reply_at - sizeof(FsProtocol::Reply));
+    FsProtocol::Reply reply{};
+    reply.id = request.id;
+    reply.status = failed ? -1 : 0;
+    reply.result = failed ? -1 : static_cast<int64_t>(*position);
+    reply.payload_length = failed ? 0 : payload_length;
+    reply.flags = flags;
+    std::memcpy(client.output.data() + reply_at, &reply, sizeof(reply));
+    if (failed) client.output.resize(reply_at + sizeof(FsProtocol::Reply));
+}
+
+void FsServer::disconnect(Client &client) {
+    for (const uint32_t handle: client.handles) fs_core_.close_file(handle);
+    client.handles.clear();
+    if (client.shared) ::munmap(client.shared, client.shared_bytes);
+    client.shared = nullptr;
+    if (client.shared_fd >= 0) ::close(client.shared_fd);
+    client.shared_fd = -1;
+    if (client.fd >= 0) ::close(client.fd);
+    client.fd = -1;
+}
@@ -0,0 +1,140 @@
+#include "../include/fs_trace.h"
+#include "../include/output.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace FsTrace {
+    const char *op_name(const Op op) {
+        switch (op) {
+            case Op::OPEN: return "open";
+            case Op::CLOSE: return "close";
+            case Op::READ: return "read";
+            case Op::WRITE: return "write";
+            case Op::PREAD: return "pread";
+            case Op::PWRITE: return "pwrite";
+            case Op::PREADV: return "preadv";
+            case Op::PWRITEV: return "pwritev";
+            case Op::READV: return "readv";
+            case Op::WRITEV: return "writev";
+            case Op::SEEK: return "seek";
+            case Op::REMOVE: return "remove";
+            case Op::RENAME: return "rename";
+            case Op::MKDIR: return "mkdir";
+            case Op::RMDIR: return "rmdir";
+            case Op::LIST: return "list";
+            case Op::CLONE: return "clone";
+            case Op::COPY: return "copy";
+            case Op::OPENDIR: return "opendir";
+            case Op::READDIR: return "readdir";
+            case Op::CLOSEDIR: return "closedir";
+        }
+        return "unknown";
+    }
+
+    bool TraceWriter::open(const std::string &path) {
+        close();
+        std::lock_guard lock(mutex_);
+        file_.open(path, std::ios::binary | std::ios::out | std::ios::trunc);
+        if (!file_) {
+            output::err(output::prefix::FS_TRACE_ERROR) << "Cannot create trace file '" << path << "'" << std::endl;
+            return false;
+        }
+        const TraceHeader header{MAGIC, VERSION, sizeof(Record)};
+        file_.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        buffer_.clear();
+        buffer_.reserve(WRITE_BUFFER_BYTES);
+        records_ = 0;
+        failed_ = !file_;
+        started_ = std::chrono::steady_clock::now();
+        active_ = true;
+        return true;
+    }
+
+    bool TraceWriter::close() {
+        std::lock_guard lock(mutex_);
+        if (!file_.is_open()) return true;
+        active_ = false;
+        flush_buffer();
+        file_.close();
+        if (failed_ || file_.fail()) {
+            output::err(output::prefix::FS_TRACE_ERROR) << "Failed to write trace file" << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    uint64_t TraceWriter::now_ns() const {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - started_).count());
+    }
+
+    void TraceWriter::record(Record record, const std::string &path, const std::string &second) {
+        record.path_length = static_cast<uint16_t>(std::min<size_t>(path.size(), UINT16_MAX));
+        record.second_length = static_cast<uint16_t>(std::min<size_t>(second.size(), UINT16_MAX));
+        record.reserved = 0;
+
+        std::lock_guard lock(mutex_);
+        if (!active_) return;
+        const size_t start = buffer_.size();
+        buffer_.resize(start + sizeof(Record) + record.path_length + record.second_length);
+        char *target = buffer_.data() + start;
+        std::memcpy(target, &record, sizeof(Record));
+        std::memcpy(target + sizeof(Record), path.data(), record.path_length);
+        std::memcpy(target + sizeof(Record) + record.path_length, second.data(), record.second_length);
+        ++records_;
+        if (buffer_.size() >= WRITE_BUFFER_BYTES) flush_buffer();
+    }
+
+    uint64_t TraceWriter::records() const {
+        std::lock_guard lock(mutex_);
+        return records_;
+    }
+
+    void TraceWriter::flush_buffer() {
+        if (buffer_.empty()) return;
+        file_.write(buffer_.data(), static_cast<std::streamsize>(buffer_.size()));
+        if (!file_) failed_ = true;
+        buffer_.clear();
+    }
+
+    bool TraceReader::open(const std::string &path) {
+        file_.open(path, std::ios::binary | std::ios::in);
+        if (!file_) {
+            output::err(output::prefix::FS_TRACE_ERROR) << "Cannot open trace file '" << path << "'" << std::endl;
+            return false;
+        }
+        TraceHeader header{};
+        if (!file_.read(reinterpret_cast<char *>(&header), sizeof(header)) || header.magic != MAGIC ||
+            header.version != VERSION || header.record_bytes != sizeof(Record)) {
+            output::err(output::prefix::FS_TRACE_ERROR) << "'" << path << "' is not a version " << VERSION <<
+                    " trace file" << std::endl;
+            return false;
+        }
+        truncated_ = false;
+        return true;
+    }
+
+    std::optional<Entry> TraceReader::next() {
+        Entry entry{};
+        if (!file_.read(reinterpret_cast<char *>(&entry.record), sizeof(Record))) {
+            truncated_ = file_.gcount() != 0;
+            return std::nullopt;
+        }
+        entry.path.resize(entry.record.path_length);
+        entry.second.resize(entry.record.second_length);
+        if (!file_.read(entry.path.data(), entry.record.path_length) ||
+            !file_.read(entry.second.data(), entry.record.second_length)) {
+            truncated_ = true;
+            return std::nullopt;
+        }
+        const auto op = static_cast<uint8_t>(entry.record.op);
+        if (op == 0 || op >= OP_COUNT) {
+            output::err(output::prefix::FS_TRACE_ERROR) << "Unknown operation " << static_cast<int>(op) <<
+                    " in trace" << std::endl;
+            truncated_ = true;
+            return std::nullopt;
+        }
+        return entry;
+    }
+}
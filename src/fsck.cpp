@@ -0,0 +1,97 @@
+#include "consistency_checker.h"
+#include "volume_manager.h"
+
+#include <chrono>
+#include <iostream>
+#include <string>
+
+// Вспомогательная функция для вывода справки по параметрам
+void printFsckUsage() {
+    std::cout << "Usage: fsck <volume_file> [--repair] [--threads N]\n";
+    std::cout << "  --repair       - fixes found errors (truncates broken chains, rebuilds FAT and bitmap,\n";
+    std::cout << "                   reseals checksums of damaged clusters).\n";
+    std::cout << "  --threads N    - number of worker threads (default: number of cores).\n";
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        printFsckUsage();
+        return 2;
+    }
+
+    std::string volume_path;
+    ConsistencyChecker::Options options;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (arg == "--repair") {
+            options.repair = true;
+        } else if (arg == "--threads" && i + 1 < argc) {
+            try {
+                options.threads = static_cast<unsigned>(std::stoul(argv[++i]));
+            } catch (const std::exception &e) {
+                std::cerr << "Error: Invalid thread count: " << argv[i] << ". " << e.what() << std::endl;
+                return 2;
+            }
+        } else if (volume_path.empty()) {
+            volume_path = arg;
+        } else {
+            printFsckUsage();
+            return 2;
+        }
+    }
+
+    VolumeManager vol_manager;
+    if (!vol_manager.load_volume(volume_path)) {
+        std::cerr << "Error: Cannot load volume '" << volume_path << "'" << std::endl;
+        return 8;
+    }
+
+    const auto started = std::chrono::steady_clock::now();
+    ConsistencyChecker checker(vol_manager);
+    const auto report = checker.run(options);
+    const auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    vol_manager.close_volume();
+
+    if (!report) {
+        std::cerr << "Error: Check of '" << volume_path << "' failed" << std::endl;
+        return 8;
+    }
+
+    for (const auto &problem: report->problems) {
+        std::cout << "  " << problem << "\n";
+    }
+    std::cout << "--- fsck report for " << volume_path << " ---\n";
+    std::cout << "Directories:       " << report->directories_checked << "\n";
+    std::cout << "Files:             " << report->files_checked << " (" << report->inline_files << " inline)\n";
+    std::cout << "Leaked clusters:   " << report->leaked_clusters << "\n";
+    std::cout << "Orphaned clusters: " << report->orphaned_clusters << "\n";
+    std::cout << "Cross-linked:      " << report->cross_linked_clusters << "\n";
+    std::cout << "Unmarked clusters: " << report->unmarked_clusters << "\n";
+    std::cout << "Broken chains:     " << report->broken_chains << "\n";
+    std::cout << "Size mismatches:   " << report->size_mismatches << "\n";
+    std::cout << "Orphaned holes:    " << report->orphaned_holes << "\n";
+    std::cout << "Refcount mismatch: " << report->refcount_mismatches << "\n";
+    std::cout << "Counter mismatch:  " << report->counter_mismatches << "\n";
+    if (report->checksums_verified) {
+        std::cout << "Checksum errors:   " << report->checksum_errors << "\n";
+    } else {
+        std::cout << "Checksum errors:   not verified (volume has no checksum table)\n";
+    }
+    if (report->unclean_shutdown) {
+        std::cout << "Unclean shutdown:  free space counters " << (report->repaired ? "rebuilt" : "not verified") <<
+                "\n";
+    }
+    std::cout << "Elapsed (s):       " << elapsed << "\n";
+    std::cout << "-------------------------------\n";
+
+    if (report->is_clean()) {
+        std::cout << "Volume is clean.\n";
+        return 0;
+    }
+    if (report->repaired) {
+        std::cout << "Errors corrected (" << report->repaired_entries << " directory entries updated).\n";
+        return 1;
+    }
+    std::cout << "Errors found. Run with --repair to fix them.\n";
+    return 4;
+}
@@ -0,0 +1,54 @@
+#include "../include/handle_table.h"
+
+#include <utility>
+
+std::optional<uint32_t> HandleTable::insert(FileSystem::FileHandle &&handle) {
+    uint32_t slot_idx;
+    if (!free_slots_.empty()) {
+        slot_idx = free_slots_.front();
+        free_slots_.pop_front();
+    } else {
+        if (slots_.size() >= MAX_HANDLES) return std::nullopt;
+        slot_idx = static_cast<uint32_t>(slots_.size());
+        slots_.emplace_back();
+    }
+
+    Slot &slot = slots_[slot_idx];
+    slot.handle = std::move(handle);
+    slot.handle.handle_id = make_id(slot_idx, slot.generation);
+    slot.in_use = true;
+    ++size_;
+    return slot.handle.handle_id;
+}
+
+FileSystem::FileHandle *HandleTable::find(const uint32_t handle_id) {
+    const uint32_t slot_idx = handle_id & (MAX_HANDLES - 1);
+    if (slot_idx >= slots_.size()) return nullptr;
+    Slot &slot = slots_[slot_idx];
+    if (!slot.in_use || slot.generation != handle_id >> SLOT_BITS) return nullptr;
+    return &slot.handle;
+}
+
+const FileSystem::FileHandle *HandleTable::find(const uint32_t handle_id) const {
+    return const_cast<HandleTable *>(this)->find(handle_id);
+}
+
+bool HandleTable::erase(const uint32_t handle_id) {
+    if (!find(handle_id)) return false;
+    const uint32_t slot_idx = handle_id & (MAX_HANDLES - 1);
+    Slot &slot = slots_[slot_idx];
+    slot.handle = FileSystem::FileHandle(); // путь и индекс групп освобождаются сразу
+    slot.in_use = false;
+    // поколение 0 не используется: ID дескриптора никогда не равен 0
+    slot.generation = (slot.generation + 1) & GENERATION_MASK;
+    if (slot.generation == 0) slot.generation = 1;
+    free_slots_.push_back(slot_idx);
+    --size_;
+    return true;
+}
+
+void HandleTable::clear() {
+    for (uint32_t i = 0; i < slots_.size(); ++i) {
+        if (slots_[i].in_use) erase(make_id(i, slots_[i].generation));
+    }
+}
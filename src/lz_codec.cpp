@@ -0,0 +1,211 @@
+#include "../include/lz_codec.h"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+namespace {
+    constexpr unsigned HASH_LOG = 13; // 8192 позиций в таблице поиска совпадений
+    constexpr size_t MIN_MATCH = 4; // совпадение короче не кодируется
+    constexpr size_t LAST_LITERALS = 5; // последние байты блока всегда литералы
+    constexpr size_t MF_LIMIT = 12; // совпадение не начинается ближе к концу блока
+    constexpr size_t MAX_DISTANCE = 65535; // смещение хранится в двух байтах
+    constexpr unsigned SKIP_TRIGGER = 6; // после 2^6 неудачных проб шаг поиска растёт
+    constexpr size_t WILD_COPY = 16; // распаковка копирует блоками с запасом за концом
+
+    uint32_t read32(const uint8_t *p) {
+        uint32_t value;
+        std::memcpy(&value, p, sizeof(value));
+        return value;
+    }
+
+    uint64_t read64(const uint8_t *p) {
+        uint64_t value;
+        std::memcpy(&value, p, sizeof(value));
+        return value;
+    }
+
+    uint32_t hash4(const uint32_t sequence) {
+        return (sequence * 2654435761u) >> (32 - HASH_LOG);
+    }
+
+    // длина общего префикса a и b, a не заходит за limit
+    size_t common_length(const uint8_t *a, const uint8_t *b, const uint8_t *limit) {
+        const uint8_t *start = a;
+        while (a + sizeof(uint64_t) <= limit) {
+            const uint64_t diff = read64(a) ^ read64(b);
+            if (diff != 0) {
+#if defined(__GNUC__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+                return static_cast<size_t>(a - start) + static_cast<size_t>(__builtin_ctzll(diff)) / 8;
+#else
+                break;
+#endif
+            }
+            a += sizeof(uint64_t);
+            b += sizeof(uint64_t);
+        }
+        while (a < limit && *a == *b) {
+            ++a;
+            ++b;
+        }
+        return static_cast<size_t>(a - start);
+    }
+
+    // длина сверх значения в токене: байты 255 и остаток
+    uint8_t *write_length(uint8_t *op, size_t length) {
+        for (; length >= 255; length -= 255) *op++ = 255;
+        *op++ = static_cast<uint8_t>(length);
+        return op;
+    }
+
+    // байт под токен и расширение длины literals / match
+    constexpr size_t length_bytes(const size_t length) { return length >= 15 ? (length - 15) / 255 + 1 : 0; }
+
+    // последовательность: токен, литералы [anchor, anchor + literals), затем совпадение (match_length = 0 - без него)
+    uint8_t *write_sequence(uint8_t *op, const uint8_t *oend, const uint8_t *anchor, const size_t literals,
+                            const size_t offset, const size_t match_length) {
+        const size_t match_code = match_length == 0 ? 0 : match_length - MIN_MATCH;
+        const size_t needed = 1 + length_bytes(literals) + literals +
+                              (match_length == 0 ? 0 : 2 + length_bytes(match_code));
+        if (needed > static_cast<size_t>(oend - op)) return nullptr;
+
+        uint8_t *token = op++;
+        *token = static_cast<uint8_t>((literals >= 15 ? 15 : literals) << 4);
+        if (literals >= 15) op = write_length(op, literals - 15);
+        if (literals > 0) std::memcpy(op, anchor, literals);
+        op += literals;
+        if (match_length == 0) return op;
+
+        *op++ = static_cast<uint8_t>(offset & 0xFF);
+        *op++ = static_cast<uint8_t>(offset >> 8);
+        *token |= static_cast<uint8_t>(match_code >= 15 ? 15 : match_code);
+        if (match_code >= 15) op = write_length(op, match_code - 15);
+        return op;
+    }
+
+    // читает расширение длины; false - блок закончился раньше
+    bool read_length(const uint8_t *&ip, const uint8_t *iend, size_t &length) {
+        uint8_t byte;
+        do {
+            if (ip >= iend) return false;
+            byte = *ip++;
+            length += byte;
+        } while (byte == 255);
+        return true;
+    }
+}
+
+namespace lz_codec {
+    size_t compress(const void *src, const size_t size, void *dst, const size_t dst_capacity) {
+        const auto *base = static_cast<const uint8_t *>(src);
+        const uint8_t *ip = base;
+        const uint8_t *anchor = base;
+        const uint8_t *const iend = base + size;
+        auto *op = static_cast<uint8_t *>(dst);
+        const uint8_t *const oend = op + dst_capacity;
+        auto *const ostart = op;
+
+        if (size > MF_LIMIT) {
+            // позиции последних вхождений четырёхбайтовых последовательностей; таблица живёт между вызовами
+            thread_local std::vector<uint32_t> table(1u << HASH_LOG);
+            std::fill(table.begin(), table.end(), 0);
+
+            const uint8_t *const mflimit = iend - MF_LIMIT;
+            const uint8_t *const match_limit = iend - LAST_LITERALS;
+            table[hash4(read32(ip))] = 0;
+            ++ip;
+
+            while (ip <= mflimit) {
+                // поиск совпадения; на несжимаемых данных шаг постепенно увеличивается
+                const uint8_t *match = nullptr;
+                for (unsigned attempts = 1u << SKIP_TRIGGER; ip <= mflimit; ++attempts) {
+                    const uint32_t sequence = read32(ip);
+                    uint32_t &slot = table[hash4(sequence)];
+                    const uint8_t *candidate = base + slot;
+                    slot = static_cast<uint32_t>(ip - base);
+                    if (candidate < ip && static_cast<size_t>(ip - candidate) <= MAX_DISTANCE &&
+                        read32(candidate) == sequence) {
+                        match = candidate;
+                        break;
+                    }
+                    ip += attempts >> SKIP_TRIGGER;
+                }
+                if (!match) break;
+
+                // совпадение продлевается назад за счёт ещё не закодированных литералов
+                while (ip > anchor && match > base && ip[-1] == match[-1]) {
+                    --ip;
+                    --match;
+                }
+                const size_t match_length = MIN_MATCH + common_length(ip + MIN_MATCH, match + MIN_MATCH, match_limit);
+                op = write_sequence(op, oend, anchor, static_cast<size_t>(ip - anchor),
+                                    static_cast<size_t>(ip - match), match_length);
+                if (!op) return 0;
+
+                ip += match_length;
+                anchor = ip;
+                if (ip <= mflimit) table[hash4(read32(ip - 2))] = static_cast<uint32_t>(ip - 2 - base);
+            }
+        }
+
+        op = write_sequence(op, oend, anchor, static_cast<size_t>(iend - anchor), 0, 0);
+        return op ? static_cast<size_t>(op - ostart) : 0;
+    }
+
+    std::optional<size_t> decompress(const void *src, const size_t size, void *dst, const size_t dst_capacity) {
+        const auto *ip = static_cast<const uint8_t *>(src);
+        const uint8_t *const iend = ip + size;
+        auto *op = static_cast<uint8_t *>(dst);
+        const uint8_t *const ostart = op;
+        const uint8_t *const oend = op + dst_capacity;
+
+        while (ip < iend) {
+            const uint8_t token = *ip++;
+
+            size_t literals = token >> 4;
+            if (literals == 15 && !read_length(ip, iend, literals)) return std::nullopt;
+            if (literals > static_cast<size_t>(iend - ip) || literals > static_cast<size_t>(oend - op)) {
+                return std::nullopt;
+            }
+            // короткие литералы копируются одним блоком WILD_COPY байт, если хватает запаса по обе стороны
+            if (literals <= WILD_COPY && iend - ip >= static_cast<std::ptrdiff_t>(WILD_COPY) &&
+                oend - op >= static_cast<std::ptrdiff_t>(WILD_COPY)) {
+                std::memcpy(op, ip, WILD_COPY);
+            } else {
+                std::memcpy(op, ip, literals);
+            }
+            op += literals;
+            ip += literals;
+            if (ip == iend) break; // последняя последовательность состоит только из литералов
+
+            if (iend - ip < 2) return std::nullopt;
+            const size_t offset = static_cast<size_t>(ip[0]) | static_cast<size_t>(ip[1]) << 8;
+            ip += 2;
+            if (offset == 0 || offset > static_cast<size_t>(op - ostart)) return std::nullopt;
+
+            size_t match_length = token & 15;
+            if (match_length == 15 && !read_length(ip, iend, match_length)) return std::nullopt;
+            match_length += MIN_MATCH;
+            if (match_length > static_cast<size_t>(oend - op)) return std::nullopt;
+
+            // источник может перекрываться с результатом: при смещении меньше 8 байт копируем побайтно
+            const uint8_t *match = op - offset;
+            if (offset >= WILD_COPY && static_cast<size_t>(oend - op) >= match_length + WILD_COPY) {
+                // блоки по WILD_COPY байт могут выйти за конец совпадения, лишнее перезапишет следующая последовательность
+                uint8_t *const match_end = op + match_length;
+                for (; op < match_end; op += WILD_COPY, match += WILD_COPY) std::memcpy(op, match, WILD_COPY);
+                op = match_end;
+                continue;
+            }
+            if (offset >= sizeof(uint64_t)) {
+                for (; match_length >= sizeof(uint64_t); match_length -= sizeof(uint64_t)) {
+                    std::memcpy(op, match, sizeof(uint64_t));
+                    op += sizeof(uint64_t);
+                    match += sizeof(uint64_t);
+                }
+            }
+            for (; match_length > 0; --match_length) *op++ = *match++;
+        }
+        return static_cast<size_t>(op - ostart);
+    }
+}
@@ -1,3 +1,4 @@
+#include "defragmenter.h"
 #include "fs_core.h"
 #include "output.h"
 #include <iomanip>
@@ -21,22 +22,43 @@ std::vector<std::string> parseInput(const std::string &input) {
 // Вспомогательная функция для вывода справки по командам оболочки
 void printShellHelp() {
     std::cout << "\nSimple File System Shell Commands:\n";
-    std::cout << "  format <volume_file> <size_MB>        - Formats a new volume.\n";
-    std::cout << "  mount <volume_file>                   - Mounts an existing volume.\n";
+    std::cout << "  format <volume_file> <size_MB> [--prealloc] - Formats a new volume (optionally preallocated).\n";
+    std::cout << "         [--stripe <img>[,<img>...]] [--stripe-width N] - Stripes it across more image files.\n";
+    std::cout << "         [--mirror <img>[,<img>...]]   - Keeps full copies of it in more image files.\n";
+    std::cout << "  mount <volume_file> [cache_MB]        - Mounts an existing volume (FAT/bitmap cache budget).\n";
+    std::cout << "  mount_snapshot <volume_file> <name>   - Mounts a volume snapshot read-only.\n";
     std::cout << "  unmount                               - Unmounts the current volume.\n";
-    std::cout << "  info                                  - Shows current volume superblock info (requires mount).\n";
-    std::cout <<
-            "  ls [fs_path]                          - Lists directory contents (default: root '/'). Requires mount.\n";
+    std::cout << "  info                                  - Shows superblock info and fragmentation report (requires mount).\n";
+    std::cout << "  df [-r | -g]                          - Shows free space (-r: per region, -g: per allocation group).\n";
+    std::cout << "  discard on | off                      - Punches holes in the image for freed clusters.\n";
+    std::cout << "  verify on | off                       - Verifies cluster checksums on read (default: on).\n";
+    std::cout << "  trace start <host_file> | stop        - Records file system calls to a trace for fs_replay.\n";
+    std::cout << "  directio on | off                     - O_DIRECT volume I/O bypassing the host page cache (next mount).\n";
+    std::cout << "  compact                               - Punches holes for all free clusters. Requires mount.\n";
+    std::cout << "  dedup on | off                        - Shares written clusters with identical ones on the volume.\n";
+    std::cout << "  dedup run                             - Deduplicates clusters of existing files. Requires mount.\n";
+    std::cout << "  ls [fs_path] [prefix]                 - Lists directory contents (default: root '/'), names starting with prefix. Requires mount.\n";
     std::cout << "  mkdir <fs_dir_path>                   - Creates a directory. Requires mount.\n";
     std::cout << "  rmdir <fs_dir_path>                   - Removes an empty directory. Requires mount.\n";
     std::cout << "  create <fs_file_path>                 - Creates an empty file (or truncates). Requires mount.\n";
     std::cout << "  rm <fs_file_path>                     - Removes a file. Requires mount.\n";
     std::cout << "  write <fs_file_path> \"text ...\"       - Writes text to a file (overwrites). Requires mount.\n";
     std::cout << "  append <fs_file_path> \"text ...\"      - Appends text to a file. Requires mount.\n";
+    std::cout << "  pwrite <fs_file_path> <offset> \"text\" - Writes text at offset; a gap past EOF stays a hole.\n";
+    std::cout << "  pread <fs_file_path> <offset> <bytes> - Prints bytes of a file starting at offset. Requires mount.\n";
+    std::cout << "  map <fs_file_path>                    - Lists data and hole ranges of a file. Requires mount.\n";
+    std::cout << "  compress <fs_file_path> on | off      - Stores the file compressed in 64 KB groups (repacks data).\n";
+    std::cout << "  clone <fs_src_path> <fs_dest_path>    - Clones a file sharing its clusters (copy on write).\n";
+    std::cout << "  copy <fs_src_path> <fs_dest_path>     - Copies a file inside the volume into a new contiguous extent.\n";
+    std::cout << "  snapshot create | delete <name>       - Creates / deletes a point-in-time volume snapshot.\n";
+    std::cout << "  snapshot list                         - Lists volume snapshots. Requires mount.\n";
     std::cout << "  cat <fs_file_path>                    - Prints file content to console. Requires mount.\n";
     std::cout << "  rename <old_fs_path> <new_fs_path>    - Renames a file or directory. Requires mount.\n";
     std::cout << "  cp_to_fs <host_src_file> <fs_dest_path> - Copies file from host to FS. Requires mount.\n";
     std::cout << "  cp_from_fs <fs_src_path> <host_dest_file> - Copies file from FS to host. Requires mount.\n";
+    std::cout << "  defrag start [clusters_per_sec]       - Starts background defragmentation. Requires mount.\n";
+    std::cout << "  defrag stop | status                  - Stops / shows background defragmentation. Requires mount.\n";
+    std::cout << "  defrag <fs_file_path>                 - Defragments a single file. Requires mount.\n";
     std::cout << "  help                                  - Shows this help message.\n";
     std::cout << "  exit / quit                           - Exits the shell.\n";
     std::cout << std::endl;
@@ -161,13 +183,118 @@ std::string collectTextFromArgs(const std::vector<std::string> &args, size_t sta
     return text;
 }
 
+// Вспомогательная функция для вывода состояния кэша метаданных
+void printMetadataCacheUsage(const MetadataCacheUsage &usage) {
+    std::cout << "--- Metadata Cache ---\n";
+    const auto print_region = [](const char *name, const MetadataCache::Stats &stats) {
+        std::cout << name << stats.resident_pages << "/" << stats.total_pages << " pages resident (limit " <<
+                stats.max_resident_pages << "), " << stats.misses << " loads, " << stats.writebacks <<
+                " writebacks\n";
+    };
+    print_region("FAT pages:         ", usage.fat);
+    print_region("Bitmap pages:      ", usage.bitmap);
+    print_region("Checksum pages:    ", usage.checksums);
+    print_region("Dedup index pages: ", usage.dedup);
+}
+
+// Вспомогательная функция для вывода участков данных и дыр файла (через FS_SEEK_DATA / FS_SEEK_HOLE)
+void printFileMap(FileSystemCore &fs, const std::string &path) {
+    const auto handle_opt = fs.open_file(path, "r");
+    if (!handle_opt) {
+        std::cout << "Failed to open file '" << path << "'.\n";
+        return;
+    }
+    const uint32_t handle = *handle_opt;
+    uint64_t file_size = 0;
+    if (fs.seek(handle, 0, FS_SEEK_END)) file_size = fs.tell(handle).value_or(0);
+
+    uint64_t data_bytes = 0;
+    for (uint64_t position = 0; position < file_size;) {
+        if (!fs.seek(handle, position, FS_SEEK_DATA)) {
+            std::cout << "  hole [" << position << ", " << file_size << ")\n";
+            break;
+        }
+        const uint64_t data_start = fs.tell(handle).value_or(file_size);
+        if (data_start > position) std::cout << "  hole [" << position << ", " << data_start << ")\n";
+        if (!fs.seek(handle, data_start, FS_SEEK_HOLE)) break;
+        const uint64_t data_end = fs.tell(handle).value_or(file_size);
+        std::cout << "  data [" << data_start << ", " << data_end << ")\n";
+        data_bytes += data_end - data_start;
+        position = data_end;
+    }
+    std::cout << path << ": " << file_size << " bytes, " << data_bytes << " in data ranges\n";
+    fs.close_file(handle);
+}
+
+// Первый кластер записи для ls: ссылки FAT на дыры и общие кластеры показываются без флагов
+std::string describeFirstCluster(const FileSystemCore &fs, const DirectoryCursor::EntryView &entry) {
+    if (entry.is_inline()) return "inline";
+    if (FileSystem::is_hole_ref(entry.first_cluster)) return "sparse";
+    if (FileSystem::is_shared_ref(entry.first_cluster)) {
+        const std::optional<uint32_t> cluster = fs.resolve_data_cluster(entry.first_cluster);
+        return cluster ? std::to_string(*cluster) + " shared" : "shared";
+    }
+    return std::to_string(entry.first_cluster);
+}
+
+// Вспомогательная функция для вывода отчёта о фрагментации
+void printFragmentationReport(const FragmentationReport &report) {
+    constexpr size_t max_listed_files = 20;
+    std::cout << "--- Fragmentation ---\n";
+    std::cout << "Files:             " << report.files << "\n";
+    std::cout << "Fragmented files:  " << report.fragmented_files << "\n";
+    std::cout << "Extents:           " << report.extents << "\n";
+    std::cout << "Avg Run (Cl):      " << std::fixed << std::setprecision(2) << report.average_run_length() << "\n";
+
+    std::vector<FileFragmentation> fragmented;
+    for (const auto &file: report.per_file) {
+        if (file.extents > 1) fragmented.push_back(file);
+    }
+    std::sort(fragmented.begin(), fragmented.end(), [](const auto &a, const auto &b) {
+        return a.extents > b.extents;
+    });
+    for (size_t i = 0; i < fragmented.size() && i < max_listed_files; ++i) {
+        std::cout << "  " << fragmented[i].path << ": " << fragmented[i].extents << " extents, " <<
+                fragmented[i].clusters << " clusters\n";
+    }
+    if (fragmented.size() > max_listed_files) {
+        std::cout << "  ... and " << fragmented.size() - max_listed_files << " more\n";
+    }
+}
+
 int main(int argc, char *argv[]) {
     FileSystemCore fs_core;
+    Defragmenter defragmenter(fs_core);
     std::string current_volume_file;
 
+    // FileSystem [volume_file] [--script <file>]: в режиме сценария команды читаются из файла
+    // ("-" - из стандартного ввода) без приглашений; пустые строки и строки с '#' пропускаются
+    std::string initial_volume;
+    std::string script_path;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (arg == "--script" && i + 1 < argc) {
+            script_path = argv[++i];
+        } else if (initial_volume.empty() && arg.rfind("--", 0) != 0) {
+            initial_volume = arg;
+        } else {
+            std::cout << "Usage: FileSystem [volume_file] [--script <file>]\n";
+            return 2;
+        }
+    }
+    const bool interactive = script_path.empty();
+    std::ifstream script_file;
+    if (!interactive && script_path != "-") {
+        script_file.open(script_path);
+        if (!script_file) {
+            std::cerr << "Error: Cannot open script '" << script_path << "'" << std::endl;
+            return 1;
+        }
+    }
+    std::istream &input = interactive || script_path == "-" ? std::cin : script_file;
+
     // Попытка автомонтирования, если файл тома передан как аргумент программе
-    if (argc == 2) {
-        std::string initial_volume = argv[1];
+    if (!initial_volume.empty()) {
         if (fs_core.mount(initial_volume)) {
             current_volume_file = initial_volume;
             std::cout << "Volume '" << current_volume_file << "' auto-mounted.\n";
@@ -178,22 +305,22 @@ int main(int argc, char *argv[]) {
     }
 
     std::string line;
-    std::cout << "SimpleFS Shell. Type 'help' for commands.\n";
+    if (interactive) std::cout << "SimpleFS Shell. Type 'help' for commands.\n";
 
     while (true) {
         // Показываем приглашение с именем смонтированного тома
-        if (fs_core.isMounted()) {
+        if (interactive && fs_core.isMounted()) {
             std::cout << "[" << current_volume_file << "] > ";
-        } else {
+        } else if (interactive) {
             std::cout << "FS_Shell > ";
         }
 
-        if (!std::getline(std::cin, line)) {
+        if (!std::getline(input, line)) {
             break; // EOF (например, Ctrl+D)
         }
 
         std::vector<std::string> tokens = parseInput(line);
-        if (tokens.empty()) {
+        if (tokens.empty() || (!interactive && tokens[0][0] == '#')) {
             continue;
         }
 
@@ -203,18 +330,58 @@ int main(int argc, char *argv[]) {
 
         if (command == "exit" || command == "quit") {
             break;
-        } else if (command == "help") {
+        } else if (command == "format" || command == "mount" || command == "mount_snapshot" || command == "unmount") {
+            // фоновая дефрагментация не должна пережить смену тома
+            defragmenter.stop();
+        }
+
+        if (command == "help") {
             printShellHelp();
         } else if (command == "format") {
-            if (tokens.size() == 3) {
+            // необязательные флаги после размера: --prealloc, --stripe a,b,..., --stripe-width N и --mirror a,b,...
+            bool preallocate = false;
+            bool options_valid = tokens.size() >= 3;
+            std::vector<std::string> stripe_members;
+            std::vector<std::string> mirror_copies;
+            uint32_t stripe_width = FileSystem::DEFAULT_STRIPE_WIDTH_CLUSTERS;
+            for (size_t i = 3; options_valid && i < tokens.size(); ++i) {
+                if (tokens[i] == "--prealloc") {
+                    preallocate = true;
+                } else if (tokens[i] == "--stripe" && i + 1 < tokens.size()) {
+                    std::stringstream members(tokens[++i]);
+                    for (std::string member; std::getline(members, member, ',');) {
+                        if (!member.empty()) stripe_members.push_back(member);
+                    }
+                } else if (tokens[i] == "--mirror" && i + 1 < tokens.size()) {
+                    std::stringstream copies(tokens[++i]);
+                    for (std::string copy; std::getline(copies, copy, ',');) {
+                        if (!copy.empty()) mirror_copies.push_back(copy);
+                    }
+                } else if (tokens[i] == "--stripe-width" && i + 1 < tokens.size()) {
+                    try {
+                        const unsigned long long width = std::stoull(tokens[++i]);
+                        options_valid = width != 0 && width <= UINT32_MAX;
+                        stripe_width = static_cast<uint32_t>(width);
+                    } catch (const std::exception &) {
+                        options_valid = false;
+                    }
+                } else {
+                    options_valid = false;
+                }
+            }
+            if (options_valid) {
                 if (fs_core.isMounted() && tokens[1] == current_volume_file) {
                     std::cout << "Cannot format currently mounted volume. Unmount first.\n";
+                } else if (!fs_core.set_stripe_layout(stripe_members, stripe_width)) {
+                    std::cout << "Invalid stripe layout.\n";
+                } else if (!fs_core.set_mirror_layout(mirror_copies)) {
+                    std::cout << "Invalid mirror layout.\n";
                 } else {
                     uint64_t size_mb = 0;
                     try {
                         size_mb = std::stoull(tokens[2]);
                         if (size_mb == 0) throw std::invalid_argument("Size cannot be zero.");
-                        if (fs_core.format(tokens[1], size_mb)) {
+                        if (fs_core.format(tokens[1], size_mb, preallocate)) {
                             std::cout << "Volume '" << tokens[1] << "' formatted (" << size_mb << "MB).\n";
                         } else {
                             std::cout << "Failed to format volume '" << tokens[1] << "'.\n";
@@ -224,14 +391,23 @@ int main(int argc, char *argv[]) {
                     }
                 }
             } else {
-                std::cout << "Usage: format <volume_file> <size_MB>\n";
+                std::cout << "Usage: format <volume_file> <size_MB> [--prealloc] [--stripe <img>[,<img>...]] "
+                        "[--stripe-width N] [--mirror <img>[,<img>...]]\n";
             }
         } else if (command == "mount") {
-            if (tokens.size() == 2) {
+            if (tokens.size() == 2 || tokens.size() == 3) {
                 if (fs_core.isMounted()) {
                     fs_core.unmount();
                     current_volume_file.clear();
                 }
+                if (tokens.size() == 3) {
+                    try {
+                        fs_core.set_metadata_cache_budget(std::stoull(tokens[2]) * 1024 * 1024);
+                    } catch (const std::exception &e) {
+                        std::cout << "Invalid cache size: " << tokens[2] << "\n";
+                        continue;
+                    }
+                }
                 if (fs_core.mount(tokens[1])) {
                     current_volume_file = tokens[1];
                     std::cout << "Volume '" << current_volume_file << "' mounted.\n";
@@ -239,7 +415,67 @@ int main(int argc, char *argv[]) {
                     std::cout << "Failed to mount volume '" << tokens[1] << "'.\n";
                 }
             } else {
-                std::cout << "Usage: mount <volume_file>\n";
+                std::cout << "Usage: mount <volume_file> [cache_MB]\n";
+            }
+        } else if (command == "mount_snapshot") {
+            if (tokens.size() == 3) {
+                if (fs_core.isMounted()) {
+                    fs_core.unmount();
+                    current_volume_file.clear();
+                }
+                if (fs_core.mount_snapshot(tokens[1], tokens[2])) {
+                    current_volume_file = tokens[1];
+                    std::cout << "Snapshot '" << tokens[2] << "' of '" << current_volume_file << "' mounted read-only.\n";
+                } else {
+                    std::cout << "Failed to mount snapshot '" << tokens[2] << "' of '" << tokens[1] << "'.\n";
+                }
+            } else {
+                std::cout << "Usage: mount_snapshot <volume_file> <name>\n";
+            }
+        } else if (command == "discard") {
+            if (tokens.size() == 2 && (tokens[1] == "on" || tokens[1] == "off")) {
+                fs_core.set_discard_freed(tokens[1] == "on");
+                std::cout << "Discarding freed clusters " << (tokens[1] == "on" ? "enabled" : "disabled") << ".\n";
+            } else {
+                std::cout << "Usage: discard on | off\n";
+            }
+        } else if (command == "verify") {
+            if (tokens.size() == 2 && (tokens[1] == "on" || tokens[1] == "off")) {
+                fs_core.set_checksum_verification(tokens[1] == "on");
+                std::cout << "Checksum verification " << (tokens[1] == "on" ? "enabled" : "disabled") << ".\n";
+            } else {
+                std::cout << "Usage: verify on | off\n";
+            }
+        } else if (command == "trace") {
+            if (tokens.size() == 3 && tokens[1] == "start") {
+                if (fs_core.start_trace(tokens[2])) {
+                    std::cout << "Recording trace to '" << tokens[2] << "'.\n";
+                } else {
+                    std::cout << "Failed to start trace '" << tokens[2] << "'.\n";
+                }
+            } else if (tokens.size() == 2 && tokens[1] == "stop") {
+                if (const auto records = fs_core.stop_trace()) {
+                    std::cout << "Trace stopped: " << *records << " calls recorded.\n";
+                } else {
+                    std::cout << "No trace was recorded or it could not be written.\n";
+                }
+            } else {
+                std::cout << "Usage: trace start <host_trace_file> | trace stop\n";
+            }
+        } else if (command == "directio") {
+            if (tokens.size() == 2 && (tokens[1] == "on" || tokens[1] == "off")) {
+                fs_core.set_direct_io(tokens[1] == "on");
+                std::cout << "Direct I/O " << (tokens[1] == "on" ? "enabled" : "disabled") <<
+                        " from the next mount or format.\n";
+            } else {
+                std::cout << "Usage: directio on | off\n";
+            }
+        } else if (command == "dedup" && !(tokens.size() == 2 && tokens[1] == "run")) {
+            if (tokens.size() == 2 && (tokens[1] == "on" || tokens[1] == "off")) {
+                fs_core.set_dedup(tokens[1] == "on");
+                std::cout << "Deduplication " << (tokens[1] == "on" ? "enabled" : "disabled") << ".\n";
+            } else {
+                std::cout << "Usage: dedup on | off | run\n";
             }
         } else if (command == "unmount") {
             if (fs_core.isMounted()) {
@@ -253,7 +489,7 @@ int main(int argc, char *argv[]) {
         // Команды, требующие смонтированной ФС
         else if (!fs_core.isMounted()) {
             std::cout << "No volume mounted. Mount a volume first or format a new one.\n";
-            std::cout << "Available commands: format, mount, help, exit.\n";
+            std::cout << "Available commands: format, mount, mount_snapshot, help, exit.\n";
         } else if (command == "info") {
             const auto &sb = fs_core.get_header();
             std::cout << "--- Superblock Info for " << current_volume_file << " ---\n";
@@ -268,34 +504,115 @@ int main(int argc, char *argv[]) {
             std::cout << "FAT Size:          " << sb.fat_size_clusters << "\n";
             std::cout << "Bitmap Start:      " << sb.bitmap_start_cluster << "\n";
             std::cout << "Bitmap Size:       " << sb.bitmap_size_cluster << "\n";
+            if (const auto allocated = fs_core.get_allocated_bytes()) {
+                std::cout << "Host Allocated (B):" << *allocated << "\n";
+            }
+            std::cout << "Volume I/O:        " << (fs_core.isDirectIO() ? "direct (O_DIRECT)" : "buffered") << "\n";
+            if (sb.stripe_member_count > 1) {
+                std::cout << "Stripe:            " << sb.stripe_member_count << " images, " <<
+                        sb.stripe_width_clusters << " clusters per stripe, " << sb.stripe_member_clusters <<
+                        " clusters per image\n";
+                for (const auto &member: fs_core.volume_image_paths()) std::cout << "  " << member << "\n";
+            }
+            if (sb.mirror_count > 1) {
+                std::cout << "Mirror:            " << sb.mirror_count << " copies" <<
+                        (fs_core.isMirrorDegraded() ? ", degraded" : "") <<
+                        (fs_core.isMirrorResyncing() ? ", resync in progress" : "") << "\n";
+                const auto paths = fs_core.volume_image_paths();
+                const auto stats = fs_core.volume_image_stats();
+                for (size_t i = 0; i < paths.size() && i < stats.size(); ++i) {
+                    std::cout << "  " << paths[i];
+                    if (!stats[i].online) {
+                        std::cout << " (offline)\n";
+                        continue;
+                    }
+                    std::cout << " - " << stats[i].reads << " reads, " << stats[i].read_bytes << " B, " <<
+                            std::fixed << std::setprecision(1) << stats[i].service_us << " us/cluster\n";
+                }
+            }
+            printMetadataCacheUsage(fs_core.get_metadata_cache_usage());
+            printFragmentationReport(fs_core.analyze_fragmentation());
             std::cout << "-------------------------------\n";
+        } else if (command == "compact") {
+            if (const auto reclaimed = fs_core.compact_volume()) {
+                std::cout << "Compacted: " << *reclaimed << " bytes released on host.\n";
+            } else {
+                std::cout << "Failed to compact volume.\n";
+            }
+        } else if (command == "dedup") {
+            if (const auto report = fs_core.deduplicate_volume()) {
+                std::cout << "Deduplicated " << report->deduplicated_clusters << " of " << report->clusters <<
+                        " clusters in " << report->files << " files (" << report->skipped_files << " skipped).\n";
+            } else {
+                std::cout << "Failed to deduplicate volume.\n";
+            }
+        } else if (command == "df") {
+            const auto space = fs_core.get_space_info();
+            if (!space) {
+                std::cout << "Failed to get free space.\n";
+                continue;
+            }
+            const double mb = static_cast<double>(space->cluster_size) / (1024.0 * 1024.0);
+            std::cout << std::fixed << std::setprecision(2);
+            std::cout << "Size (MB):         " << static_cast<double>(space->data_clusters) * mb << "\n";
+            std::cout << "Used (MB):         " << static_cast<double>(space->used_clusters()) * mb << "\n";
+            std::cout << "Free (MB):         " << static_cast<double>(space->free_clusters) * mb << "\n";
+            std::cout << "Use%:              " << (space->data_clusters == 0
+                                                       ? 0.0
+                                                       : 100.0 * static_cast<double>(space->used_clusters()) /
+                                                         static_cast<double>(space->data_clusters)) << "\n";
+            if (tokens.size() > 1 && tokens[1] == "-r") {
+                for (uint32_t region = 0; region < space->regions; ++region) {
+                    const auto region_free = fs_core.get_region_free_clusters(region);
+                    std::cout << "  region " << region << ": " << (region_free ? *region_free : 0) <<
+                            " free clusters\n";
+                }
+            }
+            if (tokens.size() > 1 && tokens[1] == "-g") {
+                for (uint32_t group = 0; group < space->allocation_groups; ++group) {
+                    const auto group_free = fs_core.get_group_free_clusters(group);
+                    std::cout << "  group " << group << ": " << (group_free ? *group_free : 0) <<
+                            " free clusters\n";
+                }
+            }
         } else if (command == "ls") {
             std::string fs_path = tokens.size() > 1 ? tokens[1] : "/";
-            std::vector<FileSystem::DirectoryEntry> entries = fs_core.list_directory(fs_path);
-
-            if (entries.empty() && fs_path != "/") {
-                std::cout << "(Directory '" << fs_path << "' is empty or does not exist)\n";
+            const std::string prefix = tokens.size() > 2 ? tokens[2] : "";
+            const auto dir_id = fs_core.open_directory(fs_path, 0, prefix);
+            if (!dir_id) {
+                std::cout << "(Directory '" << fs_path << "' does not exist)\n";
+                continue;
             }
 
-
-
+            // первый проход - ширина колонки имён, второй - вывод; записи каталога в памяти не накапливаются
             size_t max_filename_length = 0;
-            for (const auto& entry : entries) {
-                size_t name_length = strnlen(entry.name.data(), FileSystem::MAX_FILE_NAME);
-                if (name_length > max_filename_length) {
-                    max_filename_length = name_length;
-                }
+            size_t entry_count = 0;
+            while (const auto entry = fs_core.read_directory(*dir_id)) {
+                max_filename_length = std::max(max_filename_length, entry->name.size());
+                ++entry_count;
+            }
+            fs_core.close_directory(*dir_id);
+            if (entry_count == 0 && !prefix.empty()) {
+                std::cout << "(No entries starting with '" << prefix << "' in '" << fs_path << "')\n";
+                continue;
+            }
+            if (entry_count == 0 && fs_path != "/") {
+                std::cout << "(Directory '" << fs_path << "' is empty)\n";
+                continue;
             }
 
-            for (const auto& entry : entries) {
-                char type_char = (entry.type == FileSystem::EntityType::DIRECTORY) ? 'D' : 'F';
-                std::string filename(entry.name.data(), strnlen(entry.name.data(), FileSystem::MAX_FILE_NAME));
+            const auto print_id = fs_core.open_directory(fs_path, 0, prefix);
+            if (!print_id) continue;
+            while (const auto entry = fs_core.read_directory(*print_id)) {
+                char type_char = (entry->type == FileSystem::EntityType::DIRECTORY) ? 'D' : 'F';
 
                 std::cout << type_char << " "
-                          << std::left << std::setw(static_cast<int>(max_filename_length)) << filename << " "
-                          << std::right << std::setw(10) << entry.file_size_bytes << " B"
-                          << std::setw(7) << "(Cl: " << entry.first_cluster << ")" << std::endl;
+                          << std::left << std::setw(static_cast<int>(max_filename_length)) << entry->name << " "
+                          << std::right << std::setw(10) << entry->file_size_bytes << " B"
+                          << std::setw(7) << "(Cl: " << describeFirstCluster(fs_core, *entry) << ")"
+                          << (entry->is_compressed() ? " compressed" : "") << std::endl;
             }
+            fs_core.close_directory(*print_id);
         } else if (command == "mkdir") {
             if (tokens.size() == 2) {
                 if (fs_core.create_directory(tokens[1])) {
@@ -361,6 +678,113 @@ int main(int argc, char *argv[]) {
             } else {
                 std::cout << "Usage: " << command << " <fs_file_path> \"text data\"\n";
             }
+        } else if (command == "pwrite") {
+            if (tokens.size() >= 4) {
+                try {
+                    const uint64_t offset = std::stoull(tokens[2]);
+                    const std::string text_to_write = collectTextFromArgs(tokens, 3);
+                    auto handle_opt = fs_core.open_file(tokens[1], "a+");
+                    if (!handle_opt) {
+                        std::cout << "Failed to open file '" << tokens[1] << "' for pwrite.\n";
+                    } else {
+                        const uint32_t handle = *handle_opt;
+                        const int64_t written = fs_core.pwrite_file(handle, text_to_write.c_str(),
+                                                                    text_to_write.length(), offset);
+                        if (written == static_cast<int64_t>(text_to_write.length())) {
+                            std::cout << written << " bytes written to '" << tokens[1] << "' at offset " << offset <<
+                                    ".\n";
+                        } else {
+                            std::cout << "Failed to write all text (wrote " << written << ").\n";
+                        }
+                        fs_core.close_file(handle);
+                    }
+                } catch (const std::exception &e) {
+                    std::cerr << "Error: Invalid offset: " << tokens[2] << ". " << e.what() << std::endl;
+                }
+            } else {
+                std::cout << "Usage: pwrite <fs_file_path> <offset> \"text data\"\n";
+            }
+        } else if (command == "pread") {
+            if (tokens.size() == 4) {
+                try {
+                    const uint64_t offset = std::stoull(tokens[2]);
+                    const uint64_t length = std::stoull(tokens[3]);
+                    auto handle_opt = fs_core.open_file(tokens[1], "r");
+                    if (!handle_opt) {
+                        std::cout << "Failed to open file '" << tokens[1] << "' for reading.\n";
+                    } else {
+                        std::string data(length, '\0');
+                        const int64_t bytes_read = fs_core.pread_file(*handle_opt, data.data(), length, offset);
+                        if (bytes_read < 0) {
+                            std::cout << "Error during read." << std::endl;
+                        } else {
+                            data.resize(static_cast<size_t>(bytes_read));
+                            std::cout << data << std::endl;
+                        }
+                        fs_core.close_file(*handle_opt);
+                    }
+                } catch (const std::exception &e) {
+                    std::cerr << "Error: Invalid offset or length. " << e.what() << std::endl;
+                }
+            } else {
+                std::cout << "Usage: pread <fs_file_path> <offset> <bytes>\n";
+            }
+        } else if (command == "map") {
+            if (tokens.size() == 2) {
+                printFileMap(fs_core, tokens[1]);
+            } else {
+                std::cout << "Usage: map <fs_file_path>\n";
+            }
+        } else if (command == "compress") {
+            if (tokens.size() == 3 && (tokens[2] == "on" || tokens[2] == "off")) {
+                if (fs_core.set_compression(tokens[1], tokens[2] == "on")) {
+                    std::cout << "Compression " << tokens[2] << " for '" << tokens[1] << "'.\n";
+                } else {
+                    std::cout << "Failed to change compression of '" << tokens[1] << "'.\n";
+                }
+            } else {
+                std::cout << "Usage: compress <fs_file_path> on | off\n";
+            }
+        } else if (command == "clone") {
+            if (tokens.size() == 3) {
+                if (fs_core.clone_file(tokens[1], tokens[2])) {
+                    std::cout << "Cloned '" << tokens[1] << "' to '" << tokens[2] << "'.\n";
+                } else {
+                    std::cout << "Failed to clone '" << tokens[1] << "'.\n";
+                }
+            } else {
+                std::cout << "Usage: clone <fs_src_path> <fs_dest_path>\n";
+            }
+        } else if (command == "copy") {
+            if (tokens.size() == 3) {
+                if (fs_core.copy_file(tokens[1], tokens[2])) {
+                    std::cout << "Copied '" << tokens[1] << "' to '" << tokens[2] << "'.\n";
+                } else {
+                    std::cout << "Failed to copy '" << tokens[1] << "'.\n";
+                }
+            } else {
+                std::cout << "Usage: copy <fs_src_path> <fs_dest_path>\n";
+            }
+        } else if (command == "snapshot") {
+            if (tokens.size() == 2 && tokens[1] == "list") {
+                const std::vector<std::string> snapshots = fs_core.list_snapshots();
+                if (snapshots.empty()) std::cout << "No snapshots.\n";
+                for (const auto &name: snapshots) std::cout << "  " << name << "\n";
+            } else if (tokens.size() == 3 && tokens[1] == "create") {
+                if (fs_core.create_snapshot(tokens[2])) {
+                    std::cout << "Snapshot '" << tokens[2] << "' created.\n";
+                } else {
+                    std::cout << "Failed to create snapshot '" << tokens[2] << "'.\n";
+                }
+            } else if (tokens.size() == 3 && tokens[1] == "delete") {
+                if (fs_core.delete_snapshot(tokens[2])) {
+                    std::cout << "Snapshot '" << tokens[2] << "' deleted.\n";
+                } else {
+                    std::cout << "Failed to delete snapshot '" << tokens[2] << "'.\n";
+                }
+            } else {
+                std::cout << "Usage: snapshot create | delete <name> | list\n";
+            }
         } else if (command == "cat") {
             if (tokens.size() == 2) {
                 auto handle_opt = fs_core.open_file(tokens[1], "r");
@@ -392,6 +816,36 @@ int main(int argc, char *argv[]) {
             } else {
                 std::cout << "Usage: rename <old_fs_path> <new_fs_path>\n";
             }
+        } else if (command == "defrag") {
+            if (tokens.size() >= 2 && tokens[1] == "start") {
+                uint32_t rate = 0;
+                try {
+                    if (tokens.size() == 3) rate = static_cast<uint32_t>(std::stoul(tokens[2]));
+                    if (defragmenter.start(rate)) {
+                        std::cout << "Background defragmentation started.\n";
+                    }
+                } catch (const std::exception &e) {
+                    std::cerr << "Error: Invalid rate value: " << tokens[2] << ". " << e.what() << std::endl;
+                }
+            } else if (tokens.size() == 2 && tokens[1] == "stop") {
+                defragmenter.stop();
+                std::cout << "Background defragmentation stopped.\n";
+            } else if (tokens.size() == 2 && tokens[1] == "status") {
+                const Defragmenter::Status status = defragmenter.status();
+                std::cout << (status.running ? "Running" : "Idle") << ": " << status.files_defragmented <<
+                        " files, " << status.clusters_moved << " clusters moved, " << status.files_skipped <<
+                        " skipped";
+                if (!status.current_file.empty()) std::cout << " (current: " << status.current_file << ")";
+                std::cout << "\n";
+            } else if (tokens.size() == 2) {
+                if (const auto moved = fs_core.defragment_file(tokens[1])) {
+                    std::cout << "Moved " << *moved << " clusters of '" << tokens[1] << "'.\n";
+                } else {
+                    std::cout << "Failed to defragment '" << tokens[1] << "'.\n";
+                }
+            } else {
+                std::cout << "Usage: defrag start [clusters_per_sec] | stop | status | <fs_file_path>\n";
+            }
         } else if (command == "cp_to_fs") {
             copyHostToFsShell(fs_core, tokens);
         } else if (command == "cp_from_fs") {
@@ -401,10 +855,12 @@ int main(int argc, char *argv[]) {
         }
     }
 
+    defragmenter.stop();
     if (fs_core.isMounted()) {
         fs_core.unmount(); // Убедимся, что все отмонтировано при выходе
     }
 
-    std::cout << "Exiting SimpleFS Shell.\n";
+    if (fs_core.isTracing()) fs_core.stop_trace();
+    if (interactive) std::cout << "Exiting SimpleFS Shell.\n";
     return 0;
 }
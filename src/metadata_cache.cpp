@@ -0,0 +1,145 @@
+#include "../include/metadata_cache.h"
+
+#include <algorithm>
+
+#include "../include/output.h"
+#include "../include/volume_manager.h"
+
+MetadataCache::MetadataCache(VolumeManager &vol_manager, const uint32_t region_start_cluster,
+                             const uint32_t region_cluster_count, const size_t max_resident_pages)
+    : vol_manager_(vol_manager), region_start_cluster_(region_start_cluster),
+      region_cluster_count_(region_cluster_count), page_size_(vol_manager.get_cluster_size()),
+      max_resident_pages_(std::max<size_t>(1, max_resident_pages)) {
+}
+
+const char *MetadataCache::get_page(const uint32_t page_idx) {
+    std::lock_guard lock(mutex_);
+    Page *page = load_page(page_idx);
+    return page ? page->data.get() : nullptr;
+}
+
+char *MetadataCache::get_page_for_write(const uint32_t page_idx) {
+    std::lock_guard lock(mutex_);
+    Page *page = load_page(page_idx);
+    if (!page) return nullptr;
+    page->dirty = true;
+    return page->data.get();
+}
+
+MetadataCache::LockedPage MetadataCache::lock_page(const uint32_t page_idx, const bool for_write) {
+    LockedPage locked;
+    locked.lock_ = std::unique_lock(mutex_);
+    Page *page = load_page(page_idx);
+    if (!page) return {};
+    page->dirty |= for_write;
+    locked.data_ = page->data.get();
+    return locked;
+}
+
+MetadataCache::Page *MetadataCache::load_page(const uint32_t page_idx) {
+    if (page_idx >= region_cluster_count_) {
+        output::err(output::prefix::METADATA_CACHE_ERROR) << "Page " << page_idx << " out of bounds (pages: " <<
+                region_cluster_count_ << ")" << std::endl;
+        return nullptr;
+    }
+
+    if (last_page_ && last_page_idx_ == page_idx) {
+        ++stats_.hits;
+        return last_page_;
+    }
+    if (const auto it = pages_.find(page_idx); it != pages_.end()) {
+        ++stats_.hits;
+        lru_.splice(lru_.begin(), lru_, it->second.lru_position);
+        last_page_idx_ = page_idx;
+        last_page_ = &it->second;
+        return last_page_;
+    }
+
+    // освобождаем место под новую страницу до её загрузки
+    if (!evict_until(max_resident_pages_ - 1)) {
+        return nullptr;
+    }
+
+    Page page;
+    page.data = vol_manager_.lease_cluster_buffer();
+    if (!page.data) {
+        output::err(output::prefix::METADATA_CACHE_ERROR) << "Out of memory for page " << page_idx << std::endl;
+        return nullptr;
+    }
+    if (!vol_manager_.read_cluster(region_start_cluster_ + page_idx, page.data.get())) {
+        output::err(output::prefix::METADATA_CACHE_ERROR) << "Failed to read page " << page_idx << " (cluster " <<
+                region_start_cluster_ + page_idx << ")" << std::endl;
+        return nullptr;
+    }
+    ++stats_.misses;
+
+    lru_.push_front(page_idx);
+    page.lru_position = lru_.begin();
+    last_page_idx_ = page_idx;
+    last_page_ = &pages_.emplace(page_idx, std::move(page)).first->second;
+    return last_page_;
+}
+
+bool MetadataCache::write_back(const uint32_t page_idx, Page &page) {
+    if (!page.dirty) return true;
+    if (!vol_manager_.write_cluster(region_start_cluster_ + page_idx, page.data.get())) {
+        output::err(output::prefix::METADATA_CACHE_ERROR) << "Failed to write back page " << page_idx <<
+                " (cluster " << region_start_cluster_ + page_idx << ")" << std::endl;
+        return false;
+    }
+    page.dirty = false;
+    ++stats_.writebacks;
+    return true;
+}
+
+bool MetadataCache::evict_until(const size_t limit) {
+    while (pages_.size() > limit && !lru_.empty()) {
+        const uint32_t victim = lru_.back();
+        const auto it = pages_.find(victim);
+        if (!write_back(victim, it->second)) {
+            return false;
+        }
+        lru_.pop_back();
+        if (last_page_ == &it->second) last_page_ = nullptr;
+        pages_.erase(it);
+    }
+    return true;
+}
+
+bool MetadataCache::flush() {
+    std::lock_guard lock(mutex_);
+    // пишем в порядке возрастания номеров страниц, чтобы запись на диск шла последовательно
+    std::vector<uint32_t> dirty_pages;
+    for (const auto &[page_idx, page]: pages_) {
+        if (page.dirty) dirty_pages.push_back(page_idx);
+    }
+    std::sort(dirty_pages.begin(), dirty_pages.end());
+
+    bool success = true;
+    for (const uint32_t page_idx: dirty_pages) {
+        if (!write_back(page_idx, pages_.at(page_idx))) success = false;
+    }
+    return success;
+}
+
+void MetadataCache::drop() {
+    std::lock_guard lock(mutex_);
+    last_page_ = nullptr;
+    pages_.clear();
+    lru_.clear();
+}
+
+void MetadataCache::set_max_resident_pages(const size_t max_resident_pages) {
+    std::lock_guard lock(mutex_);
+    max_resident_pages_ = std::max<size_t>(1, max_resident_pages);
+    evict_until(max_resident_pages_);
+}
+
+MetadataCache::Stats MetadataCache::stats() const {
+    std::lock_guard lock(mutex_);
+    Stats stats = stats_;
+    stats.resident_pages = pages_.size();
+    stats.max_resident_pages = max_resident_pages_;
+    stats.total_pages = region_cluster_count_;
+    return stats;
+}
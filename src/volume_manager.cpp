@@ -1,19 +1,276 @@
 #include "../include/volume_manager.h"
 
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <functional>
 #include <iostream>
+#include <mutex>
+#include <thread>
 
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "crc32c.h"
 #include "output.h"
 
-VolumeManager::VolumeManager() = default;
+namespace {
+    // pread до заполнения буфера или конца файла; -1 при ошибке
+    std::streamsize pread_full(const int fd, char *buffer, const std::streamsize bytes, const std::streamoff offset) {
+        std::streamsize done = 0;
+        while (done < bytes) {
+            const ssize_t n = ::pread(fd, buffer + done, static_cast<size_t>(bytes - done), offset + done);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0) return -1;
+            if (n == 0) break;
+            done += n;
+        }
+        return done;
+    }
+
+    bool pwrite_full(const int fd, const char *buffer, const std::streamsize bytes, const std::streamoff offset) {
+        std::streamsize done = 0;
+        while (done < bytes) {
+            const ssize_t n = ::pwrite(fd, buffer + done, static_cast<size_t>(bytes - done), offset + done);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            done += n;
+        }
+        return true;
+    }
+
+    // O_DIRECT требует выравнивания адреса, смещения и длины; кластер кратен логическому блоку хоста
+    bool is_direct_aligned(const void *buffer, const std::streamoff offset, const std::streamsize bytes) {
+        constexpr auto alignment = FileSystem::CLUSTER_SIZE_BYTES;
+        return reinterpret_cast<uintptr_t>(buffer) % alignment == 0 && offset % alignment == 0 &&
+               bytes % alignment == 0;
+    }
+
+    // чтение через дескриптор с O_DIRECT; невыровненный буфер вызывающего - через промежуточный буфер bounce_arena
+    std::streamsize direct_read(const int fd, BufferPool &bounce_arena, const std::streamoff offset, char *buffer,
+                                const std::streamsize bytes) {
+        if (is_direct_aligned(buffer, offset, bytes)) {
+            const std::streamsize read = pread_full(fd, buffer, bytes, offset);
+            if (read < 0) {
+                output::err(output::prefix::VOLUME_MANAGER_ERROR) << "Direct read at offset " << offset <<
+                        " failed (" << std::strerror(errno) << ")" << std::endl;
+            }
+            return read;
+        }
+
+        // смещения в образе кратны кластеру
+        const BufferPool::Lease bounce = bounce_arena.lease();
+        if (!bounce) {
+            output::err(output::prefix::VOLUME_MANAGER_ERROR) << "Out of memory for direct I/O buffer" << std::endl;
+            return -1;
+        }
+        const auto bounce_size = static_cast<std::streamsize>(bounce_arena.buffer_size());
+        std::streamsize done = 0;
+        while (done < bytes) {
+            const std::streamsize chunk = std::min(bounce_size, bytes - done);
+            // длина чтения округляется вверх до кластера, лишнее отбрасывается
+            const std::streamsize aligned_chunk = (chunk + FileSystem::CLUSTER_SIZE_BYTES - 1) /
+                                                  FileSystem::CLUSTER_SIZE_BYTES * FileSystem::CLUSTER_SIZE_BYTES;
+            const std::streamsize read = pread_full(fd, bounce.get(), aligned_chunk, offset + done);
+            if (read < 0) {
+                output::err(output::prefix::VOLUME_MANAGER_ERROR) << "Direct read at offset " << offset + done <<
+                        " failed (" << std::strerror(errno) << ")" << std::endl;
+                return -1;
+            }
+            const std::streamsize useful = std::min(read, chunk);
+            std::memcpy(buffer + done, bounce.get(), static_cast<size_t>(useful));
+            done += useful;
+            if (read < aligned_chunk) break; // конец файла
+        }
+        return done;
+    }
+
+    bool direct_write(const int fd, BufferPool &bounce_arena, const std::streamoff offset, const char *buffer,
+                      const std::streamsize bytes) {
+        if (is_direct_aligned(buffer, offset, bytes)) {
+            if (pwrite_full(fd, buffer, bytes, offset)) return true;
+            output::err(output::prefix::VOLUME_MANAGER_ERROR) << "Direct write at offset " << offset << " failed (" <<
+                    std::strerror(errno) << ")" << std::endl;
+            return false;
+        }
+        // запись всегда идёт целыми кластерами, выравнивать нужно только адрес буфера
+        if (!is_direct_aligned(nullptr, offset, bytes)) {
+            output::err(output::prefix::VOLUME_MANAGER_ERROR) << "Direct write at offset " << offset <<
+                    " is not cluster aligned" << std::endl;
+            return false;
+        }
+        const BufferPool::Lease bounce = bounce_arena.lease();
+        if (!bounce) {
+            output::err(output::prefix::VOLUME_MANAGER_ERROR) << "Out of memory for direct I/O buffer" << std::endl;
+            return false;
+        }
+        const auto bounce_size = static_cast<std::streamsize>(bounce_arena.buffer_size());
+        for (std::streamsize done = 0; done < bytes;) {
+            const std::streamsize chunk = std::min(bounce_size, bytes - done);
+            std::memcpy(bounce.get(), buffer + done, static_cast<size_t>(chunk));
+            if (!pwrite_full(fd, bounce.get(), chunk, offset + done)) {
+                output::err(output::prefix::VOLUME_MANAGER_ERROR) << "Direct write at offset " << offset + done <<
+                        " failed (" << std::strerror(errno) << ")" << std::endl;
+                return false;
+            }
+            done += chunk;
+        }
+        return true;
+    }
+
+    // копирование между файлами в ядре (copy_file_range); возвращает скопированное - остаток копирует
+    // вызывающий через буфер, если ядро или файловая система копирование не поддерживают; -1 при ошибке
+    std::streamsize kernel_copy(const int src_fd, const std::streamoff src_offset, const int dst_fd,
+                                const std::streamoff dst_offset, const std::streamsize bytes) {
+#ifdef __linux__
+        auto src = static_cast<off64_t>(src_offset);
+        auto dst = static_cast<off64_t>(dst_offset);
+        std::streamsize done = 0;
+        while (done < bytes) {
+            const ssize_t copied = ::copy_file_range(src_fd, &src, dst_fd, &dst, static_cast<size_t>(bytes - done), 0);
+            if (copied > 0) {
+                done += copied;
+                continue;
+            }
+            if (copied == 0) break;
+            if (errno == EINTR) continue;
+            if (errno == ENOSYS || errno == EXDEV || errno == EINVAL || errno == EOPNOTSUPP) break;
+            output::err(output::prefix::VOLUME_MANAGER_ERROR) << "copy_file_range at offset " << src <<
+                    " failed (" << std::strerror(errno) << ")" << std::endl;
+            return -1;
+        }
+        return done;
+#else
+        return 0;
+#endif
+    }
+}
+
+// Дополнительный образ чередующегося или зеркального тома. Задание (участки одного запроса) выполняет поток образа, пока
+// вызывающий работает с основным образом; запросы к тому сериализует FileSystemCore, поэтому у образа
+// одновременно не больше одного задания
+struct VolumeManager::ImageMember {
+    std::string path;
+    int fd = -1; // дескриптор образа; через него идёт ввод-вывод без O_DIRECT
+    int direct_fd = -1; // дескриптор с O_DIRECT, -1 - прямой ввод-вывод не используется
+    BufferPool bounce{FileSystem::CLUSTER_SIZE_BYTES * FileSystem::DIRECT_IO_BOUNCE_CLUSTERS,
+                      FileSystem::CLUSTER_SIZE_BYTES, 1}; // промежуточные буферы O_DIRECT этого образа
+
+    explicit ImageMember(std::string member_path) : path(std::move(member_path)) {
+    }
+
+    ~ImageMember() {
+        if (worker_.joinable()) {
+            {
+                std::lock_guard lock(mutex_);
+                stop_ = true;
+            }
+            cv_.notify_all();
+            worker_.join();
+        }
+        if (direct_fd >= 0) ::close(direct_fd);
+        if (fd >= 0) ::close(fd);
+    }
+
+    void start() { worker_ = std::thread(&ImageMember::run, this); }
+
+    void post(std::function<bool()> task) {
+        {
+            std::lock_guard lock(mutex_);
+            task_ = std::move(task);
+        }
+        cv_.notify_all();
+    }
+
+    // ждёт завершения задания; результат задания
+    bool wait() {
+        std::unique_lock lock(mutex_);
+        cv_.wait(lock, [this] { return !task_; });
+        return result_;
+    }
+
+    std::streamsize read(const std::streamoff offset, char *buffer, const std::streamsize bytes) {
+        return direct_fd >= 0 ? direct_read(direct_fd, bounce, offset, buffer, bytes)
+                              : pread_full(fd, buffer, bytes, offset);
+    }
+
+    bool write(const std::streamoff offset, const char *buffer, const std::streamsize bytes) {
+        return direct_fd >= 0 ? direct_write(direct_fd, bounce, offset, buffer, bytes)
+                              : pwrite_full(fd, buffer, bytes, offset);
+    }
+
+private:
+    std::thread worker_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::function<bool()> task_; // пусто - задания нет
+    bool result_ = true;
+    bool stop_ = false;
+
+    void run() {
+        std::unique_lock lock(mutex_);
+        while (true) {
+            cv_.wait(lock, [this] { return stop_ || task_; });
+            if (stop_) return;
+            lock.unlock();
+            const bool result = task_();
+            lock.lock();
+            result_ = result;
+            task_ = nullptr;
+            cv_.notify_all();
+        }
+    }
+};
+
+VolumeManager::VolumeManager()
+    : cluster_arena_(FileSystem::CLUSTER_SIZE_BYTES, FileSystem::CLUSTER_SIZE_BYTES, FileSystem::IO_BUFFERS_PER_CHUNK),
+      bounce_arena_(FileSystem::CLUSTER_SIZE_BYTES * FileSystem::DIRECT_IO_BOUNCE_CLUSTERS,
+                    FileSystem::CLUSTER_SIZE_BYTES, 1) {
+}
 
 VolumeManager::~VolumeManager() {
     close_volume();
 }
 
 void VolumeManager::close_volume() {
+    if (resync_thread_.joinable()) {
+        resync_stop_ = true;
+        resync_thread_.join();
+    }
+    if (checksum_cache_) {
+        // страницы таблицы сумм записываются через ещё открытый поток
+        if (is_open()) flush_checksums();
+        checksum_cache_.reset();
+    }
+    if (is_open() && mirrored()) {
+        // копии совпадают - журнал очищается; иначе отметки остаются до следующей синхронизации
+        if (!degraded_ && !resync_active_) std::fill(dirty_log_.begin(), dirty_log_.end(), 0);
+        write_header_to_disk(header_cache_);
+    }
+    members_.clear();
+    image_stats_.clear();
+    dirty_log_.clear();
+    degraded_ = false;
+    resync_active_ = false;
+    resync_stop_ = false;
     if (volume_stream_.is_open()) {
         volume_stream_.close();
     }
+    if (direct_fd_ >= 0) {
+        ::close(direct_fd_);
+        direct_fd_ = -1;
+    }
+    if (volume_fd_ >= 0) {
+        ::close(volume_fd_);
+        volume_fd_ = -1;
+    }
     is_volume_loaded_ = false;
     current_volume_path_.clear();
 }
@@ -30,12 +287,52 @@ uint32_t VolumeManager::get_cluster_size() const {
 }
 
 bool VolumeManager::create_and_format(const std::string &volume_path, const uint64_t volume_size_bytes,
-                                      FileSystem::Header &out_header) {
+                                      FileSystem::Header &out_header, const bool preallocate) {
     if (is_open()) {
         close_volume();
     }
     current_volume_path_ = volume_path;
-    volume_stream_.open(current_volume_path_, std::ios::out | std::ios::binary | std::ios::trunc);
+
+    if (!requested_stripe_paths_.empty() && !requested_mirror_paths_.empty()) {
+        output::err(output::prefix::VOLUME_MANAGER_ERROR) << "A volume cannot be both striped and mirrored" <<
+                std::endl;
+        return false;
+    }
+    // чередующийся том: все образы одного размера, в каждом целое число полос; копия зеркала - полный образ
+    const bool mirror = !requested_mirror_paths_.empty();
+    const std::vector<std::string> &requested_paths = mirror ? requested_mirror_paths_ : requested_stripe_paths_;
+    const auto member_count = static_cast<uint32_t>(1 + requested_paths.size());
+    uint64_t image_bytes = volume_size_bytes;
+    uint64_t member_clusters = 0;
+    std::vector<std::string> member_paths;
+    if (member_count > 1 && !mirror) {
+        const uint64_t total_clusters = volume_size_bytes / FileSystem::CLUSTER_SIZE_BYTES;
+        const uint64_t stripes = (total_clusters + requested_stripe_width_ - 1) / requested_stripe_width_;
+        member_clusters = (stripes + member_count - 1) / member_count * requested_stripe_width_;
+        image_bytes = member_clusters * FileSystem::CLUSTER_SIZE_BYTES;
+    }
+    if (member_count > 1) {
+        // пути в таблице абсолютные: том монтируется и из другого рабочего каталога
+        std::error_code ec;
+        const auto main_path = std::filesystem::absolute(volume_path, ec).lexically_normal();
+        for (const auto &requested: requested_paths) {
+            const auto path = std::filesystem::absolute(requested, ec).lexically_normal();
+            if (ec || path.string().size() >= sizeof(FileSystem::ImageRecord::path)) {
+                output::err(output::prefix::VOLUME_MANAGER_ERROR) << "Image path is too long: " << requested <<
+                        std::endl;
+                return false;
+            }
+            if (path == main_path || std::find(member_paths.begin(), member_paths.end(), path.string()) !=
+                member_paths.end()) {
+                output::err(output::prefix::VOLUME_MANAGER_ERROR) << "Image " << requested << " is used twice" <<
+                        std::endl;
+                return false;
+            }
+            member_paths.push_back(path.string());
+        }
+    }
+
+    volume_stream_.open(current_volume_path_, std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
 
     if (!volume_stream_.is_open()) {
         output::err(output::prefix::VOLUME_MANAGER_ERROR) << "Could not open file for format" << std::endl;
@@ -46,8 +343,8 @@ bool VolumeManager::create_and_format(const std::string &volume_path, const uint
         close_volume();
         return false;
     }
-    const auto offset = FileSystem::try_to_streamoff(volume_size_bytes - 1);
-    if (!offset) {
+    const auto offset = FileSystem::try_to_streamoff(image_bytes - 1);
+    if (!offset || member_clusters > UINT32_MAX) {
         output::err(output::prefix::VOLUME_MANAGER_ERROR) << "File is too large for this system" << std::endl;
         return false;
     }
@@ -61,11 +358,51 @@ bool VolumeManager::create_and_format(const std::string &volume_path, const uint
     }
     volume_stream_.flush();
 
+    if (!open_native_handle()) {
+        close_volume();
+        return false;
+    }
+    open_direct_handle();
+    if (!open_members(member_paths, image_bytes, true)) {
+        close_volume();
+        return false;
+    }
+    if (preallocate) {
+        bool preallocated = preallocate_image(volume_fd_, image_bytes);
+        for (const auto &member: members_) preallocated = preallocated && preallocate_image(member->fd, image_bytes);
+        if (!preallocated) {
+            output::err(output::prefix::VOLUME_MANAGER_ERROR) << "Could not preallocate " << image_bytes <<
+                    " bytes for: " << current_volume_path_ << std::endl;
+            close_volume();
+            return false;
+        }
+    }
+
     if (!initialize_header(volume_size_bytes, header_cache_)) {
         output::err(output::prefix::VOLUME_MANAGER_ERROR) << "Could not initialize header structure" << std::endl;
         close_volume();
         return false;
     }
+    if (member_count > 1) {
+        const BufferPool::Lease table = cluster_arena_.lease();
+        if (!table) {
+            close_volume();
+            return false;
+        }
+        if (mirror) {
+            // журнал вмещает DIRTY_LOG_BYTES * 8 участков: на больших томах участки крупнее
+            constexpr uint64_t max_regions = FileSystem::DIRTY_LOG_BYTES * 8;
+            header_cache_.mirror_count = member_count;
+            header_cache_.dirty_region_clusters = static_cast<uint32_t>(std::max<uint64_t>(
+                FileSystem::DEFAULT_DIRTY_REGION_CLUSTERS, (header_cache_.total_clusters + max_regions - 1) / max_regions));
+            dirty_log_.assign(FileSystem::DIRTY_LOG_BYTES, 0);
+        } else {
+            header_cache_.stripe_member_count = member_count;
+            header_cache_.stripe_width_clusters = requested_stripe_width_;
+            header_cache_.stripe_member_clusters = static_cast<uint32_t>(member_clusters);
+        }
+        header_cache_.image_table_checksum = fill_image_table(table.get());
+    }
 
     out_header = header_cache_;
 
@@ -75,6 +412,31 @@ bool VolumeManager::create_and_format(const std::string &volume_path, const uint
         return false;
     }
     is_volume_loaded_ = true;
+    attach_checksums();
+    // области метаданных нового тома заполнены нулями: их суммы записываются сразу, чтобы повреждение
+    // ещё не изменявшихся страниц FAT и битовой карты тоже обнаруживалось
+    if (checksum_cache_) {
+        const BufferPool::Lease zeros = cluster_arena_.lease();
+        if (!zeros) {
+            close_volume();
+            return false;
+        }
+        std::memset(zeros.get(), 0, header_cache_.cluster_size_bytes);
+        const uint32_t zero_checksum = cluster_checksum(zeros.get(), header_cache_.cluster_size_bytes);
+        for (uint32_t c = header_cache_.header_cluster_count; c < header_cache_.data_start_cluster; ++c) {
+            if (is_checksummed(c) && !store_checksum(c, zero_checksum)) {
+                close_volume();
+                return false;
+            }
+        }
+    }
+    if (mirror) {
+        output::succ(output::prefix::VOLUME_MANAGER) << "Volume mirrored across " << member_count << " images" <<
+                std::endl;
+    } else if (member_count > 1) {
+        output::succ(output::prefix::VOLUME_MANAGER) << "Volume striped across " << member_count << " images, " <<
+                requested_stripe_width_ << " clusters per stripe" << std::endl;
+    }
     output::succ(output::prefix::VOLUME_MANAGER) << "Volume initialised and formatted successfully" << std::endl;
 
     return true;
@@ -92,15 +454,50 @@ bool VolumeManager::load_volume(const std::string &volume_path) {
         return false;
     }
 
-    if (!read_header_from_disk(header_cache_)) {
+    std::vector<std::string> member_paths;
+    if (!read_header_from_disk(header_cache_, member_paths)) {
         output::err(output::prefix::VOLUME_MANAGER_ERROR) << "Failed to read or validate header from: " <<
                 current_volume_path_ <<
                 std::endl;
         close_volume();
         return false;
     }
+    if (!open_native_handle()) {
+        close_volume();
+        return false;
+    }
+    open_direct_handle();
+    const uint64_t image_bytes = mirrored()
+                                     ? header_cache_.volume_size_bytes
+                                     : static_cast<uint64_t>(header_cache_.stripe_member_clusters) *
+                                       header_cache_.cluster_size_bytes;
+    // без копии зеркала том доступен, без полосы - нет
+    if (!open_members(member_paths, image_bytes, false, !mirrored())) {
+        close_volume();
+        return false;
+    }
 
     is_volume_loaded_ = true;
+    attach_checksums();
+    if (mirrored()) {
+        degraded_ = std::any_of(image_stats_.begin(), image_stats_.end(),
+                                [](const ImageStats &stats) { return !stats.online; });
+        if (degraded_) {
+            // записи идут мимо отсутствующих копий: при их возвращении нужна полная синхронизация
+            output::warn(output::prefix::VOLUME_MANAGER_WARNING) << "Mirror is degraded, " <<
+                    "missing copies will be fully resynced when they are back" << std::endl;
+            std::fill(dirty_log_.begin(), dirty_log_.end(), 0xFF);
+            if (!write_header_to_disk(header_cache_)) {
+                close_volume();
+                return false;
+            }
+        } else if (std::any_of(dirty_log_.begin(), dirty_log_.end(), [](const uint8_t byte) { return byte != 0; })) {
+            output::warn(output::prefix::VOLUME_MANAGER_WARNING) << "Volume was not closed cleanly, " <<
+                    "resyncing mirror copies in background" << std::endl;
+            resync_active_ = true;
+            resync_thread_ = std::thread(&VolumeManager::run_resync, this);
+        }
+    }
     output::succ(output::prefix::VOLUME_MANAGER) << "Volume loaded successfully" << std::endl;
     return true;
 }
@@ -110,6 +507,7 @@ bool VolumeManager::read_cluster(uint32_t cluster_idx, char *buffer) const {
         output::err(output::prefix::VOLUME_MANAGER_ERROR) << "Volume not open for reading cluster" << std::endl;
         return false;
     }
+    if (mirrored()) return read_clusters(cluster_idx, 1, buffer);
 
     if (cluster_idx >= header_cache_.total_clusters) {
         output::err(output::prefix::VOLUME_MANAGER_ERROR) << "Cluster index " << cluster_idx << " out of bounds" <<
@@ -117,29 +515,18 @@ bool VolumeManager::read_cluster(uint32_t cluster_idx, char *buffer) const {
         return false;
     }
 
-    const auto cluster_offset = get_cluster_offset(cluster_idx);
-    if (!cluster_offset) {
+    const auto location = locate_cluster(cluster_idx);
+    if (!location) {
         output::err(output::prefix::VOLUME_MANAGER_ERROR) << "Cluster offset is invalid" << std::endl;
         return false;
     }
-    const auto offset = FileSystem::try_to_streamoff(*cluster_offset);
-    if (!offset) {
-        output::err(output::prefix::VOLUME_MANAGER_ERROR) << "Offset is too large for this filesystem" << std::endl;
-        return false;
-    }
-    volume_stream_.seekg(*offset);
-    if (!volume_stream_) {
-        output::err(output::prefix::VOLUME_MANAGER_ERROR) << "Seekg failed for cluster" << cluster_idx << std::endl;
-        return false;
-    }
-    volume_stream_.read(buffer, header_cache_.cluster_size_bytes);
-    if (volume_stream_.gcount() != static_cast<std::streamsize>(header_cache_.cluster_size_bytes)) {
+    const std::streamsize read = read_at(location->first, location->second, buffer, header_cache_.cluster_size_bytes);
+    if (read != static_cast<std::streamsize>(header_cache_.cluster_size_bytes)) {
         output::err(output::prefix::VOLUME_MANAGER_ERROR) << "Read failed for cluster " << cluster_idx <<
-                ". Expected " << header_cache_.cluster_size_bytes << " got " << volume_stream_.gcount() << std::endl;
-        if (!volume_stream_.eof()) volume_stream_.clear();
+                ". Expected " << header_cache_.cluster_size_bytes << " got " << read << std::endl;
         return false;
     }
-    return true;
+    return verify_clusters(cluster_idx, 1, buffer);
 }
 
 bool VolumeManager::write_cluster(uint32_t cluster_idx, const char *buffer) const {
@@ -147,28 +534,156 @@ bool VolumeManager::write_cluster(uint32_t cluster_idx, const char *buffer) cons
         output::err(output::prefix::VOLUME_MANAGER_ERROR) << "Volume not open for writing cluster" << std::endl;
         return false;
     }
+    if (mirrored()) return write_clusters(cluster_idx, 1, buffer);
     if (cluster_idx >= header_cache_.total_clusters) {
         output::err(output::prefix::VOLUME_MANAGER_ERROR) << "Cluster index " << cluster_idx << " out of bounds" <<
                 std::endl;
         return false;
     }
-    const auto offset_opt = get_cluster_offset(cluster_idx);
-    if (!offset_opt) {
+    const auto location = locate_cluster(cluster_idx);
+    if (!location) {
         output::err(output::prefix::VOLUME_MANAGER_ERROR) << "Offset is too large for this filesystem" << std::endl;
         return false;
     }
-    const auto offset = FileSystem::try_to_streamoff(*offset_opt);
-    volume_stream_.seekp(*offset);
-    if (!volume_stream_) {
-        output::err(output::prefix::VOLUME_MANAGER_ERROR) << "Seekp failed for cluster" << cluster_idx << std::endl;
+    if (!write_at(location->first, location->second, buffer, header_cache_.cluster_size_bytes)) {
+        output::err(output::prefix::VOLUME_MANAGER_ERROR) << "Write failed for cluster" << cluster_idx << std::endl;
         return false;
     }
-    volume_stream_.write(buffer, header_cache_.cluster_size_bytes);
-    if (!volume_stream_) {
-        output::err(output::prefix::VOLUME_MANAGER_ERROR) << "Write failed for cluster" << cluster_idx << std::endl;
+    return store_checksums(cluster_idx, 1, buffer);
+}
+
+bool VolumeManager::read_clusters(const uint32_t first_cluster_idx, const uint32_t cluster_count, char *buffer) const {
+    if (!is_open()) {
+        output::err(output::prefix::VOLUME_MANAGER_ERROR) << "Volume not open for reading clusters" << std::endl;
         return false;
     }
-    volume_stream_.flush();
+    if (cluster_count == 0) return true;
+    if (first_cluster_idx >= header_cache_.total_clusters ||
+        cluster_count > header_cache_.total_clusters - first_cluster_idx) {
+        output::err(output::prefix::VOLUME_MANAGER_ERROR) << "Cluster range " << first_cluster_idx << "+" <<
+                cluster_count << " out of bounds" << std::endl;
+        return false;
+    }
+    const auto resync_lock = lock_resync();
+    const std::vector<ImagePiece> pieces = mirrored()
+                                               ? mirror_read_pieces(first_cluster_idx, cluster_count)
+                                               : split_range(first_cluster_idx, cluster_count);
+    if (pieces.empty()) {
+        output::err(output::prefix::VOLUME_MANAGER_ERROR) << "Cluster offset is invalid" << std::endl;
+        return false;
+    }
+    if (!transfer_pieces(pieces, buffer, nullptr)) {
+        output::err(output::prefix::VOLUME_MANAGER_ERROR) << "Read failed for clusters " << first_cluster_idx <<
+                "+" << cluster_count << std::endl;
+        return mirrored() && repair_read(first_cluster_idx, cluster_count, buffer);
+    }
+    if (verify_clusters(first_cluster_idx, cluster_count, buffer)) return true;
+    return mirrored() && repair_read(first_cluster_idx, cluster_count, buffer);
+}
+
+bool VolumeManager::write_clusters(const uint32_t first_cluster_idx, const uint32_t cluster_count,
+                                   const char *buffer) const {
+    if (!is_open()) {
+        output::err(output::prefix::VOLUME_MANAGER_ERROR) << "Volume not open for writing clusters" << std::endl;
+        return false;
+    }
+    if (cluster_count == 0) return true;
+    if (first_cluster_idx >= header_cache_.total_clusters ||
+        cluster_count > header_cache_.total_clusters - first_cluster_idx) {
+        output::err(output::prefix::VOLUME_MANAGER_ERROR) << "Cluster range " << first_cluster_idx << "+" <<
+                cluster_count << " out of bounds" << std::endl;
+        return false;
+    }
+    const auto resync_lock = lock_resync();
+    const std::vector<ImagePiece> pieces = replicate(split_range(first_cluster_idx, cluster_count));
+    if (pieces.empty()) {
+        output::err(output::prefix::VOLUME_MANAGER_ERROR) << "Cluster offset is invalid" << std::endl;
+        return false;
+    }
+    if (!mark_dirty(first_cluster_idx, cluster_count) || !transfer_pieces(pieces, nullptr, buffer)) {
+        output::err(output::prefix::VOLUME_MANAGER_ERROR) << "Write failed for clusters " << first_cluster_idx <<
+                "+" << cluster_count << std::endl;
+        return false;
+    }
+    return store_checksums(first_cluster_idx, cluster_count, buffer);
+}
+
+bool VolumeManager::copy_clusters(const uint32_t src_first_cluster_idx, const uint32_t dst_first_cluster_idx,
+                                  const uint32_t cluster_count) const {
+    if (!is_open()) {
+        output::err(output::prefix::VOLUME_MANAGER_ERROR) << "Volume not open for copying clusters" << std::endl;
+        return false;
+    }
+    if (cluster_count == 0) return true;
+    for (const uint32_t first: {src_first_cluster_idx, dst_first_cluster_idx}) {
+        if (first >= header_cache_.total_clusters || cluster_count > header_cache_.total_clusters - first) {
+            output::err(output::prefix::VOLUME_MANAGER_ERROR) << "Cluster range " << first << "+" << cluster_count <<
+                    " out of bounds" << std::endl;
+            return false;
+        }
+    }
+    if (src_first_cluster_idx < dst_first_cluster_idx + cluster_count &&
+        dst_first_cluster_idx < src_first_cluster_idx + cluster_count) {
+        output::err(output::prefix::VOLUME_MANAGER_ERROR) << "Cluster ranges " << src_first_cluster_idx << " and " <<
+                dst_first_cluster_idx << " overlap" << std::endl;
+        return false;
+    }
+    const auto resync_lock = lock_resync();
+    if (!mark_dirty(dst_first_cluster_idx, cluster_count)) return false;
+    // в чередующемся томе копируются отрезки, не пересекающие границу полосы ни в источнике, ни в приёмнике,
+    // в зеркальном - каждый отрезок копируется внутри каждой копии
+    const uint32_t width = header_cache_.stripe_member_count > 1 ? header_cache_.stripe_width_clusters : cluster_count;
+    for (uint32_t copied = 0; copied < cluster_count;) {
+        const uint32_t src_cluster = src_first_cluster_idx + copied;
+        const uint32_t dst_cluster = dst_first_cluster_idx + copied;
+        const uint32_t run = std::min({cluster_count - copied, width - src_cluster % width, width - dst_cluster % width});
+        const auto src = locate_cluster(src_cluster);
+        const auto dst = locate_cluster(dst_cluster);
+        if (!src || !dst) {
+            output::err(output::prefix::VOLUME_MANAGER_ERROR) << "Cluster offset is invalid" << std::endl;
+            return false;
+        }
+        const auto bytes = static_cast<std::streamsize>(run) * header_cache_.cluster_size_bytes;
+
+        for (uint32_t copy = 0; copy < (mirrored() ? image_count() : 1); ++copy) {
+            if (!member_online(copy)) continue;
+            const uint32_t src_member = mirrored() ? copy : src->first;
+            const uint32_t dst_member = mirrored() ? copy : dst->first;
+            std::streamsize done = copy_range(src_member, src->second, dst_member, dst->second, bytes);
+            if (done < 0) return false;
+            if (done < bytes) {
+                // остаток копируется через промежуточный буфер; с O_DIRECT он выровнен и передаётся без лишней копии
+                const BufferPool::Lease bounce = bounce_arena_.lease();
+                if (!bounce) {
+                    output::err(output::prefix::VOLUME_MANAGER_ERROR) << "Out of memory for copy buffer" << std::endl;
+                    return false;
+                }
+                const auto bounce_size = static_cast<std::streamsize>(bounce_arena_.buffer_size());
+                while (done < bytes) {
+                    const std::streamsize chunk = std::min(bounce_size, bytes - done);
+                    if (read_at(src_member, src->second + done, bounce.get(), chunk) != chunk ||
+                        !write_at(dst_member, dst->second + done, bounce.get(), chunk)) {
+                        output::err(output::prefix::VOLUME_MANAGER_ERROR) << "Failed to copy clusters " <<
+                                src_first_cluster_idx << "+" << cluster_count << " to " << dst_first_cluster_idx <<
+                                std::endl;
+                        return false;
+                    }
+                    done += chunk;
+                }
+            }
+        }
+        copied += run;
+    }
+
+    // данные не проходили через память: суммы переносятся из таблицы, и повреждённый исходный кластер
+    // обнаружится при чтении копии
+    for (uint32_t i = 0; i < cluster_count; ++i) {
+        if (!is_checksummed(dst_first_cluster_idx + i)) continue;
+        const std::optional<uint32_t> checksum = is_checksummed(src_first_cluster_idx + i)
+                                                     ? stored_checksum(src_first_cluster_idx + i)
+                                                     : std::optional<uint32_t>(FileSystem::CHECKSUM_NONE);
+        if (!checksum || !store_checksum(dst_first_cluster_idx + i, *checksum)) return false;
+    }
     return true;
 }
 
@@ -176,11 +691,519 @@ const FileSystem::Header &VolumeManager::get_header() const {
     return header_cache_;
 }
 
+bool VolumeManager::open_native_handle() {
+    volume_fd_ = ::open(current_volume_path_.c_str(), O_RDWR);
+    if (volume_fd_ < 0) {
+        output::err(output::prefix::VOLUME_MANAGER_ERROR) << "Could not open native handle for: " <<
+                current_volume_path_ << " (" << std::strerror(errno) << ")" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void VolumeManager::prefetch_clusters(const uint32_t first_cluster_idx, const uint32_t cluster_count) const {
+    if (!is_open() || direct_fd_ >= 0 || volume_fd_ < 0 || cluster_count == 0) return;
+    if (first_cluster_idx >= header_cache_.total_clusters ||
+        cluster_count > header_cache_.total_clusters - first_cluster_idx) {
+        return;
+    }
+#ifdef POSIX_FADV_WILLNEED
+    // копию зеркала для следующего чтения заранее не узнать: подсказка даётся всем копиям
+    for (const ImagePiece &piece: replicate(split_range(first_cluster_idx, cluster_count))) {
+        ::posix_fadvise(member_fd(piece.member), static_cast<off_t>(piece.offset), static_cast<off_t>(piece.bytes),
+                        POSIX_FADV_WILLNEED);
+    }
+#endif
+}
+
+void VolumeManager::open_direct_handle() {
+    if (!direct_io_requested_) return;
+#ifdef O_DIRECT
+    direct_fd_ = ::open(current_volume_path_.c_str(), O_RDWR | O_DIRECT);
+    if (direct_fd_ >= 0) return;
+    output::warn(output::prefix::VOLUME_MANAGER_WARNING) << "O_DIRECT is not available for " << current_volume_path_ <<
+            " (" << std::strerror(errno) << "), using buffered I/O" << std::endl;
+#else
+    output::warn(output::prefix::VOLUME_MANAGER_WARNING) << "O_DIRECT is not supported on this platform, "
+            "using buffered I/O" << std::endl;
+#endif
+}
+
+std::streamsize VolumeManager::read_at(const uint32_t member, const std::streamoff offset, char *buffer,
+                                       const std::streamsize bytes) const {
+    if (member != 0) return members_[member - 1]->read(offset, buffer, bytes);
+    // после подключения основной образ читается через дескриптор: pread не делит позицию между потоками
+    if (direct_fd_ < 0 && volume_fd_ >= 0) return pread_full(volume_fd_, buffer, bytes, offset);
+    if (direct_fd_ < 0) {
+        volume_stream_.seekg(offset);
+        if (!volume_stream_) return -1;
+        volume_stream_.read(buffer, bytes);
+        const std::streamsize read = volume_stream_.gcount();
+        if (read != bytes && !volume_stream_.eof()) volume_stream_.clear();
+        return read;
+    }
+    return direct_read(direct_fd_, bounce_arena_, offset, buffer, bytes);
+}
+
+bool VolumeManager::write_at(const uint32_t member, const std::streamoff offset, const char *buffer,
+                             const std::streamsize bytes) const {
+    if (member != 0) return members_[member - 1]->write(offset, buffer, bytes);
+    if (direct_fd_ < 0 && volume_fd_ >= 0) return pwrite_full(volume_fd_, buffer, bytes, offset);
+    if (direct_fd_ < 0) {
+        volume_stream_.seekp(offset);
+        if (!volume_stream_) return false;
+        volume_stream_.write(buffer, bytes);
+        if (!volume_stream_) return false;
+        volume_stream_.flush();
+        return true;
+    }
+    return direct_write(direct_fd_, bounce_arena_, offset, buffer, bytes);
+}
+
+std::streamsize VolumeManager::copy_range(const uint32_t src_member, const std::streamoff src_offset,
+                                          const uint32_t dst_member, const std::streamoff dst_offset,
+                                          const std::streamsize bytes) const {
+    const int src_fd = member_fd(src_member);
+    const int dst_fd = member_fd(dst_member);
+    if (src_fd < 0 || dst_fd < 0) return 0;
+    // данные потока должны попасть в файл до копирования в ядре
+    volume_stream_.flush();
+    return kernel_copy(src_fd, src_offset, dst_fd, dst_offset, bytes);
+}
+
+bool VolumeManager::preallocate_image(const int fd, const uint64_t image_bytes) {
+#ifdef __linux__
+    // mode 0: блоки выделяются сразу, размер файла не меняется
+    if (::fallocate(fd, 0, 0, static_cast<off_t>(image_bytes)) == 0) return true;
+    output::warn(output::prefix::VOLUME_MANAGER_WARNING) << "fallocate failed (" << std::strerror(errno) <<
+            "), writing zeros instead" << std::endl;
+#endif
+    // запасной вариант: явная запись нулей по всему образу
+    const std::vector<char> zeros(FileSystem::CLUSTER_SIZE_BYTES * 256, 0);
+    for (uint64_t offset = 0; offset < image_bytes; offset += zeros.size()) {
+        const size_t chunk = static_cast<size_t>(std::min<uint64_t>(zeros.size(), image_bytes - offset));
+        if (::pwrite(fd, zeros.data(), chunk, static_cast<off_t>(offset)) != static_cast<ssize_t>(chunk)) {
+            return false;
+        }
+    }
+    return ::fsync(fd) == 0;
+}
+
+bool VolumeManager::punch_holes(const uint32_t first_cluster_idx, const uint32_t cluster_count) const {
+    if (!is_open() || volume_fd_ < 0) {
+        output::err(output::prefix::VOLUME_MANAGER_ERROR) << "Volume not open for punching holes" << std::endl;
+        return false;
+    }
+    if (cluster_count == 0) return true;
+    if (first_cluster_idx >= header_cache_.total_clusters ||
+        cluster_count > header_cache_.total_clusters - first_cluster_idx) {
+        output::err(output::prefix::VOLUME_MANAGER_ERROR) << "Cluster range " << first_cluster_idx << "+" <<
+                cluster_count << " out of bounds" << std::endl;
+        return false;
+    }
+#ifdef __linux__
+    const auto resync_lock = lock_resync();
+    const std::vector<ImagePiece> pieces = replicate(split_range(first_cluster_idx, cluster_count));
+    if (pieces.empty() || !mark_dirty(first_cluster_idx, cluster_count)) return false;
+    // данные потока должны попасть в файл до освобождения блоков, иначе они перезапишут дыру
+    volume_stream_.flush();
+    for (const ImagePiece &piece: pieces) {
+        if (::fallocate(member_fd(piece.member), FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                        static_cast<off_t>(piece.offset), static_cast<off_t>(piece.bytes)) != 0) {
+            output::err(output::prefix::VOLUME_MANAGER_ERROR) << "Failed to punch hole at cluster " <<
+                    first_cluster_idx << " (" << std::strerror(errno) << ")" << std::endl;
+            return false;
+        }
+    }
+    // дыра читается нулями, старые суммы кластеров больше не действительны
+    for (uint32_t i = 0; i < cluster_count; ++i) {
+        if (is_checksummed(first_cluster_idx + i) &&
+            !store_checksum(first_cluster_idx + i, FileSystem::CHECKSUM_NONE)) {
+            return false;
+        }
+    }
+    return true;
+#else
+    output::warn(output::prefix::VOLUME_MANAGER_WARNING) << "Hole punching is not supported on this platform" <<
+            std::endl;
+    return false;
+#endif
+}
+
+std::optional<uint64_t> VolumeManager::get_allocated_bytes() const {
+    if (volume_fd_ < 0) return std::nullopt;
+    volume_stream_.flush();
+    uint64_t allocated = 0;
+    for (uint32_t member = 0; member < image_count(); ++member) {
+        if (!member_online(member)) continue;
+        struct stat st{};
+        if (::fstat(member_fd(member), &st) != 0) return std::nullopt;
+        allocated += static_cast<uint64_t>(st.st_blocks) * 512;
+    }
+    return allocated;
+}
+
+bool VolumeManager::update_header(const FileSystem::Header &header) {
+    if (!is_open()) {
+        output::err(output::prefix::VOLUME_MANAGER_ERROR) << "Volume not open for updating header" << std::endl;
+        return false;
+    }
+    const auto resync_lock = lock_resync();
+    if (!write_header_to_disk(header)) {
+        output::err(output::prefix::VOLUME_MANAGER_ERROR) << "Failed to update header" << std::endl;
+        return false;
+    }
+    header_cache_ = header;
+    return true;
+}
+
 std::optional<uint64_t> VolumeManager::get_cluster_offset(const uint32_t cluster_idx) const {
+    const auto location = locate_cluster(cluster_idx);
+    if (!location) return std::nullopt;
+    return static_cast<uint64_t>(location->second);
+}
+
+std::optional<std::pair<uint32_t, std::streamoff>> VolumeManager::locate_cluster(const uint32_t cluster_idx) const {
     if (!is_volume_loaded_ || header_cache_.cluster_size_bytes == 0) {
         return std::nullopt;
     }
-    return static_cast<uint64_t>(cluster_idx) * header_cache_.cluster_size_bytes;
+    const uint32_t cluster_size = header_cache_.cluster_size_bytes;
+    if (header_cache_.stripe_member_count <= 1) {
+        // без чередования (и в каждой копии зеркала) кластер лежит по своему номеру
+        return std::pair<uint32_t, std::streamoff>(0, static_cast<std::streamoff>(cluster_idx) * cluster_size);
+    }
+    // полоса stripe лежит в образе stripe % образов, полосы одного образа идут в нём подряд
+    const uint32_t width = header_cache_.stripe_width_clusters;
+    const uint32_t members = image_count();
+    const uint32_t stripe = cluster_idx / width;
+    const uint64_t member_cluster = static_cast<uint64_t>(stripe / members) * width + cluster_idx % width;
+    return std::pair<uint32_t, std::streamoff>(stripe % members,
+                                               static_cast<std::streamoff>(member_cluster * cluster_size));
+}
+
+std::vector<VolumeManager::ImagePiece> VolumeManager::split_range(const uint32_t first_cluster_idx,
+                                                                   const uint32_t cluster_count) const {
+    std::vector<ImagePiece> pieces;
+    const uint32_t width = header_cache_.stripe_member_count > 1 ? header_cache_.stripe_width_clusters : cluster_count;
+    for (uint32_t done = 0; done < cluster_count;) {
+        const uint32_t cluster = first_cluster_idx + done;
+        const uint32_t run = std::min(cluster_count - done, width - cluster % width);
+        const auto location = locate_cluster(cluster);
+        if (!location) return {};
+        pieces.push_back({location->first, location->second,
+                          static_cast<size_t>(done) * header_cache_.cluster_size_bytes,
+                          static_cast<std::streamsize>(run) * header_cache_.cluster_size_bytes});
+        done += run;
+    }
+    return pieces;
+}
+
+bool VolumeManager::transfer_pieces(const std::vector<ImagePiece> &pieces, char *read_buffer,
+                                    const char *write_buffer) const {
+    // статистику образа обновляет только выполняющий его участки поток
+    const auto run_member = [&](const uint32_t member) {
+        for (const ImagePiece &piece: pieces) {
+            if (piece.member != member) continue;
+            if (!read_buffer) {
+                if (!write_at(member, piece.offset, write_buffer + piece.buffer_offset, piece.bytes)) return false;
+                continue;
+            }
+            const auto started = std::chrono::steady_clock::now();
+            if (read_at(member, piece.offset, read_buffer + piece.buffer_offset, piece.bytes) != piece.bytes) {
+                return false;
+            }
+            const double elapsed_us = std::chrono::duration<double, std::micro>(
+                std::chrono::steady_clock::now() - started).count();
+            ImageStats &stats = image_stats_[member];
+            const double per_cluster = elapsed_us * header_cache_.cluster_size_bytes / static_cast<double>(piece.bytes);
+            // скользящее среднее с весом 1/8: медленный диск быстро теряет чтения, восстановившийся - возвращает
+            stats.service_us = stats.reads == 0 ? per_cluster : stats.service_us + (per_cluster - stats.service_us) / 8;
+            ++stats.reads;
+            stats.read_bytes += static_cast<uint64_t>(piece.bytes);
+            stats.last_read = read_sequence_;
+        }
+        return true;
+    };
+    if (pieces.size() == 1) return run_member(pieces.front().member);
+
+    // дополнительные образы работают в своих потоках, основной - в вызывающем
+    std::vector<bool> posted(members_.size(), false);
+    for (const ImagePiece &piece: pieces) {
+        if (piece.member == 0 || posted[piece.member - 1]) continue;
+        posted[piece.member - 1] = true;
+        members_[piece.member - 1]->post([&run_member, member = piece.member] { return run_member(member); });
+    }
+    bool result = run_member(0);
+    for (size_t i = 0; i < posted.size(); ++i) {
+        if (posted[i] && !members_[i]->wait()) result = false;
+    }
+    return result;
+}
+
+int VolumeManager::member_fd(const uint32_t member) const {
+    return member == 0 ? volume_fd_ : members_[member - 1]->fd;
+}
+
+bool VolumeManager::member_online(const uint32_t member) const {
+    return member == 0 || members_[member - 1]->fd >= 0;
+}
+
+std::vector<VolumeManager::ImagePiece> VolumeManager::replicate(const std::vector<ImagePiece> &pieces) const {
+    if (!mirrored()) return pieces;
+    std::vector<ImagePiece> copies;
+    copies.reserve(pieces.size() * image_count());
+    for (uint32_t copy = 0; copy < image_count(); ++copy) {
+        if (!member_online(copy)) continue;
+        for (ImagePiece piece: pieces) {
+            piece.member = copy;
+            copies.push_back(piece);
+        }
+    }
+    return copies;
+}
+
+uint32_t VolumeManager::choose_mirror() const {
+    ++read_sequence_;
+    uint32_t best = 0;
+    uint32_t least_recent = 0;
+    for (uint32_t copy = 1; copy < image_count(); ++copy) {
+        if (!member_online(copy)) continue;
+        if (image_stats_[copy].service_us < image_stats_[best].service_us) best = copy;
+        if (image_stats_[copy].last_read < image_stats_[least_recent].last_read) least_recent = copy;
+    }
+    // время ответа отстающей копии обновляется только её чтениями: время от времени она получает одно из них
+    return read_sequence_ % FileSystem::MIRROR_PROBE_INTERVAL == 0 ? least_recent : best;
+}
+
+std::vector<VolumeManager::ImagePiece> VolumeManager::mirror_read_pieces(const uint32_t first_cluster_idx,
+                                                                         const uint32_t cluster_count) const {
+    std::vector<ImagePiece> pieces = split_range(first_cluster_idx, cluster_count);
+    if (pieces.empty()) return pieces;
+    // до синхронизации отмеченных участков достоверна только основная копия
+    if (resync_active_ && range_dirty(first_cluster_idx, cluster_count)) return pieces;
+
+    const uint32_t chosen = choose_mirror();
+    if (cluster_count < FileSystem::MIRROR_SPLIT_MIN_CLUSTERS) {
+        pieces.front().member = chosen;
+        return pieces;
+    }
+    // крупное чтение делится на части пропорционально скорости копий; копии, отвечающие вчетверо медленнее
+    // лучшей, не участвуют, чтобы один медленный диск не задерживал весь запрос
+    const double best_service = image_stats_[chosen].service_us;
+    std::vector<std::pair<uint32_t, double>> shares;
+    double total_weight = 0;
+    for (uint32_t copy = 0; copy < image_count(); ++copy) {
+        if (!member_online(copy)) continue;
+        const double service = image_stats_[copy].service_us;
+        if (copy != chosen && service > best_service * 4 && image_stats_[copy].reads != 0) continue;
+        const double weight = 1.0 / std::max(service, 1.0);
+        shares.emplace_back(copy, weight);
+        total_weight += weight;
+    }
+    pieces.clear();
+    const uint32_t cluster_size = header_cache_.cluster_size_bytes;
+    uint32_t assigned = 0;
+    for (size_t i = 0; i < shares.size() && assigned < cluster_count; ++i) {
+        uint32_t part = cluster_count - assigned;
+        if (i + 1 < shares.size()) {
+            part = std::min(part, static_cast<uint32_t>(std::lround(cluster_count * shares[i].second / total_weight)));
+        }
+        if (part == 0) continue;
+        pieces.push_back({shares[i].first, static_cast<std::streamoff>(first_cluster_idx + assigned) * cluster_size,
+                          static_cast<size_t>(assigned) * cluster_size,
+                          static_cast<std::streamsize>(part) * cluster_size});
+        assigned += part;
+    }
+    return pieces;
+}
+
+bool VolumeManager::repair_read(const uint32_t first_cluster_idx, const uint32_t cluster_count, char *buffer) const {
+    // копии перебираются от самой быстрой; прочитанное без ошибок и совпавшее с суммами переписывается в остальные
+    std::vector<uint32_t> order;
+    for (uint32_t copy = 0; copy < image_count(); ++copy) {
+        if (member_online(copy)) order.push_back(copy);
+    }
+    if (resync_active_ && range_dirty(first_cluster_idx, cluster_count)) order.resize(1);
+    std::stable_sort(order.begin(), order.end(), [this](const uint32_t a, const uint32_t b) {
+        return image_stats_[a].service_us < image_stats_[b].service_us;
+    });
+    const auto offset = static_cast<std::streamoff>(first_cluster_idx) * header_cache_.cluster_size_bytes;
+    const auto bytes = static_cast<std::streamsize>(cluster_count) * header_cache_.cluster_size_bytes;
+    for (const uint32_t source: order) {
+        if (read_at(source, offset, buffer, bytes) != bytes ||
+            !verify_clusters(first_cluster_idx, cluster_count, buffer)) {
+            continue;
+        }
+        std::vector<ImagePiece> others;
+        for (const ImagePiece &piece: replicate({{0, offset, 0, bytes}})) {
+            if (piece.member != source) others.push_back(piece);
+        }
+        if (!mark_dirty(first_cluster_idx, cluster_count) || !transfer_pieces(others, nullptr, buffer)) {
+            output::warn(output::prefix::VOLUME_MANAGER_WARNING) << "Failed to repair clusters " <<
+                    first_cluster_idx << "+" << cluster_count << " in other mirror copies" << std::endl;
+            return true;
+        }
+        output::warn(output::prefix::VOLUME_MANAGER_WARNING) << "Clusters " << first_cluster_idx << "+" <<
+                cluster_count << " read from mirror copy " << source << ", other copies repaired" << std::endl;
+        return true;
+    }
+    output::err(output::prefix::VOLUME_MANAGER_ERROR) << "No mirror copy holds valid clusters " <<
+            first_cluster_idx << "+" << cluster_count << std::endl;
+    return false;
+}
+
+bool VolumeManager::mark_dirty(const uint32_t first_cluster_idx, const uint32_t cluster_count) const {
+    if (!mirrored() || cluster_count == 0) return true;
+    const uint32_t region_clusters = header_cache_.dirty_region_clusters;
+    bool changed = false;
+    for (uint32_t region = first_cluster_idx / region_clusters;
+         region <= (first_cluster_idx + cluster_count - 1) / region_clusters; ++region) {
+        const uint8_t bit = static_cast<uint8_t>(1u << (region % 8));
+        if (dirty_log_[region / 8] & bit) continue;
+        dirty_log_[region / 8] |= bit;
+        changed = true;
+    }
+    // отметка попадает во все копии раньше данных участка
+    return !changed || write_header_to_disk(header_cache_);
+}
+
+bool VolumeManager::range_dirty(const uint32_t first_cluster_idx, const uint32_t cluster_count) const {
+    const uint32_t region_clusters = header_cache_.dirty_region_clusters;
+    for (uint32_t region = first_cluster_idx / region_clusters;
+         region <= (first_cluster_idx + cluster_count - 1) / region_clusters; ++region) {
+        if (dirty_log_[region / 8] & (1u << (region % 8))) return true;
+    }
+    return false;
+}
+
+std::unique_lock<std::recursive_mutex> VolumeManager::lock_resync() const {
+    if (!resync_active_) return {};
+    return std::unique_lock(resync_mutex_);
+}
+
+void VolumeManager::run_resync() {
+    // участки копируются из основного образа через дескрипторы: поток тома и O_DIRECT остаются вызывающему,
+    // записи через поток сбрасываются сразу, так что в файле основного образа уже всё записанное
+    const uint32_t region_clusters = header_cache_.dirty_region_clusters;
+    const uint64_t region_bytes = static_cast<uint64_t>(region_clusters) * header_cache_.cluster_size_bytes;
+    const uint32_t regions = (header_cache_.total_clusters + region_clusters - 1) / region_clusters;
+    std::vector<char> buffer;
+    uint32_t synced = 0;
+    for (uint32_t region = 0; region < regions; ++region) {
+        if (resync_stop_) return;
+        std::lock_guard lock(resync_mutex_);
+        if (!(dirty_log_[region / 8] & (1u << (region % 8)))) continue;
+        const auto offset = static_cast<std::streamoff>(region * region_bytes);
+        const auto bytes = static_cast<std::streamsize>(std::min<uint64_t>(
+            region_bytes, header_cache_.volume_size_bytes - static_cast<uint64_t>(offset)));
+        for (uint32_t copy = 1; copy < image_count(); ++copy) {
+            std::streamsize done = kernel_copy(volume_fd_, offset, member_fd(copy), offset, bytes);
+            if (done < 0) return;
+            if (done < bytes) {
+                buffer.resize(static_cast<size_t>(bytes));
+                if (pread_full(volume_fd_, buffer.data() + done, bytes - done, offset + done) != bytes - done ||
+                    !pwrite_full(member_fd(copy), buffer.data() + done, bytes - done, offset + done)) {
+                    output::err(output::prefix::VOLUME_MANAGER_ERROR) << "Mirror resync of region " << region <<
+                            " failed (" << std::strerror(errno) << ")" << std::endl;
+                    return;
+                }
+            }
+        }
+        dirty_log_[region / 8] &= static_cast<uint8_t>(~(1u << (region % 8)));
+        ++synced;
+    }
+    output::succ(output::prefix::VOLUME_MANAGER) << "Mirror resync finished, " << synced << " regions copied" <<
+            std::endl;
+    resync_active_ = false;
+}
+
+bool VolumeManager::set_stripe_layout(const std::vector<std::string> &member_paths, const uint32_t width_clusters) {
+    if (member_paths.size() >= FileSystem::MAX_VOLUME_IMAGES) {
+        output::err(output::prefix::VOLUME_MANAGER_ERROR) << "A volume can be striped across at most " <<
+                FileSystem::MAX_VOLUME_IMAGES << " images" << std::endl;
+        return false;
+    }
+    if (width_clusters == 0) {
+        output::err(output::prefix::VOLUME_MANAGER_ERROR) << "Stripe width cannot be zero" << std::endl;
+        return false;
+    }
+    requested_stripe_paths_ = member_paths;
+    requested_stripe_width_ = width_clusters;
+    return true;
+}
+
+bool VolumeManager::set_mirror_layout(const std::vector<std::string> &mirror_paths) {
+    if (mirror_paths.size() >= FileSystem::MAX_VOLUME_IMAGES) {
+        output::err(output::prefix::VOLUME_MANAGER_ERROR) << "A volume can be mirrored across at most " <<
+                FileSystem::MAX_VOLUME_IMAGES << " images" << std::endl;
+        return false;
+    }
+    requested_mirror_paths_ = mirror_paths;
+    return true;
+}
+
+std::vector<std::string> VolumeManager::image_paths() const {
+    std::vector<std::string> paths{current_volume_path_};
+    for (const auto &member: members_) paths.push_back(member->path);
+    return paths;
+}
+
+bool VolumeManager::open_members(const std::vector<std::string> &paths, const uint64_t image_bytes,
+                                        const bool create, const bool required) {
+    image_stats_.assign(1 + paths.size(), ImageStats{});
+    for (const auto &path: paths) {
+        auto member = std::make_unique<ImageMember>(path);
+        member->fd = ::open(path.c_str(), create ? O_RDWR | O_CREAT | O_TRUNC : O_RDWR, 0644);
+        if (member->fd < 0 && !required) {
+            // путь остаётся в таблице образов, образ считается недоступным
+            output::warn(output::prefix::VOLUME_MANAGER_WARNING) << "Image " << path << " is unavailable (" <<
+                    std::strerror(errno) << ")" << std::endl;
+            image_stats_[1 + members_.size()].online = false;
+            members_.push_back(std::move(member));
+            continue;
+        }
+        if (member->fd < 0) {
+            output::err(output::prefix::VOLUME_MANAGER_ERROR) << "Could not open image: " << path << " (" <<
+                    std::strerror(errno) << ")" << std::endl;
+            return false;
+        }
+        if (create) {
+            if (::ftruncate(member->fd, static_cast<off_t>(image_bytes)) != 0) {
+                output::err(output::prefix::VOLUME_MANAGER_ERROR) << "Could not set file size for: " << path <<
+                        std::endl;
+                return false;
+            }
+        } else {
+            // образ другого тома или обрезанный образ отличается размером
+            struct stat st{};
+            if (::fstat(member->fd, &st) != 0 || static_cast<uint64_t>(st.st_size) != image_bytes) {
+                if (!required) {
+                    output::warn(output::prefix::VOLUME_MANAGER_WARNING) << "Image " << path << " has size " <<
+                            st.st_size << ", expected " << image_bytes << ", ignoring it" << std::endl;
+                    ::close(member->fd);
+                    member->fd = -1;
+                    image_stats_[1 + members_.size()].online = false;
+                    members_.push_back(std::move(member));
+                    continue;
+                }
+                output::err(output::prefix::VOLUME_MANAGER_ERROR) << "Image " << path << " has size " <<
+                        st.st_size << ", expected " << image_bytes << std::endl;
+                return false;
+            }
+        }
+        if (direct_io_requested_) {
+#ifdef O_DIRECT
+            member->direct_fd = ::open(path.c_str(), O_RDWR | O_DIRECT);
+            if (member->direct_fd < 0) {
+                output::warn(output::prefix::VOLUME_MANAGER_WARNING) << "O_DIRECT is not available for " << path <<
+                        " (" << std::strerror(errno) << "), using buffered I/O" << std::endl;
+            }
+#endif
+        }
+        member->start();
+        members_.push_back(std::move(member));
+    }
+    return true;
 }
 
 bool VolumeManager::initialize_header(const uint64_t volume_size_bytes, FileSystem::Header &header_to_fill) {
@@ -211,12 +1234,49 @@ bool VolumeManager::initialize_header(const uint64_t volume_size_bytes, FileSyst
     header_to_fill.bitmap_size_cluster = (bitmap_size_bytes + header_to_fill.cluster_size_bytes - 1) / header_to_fill.
                                          cluster_size_bytes;
 
-    header_to_fill.fat_start_cluster = header_to_fill.bitmap_start_cluster + header_to_fill.bitmap_size_cluster;
+    // таблица свободных кластеров: один uint32_t на регион (один кластер битовой карты)
+    header_to_fill.free_counts_start_cluster = header_to_fill.bitmap_start_cluster + header_to_fill.bitmap_size_cluster;
+    const uint64_t free_counts_size_bytes = static_cast<uint64_t>(header_to_fill.bitmap_size_cluster) * sizeof(uint32_t);
+    header_to_fill.free_counts_size_clusters = (free_counts_size_bytes + header_to_fill.cluster_size_bytes - 1) /
+                                               header_to_fill.cluster_size_bytes;
+
+    header_to_fill.fat_start_cluster = header_to_fill.free_counts_start_cluster +
+                                       header_to_fill.free_counts_size_clusters;
     constexpr uint32_t fat_entry_size = sizeof(uint32_t);
     const uint64_t total_fat_size_bytes = static_cast<uint64_t>(header_to_fill.total_clusters) * fat_entry_size;
     header_to_fill.fat_size_clusters = (total_fat_size_bytes + header_to_fill.cluster_size_bytes - 1) / header_to_fill.
                                        cluster_size_bytes;
-    header_to_fill.root_dir_start_cluster = header_to_fill.fat_start_cluster + header_to_fill.fat_size_clusters;
+    // таблица дыр: одна запись на 2 кластера тома (в ней же хранятся ссылки на общие кластеры);
+    // ссылки на записи отличаются от номеров кластеров старшими битами, поэтому на томах с 2^30 кластерами и более
+    // разреженные файлы и общие кластеры не поддерживаются
+    header_to_fill.hole_table_start_cluster = header_to_fill.fat_start_cluster + header_to_fill.fat_size_clusters;
+    if (header_to_fill.total_clusters < FileSystem::FAT_SHARED_FLAG) {
+        const uint64_t hole_table_size_bytes = std::max<uint64_t>(1, header_to_fill.total_clusters / 2) *
+                                               sizeof(FileSystem::HoleRecord);
+        header_to_fill.hole_table_size_clusters = (hole_table_size_bytes + header_to_fill.cluster_size_bytes - 1) /
+                                                  header_to_fill.cluster_size_bytes;
+    }
+
+    // таблица контрольных сумм: одна CRC32C на каждый кластер тома, как и в FAT
+    header_to_fill.checksum_table_start_cluster = header_to_fill.hole_table_start_cluster +
+                                                  header_to_fill.hole_table_size_clusters;
+    header_to_fill.checksum_table_size_clusters = header_to_fill.fat_size_clusters;
+
+    // счётчики ссылок на кластеры и индекс дедупликации: по uint32_t на кластер тома; общие кластеры подключаются
+    // к цепочкам через записи таблицы дыр, поэтому без неё таблицы не создаются
+    header_to_fill.refcount_table_start_cluster = header_to_fill.checksum_table_start_cluster +
+                                                  header_to_fill.checksum_table_size_clusters;
+    if (header_to_fill.hole_table_size_clusters != 0) {
+        header_to_fill.refcount_table_size_clusters = header_to_fill.fat_size_clusters;
+    }
+    header_to_fill.dedup_index_start_cluster = header_to_fill.refcount_table_start_cluster +
+                                               header_to_fill.refcount_table_size_clusters;
+    if (header_to_fill.hole_table_size_clusters != 0) {
+        header_to_fill.dedup_index_size_clusters = header_to_fill.fat_size_clusters;
+    }
+
+    header_to_fill.root_dir_start_cluster = header_to_fill.dedup_index_start_cluster +
+                                            header_to_fill.dedup_index_size_clusters;
     header_to_fill.root_dir_size_clusters = FileSystem::ROOT_DIRECTORY_CLUSTER_COUNT;
 
     header_to_fill.data_start_cluster = header_to_fill.root_dir_start_cluster + header_to_fill.root_dir_size_clusters;
@@ -237,52 +1297,262 @@ bool VolumeManager::write_header_to_disk(const FileSystem::Header &header_to_wri
         output::err(output::prefix::VOLUME_MANAGER_ERROR) << "Stream not open for writing header" << std::endl;
         return false;
     }
-    std::vector<char> cluster_buffer(header_to_write.cluster_size_bytes, 0);
-    std::memcpy(cluster_buffer.data(), &header_to_write, sizeof(FileSystem::Header));
-
-    volume_stream_.seekp(0);
-    if (!volume_stream_) {
-        output::err(output::prefix::VOLUME_MANAGER_ERROR) << "Seekp to 0 for writing Header" << std::endl;
+    const BufferPool::Lease cluster_buffer = cluster_arena_.lease();
+    if (!cluster_buffer) {
+        output::err(output::prefix::VOLUME_MANAGER_ERROR) << "Out of memory for header buffer" << std::endl;
         return false;
     }
-    volume_stream_.write(cluster_buffer.data(), header_to_write.cluster_size_bytes);
-    if (!volume_stream_) {
-        output::err(output::prefix::VOLUME_MANAGER_ERROR) << "Writing header failed" << std::endl;
-        return false;
+    std::memset(cluster_buffer.get(), 0, FileSystem::CLUSTER_SIZE_BYTES);
+    std::memcpy(cluster_buffer.get(), &header_to_write, sizeof(FileSystem::Header));
+    const uint32_t checksum = header_checksum(header_to_write);
+    std::memcpy(cluster_buffer.get() + offsetof(FileSystem::Header, header_checksum), &checksum, sizeof(checksum));
+    if (header_to_write.stripe_member_count > 1 || header_to_write.mirror_count > 1) {
+        fill_image_table(cluster_buffer.get());
+    }
+    if (header_to_write.mirror_count > 1) {
+        std::memcpy(cluster_buffer.get() + FileSystem::DIRTY_LOG_OFFSET, dirty_log_.data(), dirty_log_.size());
+    }
+
+    // заголовок зеркального тома есть в каждой копии
+    const uint32_t copies = header_to_write.mirror_count > 1 ? image_count() : 1;
+    for (uint32_t copy = 0; copy < copies; ++copy) {
+        if (member_online(copy) && !write_at(copy, 0, cluster_buffer.get(), FileSystem::CLUSTER_SIZE_BYTES)) {
+            output::err(output::prefix::VOLUME_MANAGER_ERROR) << "Writing header failed" << std::endl;
+            return false;
+        }
     }
-    volume_stream_.flush();
     return true;
 }
 
-bool VolumeManager::read_header_from_disk(FileSystem::Header &header_to_fill) const {
+bool VolumeManager::read_header_from_disk(FileSystem::Header &header_to_fill,
+                                         std::vector<std::string> &member_paths) {
     if (!volume_stream_.is_open()) {
         output::err(output::prefix::VOLUME_MANAGER_ERROR) << "Stream not open for reading header" << std::endl;
         return false;
     }
-    std::vector<char> cluster_buffer(FileSystem::CLUSTER_SIZE_BYTES);
-    volume_stream_.seekg(0);
-    if (!volume_stream_) {
-        output::err(output::prefix::VOLUME_MANAGER_ERROR) << "Seekg to 0 failed for reading Header";
+    const BufferPool::Lease cluster_buffer = cluster_arena_.lease();
+    if (!cluster_buffer) {
+        output::err(output::prefix::VOLUME_MANAGER_ERROR) << "Out of memory for header buffer" << std::endl;
         return false;
     }
-    volume_stream_.read(cluster_buffer.data(), FileSystem::CLUSTER_SIZE_BYTES);
-    if (volume_stream_.gcount() != static_cast<std::streamsize>(FileSystem::CLUSTER_SIZE_BYTES)) {
-        output::err(output::prefix::VOLUME_MANAGER_ERROR) << "Read header failed. Read " << volume_stream_.gcount() <<
-                " bytes" <<
+    const std::streamsize read = read_at(0, 0, cluster_buffer.get(), FileSystem::CLUSTER_SIZE_BYTES);
+    if (read != static_cast<std::streamsize>(FileSystem::CLUSTER_SIZE_BYTES)) {
+        output::err(output::prefix::VOLUME_MANAGER_ERROR) << "Read header failed. Read " << read << " bytes" <<
                 std::endl;
         return false;
     }
-    std::memcpy(&header_to_fill, cluster_buffer.data(), sizeof(FileSystem::Header));
+    std::memcpy(&header_to_fill, cluster_buffer.get(), sizeof(FileSystem::Header));
 
     if (std::string(header_to_fill.signature) != "FileSystem v1.0") {
         output::err(output::prefix::VOLUME_MANAGER_ERROR) << "Invalid file system signature" << std::endl;
         return false;
     }
 
+    // заголовки томов, созданных до появления контрольных сумм, не содержат суммы
+    if (header_to_fill.header_checksum != FileSystem::CHECKSUM_NONE &&
+        header_to_fill.header_checksum != header_checksum(header_to_fill)) {
+        output::err(output::prefix::VOLUME_MANAGER_ERROR) << "Header checksum mismatch" << std::endl;
+        return false;
+    }
+
     if (header_to_fill.cluster_size_bytes != FileSystem::CLUSTER_SIZE_BYTES) {
         output::err(output::prefix::VOLUME_MANAGER_ERROR) << "Mismatched cluster size. Expected "
                 << FileSystem::CLUSTER_SIZE_BYTES << ", got " << header_to_fill.cluster_size_bytes << std::endl;
         return false;
     }
+
+    auto paths = parse_image_table(header_to_fill, cluster_buffer.get());
+    if (!paths) {
+        output::err(output::prefix::VOLUME_MANAGER_ERROR) << "Stripe member table is invalid" << std::endl;
+        return false;
+    }
+    member_paths = std::move(*paths);
+    dirty_log_.clear();
+    if (header_to_fill.mirror_count > 1) {
+        const char *log = cluster_buffer.get() + FileSystem::DIRTY_LOG_OFFSET;
+        dirty_log_.assign(log, log + FileSystem::DIRTY_LOG_BYTES);
+    }
     return true;
 }
+
+uint32_t VolumeManager::fill_image_table(char *header_cluster) const {
+    auto *table = reinterpret_cast<FileSystem::ImageRecord *>(header_cluster + FileSystem::IMAGE_TABLE_OFFSET);
+    std::memset(table, 0, members_.size() * sizeof(FileSystem::ImageRecord));
+    for (size_t i = 0; i < members_.size(); ++i) {
+        members_[i]->path.copy(table[i].path, sizeof(table[i].path) - 1);
+    }
+    return crc32c::compute(table, members_.size() * sizeof(FileSystem::ImageRecord));
+}
+
+std::optional<std::vector<std::string>> VolumeManager::parse_image_table(const FileSystem::Header &header,
+                                                                          const char *header_cluster) {
+    std::vector<std::string> paths;
+    const bool striped = header.stripe_member_count > 1;
+    const bool mirror = header.mirror_count > 1;
+    if (!striped && !mirror) return paths;
+    const uint32_t images = striped ? header.stripe_member_count : header.mirror_count;
+    // том либо разложен полосами, либо зеркалирован; образов не больше MAX_VOLUME_IMAGES
+    if (striped && mirror) return std::nullopt;
+    if (images > FileSystem::MAX_VOLUME_IMAGES) return std::nullopt;
+    // каждый образ должен вмещать свою долю полос
+    if (striped && (header.stripe_width_clusters == 0 ||
+                    header.stripe_member_clusters % header.stripe_width_clusters != 0 ||
+                    static_cast<uint64_t>(header.stripe_member_clusters) * images < header.total_clusters)) {
+        return std::nullopt;
+    }
+    // журнал зеркала должен покрывать весь том
+    if (mirror && (header.dirty_region_clusters == 0 ||
+                   (static_cast<uint64_t>(header.total_clusters) + header.dirty_region_clusters - 1) /
+                   header.dirty_region_clusters > FileSystem::DIRTY_LOG_BYTES * 8)) {
+        return std::nullopt;
+    }
+    const size_t table_bytes = (images - 1) * sizeof(FileSystem::ImageRecord);
+    const char *table = header_cluster + FileSystem::IMAGE_TABLE_OFFSET;
+    if (crc32c::compute(table, table_bytes) != header.image_table_checksum) return std::nullopt;
+    for (uint32_t i = 0; i + 1 < images; ++i) {
+        const char *path = table + i * sizeof(FileSystem::ImageRecord);
+        const size_t length = strnlen(path, sizeof(FileSystem::ImageRecord::path));
+        if (length == 0 || length == sizeof(FileSystem::ImageRecord::path)) return std::nullopt;
+        paths.emplace_back(path, length);
+    }
+    return paths;
+}
+
+void VolumeManager::attach_checksums() {
+    checksum_cache_.reset();
+    if (header_cache_.checksum_table_size_clusters == 0) return;
+
+    const uint64_t needed_clusters = (static_cast<uint64_t>(header_cache_.total_clusters) * sizeof(uint32_t) +
+                                      header_cache_.cluster_size_bytes - 1) / header_cache_.cluster_size_bytes;
+    if (header_cache_.checksum_table_size_clusters < needed_clusters ||
+        header_cache_.checksum_table_start_cluster < header_cache_.header_cluster_count ||
+        header_cache_.checksum_table_start_cluster > header_cache_.total_clusters -
+        header_cache_.checksum_table_size_clusters) {
+        output::warn(output::prefix::VOLUME_MANAGER_WARNING) <<
+                "Checksum table region is invalid, checksums are disabled" << std::endl;
+        return;
+    }
+    checksum_cache_ = std::make_unique<MetadataCache>(*this, header_cache_.checksum_table_start_cluster,
+                                                      header_cache_.checksum_table_size_clusters,
+                                                      checksum_cache_pages_);
+}
+
+bool VolumeManager::is_checksummed(const uint32_t cluster_idx) const {
+    if (!checksum_cache_ || cluster_idx < header_cache_.header_cluster_count) return false;
+    return cluster_idx - header_cache_.checksum_table_start_cluster >= header_cache_.checksum_table_size_clusters;
+}
+
+std::optional<uint32_t> VolumeManager::stored_checksum(const uint32_t cluster_idx) const {
+    const uint32_t per_page = header_cache_.cluster_size_bytes / sizeof(uint32_t);
+    const MetadataCache::LockedPage page = checksum_cache_->lock_page(cluster_idx / per_page, false);
+    if (!page) return std::nullopt;
+    uint32_t checksum;
+    std::memcpy(&checksum, page.data() + (cluster_idx % per_page) * sizeof(uint32_t), sizeof(checksum));
+    return checksum;
+}
+
+bool VolumeManager::store_checksum(const uint32_t cluster_idx, const uint32_t checksum) const {
+    const uint32_t per_page = header_cache_.cluster_size_bytes / sizeof(uint32_t);
+    const MetadataCache::LockedPage page = checksum_cache_->lock_page(cluster_idx / per_page, true);
+    if (!page) {
+        output::err(output::prefix::VOLUME_MANAGER_ERROR) << "Failed to store checksum for cluster " << cluster_idx <<
+                std::endl;
+        return false;
+    }
+    std::memcpy(page.data() + (cluster_idx % per_page) * sizeof(uint32_t), &checksum, sizeof(checksum));
+    return true;
+}
+
+bool VolumeManager::verify_clusters(const uint32_t first_cluster_idx, const uint32_t cluster_count,
+                                    const char *buffer) const {
+    if (!checksum_cache_ || !verify_checksums_) return true;
+    const uint32_t cluster_size = header_cache_.cluster_size_bytes;
+    for (uint32_t i = 0; i < cluster_count; ++i) {
+        const uint32_t cluster_idx = first_cluster_idx + i;
+        if (!is_checksummed(cluster_idx)) continue;
+        const std::optional<uint32_t> stored = stored_checksum(cluster_idx);
+        if (!stored) {
+            output::err(output::prefix::VOLUME_MANAGER_ERROR) << "Failed to load checksum for cluster " <<
+                    cluster_idx << std::endl;
+            return false;
+        }
+        if (*stored == FileSystem::CHECKSUM_NONE) continue;
+        if (const uint32_t actual = cluster_checksum(buffer + static_cast<size_t>(i) * cluster_size, cluster_size);
+            actual != *stored) {
+            output::err(output::prefix::VOLUME_MANAGER_ERROR) << "Checksum mismatch in cluster " << cluster_idx <<
+                    " (stored " << std::hex << *stored << ", actual " << actual << std::dec << ")" << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+bool VolumeManager::store_checksums(const uint32_t first_cluster_idx, const uint32_t cluster_count,
+                                    const char *buffer) const {
+    if (!checksum_cache_) return true;
+    const uint32_t cluster_size = header_cache_.cluster_size_bytes;
+    for (uint32_t i = 0; i < cluster_count; ++i) {
+        const uint32_t cluster_idx = first_cluster_idx + i;
+        if (!is_checksummed(cluster_idx)) continue;
+        if (!store_checksum(cluster_idx,
+                            cluster_checksum(buffer + static_cast<size_t>(i) * cluster_size, cluster_size))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool VolumeManager::checksum_matches(const uint32_t cluster_idx, const char *buffer) const {
+    if (!is_checksummed(cluster_idx)) return true;
+    const std::optional<uint32_t> stored = stored_checksum(cluster_idx);
+    if (!stored) return false;
+    return *stored == FileSystem::CHECKSUM_NONE ||
+           *stored == cluster_checksum(buffer, header_cache_.cluster_size_bytes);
+}
+
+bool VolumeManager::seal_checksum(const uint32_t cluster_idx, const char *buffer) const {
+    if (!is_checksummed(cluster_idx)) return true;
+    return store_checksum(cluster_idx, cluster_checksum(buffer, header_cache_.cluster_size_bytes));
+}
+
+bool VolumeManager::flush_checksums() const {
+    return !checksum_cache_ || checksum_cache_->flush();
+}
+
+void VolumeManager::set_checksum_cache_pages(const size_t max_resident_pages) {
+    checksum_cache_pages_ = max_resident_pages;
+    if (checksum_cache_) checksum_cache_->set_max_resident_pages(max_resident_pages);
+}
+
+MetadataCache::Stats VolumeManager::checksum_cache_stats() const {
+    return checksum_cache_ ? checksum_cache_->stats() : MetadataCache::Stats{};
+}
+
+uint32_t VolumeManager::cluster_checksum(const char *buffer, const uint32_t cluster_size) {
+    const uint32_t checksum = crc32c::compute(buffer, cluster_size);
+    return checksum == FileSystem::CHECKSUM_NONE ? ~FileSystem::CHECKSUM_NONE : checksum;
+}
+
+uint32_t VolumeManager::header_checksum(const FileSystem::Header &header) {
+    // выравнивание в конце заголовка в сумму не входит
+    constexpr uint32_t empty = FileSystem::CHECKSUM_NONE;
+    uint32_t checksum = crc32c::compute(&empty, sizeof(empty),
+                                        crc32c::compute(&header, offsetof(FileSystem::Header, header_checksum)));
+    // группы полей, добавленных после суммы, учитываются, только если в группе есть ненулевое поле:
+    // так сумма заголовков старых томов остаётся прежней
+    constexpr std::pair<size_t, size_t> tail_groups[] = {
+        {offsetof(FileSystem::Header, header_checksum) + sizeof(uint32_t),
+         offsetof(FileSystem::Header, snapshot_dir_cluster) + sizeof(uint32_t)},
+        {offsetof(FileSystem::Header, stripe_member_count),
+         offsetof(FileSystem::Header, image_table_checksum) + sizeof(uint32_t)},
+        {offsetof(FileSystem::Header, mirror_count),
+         offsetof(FileSystem::Header, dirty_region_clusters) + sizeof(uint32_t)},
+    };
+    for (const auto &[group_begin, group_end]: tail_groups) {
+        const auto *group = reinterpret_cast<const char *>(&header) + group_begin;
+        if (std::any_of(group, group + (group_end - group_begin), [](const char byte) { return byte != 0; })) {
+            checksum = crc32c::compute(group, group_end - group_begin, checksum);
+        }
+    }
+    return checksum == FileSystem::CHECKSUM_NONE ? ~FileSystem::CHECKSUM_NONE : checksum;
+}
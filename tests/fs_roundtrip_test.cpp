@@ -0,0 +1,713 @@
+#include "consistency_checker.h"
+#include "fs_core.h"
+#include "volume_manager.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <optional>
+#include <random>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Сквозная проверка возможностей, меняющих формат тома: том форматируется, файлы записываются, том
+// перемонтируется, данные сверяются, после размонтирования том проверяется ConsistencyChecker.
+// Запуск: fs_roundtrip_test <scenario> <work_dir>; код возврата 0 - сценарий пройден
+namespace {
+    constexpr uint64_t VOLUME_MB = 64;
+    constexpr uint64_t CLUSTER = FileSystem::CLUSTER_SIZE_BYTES;
+
+    bool fail(const std::string &message) {
+        std::cerr << "FAIL: " << message << std::endl;
+        return false;
+    }
+
+    std::string random_bytes(const size_t size, const unsigned seed) {
+        std::mt19937 rng(seed);
+        std::string data(size, '\0');
+        for (char &c: data) c = static_cast<char>(rng() & 0xff);
+        return data;
+    }
+
+    // хорошо сжимаемые данные: повторяющиеся строки журнала
+    std::string log_lines(const size_t size) {
+        std::string data;
+        for (uint64_t line = 0; data.size() < size; ++line) {
+            data += "2024-01-01 12:00:00 INFO request " + std::to_string(line % 97) + " served\n";
+        }
+        data.resize(size);
+        return data;
+    }
+
+    // данные пишутся с offset (за концом файла остаётся дыра)
+    bool write_at(FileSystemCore &fs, const std::string &path, const std::string &mode, const std::string &data,
+                  const uint64_t offset = 0) {
+        const auto handle = fs.open_file(path, mode);
+        if (!handle) return fail("cannot open " + path + " for writing");
+        const bool written = fs.seek(*handle, offset, FS_SEEK_SET) &&
+                             fs.write_file(*handle, data.data(), data.size()) == static_cast<int64_t>(data.size());
+        return fs.close_file(*handle) && written ? true : fail("cannot write " + path);
+    }
+
+    std::optional<std::string> read_all(FileSystemCore &fs, const std::string &path) {
+        const auto handle = fs.open_file(path, "r");
+        if (!handle) return std::nullopt;
+        std::string data;
+        std::vector<char> buffer(64 * 1024);
+        int64_t read;
+        while ((read = fs.read_file(*handle, buffer.data(), buffer.size())) > 0) {
+            data.append(buffer.data(), static_cast<size_t>(read));
+        }
+        fs.close_file(*handle);
+        if (read < 0) return std::nullopt;
+        return data;
+    }
+
+    bool expect_content(FileSystemCore &fs, const std::string &path, const std::string &expected) {
+        const auto data = read_all(fs, path);
+        if (!data) return fail("cannot read " + path);
+        if (*data != expected) {
+            return fail(path + ": content differs (" + std::to_string(data->size()) + " bytes read, " +
+                        std::to_string(expected.size()) + " expected)");
+        }
+        return true;
+    }
+
+    // копия записи корневого каталога с именем name
+    std::optional<FileSystem::DirectoryEntry> find_entry(FileSystemCore &fs, const std::string &name) {
+        const auto dir = fs.open_directory("/");
+        if (!dir) return std::nullopt;
+        std::optional<FileSystem::DirectoryEntry> found;
+        while (const auto entry = fs.read_directory(*dir)) {
+            if (entry->name == name) {
+                found = entry->copy();
+                break;
+            }
+        }
+        fs.close_directory(*dir);
+        return found;
+    }
+
+    bool format_and_mount(FileSystemCore &fs, const std::string &image) {
+        return fs.format(image, VOLUME_MB) && fs.mount(image) ? true : fail("cannot format " + image);
+    }
+
+    bool remount(FileSystemCore &fs, const std::string &image) {
+        fs.unmount();
+        return fs.mount(image) ? true : fail("cannot remount " + image);
+    }
+
+    // проверка размонтированного тома, как fsck без --repair
+    bool check_volume(const std::string &image) {
+        VolumeManager vol_manager;
+        if (!vol_manager.load_volume(image)) return fail("fsck cannot load " + image);
+        ConsistencyChecker checker(vol_manager);
+        const auto report = checker.run({});
+        vol_manager.close_volume();
+        if (!report) return fail("fsck of " + image + " failed");
+        for (const auto &problem: report->problems) std::cerr << "  " << problem << "\n";
+        return report->is_clean() ? true : fail("fsck found errors in " + image);
+    }
+
+    // дыры в разреженном файле (маркер дыры в FAT)
+    bool run_sparse(FileSystemCore &fs, const std::string &image) {
+        const std::string tail = random_bytes(CLUSTER + 100, 1);
+        if (!format_and_mount(fs, image)) return false;
+        if (!write_at(fs, "sparse", "w", "head") || !write_at(fs, "sparse", "r+", tail, 10 * CLUSTER)) return false;
+        if (!remount(fs, image)) return false;
+
+        std::string expected = "head";
+        expected.resize(10 * CLUSTER);
+        expected += tail;
+        if (!expect_content(fs, "sparse", expected)) return false;
+        const auto handle = fs.open_file("sparse", "r");
+        if (!handle) return fail("cannot open sparse");
+        const bool hole = fs.seek(*handle, 0, FS_SEEK_HOLE) && fs.tell(*handle) == CLUSTER;
+        const bool data = fs.seek(*handle, CLUSTER, FS_SEEK_DATA) && fs.tell(*handle) == 10 * CLUSTER;
+        fs.close_file(*handle);
+        if (!hole || !data) return fail("SEEK_HOLE / SEEK_DATA do not find the hole after remount");
+        fs.unmount();
+        return check_volume(image);
+    }
+
+    // чтение и запись 32-битного слова образа в обход файловой системы (повреждение метаданных)
+    std::optional<uint32_t> peek(const std::string &image, const uint64_t offset) {
+        std::ifstream file(image, std::ios::binary);
+        uint32_t value = 0;
+        file.seekg(static_cast<std::streamoff>(offset));
+        if (!file.read(reinterpret_cast<char *>(&value), sizeof(value))) return std::nullopt;
+        return value;
+    }
+
+    bool poke(const std::string &image, const uint64_t offset, const uint32_t value) {
+        std::fstream file(image, std::ios::in | std::ios::out | std::ios::binary);
+        file.seekp(static_cast<std::streamoff>(offset));
+        file.write(reinterpret_cast<const char *>(&value), sizeof(value));
+        return file.good() ? true : fail("cannot damage " + image);
+    }
+
+    std::optional<ConsistencyChecker::Report> run_checker(const std::string &image, const bool repair,
+                                                          const unsigned threads) {
+        VolumeManager vol_manager;
+        if (!vol_manager.load_volume(image)) return std::nullopt;
+        ConsistencyChecker checker(vol_manager);
+        auto report = checker.run({repair, threads});
+        vol_manager.close_volume();
+        return report;
+    }
+
+    // переводит размонтированный том в раскладку прежних версий: заголовок заканчивается на data_start_cluster,
+    // бит кластера c хранится в байте 4 * (c / 8), а на диске только первая четверть карты
+    bool make_legacy_volume(const std::string &image) {
+        std::fstream file(image, std::ios::in | std::ios::out | std::ios::binary);
+        FileSystem::Header header{};
+        if (!file.read(reinterpret_cast<char *>(&header), sizeof(header))) return fail("cannot read header");
+        const size_t bitmap_bytes = (header.total_clusters + 7) / 8;
+        std::vector<char> bitmap(bitmap_bytes), legacy(static_cast<size_t>(header.bitmap_size_cluster) * CLUSTER);
+        file.seekg(static_cast<std::streamoff>(header.bitmap_start_cluster * CLUSTER));
+        if (!file.read(bitmap.data(), static_cast<std::streamsize>(bitmap_bytes))) return fail("cannot read bitmap");
+        for (size_t word = 0; 4 * word < bitmap_bytes; ++word) legacy[4 * word] = bitmap[word];
+
+        auto *raw = reinterpret_cast<char *>(&header);
+        std::fill(raw + offsetof(FileSystem::Header, free_counts_start_cluster), raw + sizeof(header), 0);
+        file.seekp(0);
+        file.write(raw, sizeof(header));
+        file.seekp(static_cast<std::streamoff>(header.bitmap_start_cluster * CLUSTER));
+        file.write(legacy.data(), static_cast<std::streamsize>(legacy.size()));
+        return file.good() ? true : fail("cannot rewrite " + image);
+    }
+
+    // том прежней версии: битовая карта строится заново по FAT, новые файлы не затирают старые
+    bool run_legacy_bitmap(FileSystemCore &fs, const std::string &image) {
+        const std::string old_data = random_bytes(300 * 1024, 10);
+        const std::string new_data = random_bytes(300 * 1024, 11);
+        if (!format_and_mount(fs, image)) return false;
+        if (!write_at(fs, "a.txt", "w", random_bytes(5000, 12)) || !write_at(fs, "r.bin", "w", old_data)) {
+            return false;
+        }
+        fs.unmount();
+        if (!make_legacy_volume(image) || !fs.mount(image)) return false;
+
+        for (unsigned i = 0; i < 12; ++i) {
+            if (!write_at(fs, "n" + std::to_string(i), "w", new_data)) return false;
+        }
+        if (!expect_content(fs, "r.bin", old_data) || !expect_content(fs, "n11", new_data)) return false;
+        fs.unmount();
+        return check_volume(image);
+    }
+
+    // fsck --repair: пересечённые цепочки, потерянная запись FAT и снятый бит; отчёт не зависит от числа потоков,
+    // пересечение остаётся за файлом с меньшим порядковым номером, после исправления том чист
+    bool run_fsck_repair(FileSystemCore &fs, const std::string &image) {
+        const std::string a = random_bytes(8 * CLUSTER, 13);
+        const std::string b = random_bytes(8 * CLUSTER, 14);
+        const std::string c = random_bytes(2 * CLUSTER, 15);
+        // каталог остаётся линейным, чтобы порядок записей совпадал с порядком создания
+        fs.set_directory_btree_threshold(0);
+        if (!format_and_mount(fs, image)) return false;
+        // встроенные файлы без цепочек ставят a последним в первую порцию параллельного прохода по объектам,
+        // а b - первым во вторую, так что их цепочки проходят разные потоки
+        for (unsigned i = 0; i < 254; ++i) {
+            if (!write_at(fs, "f" + std::to_string(i), "w", "filler")) return false;
+        }
+        if (!write_at(fs, "a", "w", a) || !write_at(fs, "b", "w", b) || !write_at(fs, "c", "w", c)) return false;
+        const auto a_entry = find_entry(fs, "a");
+        const auto b_entry = find_entry(fs, "b");
+        const auto c_entry = find_entry(fs, "c");
+        if (!a_entry || !b_entry || !c_entry) return fail("files are missing");
+        const FileSystem::Header header = fs.get_header();
+        fs.unmount();
+
+        const uint64_t fat = static_cast<uint64_t>(header.fat_start_cluster) * CLUSTER;
+        const auto nth_cluster = [&](uint32_t cluster, const unsigned n) -> std::optional<uint32_t> {
+            for (unsigned i = 0; i < n; ++i) {
+                const auto next = peek(image, fat + cluster * sizeof(uint32_t));
+                if (!next) return std::nullopt;
+                cluster = *next;
+            }
+            return cluster;
+        };
+        const auto a4 = nth_cluster(a_entry->first_cluster, 3);
+        const auto b2 = nth_cluster(b_entry->first_cluster, 1);
+        if (!a4 || !b2) return fail("cannot follow chains");
+        // a после четвёртого кластера продолжается хвостом b, у c снят бит первого кластера,
+        // последний кластер тома занят в FAT, но никому не принадлежит
+        const uint64_t bitmap_byte = static_cast<uint64_t>(header.bitmap_start_cluster) * CLUSTER +
+                                     c_entry->first_cluster / 8;
+        const auto bitmap_word = peek(image, bitmap_byte);
+        if (!bitmap_word ||
+            !poke(image, fat + *a4 * sizeof(uint32_t), *b2) ||
+            !poke(image, bitmap_byte, *bitmap_word & ~(1u << c_entry->first_cluster % 8)) ||
+            !poke(image, fat + (header.total_clusters - 1) * sizeof(uint32_t), FileSystem::MARKER_FAT_ENTRY_EOF)) {
+            return false;
+        }
+
+        const auto single = run_checker(image, false, 1);
+        if (!single) return fail("fsck failed");
+        if (single->cross_linked_clusters == 0 || single->unmarked_clusters == 0 || single->orphaned_clusters == 0) {
+            return fail("fsck did not find the damage");
+        }
+        for (const unsigned threads: {2u, 4u, 8u, 8u}) {
+            const auto parallel = run_checker(image, false, threads);
+            if (!parallel || parallel->problems != single->problems ||
+                parallel->cross_linked_clusters != single->cross_linked_clusters ||
+                parallel->orphaned_clusters != single->orphaned_clusters) {
+                return fail("fsck with " + std::to_string(threads) + " threads reports differently");
+            }
+        }
+        const auto repaired = run_checker(image, true, 4);
+        if (!repaired || !repaired->repaired) return fail("fsck --repair failed");
+        if (!check_volume(image) || !fs.mount(image)) return false;
+
+        // a - четыре своих кластера и хвост b до своего размера, b обрезан до первого кластера
+        const std::string a_fixed = a.substr(0, 4 * CLUSTER) + b.substr(CLUSTER, 4 * CLUSTER);
+        if (!expect_content(fs, "a", a_fixed) || !expect_content(fs, "b", b.substr(0, CLUSTER)) ||
+            !expect_content(fs, "c", c)) {
+            return false;
+        }
+        if (!write_at(fs, "d", "w", random_bytes(16 * CLUSTER, 16)) || !expect_content(fs, "c", c)) return false;
+        fs.unmount();
+        return check_volume(image);
+    }
+
+    // дефрагментация файла, открытого на чтение и на запись: дескрипторы продолжают работать с перенесённой цепочкой
+    bool run_defrag_open(FileSystemCore &fs, const std::string &image) {
+        constexpr unsigned CLUSTERS = 12;
+        const std::string data = random_bytes(CLUSTERS * CLUSTER, 17);
+        const std::string patch = random_bytes(3000, 18);
+        // без групп и запасов чередующиеся дозаписи двух файлов перемешивают их кластеры
+        fs.set_allocation_groups(false);
+        fs.set_cluster_magazines(false);
+        if (!format_and_mount(fs, image)) return false;
+        for (unsigned i = 0; i < CLUSTERS; ++i) {
+            const char *mode = i == 0 ? "w" : "r+";
+            if (!write_at(fs, "frag", mode, data.substr(i * CLUSTER, CLUSTER), i * CLUSTER) ||
+                !write_at(fs, "other", mode, random_bytes(CLUSTER, 19 + i), i * CLUSTER)) {
+                return false;
+            }
+        }
+        if (!fs.remove_file("other")) return fail("cannot remove other");
+        if (fs.analyze_fragmentation().fragmented_files != 1) return fail("frag is not fragmented");
+
+        const auto reader = fs.open_file("frag", "r");
+        const auto writer = fs.open_file("frag", "r+");
+        if (!reader || !writer) return fail("cannot open frag");
+        std::string head(CLUSTER + 100, '\0');
+        if (fs.read_file(*reader, head.data(), head.size()) != static_cast<int64_t>(head.size())) {
+            return fail("cannot read head of frag");
+        }
+        const auto moved = fs.defragment_file("frag");
+        if (!moved || *moved != CLUSTERS) return fail("frag was not moved while open");
+
+        // чтение продолжается с той же позиции, запись попадает в новую цепочку
+        std::string rest(data.size() - head.size(), '\0');
+        if (fs.read_file(*reader, rest.data(), rest.size()) != static_cast<int64_t>(rest.size()) ||
+            head + rest != data) {
+            return fail("reader sees different data after defragmentation");
+        }
+        const int64_t patched = fs.pwrite_file(*writer, patch.data(), patch.size(), 5 * CLUSTER - 7);
+        if (patched != static_cast<int64_t>(patch.size())) {
+            return fail("cannot write through the open handle");
+        }
+        if (!fs.close_file(*reader) || !fs.close_file(*writer)) return fail("cannot close frag");
+        if (!remount(fs, image)) return false;
+
+        std::string expected = data;
+        expected.replace(5 * CLUSTER - 7, patch.size(), patch);
+        if (!expect_content(fs, "frag", expected)) return false;
+        const FragmentationReport report = fs.analyze_fragmentation();
+        if (report.fragmented_files != 0 || report.extents != 1) return fail("frag is still fragmented");
+        fs.unmount();
+        return check_volume(image);
+    }
+
+    // данные крошечного файла в записи каталога
+    bool run_inline(FileSystemCore &fs, const std::string &image) {
+        const std::string tiny = "tiny file";
+        const std::string grown = random_bytes(3 * CLUSTER, 2);
+        if (!format_and_mount(fs, image)) return false;
+        if (!write_at(fs, "tiny", "w", tiny) || !write_at(fs, "grown", "w", "small")) return false;
+        if (!write_at(fs, "grown", "w", grown)) return false;
+        if (!remount(fs, image)) return false;
+
+        if (!expect_content(fs, "tiny", tiny) || !expect_content(fs, "grown", grown)) return false;
+        const auto tiny_entry = find_entry(fs, "tiny");
+        const auto grown_entry = find_entry(fs, "grown");
+        if (!tiny_entry || !tiny_entry->is_inline()) return fail("tiny file is not stored inline");
+        if (!grown_entry || grown_entry->is_inline()) return fail("grown file is still inline");
+        fs.unmount();
+        return check_volume(image);
+    }
+
+    // группы сжатых кластеров
+    bool run_compression(FileSystemCore &fs, const std::string &image) {
+        const std::string text = log_lines(300 * 1024);
+        const std::string patch = random_bytes(5000, 3);
+        if (!format_and_mount(fs, image)) return false;
+        if (!write_at(fs, "log", "w", "")) return false;
+        if (!fs.set_compression("log", true)) return fail("cannot enable compression");
+        if (!write_at(fs, "log", "r+", text) || !write_at(fs, "log", "r+", patch, 70 * 1024)) return false;
+        if (!remount(fs, image)) return false;
+
+        std::string expected = text;
+        expected.replace(70 * 1024, patch.size(), patch);
+        if (!expect_content(fs, "log", expected)) return false;
+        const auto entry = find_entry(fs, "log");
+        if (!entry || !entry->is_compressed()) return fail("file lost its compression flag");
+        fs.unmount();
+        return check_volume(image);
+    }
+
+    // одинаковые кластеры разных файлов хранятся один раз
+    bool run_dedup(FileSystemCore &fs, const std::string &image) {
+        const std::string data = random_bytes(16 * CLUSTER, 4);
+        fs.set_dedup(true);
+        if (!format_and_mount(fs, image)) return false;
+        if (!write_at(fs, "a", "w", data) || !write_at(fs, "b", "w", data)) return false;
+        if (!remount(fs, image)) return false;
+
+        if (!expect_content(fs, "a", data) || !expect_content(fs, "b", data)) return false;
+        const auto a = find_entry(fs, "a");
+        const auto b = find_entry(fs, "b");
+        if (!a || !b) return fail("deduplicated files are missing");
+        const auto a_cluster = fs.resolve_data_cluster(a->first_cluster);
+        if (!a_cluster || a_cluster != fs.resolve_data_cluster(b->first_cluster)) {
+            return fail("identical files do not share their first cluster");
+        }
+        // запись в общий кластер копирует его только для изменённого файла
+        if (!write_at(fs, "b", "r+", "changed", 10)) return false;
+        if (!remount(fs, image)) return false;
+        std::string changed = data;
+        changed.replace(10, 7, "changed");
+        if (!expect_content(fs, "a", data) || !expect_content(fs, "b", changed)) return false;
+        fs.unmount();
+        return check_volume(image);
+    }
+
+    // клоны с копированием при записи и снимки тома
+    bool run_clone(FileSystemCore &fs, const std::string &image) {
+        const std::string data = random_bytes(8 * CLUSTER, 5);
+        if (!format_and_mount(fs, image)) return false;
+        if (!write_at(fs, "a", "w", data)) return false;
+        if (!fs.clone_file("a", "b")) return fail("clone");
+        if (!write_at(fs, "b", "r+", "CLONE", 100)) return false;
+        if (!fs.create_snapshot("s1")) return fail("snapshot");
+        if (!write_at(fs, "a", "r+", "AFTER", 0)) return false;
+        if (!remount(fs, image)) return false;
+
+        std::string cloned = data;
+        cloned.replace(100, 5, "CLONE");
+        std::string after = data;
+        after.replace(0, 5, "AFTER");
+        if (!expect_content(fs, "a", after) || !expect_content(fs, "b", cloned)) return false;
+        if (fs.list_snapshots() != std::vector<std::string>{"s1"}) return fail("snapshot list after remount");
+        fs.unmount();
+        if (!fs.mount_snapshot(image, "s1")) return fail("cannot mount snapshot");
+        if (!expect_content(fs, "a", data) || !expect_content(fs, "b", cloned)) return false;
+        fs.unmount();
+        if (!check_volume(image)) return false;
+
+        if (!fs.mount(image) || !fs.delete_snapshot("s1") || !fs.remove_file("b")) return fail("snapshot cleanup");
+        if (!expect_content(fs, "a", after)) return false;
+        fs.unmount();
+        return check_volume(image);
+    }
+
+    // ID закрытого дескриптора не действует после того, как его слот занял другой дескриптор
+    bool run_stale_handle(FileSystemCore &fs, const std::string &image) {
+        const std::string data = random_bytes(2 * CLUSTER + 10, 10);
+        if (!format_and_mount(fs, image)) return false;
+        if (!write_at(fs, "a", "w", "first") || !write_at(fs, "b", "w", data)) return false;
+        const auto stale = fs.open_file("a", "r+");
+        if (!stale || !fs.close_file(*stale)) return fail("cannot open and close a");
+        const auto handle = fs.open_file("b", "r+");
+        if (!handle) return fail("cannot open b");
+        constexpr uint32_t SLOT_MASK = HandleTable::MAX_HANDLES - 1;
+        if ((*handle & SLOT_MASK) != (*stale & SLOT_MASK) || *handle == *stale) {
+            return fail("closed slot was not reused with a new generation");
+        }
+        char buffer[16];
+        const bool rejected = fs.read_file(*stale, buffer, sizeof(buffer)) < 0 &&
+                              fs.write_file(*stale, "STALE", 5) < 0 && fs.pwrite_file(*stale, "STALE", 5, 0) < 0 &&
+                              !fs.seek(*stale, 0, FS_SEEK_SET) && !fs.close_file(*stale);
+        const bool live = fs.read_file(*handle, buffer, sizeof(buffer)) == sizeof(buffer) &&
+                          std::string(buffer, sizeof(buffer)) == data.substr(0, sizeof(buffer));
+        fs.close_file(*handle);
+        if (!rejected) return fail("stale handle ID was accepted");
+        if (!live) return fail("handle in the reused slot reads wrong data");
+        if (!remount(fs, image)) return false;
+
+        if (!expect_content(fs, "a", "first") || !expect_content(fs, "b", data)) return false;
+        fs.unmount();
+        return check_volume(image);
+    }
+
+    // O_DIRECT: невыровненные записи идут через промежуточные буферы
+    bool run_direct(FileSystemCore &fs, const std::string &image) {
+        const std::string data = random_bytes(5 * CLUSTER + 123, 6);
+        const std::string patch = random_bytes(777, 7);
+        fs.set_direct_io(true);
+        if (!format_and_mount(fs, image)) return false;
+        if (!write_at(fs, "direct", "w", data) || !write_at(fs, "direct", "r+", patch, CLUSTER - 11)) return false;
+        if (!remount(fs, image)) return false;
+
+        std::string expected = data;
+        expected.replace(CLUSTER - 11, patch.size(), patch);
+        if (!expect_content(fs, "direct", expected)) return false;
+        // файловая система хоста может не поддерживать O_DIRECT, тогда том работает через кэш
+        if (!fs.isDirectIO()) std::cout << "note: O_DIRECT is not supported here, buffered I/O was used\n";
+        fs.unmount();
+        return check_volume(image);
+    }
+
+    constexpr unsigned DIRECTORY_FILES = 400;
+
+    // каталог из DIRECTORY_FILES файлов и подкаталога после перемонтирования обходится курсором, прерванным
+    // посередине и продолженным с позиции tell_directory(); том остаётся смонтированным
+    bool fill_and_list_directory(FileSystemCore &fs, const std::string &image, const uint32_t btree_threshold) {
+        fs.set_directory_btree_threshold(btree_threshold);
+        if (!format_and_mount(fs, image)) return false;
+        std::set<std::string> expected;
+        for (unsigned i = 0; i < DIRECTORY_FILES; ++i) {
+            const std::string name = "f" + std::to_string(i);
+            if (!write_at(fs, name, "w", name)) return false;
+            expected.insert(name);
+        }
+        if (!fs.create_directory("d")) return fail("mkdir");
+        expected.insert("d");
+        if (!remount(fs, image)) return false;
+
+        std::set<std::string> listed;
+        auto dir = fs.open_directory("/");
+        if (!dir) return fail("opendir");
+        for (unsigned i = 0; i < DIRECTORY_FILES / 2; ++i) {
+            const auto entry = fs.read_directory(*dir);
+            if (!entry) return fail("directory ended early");
+            listed.emplace(entry->name);
+        }
+        const auto position = fs.tell_directory(*dir);
+        fs.close_directory(*dir);
+        if (!position) return fail("telldir");
+        dir = fs.open_directory("/", *position);
+        if (!dir) return fail("opendir at position");
+        while (const auto entry = fs.read_directory(*dir)) listed.emplace(entry->name);
+        fs.close_directory(*dir);
+        if (listed != expected) return fail("directory listing after remount differs");
+        return expect_content(fs, "f123", "f123");
+    }
+
+    // курсор по обычному каталогу (без перестройки в дерево)
+    bool run_directory(FileSystemCore &fs, const std::string &image) {
+        if (!fill_and_list_directory(fs, image, 0)) return false;
+        fs.unmount();
+        return check_volume(image);
+    }
+
+    // тот же обход по каталогу-дереву и выборка по префиксу имени
+    bool run_directory_btree(FileSystemCore &fs, const std::string &image) {
+        if (!fill_and_list_directory(fs, image, 2)) return false;
+        const auto dir = fs.open_directory("/", 0, "f39");
+        if (!dir) return fail("opendir with prefix");
+        unsigned matched = 0;
+        while (fs.read_directory(*dir)) ++matched;
+        fs.close_directory(*dir);
+        if (matched != 11) return fail("prefix f39 matched " + std::to_string(matched) + " entries instead of 11");
+        fs.unmount();
+        return check_volume(image);
+    }
+
+    // pread/pwrite и preadv/pwritev с невыровненных смещений через границы кластеров и за конец файла;
+    // позиция дескриптора при этом не меняется
+    bool run_positional(FileSystemCore &fs, const std::string &image) {
+        std::string expected = random_bytes(3 * CLUSTER + 50, 11);
+        const std::string patch = random_bytes(CLUSTER + 1000, 12);
+        const std::string tail = random_bytes(333, 13);
+        std::string head(3, '\0'), middle(CLUSTER, '\0'), end(17, '\0');
+        if (!format_and_mount(fs, image)) return false;
+        if (!write_at(fs, "pos", "w", expected)) return false;
+        const auto handle = fs.open_file("pos", "r+");
+        if (!handle) return fail("cannot open pos");
+        const bool positioned = fs.seek(*handle, 5, FS_SEEK_SET);
+        const bool written =
+            fs.pwrite_file(*handle, patch.data(), patch.size(), CLUSTER - 3) == static_cast<int64_t>(patch.size()) &&
+            fs.pwrite_file(*handle, tail.data(), tail.size(), 4 * CLUSTER + 17) == static_cast<int64_t>(tail.size());
+        expected.replace(CLUSTER - 3, patch.size(), patch);
+        expected.resize(4 * CLUSTER + 17);
+        expected += tail;
+        const FsIoVec segments[] = {
+            {head.data(), head.size()}, {middle.data(), middle.size()}, {end.data(), end.size()}};
+        const int64_t read = fs.preadv_file(*handle, segments, 3, 2 * CLUSTER - 9);
+        const bool position_kept = fs.tell(*handle) == 5;
+        fs.close_file(*handle);
+        if (!positioned || !written) return fail("pwrite at unaligned offsets");
+        if (read != static_cast<int64_t>(CLUSTER + 20) ||
+            head + middle + end != expected.substr(2 * CLUSTER - 9, CLUSTER + 20)) {
+            return fail("preadv across a cluster boundary returned wrong data");
+        }
+        if (!position_kept) return fail("positional I/O moved the file position");
+        if (!remount(fs, image)) return false;
+
+        if (!expect_content(fs, "pos", expected)) return false;
+        const auto reader = fs.open_file("pos", "r");
+        if (!reader) return fail("cannot open pos");
+        std::string piece(CLUSTER + 1, '\0');
+        const bool piece_read =
+            fs.pread_file(*reader, piece.data(), piece.size(), CLUSTER - 1) == static_cast<int64_t>(piece.size());
+        std::string past_end(100, '\0');
+        const int64_t short_read = fs.pread_file(*reader, past_end.data(), past_end.size(), expected.size() - 7);
+        fs.close_file(*reader);
+        if (!piece_read || piece != expected.substr(CLUSTER - 1, CLUSTER + 1)) return fail("pread after remount");
+        if (short_read != 7 || past_end.substr(0, 7) != expected.substr(expected.size() - 7)) {
+            return fail("pread at the end of file");
+        }
+        fs.unmount();
+        return check_volume(image);
+    }
+
+    // copy_file файла с невыровненным размером, дырой и данными, ещё не сброшенными открытым дескриптором;
+    // копия не делит кластеры с исходным файлом
+    bool run_copy(FileSystemCore &fs, const std::string &image) {
+        std::string source = random_bytes(CLUSTER - 5, 14);
+        const std::string tail = random_bytes(2 * CLUSTER + 123, 15);
+        const std::string pending = random_bytes(501, 16);
+        if (!format_and_mount(fs, image)) return false;
+        if (!write_at(fs, "src", "w", source) || !write_at(fs, "src", "r+", tail, 3 * CLUSTER + 77)) return false;
+        if (!write_at(fs, "tiny", "w", "tiny file")) return false;
+        source.resize(3 * CLUSTER + 77);
+        source += tail;
+        const auto writer = fs.open_file("src", "r+");
+        if (!writer) return fail("cannot open src");
+        const int64_t written = fs.pwrite_file(*writer, pending.data(), pending.size(), CLUSTER + 9);
+        source.replace(CLUSTER + 9, pending.size(), pending);
+        const bool copied = fs.copy_file("src", "dst") && fs.copy_file("tiny", "tiny_copy");
+        fs.close_file(*writer);
+        if (written != static_cast<int64_t>(pending.size()) || !copied) return fail("copy_file");
+
+        std::string copy = source;
+        if (!write_at(fs, "dst", "r+", "COPY", 2 * CLUSTER - 2)) return false;
+        copy.replace(2 * CLUSTER - 2, 4, "COPY");
+        if (!remount(fs, image)) return false;
+
+        if (!expect_content(fs, "src", source) || !expect_content(fs, "dst", copy)) return false;
+        if (!expect_content(fs, "tiny_copy", "tiny file")) return false;
+        const auto src = find_entry(fs, "src");
+        const auto dst = find_entry(fs, "dst");
+        if (!src || !dst) return fail("copied files are missing");
+        if (fs.resolve_data_cluster(src->first_cluster) == fs.resolve_data_cluster(dst->first_cluster)) {
+            return fail("copy shares its first cluster with the source");
+        }
+        fs.unmount();
+        return check_volume(image);
+    }
+
+    // данные, записанные на том, должны пережить перемонтирование со всеми образами
+    bool run_multi_image(FileSystemCore &fs, const std::string &image, const size_t images) {
+        const std::string data = random_bytes(1024 * 1024 + 77, 8);
+        if (!format_and_mount(fs, image)) return false;
+        if (!write_at(fs, "big", "w", data) || !write_at(fs, "small", "w", random_bytes(2 * CLUSTER, 9))) {
+            return false;
+        }
+        if (!fs.remove_file("small") || !remount(fs, image)) return false;
+
+        if (fs.volume_image_paths().size() != images) return fail("volume did not pick up all images on mount");
+        if (!expect_content(fs, "big", data)) return false;
+        fs.unmount();
+        return check_volume(image);
+    }
+
+    bool run_stripe(FileSystemCore &fs, const std::string &image) {
+        std::remove((image + ".1").c_str());
+        std::remove((image + ".2").c_str());
+        if (!fs.set_stripe_layout({image + ".1", image + ".2"}, 4)) return fail("stripe layout");
+        return run_multi_image(fs, image, 3);
+    }
+
+    bool run_mirror(FileSystemCore &fs, const std::string &image) {
+        std::remove((image + ".copy").c_str());
+        if (!fs.set_mirror_layout({image + ".copy"})) return fail("mirror layout");
+        if (!run_multi_image(fs, image, 2)) return false;
+        if (!fs.mount(image)) return fail("mount");
+        const bool degraded = fs.isMirrorDegraded();
+        fs.unmount();
+        return degraded ? fail("mirror is degraded after a clean unmount") : true;
+    }
+
+    // потоки дописывают свои файлы одновременно (под разделяемым захватом ядра) кусками, не кратными кластеру
+    bool run_parallel_append(FileSystemCore &fs, const std::string &image) {
+        constexpr unsigned WRITERS = 8;
+        if (!format_and_mount(fs, image)) return false;
+        std::vector<std::string> data;
+        std::vector<uint32_t> handles;
+        for (unsigned t = 0; t < WRITERS; ++t) {
+            data.push_back(random_bytes(40 * CLUSTER + 123 * t, 20 + t));
+            const auto handle = fs.open_file("p" + std::to_string(t), "w");
+            if (!handle) return fail("cannot open p" + std::to_string(t));
+            handles.push_back(*handle);
+        }
+
+        std::vector<char> written(WRITERS, false); // не vector<bool>: потоки пишут соседние элементы
+        std::vector<std::thread> writers;
+        for (unsigned t = 0; t < WRITERS; ++t) {
+            writers.emplace_back([&, t] {
+                const size_t chunk = t % 2 == 0 ? CLUSTER : 1000 + 517 * t;
+                for (size_t done = 0; done < data[t].size(); done += chunk) {
+                    const size_t bytes = std::min(chunk, data[t].size() - done);
+                    if (fs.write_file(handles[t], data[t].data() + done, bytes) != static_cast<int64_t>(bytes)) return;
+                }
+                written[t] = true;
+            });
+        }
+        for (auto &writer: writers) writer.join();
+        for (unsigned t = 0; t < WRITERS; ++t) {
+            if (!fs.close_file(handles[t]) || !written[t]) return fail("cannot append to p" + std::to_string(t));
+        }
+        if (!remount(fs, image)) return false;
+
+        for (unsigned t = 0; t < WRITERS; ++t) {
+            if (!expect_content(fs, "p" + std::to_string(t), data[t])) return false;
+        }
+        fs.unmount();
+        return check_volume(image);
+    }
+
+    struct Scenario {
+        const char *name;
+        std::function<bool(FileSystemCore &, const std::string &)> run;
+    };
+
+    const Scenario SCENARIOS[] = {
+        {"fsck_repair", run_fsck_repair}, {"legacy_bitmap", run_legacy_bitmap}, {"defrag_open", run_defrag_open},
+        {"sparse", run_sparse}, {"inline", run_inline}, {"compression", run_compression}, {"dedup", run_dedup},
+        {"clone", run_clone}, {"stale_handle", run_stale_handle}, {"direct", run_direct},
+        {"directory", run_directory}, {"directory_btree", run_directory_btree},
+        {"positional", run_positional}, {"copy", run_copy}, {"stripe", run_stripe}, {"mirror", run_mirror},
+        {"parallel_append", run_parallel_append},
+    };
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 3) {
+        std::cout << "Usage: fs_roundtrip_test <scenario> <work_dir>\nScenarios:";
+        for (const auto &scenario: SCENARIOS) std::cout << " " << scenario.name;
+        std::cout << std::endl;
+        return 2;
+    }
+    const std::string name = argv[1];
+    for (const auto &scenario: SCENARIOS) {
+        if (name != scenario.name) continue;
+        FileSystemCore fs;
+        const std::string image = std::string(argv[2]) + "/roundtrip_" + name + ".img";
+        std::remove(image.c_str());
+        const bool passed = scenario.run(fs, image);
+        if (fs.isMounted()) fs.unmount();
+        std::cout << (passed ? "PASS: " : "FAIL: ") << name << std::endl;
+        return passed ? 0 : 1;
+    }
+    std::cerr << "Error: unknown scenario '" << name << "'" << std::endl;
+    return 2;
+}